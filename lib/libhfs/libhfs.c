@@ -50,10 +50,14 @@
 #include "byteorder.h"
 
 /* global private file/folder keys */
-hfs_catalog_key_t hfs_gMetadataDirectoryKey; /* contains HFS+ inodes */
-hfs_catalog_key_t hfs_gJournalInfoBlockFileKey;
-hfs_catalog_key_t hfs_gJournalBufferFileKey;
-hfs_catalog_key_t hfs_gDirMetadataDirectoryKey;
+hfs_catalog_key_t hfs_gMetadataDirectoryKey = /* contains HFS+ inodes */
+	{ 6+2*21, HFS_CNID_ROOT_FOLDER, { 21, u"\0\0\0\0HFS+ Private Data" } };
+hfs_catalog_key_t hfs_gJournalInfoBlockFileKey =
+	{ 6+2*19, HFS_CNID_ROOT_FOLDER, { 19, u".journal_info_block" } };
+hfs_catalog_key_t hfs_gJournalBufferFileKey =
+	{ 6+2*8, HFS_CNID_ROOT_FOLDER, { 8, u".journal" } };
+hfs_catalog_key_t hfs_gDirMetadataDirectoryKey =
+	{ 6+2*29, HFS_CNID_ROOT_FOLDER, { 29, u".HFS+ Private Directory Data\r" } };
 hfs_catalog_key_t* hfs_gPrivateObjectKeys[5] = {
 	&hfs_gMetadataDirectoryKey,
 	&hfs_gJournalInfoBlockFileKey,
@@ -68,14 +72,6 @@ extern uint64_t be64tohp(void** inout_ptr);
 
 hfs_callbacks	hfs_gcb;	/* global callbacks */
  
-/*    
- * global case folding table
- * (lazily initialized; see comments at bottom of hfs_open_volume())     
- */   
-unichar_t* hfs_gcft;
-
-
-int hfslib_create_casefolding_table(void);
 
 #ifdef DLO_DEBUG
 #include <stdio.h>
@@ -99,53 +95,14 @@ dlo_print_key(hfs_catalog_key_t *key)
 void
 hfslib_init(hfs_callbacks* in_callbacks)
 {
-	unichar_t	temp[256];
-	
 	memset(&hfs_gcb, 0, sizeof(hfs_callbacks));
 	if(in_callbacks!=NULL)
 		memcpy(&hfs_gcb, in_callbacks, sizeof(hfs_callbacks));
-	
-	hfs_gcft = NULL;
-	
-	/*
-	 * Create keys for the HFS+ "private" files so we can reuse them whenever
-	 * we perform a user-visible operation, such as listing directory contents.
-	 */
-		
-#define ATOU(str, len) /* quick & dirty ascii-to-unicode conversion */ \
-	do{ int i; for(i=0; i<len; i++) temp[i]=str[i]; } \
-	while( /*CONSTCOND*/ 0)
-	
-	ATOU("\0\0\0\0HFS+ Private Data", 21);
-	hfslib_make_catalog_key(HFS_CNID_ROOT_FOLDER, 21, temp, 
-		&hfs_gMetadataDirectoryKey);
-
-	ATOU(".journal_info_block", 19);
-	hfslib_make_catalog_key(HFS_CNID_ROOT_FOLDER, 19, temp, 
-		&hfs_gJournalInfoBlockFileKey);
-
-	ATOU(".journal", 8);
-	hfslib_make_catalog_key(HFS_CNID_ROOT_FOLDER, 8, temp, 
-		&hfs_gJournalBufferFileKey);
-
-	ATOU(".HFS+ Private Directory Data\xd",29);
-	hfslib_make_catalog_key(HFS_CNID_ROOT_FOLDER, 29, temp, 
-		&hfs_gDirMetadataDirectoryKey);
-
-#undef ATOU
 }
 
 void
 hfslib_done(void)
 {
-	hfs_callback_args	cbargs;
-	
-	if(hfs_gcft!=NULL) {
-		hfslib_init_cbargs(&cbargs);
-		hfslib_free(hfs_gcft, &cbargs);
-		hfs_gcft = NULL;
-	}
-
 	return;
 }
 
@@ -172,30 +129,64 @@ hfslib_open_volume(
 	int in_readonly,
 	hfs_volume* out_vol,
 	hfs_callback_args* cbargs)
+{
+	int			result;
+
+	if(in_device==NULL || out_vol==NULL)
+		return 1;
+
+	out_vol->readonly = in_readonly;
+	out_vol->offset = 0;
+
+	if(hfslib_openvoldevice(out_vol, in_device, cbargs) != 0)
+		HFS_LIBERR("could not open device");
+
+	result = hfslib_reload_volume(out_vol, cbargs);
+	if(result != 0)
+		hfslib_close_volume(out_vol, cbargs);
+
+	return result;
+
+error:
+	return 1;
+}
+
+/*
+ * hfslib_reload_volume()
+ *
+ * Reads the volume header, the b-tree header nodes, the journal state and the
+ * volume name of a volume whose device is already open. This is the bulk of
+ * opening a volume, and can be repeated to pick up changes made to the volume
+ * since by another system, provided nothing else is using in_vol meanwhile.
+ * Returns 0 on success.
+ */
+int
+hfslib_reload_volume(
+	hfs_volume* out_vol,
+	hfs_callback_args* cbargs)
 {
 	hfs_catalog_key_t		rootkey;
 	hfs_thread_record_t	rootthread;
 	hfs_hfs_master_directory_block_t mdb;
+	hfs_read_request_t	reqs[3];
 	uint16_t	node_rec_sizes[1];
 	void*		node_recs[1];
 	void*		buffer;
 	void*		buffer2;	/* used as temporary pointer for realloc() */
+	void*		rootnode;
+	uint16_t	numreqs;
+	int			journaled;
 	int			result;
-	int		isopen = 0;
 	
 	result = 1;
 	buffer = NULL;
+	rootnode = NULL;
 
-	if(in_device==NULL || out_vol==NULL)
+	if(out_vol==NULL)
 		return 1;
 
-	out_vol->readonly = in_readonly;
 	out_vol->offset = 0;
 
-	if(hfslib_openvoldevice(out_vol, in_device, cbargs) != 0)
-		HFS_LIBERR("could not open device");
-	isopen = 1;
-
 	/*
 	 *	Read the volume header.
 	 */
@@ -253,22 +244,34 @@ hfslib_open_volume(
 
 
 	/*
-	 *	Read the catalog header.
+	 * The catalog and extents overflow header nodes and the journal info
+	 * block are all located by the volume header alone, so read them as one
+	 * batch. We are only interested in the node headers, so read the first
+	 * 512 bytes of each and construct the node descriptors by hand.
 	 */
-	buffer2 = hfslib_realloc(buffer, 512, cbargs);
+	journaled = (out_vol->vh.attributes & (1<<HFS_VOL_JOURNALED)) != 0;
+	buffer2 = hfslib_realloc(buffer, 512 + 512
+		+ max(sizeof(hfs_journal_info_t), sizeof(hfs_journal_header_t)),
+		cbargs);
 	if(buffer2==NULL)
-		HFS_LIBERR("could not allocate catalog header node");
+		HFS_LIBERR("could not allocate header nodes");
 	buffer = buffer2;
-	
-	/*
-	  We are only interested in the node header, so read the first
-	  512 bytes and construct the node descriptor by hand.
-	*/
-	if(hfslib_readd(out_vol, buffer, 512,
-	       out_vol->vh.catalog_file.extents[0].start_block
-	       *(uint64_t)out_vol->vh.block_size,
-		cbargs) != 0)
-		HFS_LIBERR("could not read catalog header node");
+
+	reqs[0].buffer = buffer;
+	reqs[0].length = 512;
+	reqs[0].offset = out_vol->vh.catalog_file.extents[0].start_block
+		* (uint64_t)out_vol->vh.block_size;
+	reqs[1].buffer = (char*)buffer + 512;
+	reqs[1].length = 512;
+	reqs[1].offset = out_vol->vh.extents_file.extents[0].start_block
+		* (uint64_t)out_vol->vh.block_size;
+	reqs[2].buffer = (char*)buffer + 1024;
+	reqs[2].length = sizeof(hfs_journal_info_t);
+	reqs[2].offset = out_vol->vh.journal_info_block
+		* (uint64_t)out_vol->vh.block_size;
+	if(hfslib_readdv(out_vol, reqs, journaled ? 3 : 2, cbargs) != 0)
+		HFS_LIBERR("could not read b-tree header nodes");
+
 	node_recs[0] = (char *)buffer+14;
 	node_rec_sizes[0] = 120;
 	if(hfslib_read_header_node(node_recs, node_rec_sizes, 1,
@@ -291,21 +294,7 @@ hfslib_open_volume(
 	    = (out_vol->chr.attributes & HFS_BIG_KEYS_MASK) ?
 	    sizeof(uint16_t) : sizeof(uint8_t);
 
-	/*
-	 *	Read the extent overflow header.
-	 */
-	/*
-	  We are only interested in the node header, so read the first
-	  512 bytes and construct the node descriptor by hand.
-	  buffer is already 512 bytes long.
-	*/
-	if(hfslib_readd(out_vol, buffer, 512,
-	       out_vol->vh.extents_file.extents[0].start_block
-	       *(uint64_t)out_vol->vh.block_size,
-		cbargs) != 0)
-		HFS_LIBERR("could not read extent header node");
-	
-	node_recs[0] = (char *)buffer+14;
+	node_recs[0] = (char *)buffer+512+14;
 	node_rec_sizes[0] = 120;
 	if(hfslib_read_header_node(node_recs, node_rec_sizes, 1,
 		&out_vol->ehr, NULL, NULL)==0)
@@ -313,55 +302,57 @@ hfslib_open_volume(
 	out_vol->extkeysizefieldsize
 	    = (out_vol->ehr.attributes & HFS_BIG_KEYS_MASK) ?
 	    sizeof(uint16_t):sizeof(uint8_t);
+
+	if(journaled && hfslib_read_journal_info((char*)buffer+1024,
+		&out_vol->jib)==0)
+		HFS_LIBERR("could not parse journal info block");
+
 	/*
-	 * Read the journal info block and journal header (if volume journaled).
+	 * The journal header and the catalog's root node, where the search for
+	 * the root folder's thread below begins, can likewise be read together.
+	 * The root node is offered to the application's node cache, so the
+	 * search finds it there rather than reading it again.
 	 */
-	if(out_vol->vh.attributes & (1<<HFS_VOL_JOURNALED))
+	numreqs = 0;
+	if(journaled)
 	{
-		/* journal info block */
-		buffer2 = hfslib_realloc(buffer, sizeof(hfs_journal_info_t), cbargs);
-		if(buffer2==NULL)
-			HFS_LIBERR("could not allocate journal info block");
-		buffer = buffer2;
-	
-		if(hfslib_readd(out_vol, buffer, sizeof(hfs_journal_info_t),
-			out_vol->vh.journal_info_block * out_vol->vh.block_size,
-			cbargs) != 0)
-			HFS_LIBERR("could not read journal info block");
-		
-		if(hfslib_read_journal_info(buffer, &out_vol->jib)==0)
-			HFS_LIBERR("could not parse journal info block");
-
-		/* journal header */
-		buffer2 = hfslib_realloc(buffer, sizeof(hfs_journal_header_t),cbargs);
-		if(buffer2==NULL)
-			HFS_LIBERR("could not allocate journal header");
-		buffer = buffer2;
-	
-		if(hfslib_readd(out_vol, buffer, sizeof(hfs_journal_header_t),
-			out_vol->jib.offset, cbargs) != 0)
-			HFS_LIBERR("could not read journal header");
-		
-		if(hfslib_read_journal_header(buffer, &out_vol->jh)==0)
-			HFS_LIBERR("could not parse journal header");
+		reqs[numreqs].buffer = (char*)buffer + 1024;
+		reqs[numreqs].length = sizeof(hfs_journal_header_t);
+		reqs[numreqs].offset = out_vol->jib.offset;
+		numreqs++;
+	}
+	if(hfs_gcb.putnode!=NULL && hfslib_fork_offset(&out_vol->vh.catalog_file,
+		out_vol->vh.block_size,
+		(uint64_t)out_vol->chr.root_node * out_vol->chr.node_size,
+		out_vol->chr.node_size, &reqs[numreqs].offset)==0)
+	{
+		rootnode = hfslib_malloc(out_vol->chr.node_size, cbargs);
+		if(rootnode==NULL)
+			HFS_LIBERR("could not allocate catalog root node");
+		reqs[numreqs].buffer = rootnode;
+		reqs[numreqs].length = out_vol->chr.node_size;
+		numreqs++;
+	}
+	if(numreqs>0 && hfslib_readdv(out_vol, reqs, numreqs, cbargs) != 0)
+		HFS_LIBERR("could not read journal header or catalog root node");
 
+	if(journaled)
+	{
+		if(hfslib_read_journal_header((char*)buffer+1024, &out_vol->jh)==0)
+			HFS_LIBERR("could not parse journal header");
 		out_vol->journaled = 1;
 	}
 	else
 	{
 		out_vol->journaled = 0;
 	}
+
+	if(rootnode!=NULL)
+		hfs_gcb.putnode(out_vol, HFS_CATALOG_FILE, out_vol->chr.root_node,
+			rootnode, cbargs);
 	
-	/*
-	 * If this volume uses case-folding comparison and the folding table hasn't
-	 * been created yet, do that here. (We don't do this in hfslib_init()
-	 * because the table is large and we might never even need to use it.)
-	 */
-	if(out_vol->keycmp==hfslib_compare_catalog_keys_cf && hfs_gcft==NULL)
-		result = hfslib_create_casefolding_table();
-	else
-		result = 0;
-		
+	result = 0;
+
 	/*
 	 * Find and store the volume name.
 	 */	
@@ -377,14 +368,50 @@ hfslib_open_volume(
 
 	/* FALLTHROUGH */
 error:	
-	if (result != 0 && isopen)
-		hfslib_close_volume(out_vol, cbargs);
 	if(buffer!=NULL)
 		hfslib_free(buffer, cbargs);
+	if(rootnode!=NULL)
+		hfslib_free(rootnode, cbargs);
 
 	return result;
 }
 
+/*
+ * hfslib_fork_offset()
+ *
+ * Translates a range of a fork into an offset from the start of the volume,
+ * using only the extents stored with the fork. This is enough for the few
+ * reads made before the extents overflow file can be searched. Returns 0 if
+ * the range lies entirely within one of those extents.
+ */
+int
+hfslib_fork_offset(
+	const hfs_fork_t* in_fork,
+	uint32_t in_blocksize,
+	uint64_t in_offset,
+	uint64_t in_length,
+	uint64_t* out_offset)
+{
+	uint64_t	ext_length;
+	int			i;
+
+	for(i=0; i<8 && in_fork->extents[i].block_count>0; i++)
+	{
+		ext_length = (uint64_t)in_fork->extents[i].block_count * in_blocksize;
+		if(in_offset < ext_length)
+		{
+			if(in_length > ext_length - in_offset)
+				return 1;
+			*out_offset = (uint64_t)in_fork->extents[i].start_block
+				* in_blocksize + in_offset;
+			return 0;
+		}
+		in_offset -= ext_length;
+	}
+
+	return 1;
+}
+
 void
 hfslib_close_volume(hfs_volume* in_vol, hfs_callback_args* cbargs)
 {
@@ -577,7 +604,6 @@ hfslib_find_catalog_record_with_key(
 	hfs_catalog_key_t*	curkey;
 	void**				recs;
 	void*				buffer;
-	uint64_t			bytesread;
 	uint32_t			curnode;
 	uint16_t*			recsizes;
 	uint16_t			numextents;
@@ -626,8 +652,7 @@ hfslib_find_catalog_record_with_key(
 		printf("--> node %d\n", curnode);
 #endif
 
-		if(hfslib_readd_with_extents(in_vol, buffer, 
-			&bytesread,in_vol->chr.node_size, curnode * in_vol->chr.node_size, 
+		if(hfslib_readd_node(in_vol, buffer, HFS_CATALOG_FILE, curnode,
 			extents, numextents, cbargs)!=0)
 			HFS_LIBERR("could not read catalog node #%i", curnode);
 
@@ -729,7 +754,6 @@ hfslib_find_extent_record_with_key(hfs_volume* in_vol,
 	hfs_extent_key_t	curkey;
 	void**				recs;
 	void*				buffer;
-	uint64_t			bytesread;
 	uint32_t			curnode;
 	uint16_t*			recsizes;
 	uint16_t			numextents;
@@ -763,9 +787,8 @@ hfslib_find_extent_record_with_key(hfs_volume* in_vol,
 		hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
 		recnum = 0;
 
-		if(hfslib_readd_with_extents(in_vol, buffer, &bytesread, 
-			in_vol->ehr.node_size, curnode * in_vol->ehr.node_size, extents, 
-			numextents, cbargs)!=0)
+		if(hfslib_readd_node(in_vol, buffer, HFS_EXTENTS_FILE, curnode,
+			extents, numextents, cbargs)!=0)
 			HFS_LIBERR("could not read extents overflow node #%i", curnode);
 		
 		if(hfslib_reada_node(buffer, &nd, &recs, &recsizes, HFS_EXTENTS_FILE,
@@ -980,32 +1003,1011 @@ hfslib_get_directory_contents(
 	void**				recs;
 	void*				buffer;
 	void*				ptr; /* temporary pointer for realloc() */
-	uint64_t			bytesread;
 	uint32_t			curnode;
-	uint32_t			lastnode;
-	uint16_t*			recsizes;
+	uint32_t			lastnode;
+	uint16_t*			recsizes;
+	uint16_t			numextents;
+	uint16_t			recnum;
+	int16_t				leaftype;
+	int					keycompare;
+	int					result;
+
+	if(in_vol==NULL || in_dir==0 || out_numchildren==NULL)
+		return 1;
+		
+	result = 1;
+	buffer = NULL;
+	extents = NULL;
+	lastnode = 0;
+	recs = NULL;
+	recsizes = NULL;
+	*out_numchildren = 0;
+	if(out_children!=NULL)
+		*out_children = NULL;
+	if(out_childnames!=NULL)
+		*out_childnames = NULL;
+
+	buffer = hfslib_malloc(in_vol->chr.node_size, cbargs);
+	if(buffer==NULL)
+		HFS_LIBERR("could not allocate node buffer");
+
+	numextents = hfslib_get_file_extents(in_vol, HFS_CNID_CATALOG,
+		HFS_DATAFORK, &extents, cbargs);
+	if(numextents==0)
+		HFS_LIBERR("could not locate fork extents");
+
+	nd.num_recs = 0;
+	curnode = in_vol->chr.root_node;
+	
+	while(1)
+	{
+		hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
+		recnum = 0;
+
+		/* a large folder spans many leaves; give up quietly if the caller
+		 * no longer wants the listing */
+		if(hfslib_interrupted(cbargs))
+			goto error;
+
+		if(hfslib_readd_node(in_vol, buffer, HFS_CATALOG_FILE, curnode,
+			extents, numextents, cbargs)!=0)
+			HFS_LIBERR("could not read catalog node #%i", curnode);
+
+		if(hfslib_reada_node(buffer, &nd, &recs, &recsizes, HFS_CATALOG_FILE,
+			in_vol, cbargs)==0)
+			HFS_LIBERR("could not parse catalog node #%i", curnode);
+
+		for(recnum=0; recnum<nd.num_recs; recnum++)
+		{
+			leaftype = nd.kind; /* needed b/c leaftype might be modified now */
+			if(hfslib_read_catalog_keyed_record(recs[recnum], &currec,
+				&leaftype, &curkey, in_vol)==0)
+				HFS_LIBERR("could not read cat record %i:%i", curnode, recnum);
+
+			if(nd.kind==HFS_INDEXNODE)
+			{
+				keycompare = in_dir - curkey.parent_cnid;
+				if(keycompare < 0)
+				{
+					/* Check if key is less than *every* record, which should 
+					 * never happen if the volume and key are good. */
+					if(recnum==0)
+						HFS_LIBERR("all records greater than key");
+					
+					/* Otherwise, we've found the first record that exceeds our 
+					 * key, so retrieve the previous, lesser record. */
+					curnode = lastnode;
+					break;
+				}
+				else if(keycompare == 0)
+				{
+					/*
+					 * Normally, if we were doing a typical catalog lookup with
+					 * both a parent cnid AND a name, keycompare==0 would be an
+					 * exact match. However, since we are ignoring object names
+					 * in this case and only comparing parent cnids, a direct
+					 * match on only a parent cnid could mean that we've found
+					 * an object with that parent cnid BUT which is NOT the
+					 * first object (according to the HFS+ spec) with that
+					 * parent cnid. Thus, when we find a parent cnid match, we 
+					 * still go back to the previously found leaf node and start
+					 * checking it for a possible prior instance of an object
+					 * with our desired parent cnid.
+					 */
+					curnode = lastnode;
+					break;					 
+				}
+				else if (recnum==nd.num_recs-1 && keycompare > 0)
+				{
+					/* Descend to child node if we found an exact match, or if
+					 * this is the last pointer record. */
+					curnode = currec.child;
+					break;
+				}
+				
+				lastnode = currec.child;
+			}
+			else
+			{
+				/*
+				 * We have now descended down the hierarchy of index nodes into
+				 * the leaf node that contains the first catalog record with a
+				 * matching parent CNID. Since all leaf nodes are chained
+				 * through their flink/blink, we can simply walk forward through
+				 * this chain, copying every matching non-thread record, until 
+				 * we hit a record with a different parent CNID. At that point,
+				 * we've retrieved all of our directory's items, if any.
+				 */
+				curnode = nd.flink;
+
+				if(curkey.parent_cnid<in_dir)
+					continue;
+				else if(curkey.parent_cnid==in_dir)
+				{
+					/* Hide files/folders which are supposed to be invisible
+					 * to users, according to the hfs+ spec. */
+					if(hfslib_is_private_file(&curkey))
+						continue;
+						
+					/* leaftype has now been set to the catalog record type */
+					if(leaftype==HFS_REC_FLDR || leaftype==HFS_REC_FILE)
+					{
+						(*out_numchildren)++;
+						
+						if(out_children!=NULL)
+						{
+							ptr = hfslib_realloc(*out_children, 
+								*out_numchildren *
+								sizeof(hfs_catalog_keyed_record_t), cbargs);
+							if(ptr==NULL)
+								HFS_LIBERR("could not allocate child record");
+							*out_children = ptr;
+							
+							memcpy(&((*out_children)[*out_numchildren-1]), 
+								&currec, sizeof(hfs_catalog_keyed_record_t));
+						}
+
+						if(out_childnames!=NULL)
+						{
+							ptr = hfslib_realloc(*out_childnames,
+								*out_numchildren * sizeof(hfs_unistr255_t),
+								cbargs);
+							if(ptr==NULL)
+								HFS_LIBERR("could not allocate child name");
+							*out_childnames = ptr;
+
+							memcpy(&((*out_childnames)[*out_numchildren-1]), 
+								&curkey.name, sizeof(hfs_unistr255_t));
+						}
+					}
+				} else {
+					result = 0;
+					/* We have just now passed the last item in the desired
+					 * folder (or the folder was empty), so exit. */
+					goto exit;
+				}
+			}
+		}
+	}
+
+	result = 0;
+
+	goto exit;	
+
+error:
+	if(out_children!=NULL && *out_children!=NULL)
+	{
+		hfslib_free(*out_children, cbargs);
+		*out_children = NULL;
+	}
+	if(out_childnames!=NULL && *out_childnames!=NULL)
+	{
+		hfslib_free(*out_childnames, cbargs);
+		*out_childnames = NULL;
+	}
+	*out_numchildren = 0;
+		
+	/* FALLTHROUGH */
+
+exit:
+	if(extents!=NULL)
+		hfslib_free(extents, cbargs);
+	hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
+	if(buffer!=NULL)
+		hfslib_free(buffer, cbargs);
+
+	return result;
+}
+
+/*
+ * Resumable lookups
+ *
+ * Each operation is a sequence of b-tree searches, and step records which of
+ * them is underway. A search descends from the root, taking at each index node
+ * the child of the last record whose key does not exceed the search key, until
+ * it reaches a leaf. Listing a directory searches for the folder's thread key,
+ * which sorts before all of its children, and then follows the leaf chain.
+ */
+
+enum {
+	HFS_ASYNC_STEP_THREAD,		/* catalog thread record of cnid */
+	HFS_ASYNC_STEP_RECORD,		/* catalog record with key */
+	HFS_ASYNC_STEP_EXTENTS,		/* extents overflow record with extkey */
+	HFS_ASYNC_STEP_CHILDREN		/* catalog records with cnid as their parent */
+};
+
+static hfs_async_status
+hfslib_async_search(hfs_volume* in_vol, hfs_async_lookup_t* inout_lookup,
+	int in_step)
+{
+	inout_lookup->step = in_step;
+	if(in_step==HFS_ASYNC_STEP_EXTENTS)
+	{
+		inout_lookup->btree = HFS_EXTENTS_FILE;
+		inout_lookup->node = in_vol->ehr.root_node;
+	}
+	else
+	{
+		inout_lookup->btree = HFS_CATALOG_FILE;
+		inout_lookup->node = in_vol->chr.root_node;
+	}
+
+	/* an empty tree has no root */
+	if(inout_lookup->node==0)
+		return inout_lookup->status = HFS_ASYNC_NOT_FOUND;
+	return inout_lookup->status = HFS_ASYNC_NEED_NODE;
+}
+
+static int
+hfslib_async_begin(hfs_volume* in_vol, hfs_async_lookup_t* out_lookup,
+	hfs_async_op in_op, hfs_callback_args* cbargs)
+{
+	memset(out_lookup, 0, sizeof(*out_lookup));
+	out_lookup->op = in_op;
+	out_lookup->buffer = hfslib_malloc(max(in_vol->chr.node_size,
+		in_vol->ehr.node_size), cbargs);
+	if(out_lookup->buffer==NULL)
+	{
+		out_lookup->status = HFS_ASYNC_ERROR;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Appends one extent record to the results, then either finishes or searches
+ * for the record continuing the fork.
+ */
+static hfs_async_status
+hfslib_async_add_extents(hfs_volume* in_vol, hfs_async_lookup_t* inout_lookup,
+	const hfs_extent_record_t in_rec, hfs_callback_args* cbargs)
+{
+	hfs_extent_descriptor_t*	ptr;
+	uint16_t	n;
+
+	for(n=0; n<8 && in_rec[n].block_count!=0; n++)
+		inout_lookup->numblocks += in_rec[n].block_count;
+
+	if(n>0)
+	{
+		ptr = hfslib_realloc(inout_lookup->extents,
+			(inout_lookup->num_extents+n) * sizeof(hfs_extent_descriptor_t),
+			cbargs);
+		if(ptr==NULL)
+			return inout_lookup->status = HFS_ASYNC_ERROR;
+		inout_lookup->extents = ptr;
+		memcpy(inout_lookup->extents + inout_lookup->num_extents, in_rec,
+			n * sizeof(hfs_extent_descriptor_t));
+		inout_lookup->num_extents += n;
+	}
+
+	if(inout_lookup->numblocks >= inout_lookup->forkdata.total_blocks)
+		return inout_lookup->status = HFS_ASYNC_DONE;
+	/* a record that adds nothing would have us search for it forever */
+	if(n==0)
+		return inout_lookup->status = HFS_ASYNC_ERROR;
+
+	if(hfslib_make_extent_key(inout_lookup->cnid, inout_lookup->fork,
+		inout_lookup->numblocks, &inout_lookup->extkey)==0)
+		return inout_lookup->status = HFS_ASYNC_ERROR;
+	return hfslib_async_search(in_vol, inout_lookup, HFS_ASYNC_STEP_EXTENTS);
+}
+
+static hfs_async_status
+hfslib_async_add_child(hfs_async_lookup_t* inout_lookup,
+	hfs_catalog_keyed_record_t* in_rec, hfs_catalog_key_t* in_key,
+	hfs_callback_args* cbargs)
+{
+	void*	ptr;
+	uint32_t	n;
+
+	n = inout_lookup->num_children + 1;
+
+	ptr = hfslib_realloc(inout_lookup->children,
+		n * sizeof(hfs_catalog_keyed_record_t), cbargs);
+	if(ptr==NULL)
+		return inout_lookup->status = HFS_ASYNC_ERROR;
+	inout_lookup->children = ptr;
+	memcpy(&inout_lookup->children[n-1], in_rec,
+		sizeof(hfs_catalog_keyed_record_t));
+
+	ptr = hfslib_realloc(inout_lookup->childnames,
+		n * sizeof(hfs_unistr255_t), cbargs);
+	if(ptr==NULL)
+		return inout_lookup->status = HFS_ASYNC_ERROR;
+	inout_lookup->childnames = ptr;
+	memcpy(&inout_lookup->childnames[n-1], &in_key->name,
+		sizeof(hfs_unistr255_t));
+
+	inout_lookup->num_children = n;
+	return inout_lookup->status;
+}
+
+/* Called with the exact match found by a thread or record search. */
+static hfs_async_status
+hfslib_async_found(hfs_volume* in_vol, hfs_async_lookup_t* inout_lookup,
+	hfs_catalog_keyed_record_t* in_rec, hfs_callback_args* cbargs)
+{
+	if(inout_lookup->step==HFS_ASYNC_STEP_THREAD)
+	{
+		if(in_rec->type!=HFS_REC_FLDR_THREAD
+			&& in_rec->type!=HFS_REC_FILE_THREAD)
+			return inout_lookup->status = HFS_ASYNC_ERROR;
+		if(hfslib_make_catalog_key(in_rec->thread.parent_cnid,
+			in_rec->thread.name.length, in_rec->thread.name.unicode,
+			&inout_lookup->key)==0)
+			return inout_lookup->status = HFS_ASYNC_ERROR;
+		return hfslib_async_search(in_vol, inout_lookup,
+			HFS_ASYNC_STEP_RECORD);
+	}
+
+	memcpy(&inout_lookup->rec, in_rec, sizeof(*in_rec));
+	if(inout_lookup->op!=HFS_ASYNC_FILE_EXTENTS)
+		return inout_lookup->status = HFS_ASYNC_DONE;
+
+	/* only files have extents, not folders or threads */
+	if(in_rec->type!=HFS_REC_FILE)
+		return inout_lookup->status = HFS_ASYNC_NOT_FOUND;
+	if(inout_lookup->fork==HFS_DATAFORK)
+		inout_lookup->forkdata = in_rec->file.data_fork;
+	else
+		inout_lookup->forkdata = in_rec->file.rsrc_fork;
+	return hfslib_async_add_extents(in_vol, inout_lookup,
+		inout_lookup->forkdata.extents, cbargs);
+}
+
+hfs_async_status
+hfslib_async_find_record(
+	hfs_volume* in_vol,
+	const hfs_catalog_key_t* in_key,
+	hfs_async_lookup_t* out_lookup,
+	hfs_callback_args* cbargs)
+{
+	if(hfslib_async_begin(in_vol, out_lookup, HFS_ASYNC_FIND_RECORD, cbargs))
+		return HFS_ASYNC_ERROR;
+	memcpy(&out_lookup->key, in_key, sizeof(*in_key));
+	return hfslib_async_search(in_vol, out_lookup, HFS_ASYNC_STEP_RECORD);
+}
+
+/* On success the lookup's key is the record's key. */
+hfs_async_status
+hfslib_async_find_cnid(
+	hfs_volume* in_vol,
+	hfs_cnid_t in_cnid,
+	hfs_async_lookup_t* out_lookup,
+	hfs_callback_args* cbargs)
+{
+	if(hfslib_async_begin(in_vol, out_lookup, HFS_ASYNC_FIND_CNID, cbargs))
+		return HFS_ASYNC_ERROR;
+	out_lookup->cnid = in_cnid;
+	if(hfslib_make_catalog_key(in_cnid, 0, NULL, &out_lookup->key)==0)
+		return out_lookup->status = HFS_ASYNC_ERROR;
+	return hfslib_async_search(in_vol, out_lookup, HFS_ASYNC_STEP_THREAD);
+}
+
+hfs_async_status
+hfslib_async_get_file_extents(
+	hfs_volume* in_vol,
+	hfs_cnid_t in_cnid,
+	uint8_t in_forktype,
+	hfs_async_lookup_t* out_lookup,
+	hfs_callback_args* cbargs)
+{
+	if(hfslib_async_begin(in_vol, out_lookup, HFS_ASYNC_FILE_EXTENTS, cbargs))
+		return HFS_ASYNC_ERROR;
+	out_lookup->cnid = in_cnid;
+	out_lookup->fork = in_forktype;
+
+	switch(in_cnid)
+	{
+		case HFS_CNID_CATALOG:
+			out_lookup->forkdata = in_vol->vh.catalog_file;
+			break;
+		case HFS_CNID_EXTENTS:
+			out_lookup->forkdata = in_vol->vh.extents_file;
+			break;
+		case HFS_CNID_ALLOCATION:
+			out_lookup->forkdata = in_vol->vh.allocation_file;
+			break;
+		case HFS_CNID_ATTRIBUTES:
+			out_lookup->forkdata = in_vol->vh.attributes_file;
+			break;
+		case HFS_CNID_STARTUP:
+			out_lookup->forkdata = in_vol->vh.startup_file;
+			break;
+		default:
+			if(hfslib_make_catalog_key(in_cnid, 0, NULL,
+				&out_lookup->key)==0)
+				return out_lookup->status = HFS_ASYNC_ERROR;
+			return hfslib_async_search(in_vol, out_lookup,
+				HFS_ASYNC_STEP_THREAD);
+	}
+	return hfslib_async_add_extents(in_vol, out_lookup,
+		out_lookup->forkdata.extents, cbargs);
+}
+
+hfs_async_status
+hfslib_async_get_directory_contents(
+	hfs_volume* in_vol,
+	hfs_cnid_t in_dir,
+	hfs_async_lookup_t* out_lookup,
+	hfs_callback_args* cbargs)
+{
+	if(hfslib_async_begin(in_vol, out_lookup, HFS_ASYNC_DIRECTORY_CONTENTS,
+		cbargs))
+		return HFS_ASYNC_ERROR;
+	out_lookup->cnid = in_dir;
+	if(hfslib_make_catalog_key(in_dir, 0, NULL, &out_lookup->key)==0)
+		return out_lookup->status = HFS_ASYNC_ERROR;
+	return hfslib_async_search(in_vol, out_lookup, HFS_ASYNC_STEP_CHILDREN);
+}
+
+/*
+ * hfslib_async_resume()
+ *
+ * Continues a lookup in HFS_ASYNC_NEED_NODE, whose buffer now holds the node it
+ * asked for, until it needs another node or finishes. Lookups in any other
+ * state are left as they are. Returns the new status.
+ */
+hfs_async_status
+hfslib_async_resume(
+	hfs_volume* in_vol,
+	hfs_async_lookup_t* inout_lookup,
+	hfs_callback_args* cbargs)
+{
+	hfs_node_descriptor_t		nd;
+	hfs_catalog_keyed_record_t	currec;
+	hfs_catalog_key_t*	curkey;
+	hfs_extent_record_t	extrec;
+	hfs_extent_key_t	extkey;
+	void**			recs;
+	uint16_t*		recsizes;
+	uint32_t		child;
+	uint16_t		recnum;
+	int16_t			leaftype;
+	int				keycompare;
+
+	if(in_vol==NULL || inout_lookup==NULL)
+		return HFS_ASYNC_ERROR;
+	if(inout_lookup->status!=HFS_ASYNC_NEED_NODE)
+		return inout_lookup->status;
+
+	recs = NULL;
+	recsizes = NULL;
+	nd.num_recs = 0;
+	child = 0;
+
+	/* as in hfslib_find_catalog_record_with_key(), keep this off the stack */
+	curkey = hfslib_malloc(sizeof(hfs_catalog_key_t), cbargs);
+	if(curkey==NULL)
+		HFS_LIBERR("could not allocate catalog key");
+
+	if(hfslib_reada_node(inout_lookup->buffer, &nd, &recs, &recsizes,
+		inout_lookup->btree, in_vol, cbargs)==0)
+		HFS_LIBERR("could not parse b-tree node #%i", inout_lookup->node);
+
+	if(nd.kind!=HFS_INDEXNODE && nd.kind!=HFS_LEAFNODE)
+		HFS_LIBERR("unexpected kind of b-tree node #%i", inout_lookup->node);
+
+	for(recnum=0; recnum<nd.num_recs; recnum++)
+	{
+		if(inout_lookup->btree==HFS_EXTENTS_FILE)
+		{
+			if(hfslib_read_extent_record(recs[recnum], &extrec, nd.kind,
+				&extkey, in_vol)==0)
+				HFS_LIBERR("could not read extents record #%i", recnum);
+			keycompare = hfslib_compare_extent_keys(&inout_lookup->extkey,
+				&extkey);
+			if(nd.kind==HFS_INDEXNODE)
+			{
+				if(keycompare<0 && recnum>0)
+					break;
+				/* extrec holds just a node pointer for index records */
+				child = *((uint32_t *)&extrec);
+			}
+			else if(keycompare==0)
+			{
+				hfslib_async_add_extents(in_vol, inout_lookup, extrec, cbargs);
+				goto done;
+			}
+			else if(keycompare<0)
+				break;
+			continue;
+		}
+
+		leaftype = nd.kind;
+		if(hfslib_read_catalog_keyed_record(recs[recnum], &currec, &leaftype,
+			curkey, in_vol)==0)
+			HFS_LIBERR("could not read catalog record #%i", recnum);
+
+		if(nd.kind==HFS_INDEXNODE)
+		{
+			if(in_vol->keycmp(&inout_lookup->key, curkey)<0 && recnum>0)
+				break;
+			child = currec.child;
+		}
+		else if(inout_lookup->step==HFS_ASYNC_STEP_CHILDREN)
+		{
+			if(curkey->parent_cnid<inout_lookup->cnid)
+				continue;
+			/* past the last child, or the folder was empty */
+			if(curkey->parent_cnid>inout_lookup->cnid)
+			{
+				inout_lookup->status = HFS_ASYNC_DONE;
+				goto done;
+			}
+			/* leaftype is now the record type; skip the thread, and
+			 * hide what the hfs+ spec says should be invisible to users */
+			if((leaftype==HFS_REC_FLDR || leaftype==HFS_REC_FILE)
+				&& !hfslib_is_private_file(curkey)
+				&& hfslib_async_add_child(inout_lookup, &currec, curkey,
+					cbargs)==HFS_ASYNC_ERROR)
+				goto done;
+		}
+		else
+		{
+			keycompare = in_vol->keycmp(&inout_lookup->key, curkey);
+			if(keycompare==0)
+			{
+				hfslib_async_found(in_vol, inout_lookup, &currec, cbargs);
+				goto done;
+			}
+			else if(keycompare<0)
+				break;
+		}
+	}
+
+	if(nd.kind==HFS_INDEXNODE)
+	{
+		if(child==0)
+			HFS_LIBERR("no child in index node #%i", inout_lookup->node);
+		inout_lookup->node = child;
+	}
+	else if(inout_lookup->step==HFS_ASYNC_STEP_CHILDREN && nd.flink!=0)
+	{
+		/* the folder's children may continue in the next leaf */
+		inout_lookup->node = nd.flink;
+	}
+	else if(inout_lookup->step==HFS_ASYNC_STEP_CHILDREN)
+		inout_lookup->status = HFS_ASYNC_DONE;
+	else
+		inout_lookup->status = HFS_ASYNC_NOT_FOUND;
+	goto done;
+
+error:
+	inout_lookup->status = HFS_ASYNC_ERROR;
+
+done:
+	hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
+	if(curkey!=NULL)
+		hfslib_free(curkey, cbargs);
+	return inout_lookup->status;
+}
+
+void
+hfslib_async_free(hfs_async_lookup_t* inout_lookup, hfs_callback_args* cbargs)
+{
+	if(inout_lookup==NULL)
+		return;
+	hfslib_free(inout_lookup->buffer, cbargs);
+	hfslib_free(inout_lookup->extents, cbargs);
+	hfslib_free(inout_lookup->children, cbargs);
+	hfslib_free(inout_lookup->childnames, cbargs);
+	inout_lookup->buffer = NULL;
+	inout_lookup->extents = NULL;
+	inout_lookup->children = NULL;
+	inout_lookup->childnames = NULL;
+}
+
+/*
+ * Location of each hfs_catalog_field within the on-disk record, as an offset
+ * from the start of the record data (just past the key) and a width. rectypes
+ * has bit (1 << type) set for each record type containing the field.
+ */
+#define HFS_CATFIELD_FLDR_FILE ((1 << HFS_REC_FLDR) | (1 << HFS_REC_FILE))
+#define HFS_CATFIELD_ALL_TYPES (HFS_CATFIELD_FLDR_FILE | \
+	(1 << HFS_REC_FLDR_THREAD) | (1 << HFS_REC_FILE_THREAD))
+
+static const struct
+{
+	uint16_t	offset;
+	uint8_t		width;
+	uint8_t		rectypes;
+} hfs_catalog_field_layout[] = {
+	[HFS_CATFIELD_PARENT_CNID]		= {0, 4, HFS_CATFIELD_ALL_TYPES},
+	[HFS_CATFIELD_REC_TYPE]			= {0, 2, HFS_CATFIELD_ALL_TYPES},
+	[HFS_CATFIELD_FLAGS]			= {2, 2, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_CNID]				= {8, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_DATE_CREATED]		= {12, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_DATE_CONTENT_MOD]	= {16, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_DATE_ATTRIB_MOD]	= {20, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_DATE_ACCESSED]	= {24, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_DATE_BACKEDUP]	= {28, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_OWNER_ID]			= {32, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_GROUP_ID]			= {36, 4, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_FILE_MODE]		= {42, 2, HFS_CATFIELD_FLDR_FILE},
+	[HFS_CATFIELD_FILE_TYPE]		= {48, 4, 1 << HFS_REC_FILE},
+	[HFS_CATFIELD_FILE_CREATOR]		= {52, 4, 1 << HFS_REC_FILE},
+	[HFS_CATFIELD_DATA_SIZE]		= {88, 8, 1 << HFS_REC_FILE},
+	[HFS_CATFIELD_RSRC_SIZE]		= {168, 8, 1 << HFS_REC_FILE},
+};
+
+/*
+ * hfslib_compile_catalog_predicate()
+ *
+ * Translates in_num_conds conditions, all of which must hold, into the raw
+ * record offsets tested by hfslib_catalog_predicate_matches(). The result
+ * must be released with hfslib_free_catalog_predicate().
+ *
+ * Returns 0 on success, or -1 if a field or operator is invalid.
+ */
+int
+hfslib_compile_catalog_predicate(
+	const hfs_catalog_condition_t* in_conds,
+	uint16_t in_num_conds,
+	hfs_catalog_predicate_t* out_pred,
+	hfs_callback_args* cbargs)
+{
+	hfs_catalog_compiled_condition_t*	cc;
+	uint16_t	i;
+
+	if(out_pred==NULL || (in_conds==NULL && in_num_conds>0))
+		return -1;
+
+	out_pred->num_conds = 0;
+	out_pred->conds = NULL;
+	if(in_num_conds==0)
+		return 0;
+
+	out_pred->conds = hfslib_malloc(in_num_conds * sizeof(*out_pred->conds),
+		cbargs);
+	if(out_pred->conds==NULL)
+		HFS_LIBERR("could not allocate predicate");
+
+	for(i=0; i<in_num_conds; i++)
+	{
+		if((unsigned)in_conds[i].field > HFS_CATFIELD_RSRC_SIZE)
+			HFS_LIBERR("invalid catalog field %i", in_conds[i].field);
+		if((unsigned)in_conds[i].op > HFS_CMP_ALLSET)
+			HFS_LIBERR("invalid comparison %i", in_conds[i].op);
+
+		cc = &out_pred->conds[i];
+		cc->offset = hfs_catalog_field_layout[in_conds[i].field].offset;
+		cc->width = hfs_catalog_field_layout[in_conds[i].field].width;
+		cc->rectypes = hfs_catalog_field_layout[in_conds[i].field].rectypes;
+		cc->inkey = in_conds[i].field==HFS_CATFIELD_PARENT_CNID;
+		cc->op = in_conds[i].op;
+		cc->value = in_conds[i].value;
+	}
+	out_pred->num_conds = in_num_conds;
+
+	return 0;
+
+error:
+	hfslib_free_catalog_predicate(out_pred, cbargs);
+	return -1;
+}
+
+void
+hfslib_free_catalog_predicate(
+	hfs_catalog_predicate_t* inout_pred,
+	hfs_callback_args* cbargs)
+{
+	if(inout_pred==NULL)
+		return;
+	if(inout_pred->conds!=NULL)
+		hfslib_free(inout_pred->conds, cbargs);
+	inout_pred->conds = NULL;
+	inout_pred->num_conds = 0;
+}
+
+/*
+ * hfslib_catalog_predicate_matches()
+ *
+ * Tests a raw, undecoded catalog leaf record of in_size bytes against
+ * in_pred, reading only the big-endian fields the predicate names. A NULL or
+ * empty predicate matches everything.
+ *
+ * Returns 1 on a match, 0 otherwise, or -1 if the record is malformed.
+ */
+int
+hfslib_catalog_predicate_matches(
+	const hfs_catalog_predicate_t* in_pred,
+	const void* in_bytes,
+	uint16_t in_size,
+	hfs_volume* in_vol)
+{
+	const hfs_catalog_compiled_condition_t*	cc;
+	const uint8_t*	rec;
+	const uint8_t*	field;
+	uint64_t	value;
+	uint32_t	dataoffset;
+	uint16_t	rectype;
+	uint16_t	i;
+	uint8_t		j;
+
+	if(in_pred==NULL || in_pred->num_conds==0)
+		return 1;
+
+	rec = in_bytes;
+	if(in_vol->catkeysizefieldsize == sizeof(uint16_t))
+	{
+		if(in_size < 2)
+			return -1;
+		dataoffset = 2 + ((rec[0] << 8) | rec[1]);
+	}
+	else
+	{
+		if(in_size < 1)
+			return -1;
+		dataoffset = 1 + rec[0];
+	}
+	if(dataoffset < in_vol->catkeysizefieldsize + 4 ||
+		dataoffset + 2 > in_size)
+		return -1;
+	rectype = (rec[dataoffset] << 8) | rec[dataoffset+1];
+
+	for(i=0; i<in_pred->num_conds; i++)
+	{
+		cc = &in_pred->conds[i];
+		if(cc->inkey)
+			field = rec + in_vol->catkeysizefieldsize;
+		else
+		{
+			if(rectype > HFS_REC_FILE_THREAD || !(cc->rectypes & (1 << rectype)))
+				return 0;
+			if(dataoffset + cc->offset + cc->width > in_size)
+				return 0;
+			field = rec + dataoffset + cc->offset;
+		}
+
+		value = 0;
+		for(j=0; j<cc->width; j++)
+			value = (value << 8) | field[j];
+
+		switch(cc->op)
+		{
+			case HFS_CMP_EQ: if(!(value == cc->value)) return 0; break;
+			case HFS_CMP_NE: if(!(value != cc->value)) return 0; break;
+			case HFS_CMP_LT: if(!(value <  cc->value)) return 0; break;
+			case HFS_CMP_LE: if(!(value <= cc->value)) return 0; break;
+			case HFS_CMP_GT: if(!(value >  cc->value)) return 0; break;
+			case HFS_CMP_GE: if(!(value >= cc->value)) return 0; break;
+			case HFS_CMP_ALLSET:
+				if((value & cc->value) != cc->value)
+					return 0;
+				break;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * hfslib_partition_catalog()
+ *
+ * Splits the catalog's leaf chain into at most in_max_parts contiguous ranges
+ * of roughly equal node counts, for hfslib_walk_catalog_range(). The leaves
+ * are enumerated in order from the index level just above them, which is
+ * found by descending the leftmost path from the root and then followed
+ * through its sibling links; no leaf is read. out_starts receives the first
+ * leaf of each range, and each range ends where the next one starts.
+ *
+ * Returns the number of ranges, or 0 on error.
+ */
+uint32_t
+hfslib_partition_catalog(
+	hfs_volume* in_vol,
+	uint32_t in_max_parts,
+	uint32_t* out_starts,
+	hfs_callback_args* cbargs)
+{
+	hfs_node_descriptor_t			nd;
+	hfs_extent_descriptor_t*		extents;
+	hfs_catalog_keyed_record_t		currec;
+	hfs_catalog_key_t	curkey;
+	void**				recs;
+	uint16_t*			recsizes;
+	void*				buffer;
+	uint32_t*			leaves;
+	uint32_t*			newleaves;
+	uint32_t			numleaves;
+	uint32_t			capleaves;
+	uint32_t			curnode;
+	uint32_t			numnodes;
+	uint32_t			numparts;
+	uint32_t			i;
+	uint16_t			numextents;
+	uint16_t			recnum;
+	int16_t				leaftype;
+
+	if(in_vol==NULL || in_max_parts==0 || out_starts==NULL)
+		return 0;
+
+	extents = NULL;
+	recs = NULL;
+	recsizes = NULL;
+	leaves = NULL;
+	numleaves = capleaves = 0;
+	nd.num_recs = 0;
+	numparts = 0;
+
+	buffer = hfslib_malloc(in_vol->chr.node_size, cbargs);
+	if(buffer==NULL)
+		HFS_LIBERR("could not allocate node buffer");
+
+	/* nothing to split without an index */
+	out_starts[0] = in_vol->chr.first_leaf;
+	if(in_max_parts==1 || in_vol->chr.tree_depth < 2)
+	{
+		numparts = 1;
+		goto exit;
+	}
+
+	numextents = hfslib_get_file_extents(in_vol, HFS_CNID_CATALOG,
+		HFS_DATAFORK, &extents, cbargs);
+	if(numextents==0)
+		HFS_LIBERR("could not locate fork extents");
+
+	/* leftmost node of the level above the leaves */
+	curnode = in_vol->chr.root_node;
+	for(numnodes = 0; ; numnodes++)
+	{
+		if(numnodes > in_vol->chr.tree_depth)
+			HFS_LIBERR("catalog index is deeper than its header claims");
+
+		if(hfslib_readd_node(in_vol, buffer, HFS_CATALOG_FILE, curnode,
+			extents, numextents, cbargs)!=0)
+			HFS_LIBERR("could not read catalog node #%i", curnode);
+		if(hfslib_reada_node(buffer, &nd, NULL, NULL, HFS_CATALOG_FILE,
+			in_vol, cbargs)==0)
+			HFS_LIBERR("could not parse catalog node #%i", curnode);
+		if(nd.kind!=HFS_INDEXNODE || nd.height<2 || nd.num_recs==0)
+			HFS_LIBERR("catalog node #%i is not an index node", curnode);
+		if(nd.height==2)
+			break;
+
+		/* the first record's key and child pointer follow the descriptor */
+		leaftype = HFS_INDEXNODE;
+		if(hfslib_read_catalog_keyed_record((uint8_t*)buffer + 14, &currec,
+			&leaftype, &curkey, in_vol)==0)
+			HFS_LIBERR("could not read cat record %i:0", curnode);
+		curnode = currec.child;
+	}
+
+	/* every record there points to the next leaf in key order */
+	numnodes = 0;
+	for(; curnode!=0; curnode = nd.flink)
+	{
+		if(++numnodes > in_vol->chr.total_nodes)
+			HFS_LIBERR("catalog index chain does not terminate");
+
+		hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
+
+		if(hfslib_readd_node(in_vol, buffer, HFS_CATALOG_FILE, curnode,
+			extents, numextents, cbargs)!=0)
+			HFS_LIBERR("could not read catalog node #%i", curnode);
+		if(hfslib_reada_node(buffer, &nd, &recs, &recsizes, HFS_CATALOG_FILE,
+			in_vol, cbargs)==0)
+			HFS_LIBERR("could not parse catalog node #%i", curnode);
+		if(nd.kind!=HFS_INDEXNODE || nd.height!=2)
+			HFS_LIBERR("catalog node #%i is not at index level 2", curnode);
+
+		for(recnum=0; recnum<nd.num_recs; recnum++)
+		{
+			leaftype = HFS_INDEXNODE;
+			if(hfslib_read_catalog_keyed_record(recs[recnum], &currec,
+				&leaftype, &curkey, in_vol)==0)
+				HFS_LIBERR("could not read cat record %i:%i", curnode, recnum);
+
+			if(numleaves==capleaves)
+			{
+				capleaves = capleaves ? capleaves*2 : 256;
+				newleaves = hfslib_realloc(leaves,
+					capleaves * sizeof(*leaves), cbargs);
+				if(newleaves==NULL)
+					HFS_LIBERR("could not allocate leaf list");
+				leaves = newleaves;
+			}
+			leaves[numleaves++] = currec.child;
+		}
+	}
+
+	if(numleaves==0)
+		HFS_LIBERR("catalog index has no leaves");
+
+	numparts = in_max_parts < numleaves ? in_max_parts : numleaves;
+	for(i=0; i<numparts; i++)
+		out_starts[i] = leaves[(uint64_t)i * numleaves / numparts];
+
+	goto exit;
+
+error:
+	numparts = 0;
+
+exit:
+	hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
+	if(leaves!=NULL)
+		hfslib_free(leaves, cbargs);
+	if(extents!=NULL)
+		hfslib_free(extents, cbargs);
+	if(buffer!=NULL)
+		hfslib_free(buffer, cbargs);
+
+	return numparts;
+}
+
+/*
+ * hfslib_walk_catalog()
+ *
+ * Calls in_func for every record in the catalog's leaf nodes, in key order,
+ * by following the leaf chain from the header's first_leaf. Thread records are
+ * included; the record's type field tells them apart. This visits the whole
+ * catalog in one pass without descending the index for each folder.
+ */
+int
+hfslib_walk_catalog(
+	hfs_volume* in_vol,
+	const hfs_catalog_predicate_t* in_pred,
+	hfs_catalog_walk_func in_func,
+	void* in_cookie,
+	hfs_callback_args* cbargs)
+{
+	if(in_vol==NULL)
+		return -1;
+
+	return hfslib_walk_catalog_range(in_vol, in_pred, in_vol->chr.first_leaf, 0,
+		in_func, in_cookie, cbargs);
+}
+
+/*
+ * hfslib_walk_catalog_range()
+ *
+ * Like hfslib_walk_catalog(), but follows the leaf chain from in_first_leaf
+ * and stops before reaching in_stop_leaf (0 to walk to the end). Ranges from
+ * hfslib_partition_catalog() may be walked concurrently.
+ *
+ * If in_pred is not NULL, each record is first tested in place against it and
+ * only matching records are decoded and passed to in_func. Since decoding the
+ * key's name dominates the cost of a scan, selective predicates make the walk
+ * roughly as cheap as reading the nodes.
+ *
+ * Returns 0 on success, the callback's return value if it was nonzero, or -1
+ * on a read or parse error.
+ */
+int
+hfslib_walk_catalog_range(
+	hfs_volume* in_vol,
+	const hfs_catalog_predicate_t* in_pred,
+	uint32_t in_first_leaf,
+	uint32_t in_stop_leaf,
+	hfs_catalog_walk_func in_func,
+	void* in_cookie,
+	hfs_callback_args* cbargs)
+{
+	hfs_node_descriptor_t			nd;
+	hfs_extent_descriptor_t*		extents;
+	hfs_catalog_keyed_record_t		currec;
+	hfs_catalog_key_t	curkey;
+	uint8_t*			buffer;
+	const uint8_t*		offp;
+	uint32_t			curnode;
+	uint32_t			numnodes;
+	uint16_t			nodesize;
 	uint16_t			numextents;
 	uint16_t			recnum;
+	uint16_t			recstart;
+	uint16_t			recend;
 	int16_t				leaftype;
-	int					keycompare;
 	int					result;
 
-	if(in_vol==NULL || in_dir==0 || out_numchildren==NULL)
-		return 1;
-		
-	result = 1;
-	buffer = NULL;
+	if(in_vol==NULL || in_func==NULL)
+		return -1;
+
 	extents = NULL;
-	lastnode = 0;
-	recs = NULL;
-	recsizes = NULL;
-	*out_numchildren = 0;
-	if(out_children!=NULL)
-		*out_children = NULL;
-	if(out_childnames!=NULL)
-		*out_childnames = NULL;
+	nodesize = in_vol->chr.node_size;
 
-	buffer = hfslib_malloc(in_vol->chr.node_size, cbargs);
+	buffer = hfslib_malloc(nodesize, cbargs);
 	if(buffer==NULL)
 		HFS_LIBERR("could not allocate node buffer");
 
@@ -1014,152 +2016,66 @@ hfslib_get_directory_contents(
 	if(numextents==0)
 		HFS_LIBERR("could not locate fork extents");
 
-	nd.num_recs = 0;
-	curnode = in_vol->chr.root_node;
-	
-	while(1)
+	/* a damaged leaf chain could loop, so never visit more nodes than exist */
+	numnodes = 0;
+	for(curnode = in_first_leaf; curnode!=0 && curnode!=in_stop_leaf;
+		curnode = nd.flink)
 	{
-		hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
-		recnum = 0;
+		if(++numnodes > in_vol->chr.total_nodes)
+			HFS_LIBERR("catalog leaf chain does not terminate");
 
-		if(hfslib_readd_with_extents(in_vol, buffer, &bytesread, 
-			in_vol->chr.node_size, curnode * in_vol->chr.node_size, extents, 
-			numextents, cbargs)!=0)
+		if(hfslib_readd_node(in_vol, buffer, HFS_CATALOG_FILE, curnode,
+			extents, numextents, cbargs)!=0)
 			HFS_LIBERR("could not read catalog node #%i", curnode);
 
-		if(hfslib_reada_node(buffer, &nd, &recs, &recsizes, HFS_CATALOG_FILE,
+		/* only the descriptor; records are located straight from the buffer */
+		if(hfslib_reada_node(buffer, &nd, NULL, NULL, HFS_CATALOG_FILE,
 			in_vol, cbargs)==0)
 			HFS_LIBERR("could not parse catalog node #%i", curnode);
 
+		if(nd.kind!=HFS_LEAFNODE)
+			HFS_LIBERR("catalog node #%i is not a leaf node", curnode);
+		if(14 + 2*(nd.num_recs+1) > nodesize)
+			HFS_LIBERR("catalog node #%i has too many records", curnode);
+
 		for(recnum=0; recnum<nd.num_recs; recnum++)
 		{
-			leaftype = nd.kind; /* needed b/c leaftype might be modified now */
-			if(hfslib_read_catalog_keyed_record(recs[recnum], &currec,
-				&leaftype, &curkey, in_vol)==0)
-				HFS_LIBERR("could not read cat record %i:%i", curnode, recnum);
-
-			if(nd.kind==HFS_INDEXNODE)
+			/* offsets are big-endian; read them a byte at a time */
+			offp = buffer + nodesize - 2*(recnum+1);
+			recstart = (offp[0] << 8) | offp[1];
+			recend = (offp[-2] << 8) | offp[-1];
+			if(recstart < 14 || recend <= recstart ||
+				recend > nodesize - 2*(nd.num_recs+1))
+				HFS_LIBERR("bad offset for cat record %i:%i", curnode, recnum);
+
+			switch(hfslib_catalog_predicate_matches(in_pred, buffer + recstart,
+				recend - recstart, in_vol))
 			{
-				keycompare = in_dir - curkey.parent_cnid;
-				if(keycompare < 0)
-				{
-					/* Check if key is less than *every* record, which should 
-					 * never happen if the volume and key are good. */
-					if(recnum==0)
-						HFS_LIBERR("all records greater than key");
-					
-					/* Otherwise, we've found the first record that exceeds our 
-					 * key, so retrieve the previous, lesser record. */
-					curnode = lastnode;
-					break;
-				}
-				else if(keycompare == 0)
-				{
-					/*
-					 * Normally, if we were doing a typical catalog lookup with
-					 * both a parent cnid AND a name, keycompare==0 would be an
-					 * exact match. However, since we are ignoring object names
-					 * in this case and only comparing parent cnids, a direct
-					 * match on only a parent cnid could mean that we've found
-					 * an object with that parent cnid BUT which is NOT the
-					 * first object (according to the HFS+ spec) with that
-					 * parent cnid. Thus, when we find a parent cnid match, we 
-					 * still go back to the previously found leaf node and start
-					 * checking it for a possible prior instance of an object
-					 * with our desired parent cnid.
-					 */
-					curnode = lastnode;
-					break;					 
-				}
-				else if (recnum==nd.num_recs-1 && keycompare > 0)
-				{
-					/* Descend to child node if we found an exact match, or if
-					 * this is the last pointer record. */
-					curnode = currec.child;
-					break;
-				}
-				
-				lastnode = currec.child;
+				case 0: continue;
+				case 1: break;
+				default:
+					HFS_LIBERR("malformed cat record %i:%i", curnode, recnum);
 			}
-			else
-			{
-				/*
-				 * We have now descended down the hierarchy of index nodes into
-				 * the leaf node that contains the first catalog record with a
-				 * matching parent CNID. Since all leaf nodes are chained
-				 * through their flink/blink, we can simply walk forward through
-				 * this chain, copying every matching non-thread record, until 
-				 * we hit a record with a different parent CNID. At that point,
-				 * we've retrieved all of our directory's items, if any.
-				 */
-				curnode = nd.flink;
-
-				if(curkey.parent_cnid<in_dir)
-					continue;
-				else if(curkey.parent_cnid==in_dir)
-				{
-					/* Hide files/folders which are supposed to be invisible
-					 * to users, according to the hfs+ spec. */
-					if(hfslib_is_private_file(&curkey))
-						continue;
-						
-					/* leaftype has now been set to the catalog record type */
-					if(leaftype==HFS_REC_FLDR || leaftype==HFS_REC_FILE)
-					{
-						(*out_numchildren)++;
-						
-						if(out_children!=NULL)
-						{
-							ptr = hfslib_realloc(*out_children, 
-								*out_numchildren *
-								sizeof(hfs_catalog_keyed_record_t), cbargs);
-							if(ptr==NULL)
-								HFS_LIBERR("could not allocate child record");
-							*out_children = ptr;
-							
-							memcpy(&((*out_children)[*out_numchildren-1]), 
-								&currec, sizeof(hfs_catalog_keyed_record_t));
-						}
 
-						if(out_childnames!=NULL)
-						{
-							ptr = hfslib_realloc(*out_childnames,
-								*out_numchildren * sizeof(hfs_unistr255_t),
-								cbargs);
-							if(ptr==NULL)
-								HFS_LIBERR("could not allocate child name");
-							*out_childnames = ptr;
+			leaftype = nd.kind;
+			if(hfslib_read_catalog_keyed_record(buffer + recstart, &currec,
+				&leaftype, &curkey, in_vol)==0)
+				HFS_LIBERR("could not read cat record %i:%i", curnode, recnum);
 
-							memcpy(&((*out_childnames)[*out_numchildren-1]), 
-								&curkey.name, sizeof(hfs_unistr255_t));
-						}
-					}
-				} else {
-					result = 0;
-					/* We have just now passed the last item in the desired
-					 * folder (or the folder was empty), so exit. */
-					goto exit;
-				}
-			}
+			if((result = in_func(in_vol, &curkey, &currec, in_cookie))!=0)
+				goto exit;
 		}
 	}
 
 	result = 0;
-
-	goto exit;	
+	goto exit;
 
 error:
-	if(out_children!=NULL && *out_children!=NULL)
-		hfslib_free(*out_children, cbargs);
-	if(out_childnames!=NULL && *out_childnames!=NULL)
-		hfslib_free(*out_childnames, cbargs);
-		
-	/* FALLTHROUGH */
+	result = -1;
 
 exit:
 	if(extents!=NULL)
 		hfslib_free(extents, cbargs);
-	hfslib_free_recs(&recs, &recsizes, &nd.num_recs, cbargs);
 	if(buffer!=NULL)
 		hfslib_free(buffer, cbargs);
 
@@ -2238,7 +3154,7 @@ hfslib_readd_with_extents(
 	uint16_t	in_numextents,
 	hfs_callback_args*	cbargs)
 {
-	uint64_t	ext_length, last_offset;
+	uint64_t	ext_length, last_offset, chunk;
 	uint16_t	i;
 	int			error;
 	
@@ -2263,15 +3179,32 @@ hfslib_readd_with_extents(
 			
 			isect_start = max(in_offset, last_offset);
 			isect_end = min(in_offset+in_length, last_offset+ext_length);
-			error = hfslib_readd(in_vol, out_bytes, isect_end-isect_start,
-				isect_start - last_offset + (uint64_t)in_extents[i].start_block
-					* in_vol->vh.block_size, cbargs);
-					
-			if(error!=0)
-				return error;
-				
-			*out_bytesread += isect_end-isect_start;
-			out_bytes = (uint8_t*)out_bytes + isect_end-isect_start;
+
+			/* When the application can cancel requests, read in bounded
+			 * chunks so an abandoned read stops between them instead of
+			 * holding the device until the whole range is in. */
+			while(isect_start < isect_end)
+			{
+				chunk = isect_end-isect_start;
+				if(hfs_gcb.interrupted!=NULL)
+				{
+					if(hfslib_interrupted(cbargs))
+						return -1;
+					chunk = min(chunk, HFS_READ_CHUNK_SIZE);
+				}
+
+				error = hfslib_readd(in_vol, out_bytes, chunk,
+					isect_start - last_offset
+					+ (uint64_t)in_extents[i].start_block
+						* in_vol->vh.block_size, cbargs);
+
+				if(error!=0)
+					return error;
+
+				*out_bytesread += chunk;
+				out_bytes = (uint8_t*)out_bytes + chunk;
+				isect_start += chunk;
+			}
 		}
 
 		last_offset += ext_length;
@@ -2281,6 +3214,54 @@ hfslib_readd_with_extents(
 	return 0;
 }
 
+/*
+ *	hfslib_readd_node()
+ *
+ *	Reads node number in_nodenum of the given b-tree file into out_bytes,
+ *	which must be large enough to hold one node. The application's getnode
+ *	callback is consulted first, and putnode is offered every node that had
+ *	to be read from the volume. Returns 0 on success.
+ */
+int
+hfslib_readd_node(
+	hfs_volume*	in_vol,
+	void*		out_bytes,
+	hfs_btree_file_type in_btree,
+	uint32_t	in_nodenum,
+	hfs_extent_descriptor_t in_extents[],
+	uint16_t	in_numextents,
+	hfs_callback_args*	cbargs)
+{
+	uint64_t	bytesread;
+	uint16_t	nodesize;
+	int			error;
+
+	if(in_vol==NULL || out_bytes==NULL)
+		return -1;
+
+	nodesize = in_btree==HFS_CATALOG_FILE ? in_vol->chr.node_size
+		: in_vol->ehr.node_size;
+
+	if(hfs_gcb.getnode!=NULL
+		&& hfs_gcb.getnode(in_vol, in_btree, in_nodenum, out_bytes, cbargs)==0)
+		return 0;
+
+	if(hfslib_interrupted(cbargs))
+		return -1;
+
+	error = hfslib_readd_with_extents(in_vol, out_bytes, &bytesread, nodesize,
+		(uint64_t)in_nodenum * nodesize, in_extents, in_numextents, cbargs);
+	if(error!=0)
+		return error;
+	if(bytesread!=nodesize)
+		return -1;
+
+	if(hfs_gcb.putnode!=NULL)
+		hfs_gcb.putnode(in_vol, in_btree, in_nodenum, out_bytes, cbargs);
+
+	return 0;
+}
+
 #if 0
 #pragma mark -
 #pragma mark Callback Wrappers
@@ -2348,6 +3329,46 @@ hfslib_closevoldevice(hfs_volume* in_vol, hfs_callback_args* cbargs)
 		hfs_gcb.closevol(in_vol, cbargs);
 }
 
+/*
+ * Performs a batch of independent reads with the application's readv callback
+ * if it has one, so it can issue them concurrently, or else one by one.
+ */
+int
+hfslib_readdv(
+	hfs_volume* in_vol,
+	const hfs_read_request_t* in_requests,
+	uint16_t in_count,
+	hfs_callback_args* cbargs)
+{
+	uint16_t	i;
+	int			error;
+
+	if(in_vol==NULL || (in_requests==NULL && in_count>0))
+		return -1;
+
+	if(hfs_gcb.readv!=NULL)
+		return hfs_gcb.readv(in_vol, in_requests, in_count, cbargs);
+
+	for(i=0; i<in_count; i++)
+	{
+		error = hfslib_readd(in_vol, in_requests[i].buffer,
+			in_requests[i].length, in_requests[i].offset, cbargs);
+		if(error!=0)
+			return error;
+	}
+
+	return 0;
+}
+
+int
+hfslib_interrupted(hfs_callback_args* cbargs)
+{
+	if(hfs_gcb.interrupted!=NULL)
+		return hfs_gcb.interrupted(cbargs);
+
+	return 0;
+}
+
 int
 hfslib_readd(
 	hfs_volume* in_vol,
@@ -2564,231 +3585,397 @@ hfslib_compare_extent_keys (
 	}
 }
 
-/* 1+10 tables of 16 rows and 16 columns, each 2 bytes wide = 5632 bytes */
+/*
+ * The case folding table from TN1150: 1+10 tables of 256 entries each, 2 bytes
+ * wide = 5632 bytes. The first maps a character's high byte to the offset of
+ * the subtable for it, or 0 if characters with that high byte fold to
+ * themselves, and each subtable maps the low byte to the folded character.
+ * A folded character of 0xffff is ignored when comparing.
+ */
+const unichar_t hfs_gcft[2816] = {
+	/* high byte indices */
+	0x0100, 0x0200, 0x0000, 0x0300, 0x0400, 0x0500, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0600, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0700, 0x0800, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0900, 0x0a00,
+
+	/* table 1 (high byte 0x00) */
+	0xffff, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+	0x0008, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e, 0x000f,
+	0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+	0x0018, 0x0019, 0x001a, 0x001b, 0x001c, 0x001d, 0x001e, 0x001f,
+	0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+	0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+	0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+	0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+	0x0040, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+	0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+	0x0078, 0x0079, 0x007a, 0x005b, 0x005c, 0x005d, 0x005e, 0x005f,
+	0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+	0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+	0x0078, 0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x007e, 0x007f,
+	0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+	0x0088, 0x0089, 0x008a, 0x008b, 0x008c, 0x008d, 0x008e, 0x008f,
+	0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+	0x0098, 0x0099, 0x009a, 0x009b, 0x009c, 0x009d, 0x009e, 0x009f,
+	0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+	0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+	0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+	0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+	0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00e6, 0x00c7,
+	0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+	0x00f0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+	0x00f8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00fe, 0x00df,
+	0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+	0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+	0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+	0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+
+	/* table 2 (high byte 0x01) */
+	0x0100, 0x0101, 0x0102, 0x0103, 0x0104, 0x0105, 0x0106, 0x0107,
+	0x0108, 0x0109, 0x010a, 0x010b, 0x010c, 0x010d, 0x010e, 0x010f,
+	0x0111, 0x0111, 0x0112, 0x0113, 0x0114, 0x0115, 0x0116, 0x0117,
+	0x0118, 0x0119, 0x011a, 0x011b, 0x011c, 0x011d, 0x011e, 0x011f,
+	0x0120, 0x0121, 0x0122, 0x0123, 0x0124, 0x0125, 0x0127, 0x0127,
+	0x0128, 0x0129, 0x012a, 0x012b, 0x012c, 0x012d, 0x012e, 0x012f,
+	0x0130, 0x0131, 0x0133, 0x0133, 0x0134, 0x0135, 0x0136, 0x0137,
+	0x0138, 0x0139, 0x013a, 0x013b, 0x013c, 0x013d, 0x013e, 0x0140,
+	0x0140, 0x0142, 0x0142, 0x0143, 0x0144, 0x0145, 0x0146, 0x0147,
+	0x0148, 0x0149, 0x014b, 0x014b, 0x014c, 0x014d, 0x014e, 0x014f,
+	0x0150, 0x0151, 0x0153, 0x0153, 0x0154, 0x0155, 0x0156, 0x0157,
+	0x0158, 0x0159, 0x015a, 0x015b, 0x015c, 0x015d, 0x015e, 0x015f,
+	0x0160, 0x0161, 0x0162, 0x0163, 0x0164, 0x0165, 0x0167, 0x0167,
+	0x0168, 0x0169, 0x016a, 0x016b, 0x016c, 0x016d, 0x016e, 0x016f,
+	0x0170, 0x0171, 0x0172, 0x0173, 0x0174, 0x0175, 0x0176, 0x0177,
+	0x0178, 0x0179, 0x017a, 0x017b, 0x017c, 0x017d, 0x017e, 0x017f,
+	0x0180, 0x0253, 0x0183, 0x0183, 0x0185, 0x0185, 0x0254, 0x0188,
+	0x0188, 0x0256, 0x0257, 0x018c, 0x018c, 0x018d, 0x01dd, 0x0259,
+	0x025b, 0x0192, 0x0192, 0x0260, 0x0263, 0x0195, 0x0269, 0x0268,
+	0x0199, 0x0199, 0x019a, 0x019b, 0x026f, 0x0272, 0x019e, 0x0275,
+	0x01a0, 0x01a1, 0x01a3, 0x01a3, 0x01a5, 0x01a5, 0x01a6, 0x01a8,
+	0x01a8, 0x0283, 0x01aa, 0x01ab, 0x01ad, 0x01ad, 0x0288, 0x01af,
+	0x01b0, 0x028a, 0x028b, 0x01b4, 0x01b4, 0x01b6, 0x01b6, 0x0292,
+	0x01b9, 0x01b9, 0x01ba, 0x01bb, 0x01bd, 0x01bd, 0x01be, 0x01bf,
+	0x01c0, 0x01c1, 0x01c2, 0x01c3, 0x01c6, 0x01c6, 0x01c6, 0x01c9,
+	0x01c9, 0x01c9, 0x01cc, 0x01cc, 0x01cc, 0x01cd, 0x01ce, 0x01cf,
+	0x01d0, 0x01d1, 0x01d2, 0x01d3, 0x01d4, 0x01d5, 0x01d6, 0x01d7,
+	0x01d8, 0x01d9, 0x01da, 0x01db, 0x01dc, 0x01dd, 0x01de, 0x01df,
+	0x01e0, 0x01e1, 0x01e2, 0x01e3, 0x01e5, 0x01e5, 0x01e6, 0x01e7,
+	0x01e8, 0x01e9, 0x01ea, 0x01eb, 0x01ec, 0x01ed, 0x01ee, 0x01ef,
+	0x01f0, 0x01f3, 0x01f3, 0x01f3, 0x01f4, 0x01f5, 0x01f6, 0x01f7,
+	0x01f8, 0x01f9, 0x01fa, 0x01fb, 0x01fc, 0x01fd, 0x01fe, 0x01ff,
+
+	/* table 3 (high byte 0x03) */
+	0x0300, 0x0301, 0x0302, 0x0303, 0x0304, 0x0305, 0x0306, 0x0307,
+	0x0308, 0x0309, 0x030a, 0x030b, 0x030c, 0x030d, 0x030e, 0x030f,
+	0x0310, 0x0311, 0x0312, 0x0313, 0x0314, 0x0315, 0x0316, 0x0317,
+	0x0318, 0x0319, 0x031a, 0x031b, 0x031c, 0x031d, 0x031e, 0x031f,
+	0x0320, 0x0321, 0x0322, 0x0323, 0x0324, 0x0325, 0x0326, 0x0327,
+	0x0328, 0x0329, 0x032a, 0x032b, 0x032c, 0x032d, 0x032e, 0x032f,
+	0x0330, 0x0331, 0x0332, 0x0333, 0x0334, 0x0335, 0x0336, 0x0337,
+	0x0338, 0x0339, 0x033a, 0x033b, 0x033c, 0x033d, 0x033e, 0x033f,
+	0x0340, 0x0341, 0x0342, 0x0343, 0x0344, 0x0345, 0x0346, 0x0347,
+	0x0348, 0x0349, 0x034a, 0x034b, 0x034c, 0x034d, 0x034e, 0x034f,
+	0x0350, 0x0351, 0x0352, 0x0353, 0x0354, 0x0355, 0x0356, 0x0357,
+	0x0358, 0x0359, 0x035a, 0x035b, 0x035c, 0x035d, 0x035e, 0x035f,
+	0x0360, 0x0361, 0x0362, 0x0363, 0x0364, 0x0365, 0x0366, 0x0367,
+	0x0368, 0x0369, 0x036a, 0x036b, 0x036c, 0x036d, 0x036e, 0x036f,
+	0x0370, 0x0371, 0x0372, 0x0373, 0x0374, 0x0375, 0x0376, 0x0377,
+	0x0378, 0x0379, 0x037a, 0x037b, 0x037c, 0x037d, 0x037e, 0x037f,
+	0x0380, 0x0381, 0x0382, 0x0383, 0x0384, 0x0385, 0x0386, 0x0387,
+	0x0388, 0x0389, 0x038a, 0x038b, 0x038c, 0x038d, 0x038e, 0x038f,
+	0x0390, 0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7,
+	0x03b8, 0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf,
+	0x03c0, 0x03c1, 0x03a2, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7,
+	0x03c8, 0x03c9, 0x03aa, 0x03ab, 0x03ac, 0x03ad, 0x03ae, 0x03af,
+	0x03b0, 0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7,
+	0x03b8, 0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf,
+	0x03c0, 0x03c1, 0x03c2, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7,
+	0x03c8, 0x03c9, 0x03ca, 0x03cb, 0x03cc, 0x03cd, 0x03ce, 0x03cf,
+	0x03d0, 0x03d1, 0x03d2, 0x03d3, 0x03d4, 0x03d5, 0x03d6, 0x03d7,
+	0x03d8, 0x03d9, 0x03da, 0x03db, 0x03dc, 0x03dd, 0x03de, 0x03df,
+	0x03e0, 0x03e1, 0x03e3, 0x03e3, 0x03e5, 0x03e5, 0x03e7, 0x03e7,
+	0x03e9, 0x03e9, 0x03eb, 0x03eb, 0x03ed, 0x03ed, 0x03ef, 0x03ef,
+	0x03f0, 0x03f1, 0x03f2, 0x03f3, 0x03f4, 0x03f5, 0x03f6, 0x03f7,
+	0x03f8, 0x03f9, 0x03fa, 0x03fb, 0x03fc, 0x03fd, 0x03fe, 0x03ff,
+
+	/* table 4 (high byte 0x04) */
+	0x0400, 0x0401, 0x0452, 0x0403, 0x0454, 0x0455, 0x0456, 0x0407,
+	0x0458, 0x0459, 0x045a, 0x045b, 0x040c, 0x040d, 0x040e, 0x045f,
+	0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+	0x0438, 0x0419, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e, 0x043f,
+	0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+	0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e, 0x044f,
+	0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+	0x0438, 0x0439, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e, 0x043f,
+	0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+	0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e, 0x044f,
+	0x0450, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+	0x0458, 0x0459, 0x045a, 0x045b, 0x045c, 0x045d, 0x045e, 0x045f,
+	0x0461, 0x0461, 0x0463, 0x0463, 0x0465, 0x0465, 0x0467, 0x0467,
+	0x0469, 0x0469, 0x046b, 0x046b, 0x046d, 0x046d, 0x046f, 0x046f,
+	0x0471, 0x0471, 0x0473, 0x0473, 0x0475, 0x0475, 0x0476, 0x0477,
+	0x0479, 0x0479, 0x047b, 0x047b, 0x047d, 0x047d, 0x047f, 0x047f,
+	0x0481, 0x0481, 0x0482, 0x0483, 0x0484, 0x0485, 0x0486, 0x0487,
+	0x0488, 0x0489, 0x048a, 0x048b, 0x048c, 0x048d, 0x048e, 0x048f,
+	0x0491, 0x0491, 0x0493, 0x0493, 0x0495, 0x0495, 0x0497, 0x0497,
+	0x0499, 0x0499, 0x049b, 0x049b, 0x049d, 0x049d, 0x049f, 0x049f,
+	0x04a1, 0x04a1, 0x04a3, 0x04a3, 0x04a5, 0x04a5, 0x04a7, 0x04a7,
+	0x04a9, 0x04a9, 0x04ab, 0x04ab, 0x04ad, 0x04ad, 0x04af, 0x04af,
+	0x04b1, 0x04b1, 0x04b3, 0x04b3, 0x04b5, 0x04b5, 0x04b7, 0x04b7,
+	0x04b9, 0x04b9, 0x04bb, 0x04bb, 0x04bd, 0x04bd, 0x04bf, 0x04bf,
+	0x04c0, 0x04c1, 0x04c2, 0x04c4, 0x04c4, 0x04c5, 0x04c6, 0x04c8,
+	0x04c8, 0x04c9, 0x04ca, 0x04cc, 0x04cc, 0x04cd, 0x04ce, 0x04cf,
+	0x04d0, 0x04d1, 0x04d2, 0x04d3, 0x04d4, 0x04d5, 0x04d6, 0x04d7,
+	0x04d8, 0x04d9, 0x04da, 0x04db, 0x04dc, 0x04dd, 0x04de, 0x04df,
+	0x04e0, 0x04e1, 0x04e2, 0x04e3, 0x04e4, 0x04e5, 0x04e6, 0x04e7,
+	0x04e8, 0x04e9, 0x04ea, 0x04eb, 0x04ec, 0x04ed, 0x04ee, 0x04ef,
+	0x04f0, 0x04f1, 0x04f2, 0x04f3, 0x04f4, 0x04f5, 0x04f6, 0x04f7,
+	0x04f8, 0x04f9, 0x04fa, 0x04fb, 0x04fc, 0x04fd, 0x04fe, 0x04ff,
+
+	/* table 5 (high byte 0x05) */
+	0x0500, 0x0501, 0x0502, 0x0503, 0x0504, 0x0505, 0x0506, 0x0507,
+	0x0508, 0x0509, 0x050a, 0x050b, 0x050c, 0x050d, 0x050e, 0x050f,
+	0x0510, 0x0511, 0x0512, 0x0513, 0x0514, 0x0515, 0x0516, 0x0517,
+	0x0518, 0x0519, 0x051a, 0x051b, 0x051c, 0x051d, 0x051e, 0x051f,
+	0x0520, 0x0521, 0x0522, 0x0523, 0x0524, 0x0525, 0x0526, 0x0527,
+	0x0528, 0x0529, 0x052a, 0x052b, 0x052c, 0x052d, 0x052e, 0x052f,
+	0x0530, 0x0561, 0x0562, 0x0563, 0x0564, 0x0565, 0x0566, 0x0567,
+	0x0568, 0x0569, 0x056a, 0x056b, 0x056c, 0x056d, 0x056e, 0x056f,
+	0x0570, 0x0571, 0x0572, 0x0573, 0x0574, 0x0575, 0x0576, 0x0577,
+	0x0578, 0x0579, 0x057a, 0x057b, 0x057c, 0x057d, 0x057e, 0x057f,
+	0x0580, 0x0581, 0x0582, 0x0583, 0x0584, 0x0585, 0x0586, 0x0557,
+	0x0558, 0x0559, 0x055a, 0x055b, 0x055c, 0x055d, 0x055e, 0x055f,
+	0x0560, 0x0561, 0x0562, 0x0563, 0x0564, 0x0565, 0x0566, 0x0567,
+	0x0568, 0x0569, 0x056a, 0x056b, 0x056c, 0x056d, 0x056e, 0x056f,
+	0x0570, 0x0571, 0x0572, 0x0573, 0x0574, 0x0575, 0x0576, 0x0577,
+	0x0578, 0x0579, 0x057a, 0x057b, 0x057c, 0x057d, 0x057e, 0x057f,
+	0x0580, 0x0581, 0x0582, 0x0583, 0x0584, 0x0585, 0x0586, 0x0587,
+	0x0588, 0x0589, 0x058a, 0x058b, 0x058c, 0x058d, 0x058e, 0x058f,
+	0x0590, 0x0591, 0x0592, 0x0593, 0x0594, 0x0595, 0x0596, 0x0597,
+	0x0598, 0x0599, 0x059a, 0x059b, 0x059c, 0x059d, 0x059e, 0x059f,
+	0x05a0, 0x05a1, 0x05a2, 0x05a3, 0x05a4, 0x05a5, 0x05a6, 0x05a7,
+	0x05a8, 0x05a9, 0x05aa, 0x05ab, 0x05ac, 0x05ad, 0x05ae, 0x05af,
+	0x05b0, 0x05b1, 0x05b2, 0x05b3, 0x05b4, 0x05b5, 0x05b6, 0x05b7,
+	0x05b8, 0x05b9, 0x05ba, 0x05bb, 0x05bc, 0x05bd, 0x05be, 0x05bf,
+	0x05c0, 0x05c1, 0x05c2, 0x05c3, 0x05c4, 0x05c5, 0x05c6, 0x05c7,
+	0x05c8, 0x05c9, 0x05ca, 0x05cb, 0x05cc, 0x05cd, 0x05ce, 0x05cf,
+	0x05d0, 0x05d1, 0x05d2, 0x05d3, 0x05d4, 0x05d5, 0x05d6, 0x05d7,
+	0x05d8, 0x05d9, 0x05da, 0x05db, 0x05dc, 0x05dd, 0x05de, 0x05df,
+	0x05e0, 0x05e1, 0x05e2, 0x05e3, 0x05e4, 0x05e5, 0x05e6, 0x05e7,
+	0x05e8, 0x05e9, 0x05ea, 0x05eb, 0x05ec, 0x05ed, 0x05ee, 0x05ef,
+	0x05f0, 0x05f1, 0x05f2, 0x05f3, 0x05f4, 0x05f5, 0x05f6, 0x05f7,
+	0x05f8, 0x05f9, 0x05fa, 0x05fb, 0x05fc, 0x05fd, 0x05fe, 0x05ff,
+
+	/* table 6 (high byte 0x10) */
+	0x1000, 0x1001, 0x1002, 0x1003, 0x1004, 0x1005, 0x1006, 0x1007,
+	0x1008, 0x1009, 0x100a, 0x100b, 0x100c, 0x100d, 0x100e, 0x100f,
+	0x1010, 0x1011, 0x1012, 0x1013, 0x1014, 0x1015, 0x1016, 0x1017,
+	0x1018, 0x1019, 0x101a, 0x101b, 0x101c, 0x101d, 0x101e, 0x101f,
+	0x1020, 0x1021, 0x1022, 0x1023, 0x1024, 0x1025, 0x1026, 0x1027,
+	0x1028, 0x1029, 0x102a, 0x102b, 0x102c, 0x102d, 0x102e, 0x102f,
+	0x1030, 0x1031, 0x1032, 0x1033, 0x1034, 0x1035, 0x1036, 0x1037,
+	0x1038, 0x1039, 0x103a, 0x103b, 0x103c, 0x103d, 0x103e, 0x103f,
+	0x1040, 0x1041, 0x1042, 0x1043, 0x1044, 0x1045, 0x1046, 0x1047,
+	0x1048, 0x1049, 0x104a, 0x104b, 0x104c, 0x104d, 0x104e, 0x104f,
+	0x1050, 0x1051, 0x1052, 0x1053, 0x1054, 0x1055, 0x1056, 0x1057,
+	0x1058, 0x1059, 0x105a, 0x105b, 0x105c, 0x105d, 0x105e, 0x105f,
+	0x1060, 0x1061, 0x1062, 0x1063, 0x1064, 0x1065, 0x1066, 0x1067,
+	0x1068, 0x1069, 0x106a, 0x106b, 0x106c, 0x106d, 0x106e, 0x106f,
+	0x1070, 0x1071, 0x1072, 0x1073, 0x1074, 0x1075, 0x1076, 0x1077,
+	0x1078, 0x1079, 0x107a, 0x107b, 0x107c, 0x107d, 0x107e, 0x107f,
+	0x1080, 0x1081, 0x1082, 0x1083, 0x1084, 0x1085, 0x1086, 0x1087,
+	0x1088, 0x1089, 0x108a, 0x108b, 0x108c, 0x108d, 0x108e, 0x108f,
+	0x1090, 0x1091, 0x1092, 0x1093, 0x1094, 0x1095, 0x1096, 0x1097,
+	0x1098, 0x1099, 0x109a, 0x109b, 0x109c, 0x109d, 0x109e, 0x109f,
+	0x10d0, 0x10d1, 0x10d2, 0x10d3, 0x10d4, 0x10d5, 0x10d6, 0x10d7,
+	0x10d8, 0x10d9, 0x10da, 0x10db, 0x10dc, 0x10dd, 0x10de, 0x10df,
+	0x10e0, 0x10e1, 0x10e2, 0x10e3, 0x10e4, 0x10e5, 0x10e6, 0x10e7,
+	0x10e8, 0x10e9, 0x10ea, 0x10eb, 0x10ec, 0x10ed, 0x10ee, 0x10ef,
+	0x10f0, 0x10f1, 0x10f2, 0x10f3, 0x10f4, 0x10f5, 0x10c6, 0x10c7,
+	0x10c8, 0x10c9, 0x10ca, 0x10cb, 0x10cc, 0x10cd, 0x10ce, 0x10cf,
+	0x10d0, 0x10d1, 0x10d2, 0x10d3, 0x10d4, 0x10d5, 0x10d6, 0x10d7,
+	0x10d8, 0x10d9, 0x10da, 0x10db, 0x10dc, 0x10dd, 0x10de, 0x10df,
+	0x10e0, 0x10e1, 0x10e2, 0x10e3, 0x10e4, 0x10e5, 0x10e6, 0x10e7,
+	0x10e8, 0x10e9, 0x10ea, 0x10eb, 0x10ec, 0x10ed, 0x10ee, 0x10ef,
+	0x10f0, 0x10f1, 0x10f2, 0x10f3, 0x10f4, 0x10f5, 0x10f6, 0x10f7,
+	0x10f8, 0x10f9, 0x10fa, 0x10fb, 0x10fc, 0x10fd, 0x10fe, 0x10ff,
+
+	/* table 7 (high byte 0x20) */
+	0x2000, 0x2001, 0x2002, 0x2003, 0x2004, 0x2005, 0x2006, 0x2007,
+	0x2008, 0x2009, 0x200a, 0x200b, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x2010, 0x2011, 0x2012, 0x2013, 0x2014, 0x2015, 0x2016, 0x2017,
+	0x2018, 0x2019, 0x201a, 0x201b, 0x201c, 0x201d, 0x201e, 0x201f,
+	0x2020, 0x2021, 0x2022, 0x2023, 0x2024, 0x2025, 0x2026, 0x2027,
+	0x2028, 0x2029, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x202f,
+	0x2030, 0x2031, 0x2032, 0x2033, 0x2034, 0x2035, 0x2036, 0x2037,
+	0x2038, 0x2039, 0x203a, 0x203b, 0x203c, 0x203d, 0x203e, 0x203f,
+	0x2040, 0x2041, 0x2042, 0x2043, 0x2044, 0x2045, 0x2046, 0x2047,
+	0x2048, 0x2049, 0x204a, 0x204b, 0x204c, 0x204d, 0x204e, 0x204f,
+	0x2050, 0x2051, 0x2052, 0x2053, 0x2054, 0x2055, 0x2056, 0x2057,
+	0x2058, 0x2059, 0x205a, 0x205b, 0x205c, 0x205d, 0x205e, 0x205f,
+	0x2060, 0x2061, 0x2062, 0x2063, 0x2064, 0x2065, 0x2066, 0x2067,
+	0x2068, 0x2069, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x2070, 0x2071, 0x2072, 0x2073, 0x2074, 0x2075, 0x2076, 0x2077,
+	0x2078, 0x2079, 0x207a, 0x207b, 0x207c, 0x207d, 0x207e, 0x207f,
+	0x2080, 0x2081, 0x2082, 0x2083, 0x2084, 0x2085, 0x2086, 0x2087,
+	0x2088, 0x2089, 0x208a, 0x208b, 0x208c, 0x208d, 0x208e, 0x208f,
+	0x2090, 0x2091, 0x2092, 0x2093, 0x2094, 0x2095, 0x2096, 0x2097,
+	0x2098, 0x2099, 0x209a, 0x209b, 0x209c, 0x209d, 0x209e, 0x209f,
+	0x20a0, 0x20a1, 0x20a2, 0x20a3, 0x20a4, 0x20a5, 0x20a6, 0x20a7,
+	0x20a8, 0x20a9, 0x20aa, 0x20ab, 0x20ac, 0x20ad, 0x20ae, 0x20af,
+	0x20b0, 0x20b1, 0x20b2, 0x20b3, 0x20b4, 0x20b5, 0x20b6, 0x20b7,
+	0x20b8, 0x20b9, 0x20ba, 0x20bb, 0x20bc, 0x20bd, 0x20be, 0x20bf,
+	0x20c0, 0x20c1, 0x20c2, 0x20c3, 0x20c4, 0x20c5, 0x20c6, 0x20c7,
+	0x20c8, 0x20c9, 0x20ca, 0x20cb, 0x20cc, 0x20cd, 0x20ce, 0x20cf,
+	0x20d0, 0x20d1, 0x20d2, 0x20d3, 0x20d4, 0x20d5, 0x20d6, 0x20d7,
+	0x20d8, 0x20d9, 0x20da, 0x20db, 0x20dc, 0x20dd, 0x20de, 0x20df,
+	0x20e0, 0x20e1, 0x20e2, 0x20e3, 0x20e4, 0x20e5, 0x20e6, 0x20e7,
+	0x20e8, 0x20e9, 0x20ea, 0x20eb, 0x20ec, 0x20ed, 0x20ee, 0x20ef,
+	0x20f0, 0x20f1, 0x20f2, 0x20f3, 0x20f4, 0x20f5, 0x20f6, 0x20f7,
+	0x20f8, 0x20f9, 0x20fa, 0x20fb, 0x20fc, 0x20fd, 0x20fe, 0x20ff,
+
+	/* table 8 (high byte 0x21) */
+	0x2100, 0x2101, 0x2102, 0x2103, 0x2104, 0x2105, 0x2106, 0x2107,
+	0x2108, 0x2109, 0x210a, 0x210b, 0x210c, 0x210d, 0x210e, 0x210f,
+	0x2110, 0x2111, 0x2112, 0x2113, 0x2114, 0x2115, 0x2116, 0x2117,
+	0x2118, 0x2119, 0x211a, 0x211b, 0x211c, 0x211d, 0x211e, 0x211f,
+	0x2120, 0x2121, 0x2122, 0x2123, 0x2124, 0x2125, 0x2126, 0x2127,
+	0x2128, 0x2129, 0x212a, 0x212b, 0x212c, 0x212d, 0x212e, 0x212f,
+	0x2130, 0x2131, 0x2132, 0x2133, 0x2134, 0x2135, 0x2136, 0x2137,
+	0x2138, 0x2139, 0x213a, 0x213b, 0x213c, 0x213d, 0x213e, 0x213f,
+	0x2140, 0x2141, 0x2142, 0x2143, 0x2144, 0x2145, 0x2146, 0x2147,
+	0x2148, 0x2149, 0x214a, 0x214b, 0x214c, 0x214d, 0x214e, 0x214f,
+	0x2150, 0x2151, 0x2152, 0x2153, 0x2154, 0x2155, 0x2156, 0x2157,
+	0x2158, 0x2159, 0x215a, 0x215b, 0x215c, 0x215d, 0x215e, 0x215f,
+	0x2170, 0x2171, 0x2172, 0x2173, 0x2174, 0x2175, 0x2176, 0x2177,
+	0x2178, 0x2179, 0x217a, 0x217b, 0x217c, 0x217d, 0x217e, 0x217f,
+	0x2170, 0x2171, 0x2172, 0x2173, 0x2174, 0x2175, 0x2176, 0x2177,
+	0x2178, 0x2179, 0x217a, 0x217b, 0x217c, 0x217d, 0x217e, 0x217f,
+	0x2180, 0x2181, 0x2182, 0x2183, 0x2184, 0x2185, 0x2186, 0x2187,
+	0x2188, 0x2189, 0x218a, 0x218b, 0x218c, 0x218d, 0x218e, 0x218f,
+	0x2190, 0x2191, 0x2192, 0x2193, 0x2194, 0x2195, 0x2196, 0x2197,
+	0x2198, 0x2199, 0x219a, 0x219b, 0x219c, 0x219d, 0x219e, 0x219f,
+	0x21a0, 0x21a1, 0x21a2, 0x21a3, 0x21a4, 0x21a5, 0x21a6, 0x21a7,
+	0x21a8, 0x21a9, 0x21aa, 0x21ab, 0x21ac, 0x21ad, 0x21ae, 0x21af,
+	0x21b0, 0x21b1, 0x21b2, 0x21b3, 0x21b4, 0x21b5, 0x21b6, 0x21b7,
+	0x21b8, 0x21b9, 0x21ba, 0x21bb, 0x21bc, 0x21bd, 0x21be, 0x21bf,
+	0x21c0, 0x21c1, 0x21c2, 0x21c3, 0x21c4, 0x21c5, 0x21c6, 0x21c7,
+	0x21c8, 0x21c9, 0x21ca, 0x21cb, 0x21cc, 0x21cd, 0x21ce, 0x21cf,
+	0x21d0, 0x21d1, 0x21d2, 0x21d3, 0x21d4, 0x21d5, 0x21d6, 0x21d7,
+	0x21d8, 0x21d9, 0x21da, 0x21db, 0x21dc, 0x21dd, 0x21de, 0x21df,
+	0x21e0, 0x21e1, 0x21e2, 0x21e3, 0x21e4, 0x21e5, 0x21e6, 0x21e7,
+	0x21e8, 0x21e9, 0x21ea, 0x21eb, 0x21ec, 0x21ed, 0x21ee, 0x21ef,
+	0x21f0, 0x21f1, 0x21f2, 0x21f3, 0x21f4, 0x21f5, 0x21f6, 0x21f7,
+	0x21f8, 0x21f9, 0x21fa, 0x21fb, 0x21fc, 0x21fd, 0x21fe, 0x21ff,
+
+	/* table 9 (high byte 0xFE) */
+	0xfe00, 0xfe01, 0xfe02, 0xfe03, 0xfe04, 0xfe05, 0xfe06, 0xfe07,
+	0xfe08, 0xfe09, 0xfe0a, 0xfe0b, 0xfe0c, 0xfe0d, 0xfe0e, 0xfe0f,
+	0xfe10, 0xfe11, 0xfe12, 0xfe13, 0xfe14, 0xfe15, 0xfe16, 0xfe17,
+	0xfe18, 0xfe19, 0xfe1a, 0xfe1b, 0xfe1c, 0xfe1d, 0xfe1e, 0xfe1f,
+	0xfe20, 0xfe21, 0xfe22, 0xfe23, 0xfe24, 0xfe25, 0xfe26, 0xfe27,
+	0xfe28, 0xfe29, 0xfe2a, 0xfe2b, 0xfe2c, 0xfe2d, 0xfe2e, 0xfe2f,
+	0xfe30, 0xfe31, 0xfe32, 0xfe33, 0xfe34, 0xfe35, 0xfe36, 0xfe37,
+	0xfe38, 0xfe39, 0xfe3a, 0xfe3b, 0xfe3c, 0xfe3d, 0xfe3e, 0xfe3f,
+	0xfe40, 0xfe41, 0xfe42, 0xfe43, 0xfe44, 0xfe45, 0xfe46, 0xfe47,
+	0xfe48, 0xfe49, 0xfe4a, 0xfe4b, 0xfe4c, 0xfe4d, 0xfe4e, 0xfe4f,
+	0xfe50, 0xfe51, 0xfe52, 0xfe53, 0xfe54, 0xfe55, 0xfe56, 0xfe57,
+	0xfe58, 0xfe59, 0xfe5a, 0xfe5b, 0xfe5c, 0xfe5d, 0xfe5e, 0xfe5f,
+	0xfe60, 0xfe61, 0xfe62, 0xfe63, 0xfe64, 0xfe65, 0xfe66, 0xfe67,
+	0xfe68, 0xfe69, 0xfe6a, 0xfe6b, 0xfe6c, 0xfe6d, 0xfe6e, 0xfe6f,
+	0xfe70, 0xfe71, 0xfe72, 0xfe73, 0xfe74, 0xfe75, 0xfe76, 0xfe77,
+	0xfe78, 0xfe79, 0xfe7a, 0xfe7b, 0xfe7c, 0xfe7d, 0xfe7e, 0xfe7f,
+	0xfe80, 0xfe81, 0xfe82, 0xfe83, 0xfe84, 0xfe85, 0xfe86, 0xfe87,
+	0xfe88, 0xfe89, 0xfe8a, 0xfe8b, 0xfe8c, 0xfe8d, 0xfe8e, 0xfe8f,
+	0xfe90, 0xfe91, 0xfe92, 0xfe93, 0xfe94, 0xfe95, 0xfe96, 0xfe97,
+	0xfe98, 0xfe99, 0xfe9a, 0xfe9b, 0xfe9c, 0xfe9d, 0xfe9e, 0xfe9f,
+	0xfea0, 0xfea1, 0xfea2, 0xfea3, 0xfea4, 0xfea5, 0xfea6, 0xfea7,
+	0xfea8, 0xfea9, 0xfeaa, 0xfeab, 0xfeac, 0xfead, 0xfeae, 0xfeaf,
+	0xfeb0, 0xfeb1, 0xfeb2, 0xfeb3, 0xfeb4, 0xfeb5, 0xfeb6, 0xfeb7,
+	0xfeb8, 0xfeb9, 0xfeba, 0xfebb, 0xfebc, 0xfebd, 0xfebe, 0xfebf,
+	0xfec0, 0xfec1, 0xfec2, 0xfec3, 0xfec4, 0xfec5, 0xfec6, 0xfec7,
+	0xfec8, 0xfec9, 0xfeca, 0xfecb, 0xfecc, 0xfecd, 0xfece, 0xfecf,
+	0xfed0, 0xfed1, 0xfed2, 0xfed3, 0xfed4, 0xfed5, 0xfed6, 0xfed7,
+	0xfed8, 0xfed9, 0xfeda, 0xfedb, 0xfedc, 0xfedd, 0xfede, 0xfedf,
+	0xfee0, 0xfee1, 0xfee2, 0xfee3, 0xfee4, 0xfee5, 0xfee6, 0xfee7,
+	0xfee8, 0xfee9, 0xfeea, 0xfeeb, 0xfeec, 0xfeed, 0xfeee, 0xfeef,
+	0xfef0, 0xfef1, 0xfef2, 0xfef3, 0xfef4, 0xfef5, 0xfef6, 0xfef7,
+	0xfef8, 0xfef9, 0xfefa, 0xfefb, 0xfefc, 0xfefd, 0xfefe, 0x0000,
+
+	/* table 10 (high byte 0xFF) */
+	0xff00, 0xff01, 0xff02, 0xff03, 0xff04, 0xff05, 0xff06, 0xff07,
+	0xff08, 0xff09, 0xff0a, 0xff0b, 0xff0c, 0xff0d, 0xff0e, 0xff0f,
+	0xff10, 0xff11, 0xff12, 0xff13, 0xff14, 0xff15, 0xff16, 0xff17,
+	0xff18, 0xff19, 0xff1a, 0xff1b, 0xff1c, 0xff1d, 0xff1e, 0xff1f,
+	0xff20, 0xff41, 0xff42, 0xff43, 0xff44, 0xff45, 0xff46, 0xff47,
+	0xff48, 0xff49, 0xff4a, 0xff4b, 0xff4c, 0xff4d, 0xff4e, 0xff4f,
+	0xff50, 0xff51, 0xff52, 0xff53, 0xff54, 0xff55, 0xff56, 0xff57,
+	0xff58, 0xff59, 0xff5a, 0xff3b, 0xff3c, 0xff3d, 0xff3e, 0xff3f,
+	0xff40, 0xff41, 0xff42, 0xff43, 0xff44, 0xff45, 0xff46, 0xff47,
+	0xff48, 0xff49, 0xff4a, 0xff4b, 0xff4c, 0xff4d, 0xff4e, 0xff4f,
+	0xff50, 0xff51, 0xff52, 0xff53, 0xff54, 0xff55, 0xff56, 0xff57,
+	0xff58, 0xff59, 0xff5a, 0xff5b, 0xff5c, 0xff5d, 0xff5e, 0xff5f,
+	0xff60, 0xff61, 0xff62, 0xff63, 0xff64, 0xff65, 0xff66, 0xff67,
+	0xff68, 0xff69, 0xff6a, 0xff6b, 0xff6c, 0xff6d, 0xff6e, 0xff6f,
+	0xff70, 0xff71, 0xff72, 0xff73, 0xff74, 0xff75, 0xff76, 0xff77,
+	0xff78, 0xff79, 0xff7a, 0xff7b, 0xff7c, 0xff7d, 0xff7e, 0xff7f,
+	0xff80, 0xff81, 0xff82, 0xff83, 0xff84, 0xff85, 0xff86, 0xff87,
+	0xff88, 0xff89, 0xff8a, 0xff8b, 0xff8c, 0xff8d, 0xff8e, 0xff8f,
+	0xff90, 0xff91, 0xff92, 0xff93, 0xff94, 0xff95, 0xff96, 0xff97,
+	0xff98, 0xff99, 0xff9a, 0xff9b, 0xff9c, 0xff9d, 0xff9e, 0xff9f,
+	0xffa0, 0xffa1, 0xffa2, 0xffa3, 0xffa4, 0xffa5, 0xffa6, 0xffa7,
+	0xffa8, 0xffa9, 0xffaa, 0xffab, 0xffac, 0xffad, 0xffae, 0xffaf,
+	0xffb0, 0xffb1, 0xffb2, 0xffb3, 0xffb4, 0xffb5, 0xffb6, 0xffb7,
+	0xffb8, 0xffb9, 0xffba, 0xffbb, 0xffbc, 0xffbd, 0xffbe, 0xffbf,
+	0xffc0, 0xffc1, 0xffc2, 0xffc3, 0xffc4, 0xffc5, 0xffc6, 0xffc7,
+	0xffc8, 0xffc9, 0xffca, 0xffcb, 0xffcc, 0xffcd, 0xffce, 0xffcf,
+	0xffd0, 0xffd1, 0xffd2, 0xffd3, 0xffd4, 0xffd5, 0xffd6, 0xffd7,
+	0xffd8, 0xffd9, 0xffda, 0xffdb, 0xffdc, 0xffdd, 0xffde, 0xffdf,
+	0xffe0, 0xffe1, 0xffe2, 0xffe3, 0xffe4, 0xffe5, 0xffe6, 0xffe7,
+	0xffe8, 0xffe9, 0xffea, 0xffeb, 0xffec, 0xffed, 0xffee, 0xffef,
+	0xfff0, 0xfff1, 0xfff2, 0xfff3, 0xfff4, 0xfff5, 0xfff6, 0xfff7,
+	0xfff8, 0xfff9, 0xfffa, 0xfffb, 0xfffc, 0xfffd, 0xfffe, 0xffff,
+};
+
+/*
+ * The folding table is built in; this remains so callers that still create it
+ * before use keep working.
+ */
 int
 hfslib_create_casefolding_table(void)
 {
-	hfs_callback_args	cbargs;
-	unichar_t*	t; /* convenience */
-	uint16_t	s; /* current subtable * 256 */
-	uint16_t	i; /* current subtable index (0 to 255) */
-	
-	if(hfs_gcft!=NULL)
-		return 0; /* no sweat, table already exists */
-	
-	hfslib_init_cbargs(&cbargs);
-	hfs_gcft = hfslib_malloc(5632, &cbargs);
-	if(hfs_gcft==NULL)
-		HFS_LIBERR("could not allocate case folding table");
-	
-	t = hfs_gcft;	 /* easier to type :) */
-	
-	/*
-	 * high byte indices
-	 */
-	s = 0 * 256;
-	memset(t, 0x00, 512);
-	t[s+  0] = 0x0100;
-	t[s+  1] = 0x0200;
-	t[s+  3] = 0x0300;
-	t[s+  4] = 0x0400;
-	t[s+  5] = 0x0500;
-	t[s+ 16] = 0x0600;
-	t[s+ 32] = 0x0700;
-	t[s+ 33] = 0x0800;
-	t[s+254] = 0x0900;
-	t[s+255] = 0x0a00;
-	
-	/*
-	 * table 1 (high byte 0x00)
-	 */
-	s = 1 * 256;
-	for(i=0; i<65; i++)
-		t[s+i] = i;
-	t[s+  0] = 0xffff;
-	for(i=65; i<91; i++)
-		t[s+i] = i + 0x20;
-	for(i=91; i<256; i++)
-		t[s+i] = i;
-	t[s+198] = 0x00e6;
-	t[s+208] = 0x00f0;
-	t[s+216] = 0x00f8;
-	t[s+222] = 0x00fe;
-
-	/*
-	 * table 2 (high byte 0x01)
-	 */
-	s = 2 * 256;
-	for(i=0; i<256; i++)
-		t[s+i] = i + 0x0100;
-	t[s+ 16] = 0x0111;
-	t[s+ 38] = 0x0127;
-	t[s+ 50] = 0x0133;
-	t[s+ 63] = 0x0140;
-	t[s+ 65] = 0x0142;
-	t[s+ 74] = 0x014b;
-	t[s+ 82] = 0x0153;
-	t[s+102] = 0x0167;
-	t[s+129] = 0x0253;
-	t[s+130] = 0x0183;
-	t[s+132] = 0x0185;
-	t[s+134] = 0x0254;
-	t[s+135] = 0x0188;
-	t[s+137] = 0x0256;
-	t[s+138] = 0x0257;
-	t[s+139] = 0x018c;
-	t[s+142] = 0x01dd;
-	t[s+143] = 0x0259;
-	t[s+144] = 0x025b;
-	t[s+145] = 0x0192;
-	t[s+147] = 0x0260;
-	t[s+148] = 0x0263;
-	t[s+150] = 0x0269;
-	t[s+151] = 0x0268;
-	t[s+152] = 0x0199;
-	t[s+156] = 0x026f;
-	t[s+157] = 0x0272;
-	t[s+159] = 0x0275;
-	t[s+162] = 0x01a3;
-	t[s+164] = 0x01a5;
-	t[s+167] = 0x01a8;
-	t[s+169] = 0x0283;
-	t[s+172] = 0x01ad;
-	t[s+174] = 0x0288;
-	t[s+177] = 0x028a;
-	t[s+178] = 0x028b;
-	t[s+179] = 0x01b4;
-	t[s+181] = 0x01b6;
-	t[s+183] = 0x0292;
-	t[s+184] = 0x01b9;
-	t[s+188] = 0x01bd;
-	t[s+196] = 0x01c6;
-	t[s+197] = 0x01c6;
-	t[s+199] = 0x01c9;
-	t[s+200] = 0x01c9;
-	t[s+202] = 0x01cc;
-	t[s+203] = 0x01cc;
-	t[s+228] = 0x01e5;
-	t[s+241] = 0x01f3;
-	t[s+242] = 0x01f3;
-
-	/*
-	 * table 3 (high byte 0x03)
-	 */
-	s = 3 * 256;
-	for(i=0; i<145; i++)
-		t[s+i] = i + 0x0300;
-	for(i=145; i<170; i++)
-		t[s+i] = i + 0x0320;
-	t[s+162] = 0x03a2;
-	for(i=170; i<256; i++)
-		t[s+i] = i + 0x0300;
-
-	for(i=226; i<239; i+=2)
-		t[s+i] = i + 0x0301;
-
-	/*
-	 * table 4 (high byte 0x04)
-	 */
-	s = 4 * 256;
-	for(i=0; i<16; i++)
-		t[s+i] = i + 0x0400;
-	t[s+  2] = 0x0452;
-	t[s+  4] = 0x0454;
-	t[s+  5] = 0x0455;
-	t[s+  6] = 0x0456;
-	t[s+  8] = 0x0458;
-	t[s+  9] = 0x0459;
-	t[s+ 10] = 0x045a;
-	t[s+ 11] = 0x045b;
-	t[s+ 15] = 0x045f;
-
-	for(i=16; i<48; i++)
-		t[s+i] = i + 0x0420;
-	t[s+ 25] = 0x0419;
-	for(i=48; i<256; i++)
-		t[s+i] = i + 0x0400;
-	t[s+195] = 0x04c4;
-	t[s+199] = 0x04c8;
-	t[s+203] = 0x04cc;
-
-	for(i=96; i<129; i+=2)
-		t[s+i] = i + 0x0401;
-	t[s+118] = 0x0476;
-	for(i=144; i<191; i+=2)
-		t[s+i] = i + 0x0401;
-
-	/*
-	 * table 5 (high byte 0x05)
-	 */
-	s = 5 * 256;
-	for(i=0; i<49; i++)
-		t[s+i] = i + 0x0500;
-	for(i=49; i<87; i++)
-		t[s+i] = i + 0x0530;
-	for(i=87; i<256; i++)
-		t[s+i] = i + 0x0500;
-	
-	/*
-	 * table 6 (high byte 0x10)
-	 */
-	s = 6 * 256;
-	for(i=0; i<160; i++)
-		t[s+i] = i + 0x1000;
-	for(i=160; i<198; i++)
-		t[s+i] = i + 0x1030;
-	for(i=198; i<256; i++)
-		t[s+i] = i + 0x1000;
-	
-	/*
-	 * table 7 (high byte 0x20)
-	 */
-	s = 7 * 256;
-	for(i=0; i<256; i++)
-		t[s+i] = i + 0x2000;
-	{
-		uint8_t zi[15] = { 12,  13,  14,  15,
-						   42,  43,  44,  45,  46,
-						  106, 107, 108, 109, 110, 111};
-
-		for(i=0; i<15; i++)
-			t[s+zi[i]] = 0x0000;
-	}
-
-	/*
-	 * table 8 (high byte 0x21)
-	 */
-	s = 8 * 256;
-	for(i=0; i<96; i++)
-		t[s+i] = i + 0x2100;
-	for(i=96; i<112; i++)
-		t[s+i] = i + 0x2110;
-	for(i=112; i<256; i++)
-		t[s+i] = i + 0x2100;
-
-	/*
-	 * table 9 (high byte 0xFE)
-	 */
-	s = 9 * 256;
-	for(i=0; i<256; i++)
-		t[s+i] = i + 0xFE00;
-	t[s+255] = 0x0000;
-
-	/*
-	 * table 10 (high byte 0xFF)
-	 */
-	s = 10 * 256;
-	for(i=0; i<33; i++)
-		t[s+i] = i + 0xFF00;
-	for(i=33; i<59; i++)
-		t[s+i] = i + 0xFF20;
-	for(i=59; i<256; i++)
-		t[s+i] = i + 0xFF00;
-	
 	return 0;
-	
-error:
-	return 1;
 }
 
 int
@@ -184,6 +184,9 @@ enum {
 /* number of bytes between start of volume and volume header */
 #define HFS_VOLUME_HEAD_RESERVE_SIZE	1024
 
+/* largest single device read issued while an interrupted() callback is set */
+#define HFS_READ_CHUNK_SIZE	(1024*1024)
+
 typedef enum
 {
 	HFS_CATALOG_FILE = 1,
@@ -563,6 +566,14 @@ typedef struct
 	void*	read;
 } hfs_callback_args;
 
+/* one of a batch of reads passed to the readv() callback */
+typedef struct
+{
+	void*		buffer;
+	uint64_t	length;
+	uint64_t	offset;
+} hfs_read_request_t;
+
 typedef struct
 {
 	/* error(in_format, in_file, in_line, in_args) */
@@ -588,16 +599,159 @@ typedef struct
 	 * returns 0 on success */
 	int (*read) (hfs_volume*, void*, uint64_t, uint64_t,
 		hfs_callback_args*);
+
+	/* getnode(in_volume, in_btree, in_nodenum, out_buffer, cbargs)
+	 * optional; returns 0 if the node was found in an application cache */
+	int (*getnode) (hfs_volume*, hfs_btree_file_type, uint32_t, void*,
+		hfs_callback_args*);
+
+	/* putnode(in_volume, in_btree, in_nodenum, in_buffer, cbargs)
+	 * optional; offers a node just read from the volume to the application */
+	void (*putnode) (hfs_volume*, hfs_btree_file_type, uint32_t, const void*,
+		hfs_callback_args*);
+
+	/* readv(in_volume, in_requests, in_count, cbargs)
+	 * optional; performs several independent reads, which may complete in
+	 * any order. returns 0 if all of them succeeded */
+	int (*readv) (hfs_volume*, const hfs_read_request_t*, uint16_t,
+		hfs_callback_args*);
+
+	/* interrupted(cbargs)
+	 * optional; nonzero abandons the current operation at its next node read
+	 * or read chunk, which then fails */
+	int (*interrupted) (hfs_callback_args*);
 		
 } hfs_callbacks;
 
-extern hfs_callbacks	hfs_gcb;	/* global callbacks */
+/*
+ * hfslib_walk_catalog() callback, given each leaf record's key and record and
+ * the caller's cookie. A nonzero return stops the walk.
+ */
+typedef int (*hfs_catalog_walk_func) (hfs_volume*, hfs_catalog_key_t*,
+	hfs_catalog_keyed_record_t*, void*);
+
+/*
+ * Catalog record fields that hfslib_walk_catalog() can filter on directly from
+ * the on-disk record, before anything is decoded.
+ */
+typedef enum
+{
+	HFS_CATFIELD_PARENT_CNID,		/* from the key */
+	HFS_CATFIELD_REC_TYPE,
+	HFS_CATFIELD_FLAGS,				/* files and folders only */
+	HFS_CATFIELD_CNID,
+	HFS_CATFIELD_DATE_CREATED,
+	HFS_CATFIELD_DATE_CONTENT_MOD,
+	HFS_CATFIELD_DATE_ATTRIB_MOD,
+	HFS_CATFIELD_DATE_ACCESSED,
+	HFS_CATFIELD_DATE_BACKEDUP,
+	HFS_CATFIELD_OWNER_ID,
+	HFS_CATFIELD_GROUP_ID,
+	HFS_CATFIELD_FILE_MODE,			/* ...through here */
+	HFS_CATFIELD_FILE_TYPE,			/* files only */
+	HFS_CATFIELD_FILE_CREATOR,
+	HFS_CATFIELD_DATA_SIZE,
+	HFS_CATFIELD_RSRC_SIZE
+} hfs_catalog_field;
+
+typedef enum
+{
+	HFS_CMP_EQ,
+	HFS_CMP_NE,
+	HFS_CMP_LT,
+	HFS_CMP_LE,
+	HFS_CMP_GT,
+	HFS_CMP_GE,
+	HFS_CMP_ALLSET	/* all bits of the value are set in the field */
+} hfs_compare_op;
+
+typedef struct
+{
+	hfs_catalog_field	field;
+	hfs_compare_op		op;
+	uint64_t			value;
+} hfs_catalog_condition_t;
 
 /*
- * global case folding table
- * (lazily initialized; see comments at bottom of hfs_open_volume())
+ * A conjunction of conditions, compiled by hfslib_compile_catalog_predicate()
+ * into byte offsets and widths within the raw record. A record lacking one of
+ * the fields (e.g. a folder tested on its data size) does not match.
  */
-extern unichar_t* hfs_gcft;
+typedef struct
+{
+	uint16_t	offset;		/* into the record data, after the key */
+	uint8_t		width;		/* in bytes */
+	uint8_t		rectypes;	/* bit (1 << type) set for types having the field */
+	uint8_t		inkey;		/* read from the key instead */
+	hfs_compare_op	op;
+	uint64_t	value;
+} hfs_catalog_compiled_condition_t;
+
+typedef struct
+{
+	uint16_t	num_conds;
+	hfs_catalog_compiled_condition_t*	conds;
+} hfs_catalog_predicate_t;
+
+/*
+ * Resumable lookups. Rather than reading b-tree nodes itself, a lookup started
+ * by one of the hfslib_async_*() functions stops in HFS_ASYNC_NEED_NODE naming
+ * the node it needs next. The caller reads that node into the lookup's buffer
+ * however it likes and continues with hfslib_async_resume(), so that many
+ * lookups can be kept in flight without a thread each.
+ */
+typedef enum
+{
+	HFS_ASYNC_FIND_RECORD,		/* catalog record with key */
+	HFS_ASYNC_FIND_CNID,		/* catalog record and key of cnid */
+	HFS_ASYNC_FILE_EXTENTS,		/* every extent of cnid's fork */
+	HFS_ASYNC_DIRECTORY_CONTENTS	/* children of folder cnid */
+} hfs_async_op;
+
+typedef enum
+{
+	HFS_ASYNC_NEED_NODE,	/* read node of btree into buffer, then resume */
+	HFS_ASYNC_DONE,
+	HFS_ASYNC_NOT_FOUND,
+	HFS_ASYNC_ERROR
+} hfs_async_status;
+
+typedef struct
+{
+	hfs_async_op		op;
+	hfs_async_status	status;
+
+	/* the node wanted next */
+	hfs_btree_file_type	btree;
+	uint32_t			node;
+	void*				buffer;	/* large enough for either tree's nodes */
+
+	/* arguments and results */
+	hfs_cnid_t					cnid;
+	uint8_t						fork;
+	hfs_catalog_key_t			key;
+	hfs_catalog_keyed_record_t	rec;
+	hfs_extent_descriptor_t*	extents;
+	uint16_t					num_extents;
+	hfs_catalog_keyed_record_t*	children;
+	hfs_unistr255_t*			childnames;
+	uint32_t					num_children;
+
+	/* private */
+	int					step;
+	hfs_extent_key_t	extkey;
+	hfs_fork_t			forkdata;
+	uint32_t			numblocks;
+} hfs_async_lookup_t;
+
+extern hfs_callbacks	hfs_gcb;	/* global callbacks */
+
+/* global case folding table (see TN1150) */
+extern const unichar_t hfs_gcft[];
+
+/* keys of the private folders holding hard link targets (iNode%d and dir_%d) */
+extern hfs_catalog_key_t hfs_gMetadataDirectoryKey;
+extern hfs_catalog_key_t hfs_gDirMetadataDirectoryKey;
 
 #if 0
 #pragma mark -
@@ -611,7 +765,10 @@ hfs_callbacks* hfslib_callbacks(void);
 
 int hfslib_open_volume(const char*, int, hfs_volume*,
 	hfs_callback_args*);
+int hfslib_reload_volume(hfs_volume*, hfs_callback_args*);
 void hfslib_close_volume(hfs_volume*, hfs_callback_args*);
+int hfslib_fork_offset(const hfs_fork_t*, uint32_t, uint64_t, uint64_t,
+	uint64_t*);
 
 int hfslib_path_to_cnid(hfs_volume*, hfs_cnid_t, char**, uint16_t*,
 	hfs_callback_args*);
@@ -626,6 +783,29 @@ int hfslib_find_extent_record_with_key(hfs_volume*, hfs_extent_key_t*,
 int hfslib_get_directory_contents(hfs_volume*, hfs_cnid_t,
 	hfs_catalog_keyed_record_t**, hfs_unistr255_t**, uint32_t*,
 	hfs_callback_args*);
+int hfslib_walk_catalog(hfs_volume*, const hfs_catalog_predicate_t*,
+	hfs_catalog_walk_func, void*, hfs_callback_args*);
+int hfslib_walk_catalog_range(hfs_volume*, const hfs_catalog_predicate_t*,
+	uint32_t, uint32_t, hfs_catalog_walk_func, void*, hfs_callback_args*);
+uint32_t hfslib_partition_catalog(hfs_volume*, uint32_t, uint32_t*,
+	hfs_callback_args*);
+int hfslib_compile_catalog_predicate(const hfs_catalog_condition_t*, uint16_t,
+	hfs_catalog_predicate_t*, hfs_callback_args*);
+void hfslib_free_catalog_predicate(hfs_catalog_predicate_t*,
+	hfs_callback_args*);
+int hfslib_catalog_predicate_matches(const hfs_catalog_predicate_t*,
+	const void*, uint16_t, hfs_volume*);
+hfs_async_status hfslib_async_find_record(hfs_volume*,
+	const hfs_catalog_key_t*, hfs_async_lookup_t*, hfs_callback_args*);
+hfs_async_status hfslib_async_find_cnid(hfs_volume*, hfs_cnid_t,
+	hfs_async_lookup_t*, hfs_callback_args*);
+hfs_async_status hfslib_async_get_file_extents(hfs_volume*, hfs_cnid_t,
+	uint8_t, hfs_async_lookup_t*, hfs_callback_args*);
+hfs_async_status hfslib_async_get_directory_contents(hfs_volume*, hfs_cnid_t,
+	hfs_async_lookup_t*, hfs_callback_args*);
+hfs_async_status hfslib_async_resume(hfs_volume*, hfs_async_lookup_t*,
+	hfs_callback_args*);
+void hfslib_async_free(hfs_async_lookup_t*, hfs_callback_args*);
 int hfslib_is_journal_clean(hfs_volume*);
 int hfslib_is_private_file(hfs_catalog_key_t*);
 
@@ -667,8 +847,11 @@ uint16_t hfslib_get_file_extents(hfs_volume*, hfs_cnid_t, uint8_t,
 	hfs_extent_descriptor_t**, hfs_callback_args*);
 int hfslib_readd_with_extents(hfs_volume*, void*, uint64_t*, uint64_t,
 	uint64_t, hfs_extent_descriptor_t*, uint16_t, hfs_callback_args*);
+int hfslib_readd_node(hfs_volume*, void*, hfs_btree_file_type, uint32_t,
+	hfs_extent_descriptor_t*, uint16_t, hfs_callback_args*);
 
 int hfslib_compare_catalog_keys_cf(const void*, const void*);
+int hfslib_create_casefolding_table(void);
 int hfslib_compare_catalog_keys_bc(const void*, const void*);
 int hfslib_compare_extent_keys(const void*, const void*);
 
@@ -681,5 +864,8 @@ void hfslib_free(void*, hfs_callback_args*);
 int hfslib_openvoldevice(hfs_volume*, const char*, hfs_callback_args*);
 void hfslib_closevoldevice(hfs_volume*, hfs_callback_args*);
 int hfslib_readd(hfs_volume*, void*, uint64_t, uint64_t, hfs_callback_args*);
+int hfslib_readdv(hfs_volume*, const hfs_read_request_t*, uint16_t,
+	hfs_callback_args*);
+int hfslib_interrupted(hfs_callback_args*);
 
 #endif /* !_FS_HFS_LIBHFS_H_ */
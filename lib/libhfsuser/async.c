@@ -0,0 +1,162 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hfsuser.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// a node wanted by one or more lookups in the current round
+struct node_read {
+	hfs_btree_file_type btree;
+	uint32_t node;
+	void* buf;
+	int err;
+};
+
+struct async_io {
+	hfs_volume* vol;
+	struct node_read* reads;
+	size_t nreads;
+	atomic_size_t next;
+	hfs_extent_descriptor_t* extents[2]; // of the catalog and extents overflow files
+	uint16_t nextents[2];
+};
+
+static inline int tree_index(hfs_btree_file_type btree) {
+	return btree != HFS_CATALOG_FILE;
+}
+
+static void* async_io_worker(void* arg) {
+	struct async_io* io = arg;
+	size_t i;
+	while((i = atomic_fetch_add(&io->next,1)) < io->nreads) {
+		struct node_read* r = io->reads + i;
+		int t = tree_index(r->btree);
+		r->err = hfslib_readd_node(io->vol,r->buf,r->btree,r->node,io->extents[t],io->nextents[t],NULL);
+	}
+	return NULL;
+}
+
+// reads every wanted node, with readahead hints for all of them issued first so the device sees them at once
+static void async_io_round(struct async_io* io, unsigned threads) {
+	for(size_t i = 0; i < io->nreads; i++) {
+		struct node_read* r = io->reads + i;
+		int t = tree_index(r->btree);
+		uint16_t size = t ? io->vol->ehr.node_size : io->vol->chr.node_size;
+		hfs_prefetch_range(io->vol,io->extents[t],io->nextents[t],(uint64_t)r->node * size,size);
+	}
+	atomic_store(&io->next,0);
+	threads = threads > io->nreads ? io->nreads : threads;
+	pthread_t tids[threads];
+	unsigned started = 1;
+	for(; started < threads; started++)
+		if(pthread_create(tids + started,NULL,async_io_worker,io))
+			break;
+	async_io_worker(io);
+	for(unsigned i = 1; i < started; i++)
+		pthread_join(tids[i],NULL);
+}
+
+int hfs_async_run(hfs_volume* vol, hfs_async_lookup_t* lookups[], size_t count, unsigned threads) {
+	struct async_io io = { .vol = vol };
+	size_t* waiting = malloc(count * sizeof(*waiting));
+	io.reads = malloc(count * sizeof(*io.reads));
+	int ret = 0;
+	if(!waiting || !io.reads) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	for(int t = 0; t < 2; t++)
+		if(!(io.nextents[t] = hfslib_get_file_extents(vol,t ? HFS_CNID_EXTENTS : HFS_CNID_CATALOG,HFS_DATAFORK,&io.extents[t],NULL))) {
+			ret = -EIO;
+			goto end;
+		}
+	if(!threads)
+		threads = 1;
+
+	while(true) {
+		io.nreads = 0;
+		for(size_t i = 0; i < count; i++) {
+			hfs_async_lookup_t* l = lookups[i];
+			waiting[i] = SIZE_MAX;
+			// cached nodes don't need to wait for the round
+			while(l->status == HFS_ASYNC_NEED_NODE && !hfs_getnode(vol,l->btree,l->node,l->buffer,NULL))
+				hfslib_async_resume(vol,l,NULL);
+			if(l->status != HFS_ASYNC_NEED_NODE)
+				continue;
+			// lookups often want the same node, e.g. near the root
+			size_t r;
+			for(r = 0; r < io.nreads; r++)
+				if(io.reads[r].btree == l->btree && io.reads[r].node == l->node)
+					break;
+			if(r == io.nreads) {
+				uint16_t size = l->btree == HFS_CATALOG_FILE ? vol->chr.node_size : vol->ehr.node_size;
+				if(!(io.reads[r].buf = malloc(size))) {
+					ret = -ENOMEM;
+					break;
+				}
+				io.reads[r].btree = l->btree;
+				io.reads[r].node = l->node;
+				io.nreads++;
+			}
+			waiting[i] = r;
+		}
+		if(ret) {
+			for(size_t r = 0; r < io.nreads; r++)
+				free(io.reads[r].buf);
+			break;
+		}
+		if(!io.nreads)
+			break;
+
+		async_io_round(&io,threads);
+
+		for(size_t i = 0; i < count; i++) {
+			if(waiting[i] == SIZE_MAX)
+				continue;
+			struct node_read* r = io.reads + waiting[i];
+			if(r->err)
+				lookups[i]->status = HFS_ASYNC_ERROR;
+			else {
+				memcpy(lookups[i]->buffer,r->buf,r->btree == HFS_CATALOG_FILE ? vol->chr.node_size : vol->ehr.node_size);
+				hfslib_async_resume(vol,lookups[i],NULL);
+			}
+		}
+		for(size_t r = 0; r < io.nreads; r++)
+			free(io.reads[r].buf);
+	}
+
+end:
+	free(io.extents[0]);
+	free(io.extents[1]);
+	free(io.reads);
+	free(waiting);
+	return ret;
+}
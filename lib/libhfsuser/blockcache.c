@@ -0,0 +1,314 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "blockcache.h"
+#include "sidecar.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef min
+#define max(A,B) ((A) > (B) ? (A):(B))
+#define min(A,B) ((A) < (B) ? (A):(B))
+#endif
+
+#define BLOCK_CACHE_MAGIC "HFSBLOCK"
+#define BLOCK_CACHE_VERSION 1
+// each block may be stored in one of this many slots
+#define WAYS 2
+// set in a slot's tag if it holds metadata
+#define TAG_META (UINT64_C(1) << 63)
+// most blocks read from the device at once to fill the cache
+#define MAX_RUN 256
+
+// the file is this header, the slot tags, and then the slots starting at the next multiple of the block size
+struct block_cache_header {
+	struct hfs_sidecar_header sidecar;
+	uint32_t block_size;
+	uint32_t clean; // cleared while open, so that tags left inconsistent by a crash are discarded
+	uint64_t nslots;
+};
+
+struct hfs_block_cache {
+	int fd;
+	pthread_mutex_t lock;
+	bool data;
+	uint32_t block_size;
+	uint64_t total_blocks;
+	uint64_t nsets, slots_offset;
+	struct block_cache_header* map;
+	size_t map_size;
+	uint64_t* tags; // block number + 1, or 0 for an empty slot
+	VECTOR(hfs_extent_descriptor_t) meta;
+	bool overflow; // meta includes the special files' overflow extents
+};
+
+static bool is_meta(struct hfs_block_cache* bc, uint64_t block) {
+	for(size_t i = 0; i < bc->meta.size; i++)
+		if(block >= bc->meta.data[i].start_block && block - bc->meta.data[i].start_block < bc->meta.data[i].block_count)
+			return true;
+	return false;
+}
+
+// the volume header, and the blocks of the special files libhfs reads through.
+// overflow extents can only be looked up once libhfs has read the extents b-tree's header,
+// and libhfs can't read an extents file that overflows into itself, so its inline extents are all there is
+static void set_meta(struct hfs_block_cache* bc, hfs_volume* vol, bool overflow) {
+	static const hfs_cnid_t cnids[] = { HFS_CNID_ALLOCATION, HFS_CNID_EXTENTS, HFS_CNID_CATALOG, HFS_CNID_ATTRIBUTES };
+	const hfs_fork_t* forks[] = { &vol->vh.allocation_file, &vol->vh.extents_file, &vol->vh.catalog_file, &vol->vh.attributes_file };
+	VECTOR(hfs_extent_descriptor_t) meta = {0};
+	// the lookups come back through the cache, which mustn't start them again
+	bc->overflow = overflow;
+	bool ok = PUSH(meta, (hfs_extent_descriptor_t){ 0, (1024 + 512 + bc->block_size - 1) / bc->block_size });
+	for(int f = 0; f < 4 && ok; f++) {
+		hfs_extent_descriptor_t* extents = NULL;
+		uint16_t n = 0;
+		if(overflow && cnids[f] != HFS_CNID_EXTENTS)
+			n = hfslib_get_file_extents(vol,cnids[f],HFS_DATAFORK,&extents,NULL);
+		if(n)
+			for(uint16_t i = 0; i < n && ok; i++)
+				ok = PUSH(meta, extents[i]);
+		else for(int i = 0; i < 8 && forks[f]->extents[i].block_count && ok; i++)
+			ok = PUSH(meta, forks[f]->extents[i]);
+		free(extents);
+	}
+	// on failure the previous ranges are kept
+	if(!ok) {
+		free(meta.data);
+		return;
+	}
+	free(bc->meta.data);
+	bc->meta.data = meta.data;
+	bc->meta.size = meta.size;
+	bc->meta.cap = meta.cap;
+}
+
+// tag index of the slot holding block, or -1
+static int64_t slot_find(struct hfs_block_cache* bc, uint64_t block) {
+	uint64_t set = block % bc->nsets * WAYS;
+	for(int w = 0; w < WAYS; w++)
+		if((bc->tags[set+w] & ~TAG_META) == block + 1)
+			return set + w;
+	return -1;
+}
+
+// prefer an empty slot, then one holding file data, and only let metadata replace metadata
+static int64_t slot_victim(struct hfs_block_cache* bc, uint64_t block, bool meta) {
+	uint64_t set = block % bc->nsets * WAYS;
+	for(int w = 0; w < WAYS; w++)
+		if(!bc->tags[set+w])
+			return set + w;
+	for(int w = 0; w < WAYS; w++)
+		if(!(bc->tags[set+w] & TAG_META))
+			return set + w;
+	return meta ? set + block / bc->nsets % WAYS : -1;
+}
+
+static bool slot_read(struct hfs_block_cache* bc, uint64_t block, void* buf, uint32_t offset, uint32_t length) {
+	pthread_mutex_lock(&bc->lock);
+	int64_t slot = slot_find(bc,block);
+	bool hit = slot >= 0 && pread(bc->fd,buf,length,bc->slots_offset + slot * bc->block_size + offset) == length;
+	if(slot >= 0 && !hit)
+		bc->tags[slot] = 0;
+	pthread_mutex_unlock(&bc->lock);
+	return hit;
+}
+
+static void slot_write(struct hfs_block_cache* bc, uint64_t block, const void* buf) {
+	bool meta = is_meta(bc,block);
+	pthread_mutex_lock(&bc->lock);
+	int64_t slot = slot_find(bc,block);
+	if(slot < 0 && (slot = slot_victim(bc,block,meta)) >= 0) {
+		bc->tags[slot] = 0;
+		if(pwrite(bc->fd,buf,bc->block_size,bc->slots_offset + slot * bc->block_size) == bc->block_size)
+			bc->tags[slot] = (block + 1) | (meta ? TAG_META : 0);
+	}
+	pthread_mutex_unlock(&bc->lock);
+}
+
+static bool cacheable(struct hfs_block_cache* bc, uint64_t block) {
+	return block < bc->total_blocks && (bc->data || is_meta(bc,block));
+}
+
+struct hfs_block_cache* hfs_block_cache_open(hfs_volume* vol, const char* dir, uint64_t size, bool data) {
+	struct hfs_block_cache* bc = calloc(1,sizeof(*bc));
+	char* path = hfs_sidecar_path(vol,dir,"blocks","");
+	if(!bc || !path) {
+		errno = ENOMEM;
+		goto error;
+	}
+	bc->fd = -1;
+	bc->data = data;
+	bc->block_size = vol->vh.block_size;
+	bc->total_blocks = vol->vh.total_blocks;
+	uint64_t nslots = size / bc->block_size / WAYS * WAYS;
+	if(!bc->block_size || !nslots) {
+		errno = EINVAL;
+		goto error;
+	}
+	bc->nsets = nslots / WAYS;
+	bc->map_size = sizeof(struct block_cache_header) + nslots * sizeof(*bc->tags);
+	bc->slots_offset = (bc->map_size + bc->block_size - 1) / bc->block_size * bc->block_size;
+	uint64_t file_size = bc->slots_offset + nslots * bc->block_size;
+
+	set_meta(bc,vol,false);
+	if(!bc->meta.size) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	if((bc->fd = open(path,O_RDWR|O_CREAT,0644)) < 0)
+		goto error;
+	struct block_cache_header h;
+	bool valid = pread(bc->fd,&h,sizeof(h),0) == sizeof(h) &&
+		!memcmp(h.sidecar.magic,BLOCK_CACHE_MAGIC,sizeof(h.sidecar.magic)) && h.sidecar.version == BLOCK_CACHE_VERSION &&
+		h.sidecar.write_count == vol->vh.write_count && h.sidecar.volume_id == hfs_volume_id(vol) &&
+		h.sidecar.size == file_size - sizeof(h.sidecar) && h.block_size == bc->block_size && h.nslots == nslots && h.clean;
+	if(!valid) {
+		memset(&h,0,sizeof(h));
+		memcpy(h.sidecar.magic,BLOCK_CACHE_MAGIC,sizeof(h.sidecar.magic));
+		h.sidecar.version = BLOCK_CACHE_VERSION;
+		h.sidecar.write_count = vol->vh.write_count;
+		h.sidecar.volume_id = hfs_volume_id(vol);
+		h.sidecar.size = file_size - sizeof(h.sidecar);
+		h.block_size = bc->block_size;
+		h.nslots = nslots;
+		// truncating first zeroes every tag
+		if(ftruncate(bc->fd,0) || ftruncate(bc->fd,file_size))
+			goto error;
+	}
+	h.clean = 0;
+	if(pwrite(bc->fd,&h,sizeof(h),0) != sizeof(h) || fsync(bc->fd))
+		goto error;
+	if((bc->map = mmap(NULL,bc->map_size,PROT_READ|PROT_WRITE,MAP_SHARED,bc->fd,0)) == MAP_FAILED) {
+		bc->map = NULL;
+		goto error;
+	}
+	bc->tags = (uint64_t*)(bc->map + 1);
+	if((errno = pthread_mutex_init(&bc->lock,NULL)))
+		goto error;
+	free(path);
+	return bc;
+
+error:;
+	int err = errno;
+	if(bc && bc->map)
+		munmap(bc->map,bc->map_size);
+	if(bc && bc->fd >= 0)
+		close(bc->fd);
+	if(bc)
+		free(bc->meta.data);
+	free(bc);
+	free(path);
+	errno = err;
+	return NULL;
+}
+
+void hfs_block_cache_close(struct hfs_block_cache* bc) {
+	if(!bc)
+		return;
+	if(!msync(bc->map,bc->map_size,MS_SYNC)) {
+		bc->map->clean = 1;
+		msync(bc->map,bc->map_size,MS_SYNC);
+	}
+	munmap(bc->map,bc->map_size);
+	close(bc->fd);
+	pthread_mutex_destroy(&bc->lock);
+	free(bc->meta.data);
+	free(bc);
+}
+
+void hfs_block_cache_invalidate(struct hfs_block_cache* bc, hfs_volume* vol) {
+	if(!bc)
+		return;
+	pthread_mutex_lock(&bc->lock);
+	memset(bc->tags,0,bc->nsets * WAYS * sizeof(*bc->tags));
+	bc->map->sidecar.write_count = vol->vh.write_count;
+	pthread_mutex_unlock(&bc->lock);
+	// looking up the overflow extents reads through the cache, so not under its lock.
+	// the volume isn't in use while it's reloaded, so nothing else is looking at the ranges
+	set_meta(bc,vol,true);
+}
+
+int hfs_block_cache_read(struct hfs_block_cache* bc, hfs_volume* vol, void* buf, uint64_t length, uint64_t offset, hfs_block_reader read) {
+	// the first read after libhfs has the extents b-tree's header while opening the volume, which is single threaded
+	if(!bc->overflow && vol->ehr.node_size)
+		set_meta(bc,vol,true);
+	char* out = buf;
+	uint64_t end = offset + length;
+	uint64_t block = offset / bc->block_size, last = length ? (end - 1) / bc->block_size : block;
+	while(offset < end) {
+		uint32_t skip = offset - block * bc->block_size;
+		uint32_t len = min(end - offset, bc->block_size - skip);
+		if(slot_read(bc,block,out,skip,len)) {
+			out += len;
+			offset += len;
+			block++;
+			continue;
+		}
+
+		// read up to the next cached block in one go, going through a buffer only if some of it will be kept
+		uint64_t run = block + 1;
+		bool keep = cacheable(bc,block);
+		while(run <= last && run - block < MAX_RUN) {
+			pthread_mutex_lock(&bc->lock);
+			bool cached = slot_find(bc,run) >= 0;
+			pthread_mutex_unlock(&bc->lock);
+			if(cached)
+				break;
+			keep |= cacheable(bc,run);
+			run++;
+		}
+		uint64_t run_end = min(end, run * bc->block_size);
+		int ret;
+		if(!keep) {
+			if((ret = read(vol,out,run_end - offset,offset)))
+				return ret;
+		}
+		else {
+			char* blocks = malloc((run - block) * bc->block_size);
+			if(!blocks)
+				return -ENOMEM;
+			if((ret = read(vol,blocks,(run - block) * bc->block_size,block * bc->block_size))) {
+				free(blocks);
+				return ret;
+			}
+			memcpy(out,blocks + skip,run_end - offset);
+			for(uint64_t b = block; b < run; b++)
+				if(cacheable(bc,b))
+					slot_write(bc,b,blocks + (b - block) * bc->block_size);
+			free(blocks);
+		}
+		out += run_end - offset;
+		offset = run_end;
+		block = run;
+	}
+	return 0;
+}
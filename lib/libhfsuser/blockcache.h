@@ -0,0 +1,52 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_BLOCKCACHE_H
+#define HFSUSER_BLOCKCACHE_H
+
+#include "hfsuser.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A persistent cache of device blocks in a file on faster local storage, for
+// volumes on slow media. Blocks are cached in units of the volume's allocation
+// block, keyed by their offset in the volume, in a file named for the volume's
+// unique ID like the sidecar files. The file is discarded when the volume's
+// write count changes, or if the previous user didn't close it cleanly.
+// Blocks belonging to the b-trees and allocation file are always cached, and
+// file contents only if requested, in which case they never displace metadata.
+struct hfs_block_cache;
+
+typedef int (*hfs_block_reader)(hfs_volume*, void* buf, uint64_t length, uint64_t offset);
+
+// vol's header must already be loaded. returns NULL and sets errno on failure
+struct hfs_block_cache* hfs_block_cache_open(hfs_volume* vol, const char* dir, uint64_t size, bool data);
+void hfs_block_cache_close(struct hfs_block_cache*);
+// forgets every cached block after the volume has changed, taking the metadata ranges from vol's current headers
+void hfs_block_cache_invalidate(struct hfs_block_cache*, hfs_volume* vol);
+// reads like hfs_read, serving what it can from the cache and the rest with read
+int  hfs_block_cache_read(struct hfs_block_cache*, hfs_volume* vol, void* buf, uint64_t length, uint64_t offset, hfs_block_reader read);
+
+#endif
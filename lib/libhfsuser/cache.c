@@ -0,0 +1,598 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cache.h"
+#include "shards.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#elif defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+// ARC lists: T1 holds entries seen once recently, T2 entries seen at least twice.
+// B1 and B2 remember the keys (but not the values) most recently evicted from each.
+// A one-pass scan only ever fills T1, so it can't push the working set out of T2.
+// Z holds entries trimmed from B1 and B2 that still have a compressed value.
+enum { T1, T2, B1, B2, Z, LISTS };
+
+#define RESIDENT(e) ((e)->list <= T2)
+
+#ifndef min
+#define max(A,B) ((A) > (B) ? (A):(B))
+#define min(A,B) ((A) < (B) ? (A):(B))
+#endif
+
+// values larger than this fraction of the budget are not worth caching
+#define MAX_ENTRY_FRACTION 8
+// halve each tier's ghost hit score after this many insertions
+#define SCORE_DECAY_INTERVAL 4096
+// tiers whose evicted values are kept compressed
+#define COMPRESSED_TIERS (1 << HFS_CACHE_NODES)
+
+struct cache_entry {
+	struct cache_entry* hnext;
+	struct cache_entry* prev,* next;
+	uint64_t hash;
+	size_t keylen, vallen;
+	uint8_t tier, list;
+	void* val;   // compressed if zlen is nonzero, otherwise NULL for ghosts
+	size_t zlen;
+	struct cache_entry* zprev,* znext;
+	unsigned char key[];
+};
+
+struct cache_list {
+	struct cache_entry* head,* tail; // head is most recently used
+	size_t bytes, count;
+};
+
+struct cache_tier {
+	struct cache_list lists[LISTS];
+	size_t target; // bytes of the shared budget this tier may hold
+	size_t p;      // ARC's target size for T1 within the tier
+	uint64_t score;
+	struct hfs_cache_tier_stats stats;
+	struct hfs_shards* shards;
+};
+
+// ghosts that still hold their value in compressed form, shared by all tiers
+// and limited separately from the main budget
+struct cache_zlist {
+	struct cache_entry* head,* tail;
+	size_t bytes, budget;
+};
+
+struct hfs_cache {
+	pthread_mutex_t lock;
+	unsigned mask; // tiers in use
+	size_t budget, used, floor;
+	struct cache_zlist z;
+	uint64_t inserts;
+	struct cache_entry** buckets;
+	size_t nbuckets, nentries;
+	struct cache_tier tiers[HFS_CACHE_TIERS];
+};
+
+static const char* tier_names[HFS_CACHE_TIERS] = {
+	[HFS_CACHE_RECORDS] = "records",
+	[HFS_CACHE_NODES]   = "nodes",
+	[HFS_CACHE_EXTENTS] = "extents",
+	[HFS_CACHE_DIRS]    = "dirs",
+	[HFS_CACHE_DATA]    = "data",
+};
+
+const char* hfs_cache_tier_name(enum hfs_cache_tier tier) {
+	return tier < HFS_CACHE_TIERS ? tier_names[tier] : NULL;
+}
+
+#if defined(HAVE_LZ4)
+#define HAVE_COMPRESSION
+static size_t compress_value(const void* in, size_t len, void* out, size_t cap) {
+	int ret = LZ4_compress_default(in,out,len,cap);
+	return ret > 0 ? ret : 0;
+}
+static bool decompress_value(const void* in, size_t len, void* out, size_t outlen) {
+	return LZ4_decompress_safe(in,out,len,outlen) == (int)outlen;
+}
+#elif defined(HAVE_ZLIB)
+#define HAVE_COMPRESSION
+static size_t compress_value(const void* in, size_t len, void* out, size_t cap) {
+	uLongf outlen = cap;
+	return compress2(out,&outlen,in,len,Z_BEST_SPEED) == Z_OK ? outlen : 0;
+}
+static bool decompress_value(const void* in, size_t len, void* out, size_t outlen) {
+	uLongf size = outlen;
+	return uncompress(out,&size,in,len) == Z_OK && size == outlen;
+}
+#endif
+
+static inline uint64_t cache_hash(enum hfs_cache_tier tier, const void* key, size_t keylen) {
+	uint64_t hash = 0xcbf29ce484222325ULL ^ tier;
+	for(const unsigned char* it = key; it < (const unsigned char*)key + keylen; it++)
+		hash = (hash ^ *it) * 0x100000001b3ULL;
+	return hash;
+}
+
+static inline size_t entry_size(struct cache_entry* e) {
+	return sizeof(*e) + e->keylen + e->vallen;
+}
+
+static void list_remove(struct cache_tier* t, struct cache_entry* e) {
+	struct cache_list* l = &t->lists[e->list];
+	if(e->prev) e->prev->next = e->next;
+	else l->head = e->next;
+	if(e->next) e->next->prev = e->prev;
+	else l->tail = e->prev;
+	l->bytes -= entry_size(e);
+	l->count--;
+}
+
+static void list_push(struct cache_tier* t, struct cache_entry* e, int list) {
+	struct cache_list* l = &t->lists[list];
+	e->list = list;
+	e->prev = NULL;
+	e->next = l->head;
+	if(l->head) l->head->prev = e;
+	else l->tail = e;
+	l->head = e;
+	l->bytes += entry_size(e);
+	l->count++;
+}
+
+static struct cache_entry* cache_find(struct hfs_cache* c, enum hfs_cache_tier tier, const void* key, size_t keylen, uint64_t hash) {
+	for(struct cache_entry* e = c->buckets[hash & (c->nbuckets-1)]; e; e = e->hnext)
+		if(e->hash == hash && e->tier == tier && e->keylen == keylen && !memcmp(e->key,key,keylen))
+			return e;
+	return NULL;
+}
+
+static void cache_unlink(struct hfs_cache* c, struct cache_entry* e) {
+	struct cache_entry** it = &c->buckets[e->hash & (c->nbuckets-1)];
+	while(*it != e)
+		it = &(*it)->hnext;
+	*it = e->hnext;
+	c->nentries--;
+}
+
+static void cache_grow(struct hfs_cache* c) {
+	size_t nbuckets = c->nbuckets * 2;
+	struct cache_entry** buckets = calloc(nbuckets,sizeof(*buckets));
+	if(!buckets)
+		return;
+	for(size_t i = 0; i < c->nbuckets; i++)
+		for(struct cache_entry* e = c->buckets[i],* next; e; e = next) {
+			next = e->hnext;
+			e->hnext = buckets[e->hash & (nbuckets-1)];
+			buckets[e->hash & (nbuckets-1)] = e;
+		}
+	free(c->buckets);
+	c->buckets = buckets;
+	c->nbuckets = nbuckets;
+}
+
+// what a compressed value costs the Z budget. entries trimmed to Z are only kept for their value, so their
+// struct and key are charged to it too
+static inline size_t zlist_charge(const struct cache_entry* e) {
+	return sizeof(*e) + e->keylen + e->zlen;
+}
+
+// releases a ghost's compressed value
+static void zlist_remove(struct hfs_cache* c, struct cache_entry* e) {
+	if(e->zprev) e->zprev->znext = e->znext;
+	else c->z.head = e->znext;
+	if(e->znext) e->znext->zprev = e->zprev;
+	else c->z.tail = e->zprev;
+	c->z.bytes -= zlist_charge(e);
+	c->tiers[e->tier].stats.compressed_bytes -= e->zlen;
+	c->tiers[e->tier].stats.compressed_entries--;
+	free(e->val);
+	e->val = NULL;
+	e->zlen = 0;
+}
+
+static void cache_drop(struct hfs_cache* c, struct cache_entry* e) {
+	struct cache_tier* t = &c->tiers[e->tier];
+	if(RESIDENT(e)) {
+		c->used -= entry_size(e);
+		t->stats.entries--;
+	}
+	else if(e->zlen)
+		zlist_remove(c,e);
+	list_remove(t,e);
+	cache_unlink(c,e);
+	free(e->val);
+	free(e);
+}
+
+#ifdef HAVE_COMPRESSION
+// keeps the value of an entry being evicted, compressed, if that saves at least an eighth
+static void zlist_add(struct hfs_cache* c, struct cache_entry* e) {
+	size_t cap = e->vallen - e->vallen / 8;
+	void* z = malloc(cap);
+	size_t zlen = z ? compress_value(e->val,e->vallen,z,cap) : 0;
+	if(!zlen || sizeof(*e) + e->keylen + zlen > c->z.budget) {
+		free(z);
+		return;
+	}
+	void* shrunk = realloc(z,zlen);
+	free(e->val);
+	e->val = shrunk ? shrunk : z;
+	e->zlen = zlen;
+	e->zprev = NULL;
+	e->znext = c->z.head;
+	if(c->z.head) c->z.head->zprev = e;
+	else c->z.tail = e;
+	c->z.head = e;
+	c->z.bytes += zlist_charge(e);
+	c->tiers[e->tier].stats.compressed_bytes += zlen;
+	c->tiers[e->tier].stats.compressed_entries++;
+	while(c->z.bytes > c->z.budget) {
+		if(c->z.tail->list == Z)
+			cache_drop(c,c->z.tail);
+		else zlist_remove(c,c->z.tail);
+	}
+}
+#endif
+
+// move the LRU entry of T1 or T2 to the corresponding ghost list, releasing its value
+static void tier_replace(struct hfs_cache* c, struct cache_tier* t, bool ghost_b2) {
+	struct cache_list* t1 = &t->lists[T1],* t2 = &t->lists[T2];
+	struct cache_entry* e;
+	int ghost;
+	if(t1->count && (t1->bytes > t->p || (ghost_b2 && t1->bytes == t->p) || !t2->count)) {
+		e = t1->tail;
+		ghost = B1;
+	}
+	else if(t2->count) {
+		e = t2->tail;
+		ghost = B2;
+	}
+	else return;
+	list_remove(t,e);
+	c->used -= entry_size(e);
+	t->stats.entries--;
+	t->stats.evictions++;
+#ifdef HAVE_COMPRESSION
+	if(c->z.budget && (COMPRESSED_TIERS & (1 << e->tier)))
+		zlist_add(c,e);
+#endif
+	if(!e->zlen) {
+		free(e->val);
+		e->val = NULL;
+	}
+	list_push(t,e,ghost);
+}
+
+// each ghost list remembers as much as the tier's share of the budget,
+// regardless of how much the tier is currently borrowing from idle tiers
+static void tier_trim_ghost(struct hfs_cache* c, struct cache_tier* t, struct cache_entry* e) {
+	if(e->zlen) {
+		list_remove(t,e);
+		list_push(t,e,Z);
+	}
+	else cache_drop(c,e);
+}
+
+static void tier_trim_ghosts(struct hfs_cache* c, struct cache_tier* t) {
+	struct cache_list* l = t->lists;
+	while(l[B1].count && l[B1].bytes > t->target)
+		tier_trim_ghost(c,t,l[B1].tail);
+	while(l[B2].count && l[B2].bytes > t->target)
+		tier_trim_ghost(c,t,l[B2].tail);
+}
+
+// evict from whichever tier is furthest over its share until the budget is met
+static void cache_make_room(struct hfs_cache* c, bool ghost_b2) {
+	while(c->used > c->budget) {
+		struct cache_tier* victim = NULL;
+		size_t over = 0, most = 0;
+		for(struct cache_tier* t = c->tiers; t < c->tiers + HFS_CACHE_TIERS; t++) {
+			size_t resident = t->lists[T1].bytes + t->lists[T2].bytes;
+			if(resident > t->target && resident - t->target > over) {
+				over = resident - t->target;
+				victim = t;
+			}
+			else if(!over && resident > most) {
+				most = resident;
+				victim = t;
+			}
+		}
+		if(!victim)
+			break;
+		tier_replace(c,victim,ghost_b2);
+		tier_trim_ghosts(c,victim);
+	}
+}
+
+// a ghost hit of size bytes in tier t: take that much of the budget from the
+// tier that has recently been gaining the least from its share
+static void cache_rebalance(struct hfs_cache* c, struct cache_tier* t, size_t bytes) {
+	t->score++;
+	struct cache_tier* donor = NULL;
+	for(struct cache_tier* it = c->tiers; it < c->tiers + HFS_CACHE_TIERS; it++)
+		if(it != t && (c->mask & (1 << (it - c->tiers))) && it->target > c->floor &&
+		   (!donor || it->score < donor->score || (it->score == donor->score && it->target > donor->target)))
+			donor = it;
+	if(!donor)
+		return;
+	bytes = min(bytes, donor->target - c->floor);
+	donor->target -= bytes;
+	t->target += bytes;
+	if(donor->p > donor->target)
+		donor->p = donor->target;
+}
+
+static void cache_reset_targets(struct hfs_cache* c) {
+	for(struct cache_tier* t = c->tiers; t < c->tiers + HFS_CACHE_TIERS; t++) {
+		t->target = c->mask & (1 << (t - c->tiers)) ? c->budget / __builtin_popcount(c->mask) : 0;
+		t->p = 0;
+		t->score = 0;
+	}
+}
+
+struct hfs_cache* hfs_cache_create(size_t budget, size_t compressed_budget, unsigned tiers) {
+	struct hfs_cache* c = calloc(1,sizeof(*c));
+	if(!c)
+		return NULL;
+	c->nbuckets = 1024;
+	if(!(c->buckets = calloc(c->nbuckets,sizeof(*c->buckets)))) {
+		free(c);
+		return NULL;
+	}
+	c->budget = budget;
+	c->mask = tiers & ((1 << HFS_CACHE_TIERS) - 1);
+	if(!c->mask)
+		c->mask = HFS_CACHE_METADATA;
+	c->floor = budget / (__builtin_popcount(c->mask) * 4);
+#ifdef HAVE_COMPRESSION
+	c->z.budget = compressed_budget;
+#else
+	(void)compressed_budget;
+#endif
+	cache_reset_targets(c);
+	for(int i = 0; i < HFS_CACHE_TIERS; i++)
+		if(c->mask & (1 << i))
+			c->tiers[i].shards = hfs_shards_create(HFS_MRC_SAMPLES);
+	pthread_mutex_init(&c->lock,NULL);
+	return c;
+}
+
+static void cache_drop_all(struct hfs_cache* c) {
+	for(size_t i = 0; i < c->nbuckets; i++)
+		while(c->buckets[i])
+			cache_drop(c,c->buckets[i]);
+}
+
+void hfs_cache_clear(struct hfs_cache* c) {
+	if(!c)
+		return;
+	pthread_mutex_lock(&c->lock);
+	cache_drop_all(c);
+	cache_reset_targets(c);
+	pthread_mutex_unlock(&c->lock);
+}
+
+void hfs_cache_destroy(struct hfs_cache* c) {
+	if(!c)
+		return;
+	cache_drop_all(c);
+	free(c->buckets);
+	for(int i = 0; i < HFS_CACHE_TIERS; i++)
+		hfs_shards_destroy(c->tiers[i].shards);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+// adapt the tier to a hit in one of its ghost lists and move the entry to T2.
+// returns whether the hit was in B2, for the following cache_settle
+static bool cache_ghost_hit(struct hfs_cache* c, struct cache_tier* t, struct cache_entry* e, void* val, size_t vallen) {
+	size_t size = entry_size(e);
+	struct cache_list* l = t->lists;
+	bool ghost_b2 = false;
+	t->stats.ghost_hits++;
+	if(e->list == B1)
+		t->p = min(t->target, t->p + size * max(1, l[B2].bytes / max(l[B1].bytes,1)));
+	else {
+		size_t delta = size * max(1, l[B1].bytes / max(l[B2].bytes,1));
+		t->p = t->p > delta ? t->p - delta : 0;
+		ghost_b2 = true;
+	}
+	cache_rebalance(c,t,size);
+	list_remove(t,e);
+	e->vallen = vallen;
+	e->val = val;
+	list_push(t,e,T2);
+	c->used += entry_size(e);
+	t->stats.entries++;
+	return ghost_b2;
+}
+
+// bring back an entry that is not resident but is still known, either as a ghost
+// or with a compressed value. returns whether this was a hit in B2
+static bool cache_readmit(struct hfs_cache* c, struct cache_tier* t, struct cache_entry* e, void* val, size_t vallen) {
+	if(e->zlen)
+		zlist_remove(c,e);
+	if(e->list != Z)
+		return cache_ghost_hit(c,t,e,val,vallen);
+	// forgotten by ARC, so it starts over as if new
+	list_remove(t,e);
+	e->vallen = vallen;
+	e->val = val;
+	list_push(t,e,T1);
+	c->used += entry_size(e);
+	t->stats.entries++;
+	return false;
+}
+
+// enforce the budget after an entry has been added to t
+static void cache_settle(struct hfs_cache* c, struct cache_tier* t, bool ghost_b2) {
+	cache_make_room(c,ghost_b2);
+	tier_trim_ghosts(c,t);
+	if(c->nentries > c->nbuckets * 2)
+		cache_grow(c);
+	if(!(++c->inserts % SCORE_DECAY_INTERVAL))
+		for(struct cache_tier* it = c->tiers; it < c->tiers + HFS_CACHE_TIERS; it++)
+			it->score /= 2;
+}
+
+// a ghost still holding its compressed value is restored as if it had been reinserted.
+// the caller must copy the value out before calling cache_settle, which may evict it again
+static struct cache_entry* cache_hit(struct hfs_cache* c, enum hfs_cache_tier tier, const void* key, size_t keylen, int* settle) {
+	struct cache_tier* t = &c->tiers[tier];
+	uint64_t hash = cache_hash(tier,key,keylen);
+	struct cache_entry* e = cache_find(c,tier,key,keylen,hash);
+	*settle = -1;
+	// ghosts remember their size, so only keys never seen before are sized on insertion
+	hfs_shards_access(t->shards,hash,e ? entry_size(e) : 0);
+	if(e && !RESIDENT(e) && e->zlen) {
+		void* val = malloc(e->vallen ? e->vallen : 1);
+#ifdef HAVE_COMPRESSION
+		if(val && !decompress_value(e->val,e->zlen,val,e->vallen))
+#endif
+		{
+			free(val);
+			val = NULL;
+		}
+		if(val) {
+			t->stats.compressed_hits++;
+			*settle = cache_readmit(c,t,e,val,e->vallen);
+			return e;
+		}
+		if(e->list == Z) {
+			cache_drop(c,e);
+			e = NULL;
+		}
+		else zlist_remove(c,e);
+	}
+	if(!e || !RESIDENT(e)) {
+		t->stats.misses++;
+		return NULL;
+	}
+	t->stats.hits++;
+	list_remove(t,e);
+	list_push(t,e,T2);
+	return e;
+}
+
+bool hfs_cache_lookup(struct hfs_cache* c, enum hfs_cache_tier tier, const void* key, size_t keylen, void* val, size_t vallen) {
+	if(!c)
+		return false;
+	pthread_mutex_lock(&c->lock);
+	int settle;
+	struct cache_entry* e = cache_hit(c,tier,key,keylen,&settle);
+	if(e && e->vallen == vallen)
+		memcpy(val,e->val,vallen);
+	else e = NULL;
+	if(settle >= 0)
+		cache_settle(c,&c->tiers[tier],settle);
+	pthread_mutex_unlock(&c->lock);
+	return e;
+}
+
+void* hfs_cache_lookup_alloc(struct hfs_cache* c, enum hfs_cache_tier tier, const void* key, size_t keylen, size_t* vallen) {
+	void* val = NULL;
+	if(!c)
+		return NULL;
+	pthread_mutex_lock(&c->lock);
+	int settle;
+	struct cache_entry* e = cache_hit(c,tier,key,keylen,&settle);
+	if(e && (val = malloc(e->vallen ? e->vallen : 1))) {
+		memcpy(val,e->val,e->vallen);
+		*vallen = e->vallen;
+	}
+	if(settle >= 0)
+		cache_settle(c,&c->tiers[tier],settle);
+	pthread_mutex_unlock(&c->lock);
+	return val;
+}
+
+void hfs_cache_insert(struct hfs_cache* c, enum hfs_cache_tier tier, const void* key, size_t keylen, const void* val, size_t vallen) {
+	if(!c || sizeof(struct cache_entry) + keylen + vallen > c->budget / MAX_ENTRY_FRACTION)
+		return;
+	void* copy = malloc(vallen ? vallen : 1);
+	if(!copy)
+		return;
+	memcpy(copy,val,vallen);
+
+	pthread_mutex_lock(&c->lock);
+	struct cache_tier* t = &c->tiers[tier];
+	uint64_t hash = cache_hash(tier,key,keylen);
+	struct cache_entry* e = cache_find(c,tier,key,keylen,hash);
+	bool ghost_b2 = false;
+	if(e && RESIDENT(e)) {
+		// raced with another reader that filled the same entry
+		free(copy);
+		goto end;
+	}
+	else if(e)
+		ghost_b2 = cache_readmit(c,t,e,copy,vallen);
+	else {
+		if(!(e = malloc(sizeof(*e)+keylen))) {
+			free(copy);
+			goto end;
+		}
+		e->hash = hash;
+		e->tier = tier;
+		e->keylen = keylen;
+		e->vallen = vallen;
+		e->zlen = 0;
+		memcpy(e->key,key,keylen);
+		e->hnext = c->buckets[hash & (c->nbuckets-1)];
+		c->buckets[hash & (c->nbuckets-1)] = e;
+		c->nentries++;
+		list_push(t,e,T1);
+		e->val = copy;
+		c->used += entry_size(e);
+		t->stats.entries++;
+		hfs_shards_resize(t->shards,hash,entry_size(e));
+	}
+	cache_settle(c,t,ghost_b2);
+end:
+	pthread_mutex_unlock(&c->lock);
+}
+
+size_t hfs_cache_entry_size(size_t keylen, size_t vallen) {
+	return sizeof(struct cache_entry) + keylen + vallen;
+}
+
+void hfs_cache_stats(struct hfs_cache* c, enum hfs_cache_tier tier, struct hfs_cache_tier_stats* stats) {
+	memset(stats,0,sizeof(*stats));
+	if(!c)
+		return;
+	pthread_mutex_lock(&c->lock);
+	struct cache_tier* t = &c->tiers[tier];
+	*stats = t->stats;
+	stats->bytes = t->lists[T1].bytes + t->lists[T2].bytes;
+	stats->target = t->target;
+	pthread_mutex_unlock(&c->lock);
+}
+
+void hfs_cache_mrc(struct hfs_cache* c, enum hfs_cache_tier tier, struct hfs_mrc* mrc) {
+	hfs_shards_mrc(c ? c->tiers[tier].shards : NULL,mrc);
+}
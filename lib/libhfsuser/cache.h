@@ -0,0 +1,62 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_CACHE_H
+#define HFSUSER_CACHE_H
+
+#include "hfsuser.h"
+
+// One cache manager owns every cache for a volume. Each tier keeps its own ARC
+// lists (recent/frequent plus ghost lists of recently evicted keys), and all
+// tiers draw from a single byte budget. A ghost hit in a tier is evidence that
+// it would have hit with more memory, so its share of the budget grows at the
+// expense of the tier seeing the fewest ghost hits. The tiers, and the stats
+// they keep, are in hfsuser.h.
+
+// the metadata tiers, which share one cache. file data gets a cache of its own so it can't displace them
+#define HFS_CACHE_METADATA ((1 << HFS_CACHE_DATA) - 1)
+
+struct hfs_cache;
+
+// compressed_budget bounds the memory spent keeping evicted b-tree nodes in
+// compressed form. It is ignored when built without a compressor.
+// tiers is a mask of (1 << tier) for the tiers the budget is split between.
+struct hfs_cache* hfs_cache_create(size_t budget, size_t compressed_budget, unsigned tiers);
+void hfs_cache_destroy(struct hfs_cache*);
+void hfs_cache_clear(struct hfs_cache*);
+
+// copies a cached value of exactly vallen bytes into val
+bool  hfs_cache_lookup(struct hfs_cache*, enum hfs_cache_tier, const void* key, size_t keylen, void* val, size_t vallen);
+// returns a malloc'd copy of a cached value of any size
+void* hfs_cache_lookup_alloc(struct hfs_cache*, enum hfs_cache_tier, const void* key, size_t keylen, size_t* vallen);
+void  hfs_cache_insert(struct hfs_cache*, enum hfs_cache_tier, const void* key, size_t keylen, const void* val, size_t vallen);
+
+// memory an entry with a key and value of these sizes takes from the budget
+size_t hfs_cache_entry_size(size_t keylen, size_t vallen);
+
+void hfs_cache_stats(struct hfs_cache*, enum hfs_cache_tier, struct hfs_cache_tier_stats*);
+// the tier's estimated miss ratio at each size, sampled from every lookup (see shards.h)
+void hfs_cache_mrc(struct hfs_cache*, enum hfs_cache_tier, struct hfs_mrc*);
+
+#endif
@@ -0,0 +1,800 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hfsuser.h"
+#include "vector.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// b-tree files are read in pieces of this size and handed to the workers
+#define CHECK_CHUNK_SIZE (1024*1024)
+
+#define NONE UINT32_MAX
+
+static inline uint16_t be16(const uint8_t* p) { return (uint16_t)p[0] << 8 | p[1]; }
+static inline uint32_t be32(const uint8_t* p) { return (uint32_t)be16(p) << 16 | be16(p+2); }
+
+struct index_entry { uint32_t child; void* key; };
+
+// what the cross-node checks need to know about each node
+struct node_info {
+	uint32_t flink, blink;
+	int8_t kind;
+	uint8_t height;
+	uint16_t nrecs;
+	bool valid;   // parsed cleanly, so it takes part in the cross-node checks
+	bool reached; // found by descending from the root
+	void* first,* last; // copies of the first and last keys
+	uint32_t nchildren;
+	struct index_entry* children;
+};
+
+// catalog records and threads, paired up by cnid once every node is read
+struct cat_entry {
+	hfs_cnid_t cnid, parent;
+	uint32_t name; // hash of the name, to match records against threads
+	int16_t type;
+	uint32_t node;
+};
+
+// a fork's size in blocks and the blocks covered by its catalog record or the volume header
+struct fork_entry { hfs_cnid_t cnid; uint8_t fork; uint32_t blocks, mapped; };
+
+struct extent_use { uint32_t start, count; hfs_cnid_t cnid; uint8_t fork; bool overflow; };
+
+struct check_results {
+	VECTOR(struct cat_entry) records;
+	VECTOR(struct fork_entry) forks;
+	VECTOR(struct extent_use) extents;
+	uint64_t leaf_records;
+	bool nomem;
+};
+
+struct check {
+	hfs_volume* vol;
+	FILE* out;
+	unsigned threads;
+	long problems;
+	pthread_mutex_t lock;
+	struct check_results results;
+};
+
+struct check_tree {
+	struct check* c;
+	const char* name;
+	hfs_btree_file_type btree;
+	hfs_cnid_t cnid;
+	hfs_header_record_t* hr;
+	int (*keycmp)(const void*, const void*);
+	uint8_t keyfieldsize;
+	uint8_t* map; // in-use bit per node
+	struct node_info* nodes;
+	uint32_t nnodes;
+	hfs_extent_descriptor_t* extents;
+	uint16_t nextents;
+};
+
+static void problem(struct check* c, const char* tree, uint32_t node, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	pthread_mutex_lock(&c->lock);
+	c->problems++;
+	if(tree && node != NONE)
+		fprintf(c->out, "%s node %" PRIu32 ": ", tree, node);
+	else if(tree)
+		fprintf(c->out, "%s: ", tree);
+	vfprintf(c->out, format, args);
+	fputc('\n', c->out);
+	pthread_mutex_unlock(&c->lock);
+	va_end(args);
+}
+
+static inline bool node_in_use(struct check_tree* t, uint32_t node) {
+	return node < t->nnodes && (t->map[node / 8] & (0x80 >> (node % 8)));
+}
+
+static void* key_copy(struct check_tree* t, const void* key) {
+	size_t size = t->btree == HFS_CATALOG_FILE ?
+		offsetof(hfs_catalog_key_t, name.unicode) + ((const hfs_catalog_key_t*)key)->name.length * sizeof(unichar_t) :
+		sizeof(hfs_extent_key_t);
+	void* copy = malloc(size);
+	if(copy)
+		memcpy(copy, key, size);
+	return copy;
+}
+
+static uint32_t name_hash(const hfs_unistr255_t* name) {
+	uint32_t hash = 2166136261u;
+	for(uint16_t i = 0; i < name->length; i++)
+		hash = (hash ^ name->unicode[i]) * 16777619u;
+	return hash;
+}
+
+static void add_fork(struct check_results* r, hfs_cnid_t cnid, uint8_t fork, const hfs_fork_t* f, bool overflow) {
+	uint32_t mapped = 0;
+	for(int i = 0; i < 8 && f->extents[i].block_count; i++) {
+		mapped += f->extents[i].block_count;
+		r->nomem |= !PUSH(r->extents, (struct extent_use){ f->extents[i].start_block, f->extents[i].block_count, cnid, fork, overflow });
+	}
+	if(!overflow)
+		r->nomem |= !PUSH(r->forks, (struct fork_entry){ cnid, fork, f->total_blocks, mapped });
+}
+
+// validates one node on its own: descriptor, record offsets, each record's bounds and contents, and key order
+static void check_node(struct check_tree* t, struct check_results* r, uint32_t n, const uint8_t* buf, uint8_t* scratch) {
+	struct check* c = t->c;
+	struct node_info* ni = t->nodes + n;
+	uint16_t nodesize = t->hr->node_size;
+	ni->flink = be32(buf);
+	ni->blink = be32(buf+4);
+	ni->kind = (int8_t)buf[8];
+	ni->height = buf[9];
+	ni->nrecs = be16(buf+10);
+
+	if(ni->kind == HFS_MAPNODE)
+		return;
+	if(ni->kind != HFS_LEAFNODE && ni->kind != HFS_INDEXNODE) {
+		problem(c, t->name, n, "in use but has invalid kind %d", ni->kind);
+		return;
+	}
+	if(ni->kind == HFS_LEAFNODE ? ni->height != 1 : ni->height < 2)
+		problem(c, t->name, n, "%s node has height %u", ni->kind == HFS_LEAFNODE ? "leaf" : "index", ni->height);
+	if(!ni->nrecs) {
+		problem(c, t->name, n, "has no records");
+		return;
+	}
+
+	// offsets are stored backwards from the end of the node, followed by the offset of the free space
+	if(14 + 2 * (ni->nrecs + 1) > nodesize) {
+		problem(c, t->name, n, "record count %u does not fit in the node", ni->nrecs);
+		return;
+	}
+	const uint8_t* offsets = buf + nodesize - 2;
+	if(be16(offsets) != 14) {
+		problem(c, t->name, n, "first record at offset %u instead of 14", be16(offsets));
+		return;
+	}
+	for(uint16_t i = 1; i <= ni->nrecs; i++) {
+		uint16_t prev = be16(offsets - 2*(i-1)), off = be16(offsets - 2*i);
+		if(off <= prev || off > nodesize - 2 * (ni->nrecs + 1)) {
+			problem(c, t->name, n, "record %u offset %u out of bounds", i, off);
+			return;
+		}
+	}
+
+	// each record's key is compared against the previous one
+	union { hfs_catalog_key_t cat; hfs_extent_key_t ext; } keys[2];
+	int cur = 0;
+	bool ok = true;
+	if(ni->kind == HFS_INDEXNODE && !(ni->children = calloc(ni->nrecs, sizeof(*ni->children)))) {
+		r->nomem = true;
+		return;
+	}
+	for(uint16_t i = 0; i < ni->nrecs && ok; i++) {
+		uint16_t off = be16(offsets - 2*i), size = be16(offsets - 2*(i+1)) - off;
+		const uint8_t* rec = buf + off;
+		uint16_t keylen = t->keyfieldsize == 2 ? be16(rec) : rec[0];
+		if(t->keyfieldsize + keylen + (ni->kind == HFS_INDEXNODE ? 4 : 0) > size) {
+			problem(c, t->name, n, "record %u key length %u overruns the record", i, keylen);
+			ok = false;
+			break;
+		}
+		// the libhfs readers trust length fields, so give them a padded copy
+		memcpy(scratch, rec, size);
+		memset(scratch + size, 0, 1024);
+
+		size_t used;
+		hfs_catalog_key_t* catkey = &keys[cur].cat;
+		hfs_extent_key_t* extkey = &keys[cur].ext;
+		if(t->btree == HFS_CATALOG_FILE) {
+			hfs_catalog_keyed_record_t crec;
+			int16_t type = ni->kind;
+			uint16_t namelen = keylen >= 6 ? be16(rec + t->keyfieldsize + 4) : 0;
+			if(keylen < 6 || namelen > 255 || keylen != 6 + 2 * namelen) {
+				problem(c, t->name, n, "record %u has a malformed key", i);
+				ok = false;
+				break;
+			}
+			used = hfslib_read_catalog_keyed_record(scratch, &crec, &type, catkey, c->vol);
+			if(ni->kind == HFS_LEAFNODE) {
+				if(type < HFS_REC_FLDR || type > HFS_REC_FILE_THREAD) {
+					problem(c, t->name, n, "record %u has unknown type %d", i, type);
+					ok = false;
+					break;
+				}
+				if(used > size) {
+					problem(c, t->name, n, "record %u overruns its bounds", i);
+					ok = false;
+					break;
+				}
+				r->leaf_records++;
+				if(type == HFS_REC_FLDR || type == HFS_REC_FILE) {
+					r->nomem |= !PUSH(r->records, (struct cat_entry){ crec.file.cnid, catkey->parent_cnid, name_hash(&catkey->name), type, n });
+					if(type == HFS_REC_FILE) {
+						add_fork(r, crec.file.cnid, HFS_DATAFORK, &crec.file.data_fork, false);
+						add_fork(r, crec.file.cnid, HFS_RSRCFORK, &crec.file.rsrc_fork, false);
+					}
+				}
+				else {
+					if(catkey->name.length)
+						problem(c, t->name, n, "thread record %u has a name in its key", i);
+					r->nomem |= !PUSH(r->records, (struct cat_entry){ catkey->parent_cnid, crec.thread.parent_cnid, name_hash(&crec.thread.name), type, n });
+				}
+			}
+		}
+		else {
+			hfs_extent_record_t erec;
+			if(keylen != 10) {
+				problem(c, t->name, n, "record %u key length %u instead of 10", i, keylen);
+				ok = false;
+				break;
+			}
+			used = hfslib_read_extent_record(scratch, &erec, ni->kind, extkey, c->vol);
+			if(ni->kind == HFS_LEAFNODE) {
+				if(used > size) {
+					problem(c, t->name, n, "record %u overruns its bounds", i);
+					ok = false;
+					break;
+				}
+				r->leaf_records++;
+				hfs_fork_t f = {0};
+				memcpy(f.extents, erec, sizeof(erec));
+				add_fork(r, extkey->file_cnid, extkey->fork_type, &f, true);
+			}
+		}
+		if(ni->kind == HFS_INDEXNODE && used > size) {
+			problem(c, t->name, n, "record %u overruns its bounds", i);
+			ok = false;
+			break;
+		}
+
+		if(i && t->keycmp(keys + !cur, keys + cur) >= 0)
+			problem(c, t->name, n, "records %u and %u are out of order", i-1, i);
+		if(ni->kind == HFS_INDEXNODE) {
+			ni->children[i].child = be32(rec + t->keyfieldsize + keylen);
+			ni->children[i].key = key_copy(t, keys + cur);
+			ni->nchildren++;
+		}
+		if(!i)
+			ni->first = key_copy(t, keys + cur);
+		if(i == ni->nrecs - 1)
+			ni->last = key_copy(t, keys + cur);
+		cur = !cur;
+	}
+	ni->valid = ok && ni->first && ni->last;
+}
+
+// hands chunks of the b-tree file from the reading thread to the workers
+struct check_queue {
+	struct check_tree* t;
+	pthread_mutex_t lock;
+	pthread_cond_t job, freed;
+	uint8_t** free;
+	unsigned nfree;
+	struct { uint8_t* buf; uint32_t first, count; }* jobs;
+	unsigned head, njobs, capacity;
+	bool done;
+};
+
+struct check_worker {
+	pthread_t thread;
+	struct check_queue* q;
+	struct check_results results;
+};
+
+static void* check_worker(void* arg) {
+	struct check_worker* w = arg;
+	struct check_queue* q = w->q;
+	struct check_tree* t = q->t;
+	uint8_t* scratch = malloc(t->hr->node_size + 1024);
+	if(!scratch) {
+		w->results.nomem = true;
+		return NULL;
+	}
+	while(1) {
+		pthread_mutex_lock(&q->lock);
+		while(!q->njobs && !q->done)
+			pthread_cond_wait(&q->job, &q->lock);
+		if(!q->njobs) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		uint8_t* buf = q->jobs[q->head].buf;
+		uint32_t first = q->jobs[q->head].first, count = q->jobs[q->head].count;
+		q->head = (q->head + 1) % q->capacity;
+		q->njobs--;
+		pthread_mutex_unlock(&q->lock);
+
+		for(uint32_t i = 0; i < count; i++)
+			if(first + i && node_in_use(t, first + i))
+				check_node(t, &w->results, first + i, buf + (size_t)i * t->hr->node_size, scratch);
+
+		pthread_mutex_lock(&q->lock);
+		q->free[q->nfree++] = buf;
+		pthread_cond_signal(&q->freed);
+		pthread_mutex_unlock(&q->lock);
+	}
+	free(scratch);
+	return NULL;
+}
+
+static int read_nodes(struct check_tree* t, void* buf, uint32_t first, uint32_t count) {
+	uint64_t bytes;
+	size_t length = (size_t)count * t->hr->node_size;
+	if(hfslib_readd_with_extents(t->c->vol, buf, &bytes, length, (uint64_t)first * t->hr->node_size, t->extents, t->nextents, NULL) || bytes != length)
+		return -1;
+	return 0;
+}
+
+// reads the node allocation map from the header node and any map nodes chained to it
+static int read_map(struct check_tree* t) {
+	uint16_t nodesize = t->hr->node_size;
+	size_t mapsize = (t->nnodes + 7) / 8, filled = 0;
+	uint8_t* node = malloc(nodesize);
+	if(!node || !(t->map = calloc(1, mapsize)))
+		goto error;
+	uint32_t n = 0, visited = 0;
+	do {
+		if(read_nodes(t, node, n, 1)) {
+			problem(t->c, t->name, n, "could not be read");
+			goto error;
+		}
+		int8_t kind = node[8];
+		uint16_t nrecs = be16(node+10);
+		if(n ? kind != HFS_MAPNODE : kind != HFS_HEADERNODE || nrecs != 3) {
+			problem(t->c, t->name, n, "is not a valid %s node", n ? "map" : "header");
+			goto error;
+		}
+		// the map is the last record in both the header node and map nodes
+		uint16_t start = be16(node + nodesize - 2*nrecs), end = be16(node + nodesize - 2*(nrecs+1));
+		if(end <= start || end > nodesize) {
+			problem(t->c, t->name, n, "map record out of bounds");
+			goto error;
+		}
+		size_t len = end - start < mapsize - filled ? end - start : mapsize - filled;
+		memcpy(t->map + filled, node + start, len);
+		filled += len;
+		n = be32(node);
+	} while(n && filled < mapsize && ++visited < t->nnodes);
+	// the map covers total_nodes, anything past it is not in use
+	free(node);
+	return 0;
+error:
+	free(node);
+	return -1;
+}
+
+static void check_tree_structure(struct check_tree* t) {
+	struct check* c = t->c;
+	uint32_t leaves = 0, used = 0;
+	uint64_t records = 0;
+
+	for(uint32_t n = 0; n < t->nnodes; n++)
+		used += node_in_use(t, n);
+	if(t->hr->free_nodes != t->nnodes - used)
+		problem(c, t->name, NONE, "header lists %" PRIu32 " free nodes but the map has %" PRIu32, t->hr->free_nodes, t->nnodes - used);
+
+	// sibling links, for every level
+	for(uint32_t n = 1; n < t->nnodes; n++) {
+		struct node_info* ni = t->nodes + n;
+		if(!ni->valid)
+			continue;
+		if(ni->flink && (!node_in_use(t, ni->flink) || t->nodes[ni->flink].blink != n))
+			problem(c, t->name, n, "forward link to %" PRIu32 " is not linked back", ni->flink);
+		else if(ni->flink && t->nodes[ni->flink].valid) {
+			struct node_info* next = t->nodes + ni->flink;
+			if(next->height != ni->height || next->kind != ni->kind)
+				problem(c, t->name, n, "forward link to %" PRIu32 " crosses levels", ni->flink);
+			else if(t->keycmp(ni->last, next->first) >= 0)
+				problem(c, t->name, n, "last key is not less than the first key of next node %" PRIu32, ni->flink);
+		}
+		if(ni->blink && (!node_in_use(t, ni->blink) || t->nodes[ni->blink].flink != n))
+			problem(c, t->name, n, "backward link to %" PRIu32 " is not linked forward", ni->blink);
+	}
+
+	// the leaf chain from first_leaf
+	uint32_t prev = 0, n = t->hr->first_leaf;
+	if(t->hr->leaf_recs || n) {
+		for(; n; prev = n, n = t->nodes[n].flink) {
+			if(!node_in_use(t, n) || !t->nodes[n].valid || t->nodes[n].kind != HFS_LEAFNODE) {
+				problem(c, t->name, n, "in the leaf chain but is not a valid leaf node");
+				break;
+			}
+			if(++leaves > used) {
+				problem(c, t->name, n, "leaf chain loops");
+				break;
+			}
+			records += t->nodes[n].nrecs;
+		}
+		if(!n && prev != t->hr->last_leaf)
+			problem(c, t->name, NONE, "leaf chain ends at %" PRIu32 " but the header's last leaf is %" PRIu32, prev, t->hr->last_leaf);
+		if(!n && records != t->hr->leaf_recs)
+			problem(c, t->name, NONE, "header lists %" PRIu32 " leaf records but the leaves hold %" PRIu64, t->hr->leaf_recs, records);
+	}
+
+	// descend from the root; every index record must point to a node one level down that starts with its key
+	uint32_t* stack = malloc(sizeof(*stack) * (used + 1));
+	size_t depth = 0;
+	if(!stack) {
+		c->results.nomem = true;
+		return;
+	}
+	if(t->hr->root_node) {
+		if(!node_in_use(t, t->hr->root_node) || !t->nodes[t->hr->root_node].valid)
+			problem(c, t->name, t->hr->root_node, "root node is not valid");
+		else if(t->nodes[t->hr->root_node].height != t->hr->tree_depth)
+			problem(c, t->name, t->hr->root_node, "root height %u but the tree depth is %u", t->nodes[t->hr->root_node].height, t->hr->tree_depth);
+		else {
+			t->nodes[t->hr->root_node].reached = true;
+			stack[depth++] = t->hr->root_node;
+		}
+	}
+	while(depth) {
+		struct node_info* ni = t->nodes + stack[--depth];
+		for(uint32_t i = 0; i < ni->nchildren; i++) {
+			uint32_t child = ni->children[i].child;
+			if(!node_in_use(t, child) || !t->nodes[child].valid) {
+				problem(c, t->name, ni - t->nodes, "record %" PRIu32 " points to invalid node %" PRIu32, i, child);
+				continue;
+			}
+			struct node_info* ci = t->nodes + child;
+			if(ci->reached) {
+				problem(c, t->name, ni - t->nodes, "record %" PRIu32 " points to node %" PRIu32 " which is already in the tree", i, child);
+				continue;
+			}
+			ci->reached = true;
+			if(ci->height + 1 != ni->height)
+				problem(c, t->name, ni - t->nodes, "record %" PRIu32 " points to node %" PRIu32 " at height %u", i, child, ci->height);
+			else if(t->keycmp(ni->children[i].key, ci->first))
+				problem(c, t->name, ni - t->nodes, "record %" PRIu32 " key does not match the first key of node %" PRIu32, i, child);
+			if(ci->kind == HFS_INDEXNODE)
+				stack[depth++] = child;
+		}
+	}
+	free(stack);
+
+	for(n = 1; n < t->nnodes; n++)
+		if(node_in_use(t, n) && t->nodes[n].kind != HFS_MAPNODE && !t->nodes[n].reached && t->nodes[n].valid)
+			problem(c, t->name, n, "in use but not reachable from the root");
+
+	fprintf(c->out, "%s: %" PRIu32 " nodes in use, %" PRIu32 " leaves, %" PRIu64 " records, depth %u\n", t->name, used, leaves, records, t->hr->tree_depth);
+}
+
+static int check_btree(struct check* c, hfs_btree_file_type btree) {
+	struct check_tree t = {
+		.c = c,
+		.btree = btree,
+		.name = btree == HFS_CATALOG_FILE ? "catalog" : "extents",
+		.cnid = btree == HFS_CATALOG_FILE ? HFS_CNID_CATALOG : HFS_CNID_EXTENTS,
+		.hr = btree == HFS_CATALOG_FILE ? &c->vol->chr : &c->vol->ehr,
+		.keycmp = btree == HFS_CATALOG_FILE ? c->vol->keycmp : hfslib_compare_extent_keys,
+		.keyfieldsize = btree == HFS_CATALOG_FILE ? c->vol->catkeysizefieldsize : c->vol->extkeysizefieldsize,
+	};
+	hfs_fork_t* fork = btree == HFS_CATALOG_FILE ? &c->vol->vh.catalog_file : &c->vol->vh.extents_file;
+	struct check_queue q = { .t = &t };
+	struct check_worker* workers = NULL;
+	unsigned nworkers = 0, nbufs = c->threads * 2;
+	int ret = -1;
+
+	if(t.hr->node_size < 512 || (t.hr->node_size & (t.hr->node_size - 1))) {
+		problem(c, t.name, NONE, "invalid node size %u", t.hr->node_size);
+		return -1;
+	}
+	t.nnodes = t.hr->total_nodes;
+	if((uint64_t)t.nnodes * t.hr->node_size > fork->logical_size) {
+		problem(c, t.name, NONE, "header lists %" PRIu32 " nodes but the file only holds %" PRIu64, t.nnodes, fork->logical_size / t.hr->node_size);
+		t.nnodes = fork->logical_size / t.hr->node_size;
+	}
+	if(!(t.nextents = hfslib_get_file_extents(c->vol, t.cnid, HFS_DATAFORK, &t.extents, NULL))) {
+		problem(c, t.name, NONE, "could not find the file's extents");
+		return -1;
+	}
+	if(!(t.nodes = calloc(t.nnodes + 1, sizeof(*t.nodes))))
+		goto end;
+	if(read_map(&t))
+		goto end;
+
+	uint32_t pernode = CHECK_CHUNK_SIZE / t.hr->node_size;
+	q.capacity = nbufs;
+	if(!(q.free = calloc(nbufs, sizeof(*q.free))) || !(q.jobs = calloc(nbufs, sizeof(*q.jobs))) || !(workers = calloc(c->threads, sizeof(*workers))))
+		goto end;
+	for(; q.nfree < nbufs; q.nfree++)
+		if(!(q.free[q.nfree] = malloc(CHECK_CHUNK_SIZE)))
+			goto end;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.job, NULL);
+	pthread_cond_init(&q.freed, NULL);
+	for(; nworkers < c->threads; nworkers++) {
+		workers[nworkers].q = &q;
+		if(pthread_create(&workers[nworkers].thread, NULL, check_worker, workers + nworkers))
+			break;
+	}
+
+	// read sequentially, skipping chunks with no nodes in use
+	for(uint32_t first = 0; first < t.nnodes && nworkers; first += pernode) {
+		uint32_t count = t.nnodes - first < pernode ? t.nnodes - first : pernode;
+		bool any = false;
+		for(uint32_t i = 0; i < count && !any; i++)
+			any = node_in_use(&t, first + i);
+		if(!any)
+			continue;
+		pthread_mutex_lock(&q.lock);
+		while(!q.nfree)
+			pthread_cond_wait(&q.freed, &q.lock);
+		uint8_t* buf = q.free[--q.nfree];
+		pthread_mutex_unlock(&q.lock);
+		if(read_nodes(&t, buf, first, count)) {
+			problem(c, t.name, first, "could not read %" PRIu32 " nodes starting here", count);
+			pthread_mutex_lock(&q.lock);
+			q.free[q.nfree++] = buf;
+			pthread_mutex_unlock(&q.lock);
+			continue;
+		}
+		pthread_mutex_lock(&q.lock);
+		unsigned tail = (q.head + q.njobs) % q.capacity;
+		q.jobs[tail].buf = buf;
+		q.jobs[tail].first = first;
+		q.jobs[tail].count = count;
+		q.njobs++;
+		pthread_cond_signal(&q.job);
+		pthread_mutex_unlock(&q.lock);
+	}
+	pthread_mutex_lock(&q.lock);
+	q.done = true;
+	pthread_cond_broadcast(&q.job);
+	pthread_mutex_unlock(&q.lock);
+
+	for(unsigned i = 0; i < nworkers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		struct check_results* r = &workers[i].results;
+		c->results.nomem |= r->nomem || !APPEND(c->results.records, r->records) ||
+			!APPEND(c->results.forks, r->forks) || !APPEND(c->results.extents, r->extents);
+		c->results.leaf_records += r->leaf_records;
+	}
+	pthread_mutex_destroy(&q.lock);
+	pthread_cond_destroy(&q.job);
+	pthread_cond_destroy(&q.freed);
+	if(!nworkers)
+		goto end;
+
+	check_tree_structure(&t);
+	ret = 0;
+
+end:
+	if(q.free)
+		for(unsigned i = 0; i < q.nfree; i++)
+			free(q.free[i]);
+	free(q.free);
+	free(q.jobs);
+	free(workers);
+	if(t.nodes)
+		for(uint32_t n = 0; n < t.nnodes; n++) {
+			free(t.nodes[n].first);
+			free(t.nodes[n].last);
+			for(uint32_t i = 0; i < t.nodes[n].nchildren; i++)
+				free(t.nodes[n].children[i].key);
+			free(t.nodes[n].children);
+		}
+	free(t.nodes);
+	free(t.map);
+	free(t.extents);
+	return ret;
+}
+
+static int cmp_cat_entry(const void* a, const void* b) {
+	const struct cat_entry* x = a,* y = b;
+	if(x->cnid != y->cnid)
+		return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+	// records before their threads
+	return (x->type > y->type) - (x->type < y->type);
+}
+
+static void check_threads(struct check* c) {
+	struct cat_entry* e = c->results.records.data;
+	size_t n = c->results.records.size;
+	uint32_t files = 0, folders = 0;
+	qsort(e, n, sizeof(*e), cmp_cat_entry);
+	for(size_t i = 0; i < n; ) {
+		size_t j = i;
+		while(j < n && e[j].cnid == e[i].cnid)
+			j++;
+		struct cat_entry* rec = NULL,* thread = NULL;
+		for(size_t k = i; k < j; k++) {
+			struct cat_entry** slot = e[k].type <= HFS_REC_FILE ? &rec : &thread;
+			if(*slot)
+				problem(c, "catalog", e[k].node, "duplicate %s for cnid %" PRIu32, e[k].type <= HFS_REC_FILE ? "record" : "thread", e[k].cnid);
+			else *slot = e + k;
+		}
+		if(rec && rec->type == HFS_REC_FILE)
+			files++;
+		else if(rec && rec->cnid != HFS_CNID_ROOT_FOLDER)
+			folders++;
+		if(rec && !thread)
+			problem(c, "catalog", rec->node, "cnid %" PRIu32 " has no thread record", rec->cnid);
+		else if(thread && !rec)
+			problem(c, "catalog", thread->node, "thread for cnid %" PRIu32 " has no file or folder record", thread->cnid);
+		else if(rec && thread) {
+			if(thread->type - HFS_REC_FLDR_THREAD != rec->type - HFS_REC_FLDR)
+				problem(c, "catalog", thread->node, "thread type does not match the record for cnid %" PRIu32, rec->cnid);
+			else if(thread->parent != rec->parent || thread->name != rec->name)
+				problem(c, "catalog", thread->node, "thread for cnid %" PRIu32 " names a different parent or name than its record", rec->cnid);
+		}
+		i = j;
+	}
+	if(files != c->vol->vh.file_count)
+		problem(c, "volume header", NONE, "file count %" PRIu32 " but the catalog has %" PRIu32, c->vol->vh.file_count, files);
+	if(folders != c->vol->vh.folder_count)
+		problem(c, "volume header", NONE, "folder count %" PRIu32 " but the catalog has %" PRIu32, c->vol->vh.folder_count, folders);
+}
+
+static int cmp_fork(const void* a, const void* b) {
+	const struct fork_entry* x = a,* y = b;
+	if(x->cnid != y->cnid)
+		return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+	return (x->fork > y->fork) - (x->fork < y->fork);
+}
+
+static int cmp_extent_owner(const void* a, const void* b) {
+	const struct extent_use* x = a,* y = b;
+	if(x->cnid != y->cnid)
+		return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+	return (x->fork > y->fork) - (x->fork < y->fork);
+}
+
+static int cmp_extent_start(const void* a, const void* b) {
+	const struct extent_use* x = a,* y = b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static inline bool block_allocated(const uint8_t* bitmap, uint32_t block) {
+	return bitmap[block / 8] & (0x80 >> (block % 8));
+}
+
+// overflow extents that no fork sorted before, or the last fork. the bad block file has no catalog
+// record, only overflow extents, so its extents have none to match
+static void check_unmatched_extent(struct check* c, const struct extent_use* x) {
+	if(x->overflow && x->cnid != HFS_CNID_BADBLOCKS)
+		problem(c, "extents", NONE, "overflow extents for cnid %" PRIu32 " fork %u have no matching fork", x->cnid, x->fork);
+}
+
+// forks must be fully mapped by their extents, and extents must be allocated and not shared
+static void check_allocation(struct check* c) {
+	hfs_volume* vol = c->vol;
+	struct check_results* r = &c->results;
+	add_fork(r, HFS_CNID_EXTENTS, HFS_DATAFORK, &vol->vh.extents_file, false);
+	add_fork(r, HFS_CNID_CATALOG, HFS_DATAFORK, &vol->vh.catalog_file, false);
+	add_fork(r, HFS_CNID_ALLOCATION, HFS_DATAFORK, &vol->vh.allocation_file, false);
+	add_fork(r, HFS_CNID_STARTUP, HFS_DATAFORK, &vol->vh.startup_file, false);
+	add_fork(r, HFS_CNID_ATTRIBUTES, HFS_DATAFORK, &vol->vh.attributes_file, false);
+	if(r->nomem)
+		return;
+
+	// overflow extents are matched to their forks by owner
+	struct extent_use* ext = r->extents.data;
+	size_t next = r->extents.size;
+	qsort(ext, next, sizeof(*ext), cmp_extent_owner);
+	qsort(r->forks.data, r->forks.size, sizeof(*r->forks.data), cmp_fork);
+	size_t e = 0;
+	for(size_t i = 0; i < r->forks.size; i++) {
+		struct fork_entry* f = r->forks.data + i;
+		uint64_t overflow = 0;
+		for(; e < next && cmp_extent_owner(ext + e, &(struct extent_use){ .cnid = f->cnid, .fork = f->fork }) < 0; e++)
+			check_unmatched_extent(c, ext + e);
+		for(; e < next && ext[e].cnid == f->cnid && ext[e].fork == f->fork; e++)
+			overflow += ext[e].overflow ? ext[e].count : 0;
+		if(f->mapped + overflow != f->blocks)
+			problem(c, NULL, NONE, "cnid %" PRIu32 " %s fork has %" PRIu32 " blocks but its extents cover %" PRIu64,
+				f->cnid, f->fork == HFS_DATAFORK ? "data" : "resource", f->blocks, f->mapped + overflow);
+	}
+	for(; e < next; e++)
+		check_unmatched_extent(c, ext + e);
+
+	uint32_t total = vol->vh.total_blocks;
+	size_t bitmapsize = (total + 7) / 8;
+	uint8_t* bitmap = malloc(bitmapsize + 1);
+	hfs_extent_descriptor_t* extents = NULL;
+	uint16_t nextents = hfslib_get_file_extents(vol, HFS_CNID_ALLOCATION, HFS_DATAFORK, &extents, NULL);
+	uint64_t bytes;
+	if(!bitmap || !nextents || hfslib_readd_with_extents(vol, bitmap, &bytes, bitmapsize, 0, extents, nextents, NULL) || bytes < bitmapsize) {
+		problem(c, "allocation", NONE, "could not read the allocation file");
+		free(extents);
+		free(bitmap);
+		return;
+	}
+	free(extents);
+
+	qsort(ext, next, sizeof(*ext), cmp_extent_start);
+	uint64_t owned = 0;
+	uint32_t end = 0; size_t last = SIZE_MAX;
+	for(size_t i = 0; i < next; i++) {
+		struct extent_use* x = ext + i;
+		if((uint64_t)x->start + x->count > total) {
+			problem(c, "allocation", NONE, "cnid %" PRIu32 " extent at %" PRIu32 " runs past the end of the volume", x->cnid, x->start);
+			continue;
+		}
+		if(last != SIZE_MAX && x->start < end)
+			problem(c, "allocation", NONE, "blocks %" PRIu32 "-%" PRIu32 " are claimed by both cnid %" PRIu32 " and cnid %" PRIu32,
+				x->start, (end < x->start + x->count ? end : x->start + x->count) - 1, ext[last].cnid, x->cnid);
+		uint32_t unallocated = 0;
+		for(uint32_t b = x->start; b < x->start + x->count; b++)
+			unallocated += !block_allocated(bitmap, b);
+		if(unallocated)
+			problem(c, "allocation", NONE, "cnid %" PRIu32 " extent at %" PRIu32 " has %" PRIu32 " blocks marked free", x->cnid, x->start, unallocated);
+		uint32_t from = x->start > end ? x->start : end;
+		if(x->start + x->count > from)
+			owned += x->start + x->count - from;
+		if(x->start + x->count > end) {
+			end = x->start + x->count;
+			last = i;
+		}
+	}
+
+	uint64_t allocated = 0;
+	for(uint32_t b = 0; b < total; b++)
+		allocated += block_allocated(bitmap, b);
+	// the blocks holding the volume header and its backup belong to no fork
+	uint64_t volsize = (uint64_t)total * vol->vh.block_size;
+	uint32_t reserved = 0;
+	for(uint32_t b = 0; b < total; b++) {
+		uint64_t start = (uint64_t)b * vol->vh.block_size;
+		if(start >= 1536 && start + vol->vh.block_size <= volsize - 1024)
+			b = (volsize - 1024) / vol->vh.block_size - 1;
+		else reserved += block_allocated(bitmap, b);
+	}
+	if(total - allocated != vol->vh.free_blocks)
+		problem(c, "volume header", NONE, "%" PRIu32 " free blocks but the allocation file has %" PRIu64, vol->vh.free_blocks, total - allocated);
+	if(allocated > owned + reserved)
+		problem(c, "allocation", NONE, "%" PRIu64 " blocks are allocated but not used by any fork", allocated - owned - reserved);
+	fprintf(c->out, "allocation: %" PRIu64 " of %" PRIu32 " blocks allocated, %zu extents\n", allocated, total, next);
+	free(bitmap);
+}
+
+long hfs_check(hfs_volume* vol, unsigned threads, FILE* out) {
+	struct check c = { .vol = vol, .out = out, .threads = threads };
+	if(!c.threads)
+		c.threads = hfs_cpu_count();
+	pthread_mutex_init(&c.lock, NULL);
+
+	int err = check_btree(&c, HFS_EXTENTS_FILE) | check_btree(&c, HFS_CATALOG_FILE);
+	if(!err && !c.results.nomem) {
+		check_threads(&c);
+		check_allocation(&c);
+	}
+	if(c.results.nomem) {
+		fprintf(out, "out of memory\n");
+		err = -1;
+	}
+
+	free(c.results.records.data);
+	free(c.results.forks.data);
+	free(c.results.extents.data);
+	pthread_mutex_destroy(&c.lock);
+	return err && !c.problems ? -1 : c.problems;
+}
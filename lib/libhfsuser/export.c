@@ -0,0 +1,274 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "export.h"
+#include "sidecar.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// rows are gathered a batch at a time by each partition of the scan, and each full batch is written to the
+// partition's temporary file transposed, one column after another, so memory stays bounded however large the
+// catalog is. the output's columns are then put together from the batches
+#define EXPORT_BATCH 8192
+
+struct export_row {
+	uint64_t name; // offset into the partition's names until written
+	uint64_t data_size, data_physical, rsrc_size, rsrc_physical;
+	int64_t created, content_modified, attributes_modified, accessed, backed_up;
+	uint32_t cnid, parent, valence, owner, group, finder_type, finder_creator, link_inode;
+	uint16_t mode;
+	uint8_t type;
+};
+
+struct export_part {
+	VECTOR(struct export_row) rows; // the batch being gathered
+	FILE* batches; // every batch before it, EXPORT_BATCH rows each
+	FILE* names;
+	uint64_t nrows, nnames; // written to the files so far
+	int err;
+};
+
+static const struct export_field {
+	const char* name;
+	enum hfs_export_kind kind;
+	uint32_t width;
+	size_t offset;
+} export_fields[] = {
+#define FIELD(member, kind) { #member, kind, sizeof(((struct export_row*)0)->member), offsetof(struct export_row, member) }
+	FIELD(cnid, HFS_EXPORT_UINT),
+	FIELD(parent, HFS_EXPORT_UINT),
+	FIELD(type, HFS_EXPORT_UINT), // HFS_REC_FLDR or HFS_REC_FILE
+	FIELD(name, HFS_EXPORT_OFFSETS),
+	{ "name_heap", HFS_EXPORT_BYTES, 1, 0 },
+	FIELD(data_size, HFS_EXPORT_UINT),
+	FIELD(data_physical, HFS_EXPORT_UINT),
+	FIELD(rsrc_size, HFS_EXPORT_UINT),
+	FIELD(rsrc_physical, HFS_EXPORT_UINT),
+	FIELD(valence, HFS_EXPORT_UINT), // folders only
+	FIELD(created, HFS_EXPORT_INT), // dates are Unix times, 0 if unset
+	FIELD(content_modified, HFS_EXPORT_INT),
+	FIELD(attributes_modified, HFS_EXPORT_INT),
+	FIELD(accessed, HFS_EXPORT_INT),
+	FIELD(backed_up, HFS_EXPORT_INT),
+	FIELD(mode, HFS_EXPORT_UINT), // as stored, 0 if never set
+	FIELD(owner, HFS_EXPORT_UINT),
+	FIELD(group, HFS_EXPORT_UINT),
+	FIELD(finder_type, HFS_EXPORT_UINT), // files only
+	FIELD(finder_creator, HFS_EXPORT_UINT),
+	FIELD(link_inode, HFS_EXPORT_UINT), // inode number a hard link refers to, 0 if not a link
+#undef FIELD
+};
+#define NFIELDS (sizeof(export_fields)/sizeof(*export_fields))
+
+// bytes a row takes in a batch, and where in the row's columns this field starts
+static uint32_t row_width(const struct export_field* until) {
+	uint32_t width = 0;
+	for(const struct export_field* field = export_fields; field < until; field++)
+		if(field->kind != HFS_EXPORT_BYTES)
+			width += field->width;
+	return width;
+}
+
+static int flush_batch(struct export_part* p) {
+	char buf[EXPORT_BATCH * sizeof(uint64_t)];
+	for(const struct export_field* field = export_fields; field < export_fields + NFIELDS; field++) {
+		if(field->kind == HFS_EXPORT_BYTES || !p->rows.size)
+			continue;
+		for(size_t j = 0; j < p->rows.size; j++)
+			memcpy(buf + j*field->width,(char*)(p->rows.data+j) + field->offset,field->width);
+		if(fwrite(buf,p->rows.size * field->width,1,p->batches) != 1)
+			return errno ? -errno : -EIO;
+	}
+	p->nrows += p->rows.size;
+	p->rows.size = 0;
+	return 0;
+}
+
+static int export_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct export_part* p = cookie;
+	if(!p->batches && (!(p->batches = tmpfile()) || !(p->names = tmpfile()))) {
+		p->err = -errno;
+		return -1;
+	}
+	hfs_file_record_t* f = &rec->file; // folder records share the layout up to the finder info
+	char name[512];
+	ssize_t len = hfs_unistr_to_utf8(&key->name,name);
+	if(len < 0)
+		len = 0;
+	struct export_row r = {
+		.name = p->nnames, .cnid = f->cnid, .parent = key->parent_cnid, .type = rec->type,
+		.created = HFSTIMETOEPOCH(f->date_created), .content_modified = HFSTIMETOEPOCH(f->date_content_mod),
+		.attributes_modified = HFSTIMETOEPOCH(f->date_attrib_mod), .accessed = HFSTIMETOEPOCH(f->date_accessed),
+		.backed_up = HFSTIMETOEPOCH(f->date_backedup),
+		.mode = f->bsd.file_mode, .owner = f->bsd.owner_id, .group = f->bsd.group_id
+	};
+	if(rec->type == HFS_REC_FLDR)
+		r.valence = rec->folder.valence;
+	else {
+		r.data_size = f->data_fork.logical_size;
+		r.data_physical = (uint64_t)f->data_fork.total_blocks * vol->vh.block_size;
+		r.rsrc_size = f->rsrc_fork.logical_size;
+		r.rsrc_physical = (uint64_t)f->rsrc_fork.total_blocks * vol->vh.block_size;
+		r.finder_type = f->user_info.file_type;
+		r.finder_creator = f->user_info.file_creator;
+		if((f->user_info.file_creator == HFS_HFSPLUS_CREATOR && f->user_info.file_type == HFS_HARD_LINK_FILE_TYPE) ||
+		   (f->user_info.file_creator == HFS_MACS_CREATOR && f->user_info.file_type == HFS_DIR_HARD_LINK_FILE_TYPE))
+			r.link_inode = f->bsd.special.inode_num;
+	}
+	if(len && fwrite(name,len,1,p->names) != 1) {
+		p->err = errno ? -errno : -EIO;
+		return -1;
+	}
+	p->nnames += len;
+	if(!PUSH(p->rows,r)) {
+		p->err = -ENOMEM;
+		return -1;
+	}
+	if(p->rows.size == EXPORT_BATCH && (p->err = flush_batch(p)))
+		return -1;
+	return 0;
+}
+
+static bool write_padding(FILE* out, uint64_t* pos) {
+	static const char zeros[HFS_EXPORT_ALIGN];
+	size_t pad = (HFS_EXPORT_ALIGN - *pos % HFS_EXPORT_ALIGN) % HFS_EXPORT_ALIGN;
+	*pos += pad;
+	return !pad || fwrite(zeros,pad,1,out) == 1;
+}
+
+// copies one field of every row out of each partition's batches in turn
+static bool write_field(FILE* out, const struct export_field* field, struct export_part* parts, int nparts) {
+	char buf[EXPORT_BATCH * sizeof(uint64_t)];
+	uint64_t width = row_width(export_fields + NFIELDS), start = row_width(field);
+	uint64_t names = 0;
+	for(int i = 0; i < nparts; i++) {
+		struct export_part* p = parts + i;
+		if(!p->batches)
+			continue;
+		if(field->kind == HFS_EXPORT_BYTES) {
+			rewind(p->names);
+			for(size_t n; (n = fread(buf,1,sizeof(buf),p->names)); )
+				if(fwrite(buf,n,1,out) != 1)
+					return false;
+			if(ferror(p->names))
+				return false;
+			continue;
+		}
+		for(uint64_t batch = 0; batch * EXPORT_BATCH < p->nrows; batch++) {
+			size_t n = min(p->nrows - batch * EXPORT_BATCH, EXPORT_BATCH);
+			if(fseeko(p->batches,batch * EXPORT_BATCH * width + n * start,SEEK_SET) || fread(buf,n * field->width,1,p->batches) != 1)
+				return false;
+			if(field->kind == HFS_EXPORT_OFFSETS)
+				for(size_t j = 0; j < n; j++) {
+					uint64_t off;
+					memcpy(&off,buf + j*sizeof(off),sizeof(off));
+					off += names;
+					memcpy(buf + j*sizeof(off),&off,sizeof(off));
+				}
+			if(fwrite(buf,n * field->width,1,out) != 1)
+				return false;
+		}
+		names += p->nnames;
+	}
+	return field->kind != HFS_EXPORT_OFFSETS || fwrite(&names,sizeof(names),1,out) == 1;
+}
+
+int hfs_export_catalog(hfs_volume* vol, FILE* out) {
+	unsigned nthreads = hfs_cpu_count();
+	struct export_part parts[nthreads];
+	void* cookies[nthreads];
+	for(unsigned i = 0; i < nthreads; i++) {
+		parts[i] = (struct export_part){0};
+		cookies[i] = parts + i;
+	}
+
+	int ret = -EIO;
+	hfs_catalog_condition_t records_only = { HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(&records_only,1,&pred,NULL))
+		goto end;
+	int nparts = hfs_scan_catalog(vol,&pred,nthreads,export_visit,cookies);
+	hfslib_free_catalog_predicate(&pred,NULL);
+	if(nparts == -ECANCELED) {
+		ret = -ENOMEM;
+		for(unsigned i = 0; i < nthreads; i++)
+			if(parts[i].err)
+				ret = parts[i].err;
+	}
+	if(nparts <= 0) {
+		if(nparts != -ECANCELED)
+			ret = nparts;
+		goto end;
+	}
+
+	uint64_t rows = 0, names = 0;
+	for(int i = 0; i < nparts; i++) {
+		// the last batch of each partition
+		if(parts[i].batches && ((ret = flush_batch(parts+i)) || (ret = fflush(parts[i].batches) ? -errno : 0)))
+			goto end;
+		rows += parts[i].nrows;
+		names += parts[i].nnames;
+	}
+	struct hfs_export_header h = {
+		.magic = HFS_EXPORT_MAGIC, .version = HFS_EXPORT_VERSION, .byte_order = HFS_EXPORT_BYTE_ORDER,
+		.rows = rows, .volume_id = hfs_volume_id(vol), .columns = NFIELDS
+	};
+	struct hfs_export_column columns[NFIELDS] = {{{0}}};
+	uint64_t pos = sizeof(h) + sizeof(columns);
+	for(size_t i = 0; i < NFIELDS; i++) {
+		const struct export_field* field = export_fields + i;
+		strncpy(columns[i].name,field->name,sizeof(columns[i].name));
+		columns[i].kind = field->kind;
+		columns[i].width = field->width;
+		pos += (HFS_EXPORT_ALIGN - pos % HFS_EXPORT_ALIGN) % HFS_EXPORT_ALIGN;
+		columns[i].offset = pos;
+		columns[i].size = field->kind == HFS_EXPORT_BYTES ? names : (rows + (field->kind == HFS_EXPORT_OFFSETS)) * columns[i].width;
+		pos += columns[i].size;
+	}
+
+	ret = -EIO;
+	pos = sizeof(h) + sizeof(columns);
+	if(fwrite(&h,sizeof(h),1,out) != 1 || fwrite(columns,sizeof(columns),1,out) != 1)
+		goto end;
+	for(size_t i = 0; i < NFIELDS; i++) {
+		if(!write_padding(out,&pos) || !write_field(out,export_fields+i,parts,nparts))
+			goto end;
+		pos += columns[i].size;
+	}
+	ret = fflush(out) ? -errno : 0;
+
+end:
+	for(unsigned i = 0; i < nthreads; i++) {
+		free(parts[i].rows.data);
+		if(parts[i].batches)
+			fclose(parts[i].batches);
+		if(parts[i].names)
+			fclose(parts[i].names);
+	}
+	return ret;
+}
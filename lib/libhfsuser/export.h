@@ -0,0 +1,65 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_EXPORT_H
+#define HFSUSER_EXPORT_H
+
+#include <stdint.h>
+
+// A catalog export is a header, a directory of columns, and then each column as
+// a contiguous array starting on a 64 byte boundary, so the file can be mapped
+// and its columns used in place. Integers are in the byte order of the machine
+// that wrote the file, given by byte_order. Row i of every column describes the
+// same file or folder, and rows are in catalog order.
+#define HFS_EXPORT_MAGIC "HFSCOLS\0"
+#define HFS_EXPORT_VERSION 1
+#define HFS_EXPORT_BYTE_ORDER 0x01020304
+#define HFS_EXPORT_ALIGN 64
+
+enum hfs_export_kind {
+	HFS_EXPORT_UINT,    // unsigned integers of the column's width
+	HFS_EXPORT_INT,     // signed integers of the column's width
+	HFS_EXPORT_OFFSETS, // rows+1 uint64_t offsets: row i spans [offsets[i],offsets[i+1]) of the next column
+	HFS_EXPORT_BYTES    // string heap for the preceding offsets column, UTF-8 without terminators
+};
+
+struct hfs_export_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t rows;
+	uint64_t volume_id;
+	uint32_t columns;
+	uint32_t reserved;
+};
+
+struct hfs_export_column {
+	char name[24]; // NUL padded
+	uint32_t kind;
+	uint32_t width; // bytes per element
+	uint64_t offset; // from the start of the file
+	uint64_t size; // in bytes, excluding alignment padding
+};
+
+#endif
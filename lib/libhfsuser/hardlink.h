@@ -0,0 +1,61 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_HARDLINK_H
+#define HFSUSER_HARDLINK_H
+
+#include "hfsuser.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// helpers for catalog scans to recognize hard link targets, which live in the
+// private metadata folders as iNode<n> files and dir_<n> folders
+
+static inline bool hfs_key_equals(const hfs_catalog_key_t* a, const hfs_catalog_key_t* b) {
+	return a->parent_cnid == b->parent_cnid && a->name.length == b->name.length &&
+	       !memcmp(a->name.unicode, b->name.unicode, a->name.length * sizeof(*a->name.unicode));
+}
+
+// parses the inode number out of private names like iNode123 and dir_123
+static inline bool hfs_parse_inode_name(const hfs_unistr255_t* name, const char* prefix, uint32_t* inode) {
+	size_t len = strlen(prefix);
+	if(name->length <= len || name->length > len + 10)
+		return false;
+	for(size_t i = 0; i < len; i++)
+		if(name->unicode[i] != (unsigned char)prefix[i])
+			return false;
+	uint64_t num = 0;
+	for(size_t i = len; i < name->length; i++) {
+		if(name->unicode[i] < '0' || name->unicode[i] > '9')
+			return false;
+		num = num * 10 + name->unicode[i] - '0';
+	}
+	if(num > UINT32_MAX)
+		return false;
+	*inode = num;
+	return true;
+}
+
+#endif
@@ -46,80 +46,132 @@
 #include "ublio.h"
 #endif
 
+#include "blockcache.h"
+#include "cache.h"
+#include "links.h"
+#include "manifest.h"
+#include "replica.h"
+#include "search.h"
+#include "shards.h"
+#include "sidecar.h"
+#include "usage.h"
 
-#define RING_BUFFER_SIZE 1024
 
-struct recordcache {
-	struct recordcache* next,* prev;
-	char* path;
+struct hf_record {
 	hfs_catalog_keyed_record_t record;
 	hfs_catalog_key_t key;
-}* head;
+};
 
-pthread_rwlock_t cachelock;
+struct hf_device {
+	int fd;
+	uint32_t blksize;
+	size_t prefetch_size;
+	struct hfs_cache* cache;
+	struct hfs_cache* data_cache;
+	struct hf_record root; // folder that lookups start from, if not the volume root
+	char* sidecar_dir;
+	// opened by the first read after libhfs has loaded the volume header
+	struct hfs_block_cache* blocks;
+	bool reloading; // reads bypass the block cache while the headers are probed
+	char* block_cache_dir;
+	uint64_t block_cache_size;
+	bool block_cache_data;
+	// samples the device blocks read below the caches
+	struct hfs_shards* block_mrc;
+	// built on first use
+	struct hfs_usage_table* usage;
+	struct hfs_link_table* links;
+	struct hfs_search_index* search;
+	pthread_mutex_t index_lock;
+	// files a batch job said it will read
+	struct hfs_manifest* manifest;
+	pthread_mutex_t manifest_lock;
+	// copies of the device, opened and checked against it by the first read after libhfs has loaded the volume header
+	char** replica_paths;
+	size_t nreplica_paths;
+	bool replicas_checked;
+	bool replicas_started; // reads go to the device alone until hfs_start_replicas
+	double hedge_percentile;
+	int replica_fds[HFS_REPLICAS_MAX]; // the device's own fd first
+	unsigned nreplica_fds;
+	struct hfs_replicas* replicas;
+#ifdef HAVE_UBLIO
+	ublio_filehandle_t ubfh;
+	pthread_mutex_t ubmtx;
+#endif
+};
 
-void ringbuffer_init() {
-	pthread_rwlock_init(&cachelock,NULL);
-	pthread_rwlock_wrlock(&cachelock);
-	struct recordcache* tail = head = malloc(sizeof(*head));
-	head->path = NULL;
-	for(int i = 0; i < RING_BUFFER_SIZE; i++) {
-		tail->next = malloc(sizeof(*tail));
-		tail->next->prev = tail;
-		tail = tail->next;
-		tail->path = NULL;
-	}
-	tail->next = head;
-	head->prev = tail;
-	pthread_rwlock_unlock(&cachelock);
+static inline struct hfs_cache* hfs_volume_cache(hfs_volume* vol) {
+	return vol->cbdata ? ((struct hf_device*)vol->cbdata)->cache : NULL;
 }
 
-void ringbuffer_destroy() {
-	if(!head)
-		return;
-	pthread_rwlock_wrlock(&cachelock);
-	struct recordcache* end = head;
-	do {
-		free(head->path);
-		struct recordcache* tmp = head->next;
-		free(head);
-		head = tmp;
-	} while(head != end);
-	pthread_rwlock_unlock(&cachelock);
-	pthread_rwlock_destroy(&cachelock);
-}
-
-bool ringbuffer_lookup(const char* path, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key) {
-	if(!head)
+static bool record_cache_lookup(hfs_volume* vol, const void* path, size_t len, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key) {
+	struct hf_record r;
+	if(!hfs_cache_lookup(hfs_volume_cache(vol),HFS_CACHE_RECORDS,path,len,&r,sizeof(r)))
 		return false;
-	bool ret = false;
-	pthread_rwlock_rdlock(&cachelock);
-	struct recordcache* it = head;
-	do {
-		if(!it->path) break;
-		if(!strcmp(it->path,path)) {
-			*record = it->record;
-			*key = it->key;
-			ret = true;
-			break;
-		}
-		it = it->next;
-	} while(it != head);
-	pthread_rwlock_unlock(&cachelock);
-	return ret;
+	*record = r.record;
+	*key = r.key;
+	return true;
 }
 
-void ringbuffer_add(const char* path, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key) {
-	if(!head)
-		return;
-	pthread_rwlock_wrlock(&cachelock);
-	struct recordcache* tail = head->prev;
-	tail->path = realloc(tail->path,strlen(path)+1);
-	strcpy(tail->path,path);
-	tail->key = *key;
-	tail->record = *record;
-	head = tail;
-	pthread_rwlock_unlock(&cachelock);
+static void record_cache_add(hfs_volume* vol, const void* path, size_t len, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key) {
+	struct hf_record r = { *record, *key };
+	hfs_cache_insert(hfs_volume_cache(vol),HFS_CACHE_RECORDS,path,len,&r,sizeof(r));
+}
+
+static inline unichar_t fold(unichar_t c) {
+	unichar_t table = hfs_gcft[c >> 8];
+	return table ? hfs_gcft[table + (c & 0xFF)] : c;
+}
+
+// on case insensitive volumes, records are cached by the path as the catalog compares it, decomposed and case
+// folded with the same table, with a 0 for each separator. every casing of a name then shares one entry.
+// returns the malloc'd key and its length in bytes, or NULL to cache by the path as given
+static unichar_t* record_cache_key(hfs_volume* vol, const char* path, size_t* len) {
+	if(vol->keycmp != hfslib_compare_catalog_keys_cf)
+		return NULL;
+	size_t pathlen = strlen(path), n = 0;
+	bool ascii = true;
+	for(const char* it = path; *it && ascii; it++)
+		ascii = !(*it & 0x80);
+	// decomposition takes at most two UTF-16 units per byte of UTF-8
+	unichar_t* out = malloc((ascii ? pathlen : 2*pathlen) * sizeof(*out) + 1);
+	if(!out)
+		return NULL;
+	if(ascii) {
+		// already decomposed, with names' colons stored as slashes
+		for(const char* it = path; *it; it++)
+			if(*it == '/')
+				out[n++] = 0;
+			else if((out[n] = fold(*it == ':' ? '/' : *it)))
+				n++;
+	}
+	else {
+		char* copy = strdup(path);
+		char* it = copy,* name;
+		while(copy && (name = strsep(&it,"/"))) {
+			hfs_unistr255_t u;
+			if(name != copy)
+				out[n++] = 0;
+			if(!*name)
+				continue;
+			if(hfs_pathname_from_unix(name,&u) < 0) {
+				free(copy);
+				copy = NULL;
+				break;
+			}
+			for(uint16_t i = 0; i < u.length; i++)
+				if((out[n] = fold(u.unicode[i])))
+					n++;
+		}
+		if(!copy) {
+			free(out);
+			return NULL;
+		}
+		free(copy);
+	}
+	*len = n * sizeof(*out);
+	return out;
 }
 
 ssize_t hfs_unistr_to_utf8(const hfs_unistr255_t* u16, char u8[512]) {
@@ -218,6 +270,24 @@ ssize_t hfs_pathname_from_unix(const char* u8, hfs_unistr255_t* u16) {
 	return err ? err : u16->length;
 }
 
+int hfs_set_root(hfs_volume* vol, hfs_cnid_t cnid) {
+	struct hf_device* dev = vol->cbdata;
+	struct hf_record root;
+	if(hfslib_find_catalog_record_with_cnid(vol,cnid,&root.record,&root.key,NULL))
+		return -ENOENT;
+	if(root.record.type != HFS_REC_FLDR)
+		return -ENOTDIR;
+	dev->root = root;
+	// cached paths were relative to the old root
+	hfs_cache_clear(dev->cache);
+	return 0;
+}
+
+hfs_cnid_t hfs_get_root(hfs_volume* vol) {
+	struct hf_device* dev = vol->cbdata;
+	return dev->root.record.type ? dev->root.record.folder.cnid : HFS_CNID_ROOT_FOLDER;
+}
+
 // libhfs has `hfslib_path_elements_to_cnid` but we want to be able to use our hfs_pathname_to_unix on the individual elements
 char* hfs_get_path(hfs_volume* vol, hfs_cnid_t cnid) {
 	hfs_thread_record_t	parent_thread;
@@ -226,7 +296,10 @@ char* hfs_get_path(hfs_volume* vol, hfs_cnid_t cnid) {
 	size_t len = 0;
 	char* out = NULL;
 
-	while(cnid != HFS_CNID_ROOT_FOLDER) {
+	hfs_cnid_t root = hfs_get_root(vol);
+	while(cnid != root) {
+		if(cnid == HFS_CNID_ROOT_PARENT) // outside of the mounted subtree
+			goto end;
 		if(!(newelements = realloc(elements, sizeof(*elements) * (size+1))))
 			goto end;
 		elements = newelements;
@@ -258,15 +331,42 @@ end:
 	return out;
 }
 
+char* hfs_get_hard_link_path(hfs_volume* vol, const struct hfs_hard_link* link) {
+	char* parent = hfs_get_path(vol, link->parent);
+	if(!parent)
+		return NULL;
+	size_t len = strlen(parent);
+	char* out = realloc(parent, len + (len > 1) + strlen(link->name) + 1);
+	if(!out) {
+		free(parent);
+		return NULL;
+	}
+	if(len > 1)
+		out[len++] = '/';
+	strcpy(out + len, link->name);
+	return out;
+}
+
 int hfs_lookup(hfs_volume* vol, const char* path, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key, uint8_t* fork) {
-#define RET(val) do{ free(splitpath); return -val; } while(0)
+#define RET(val) do{ free(splitpath); free(folded); return -val; } while(0)
 	if(fork) *fork = HFS_DATAFORK;
-	if(ringbuffer_lookup(path,record,key))
+	size_t cachelen = strlen(path);
+	unichar_t* folded = record_cache_key(vol,path,&cachelen);
+	const void* cachekey = folded ? (const void*)folded : path;
+	if(record_cache_lookup(vol,cachekey,cachelen,record,key)) {
+		free(folded);
 		return 0;
-	if(hfslib_find_catalog_record_with_cnid(vol,HFS_CNID_ROOT_FOLDER,record,key,NULL)) return -7;
+	}
+	struct hf_device* dev = vol->cbdata;
+	char* splitpath = NULL;
+	if(dev->root.record.type) {
+		*record = dev->root.record;
+		*key = dev->root.key;
+	}
+	else if(hfslib_find_catalog_record_with_cnid(vol,HFS_CNID_ROOT_FOLDER,record,key,NULL)) RET(7);
 	int ret;
 	hfs_unistr255_t upath;
-	char* splitpath = strdup(path);
+	splitpath = strdup(path);
 	char* splitptr  = splitpath+1;
 	char* pelem;
 	while(record->type == HFS_REC_FLDR && (pelem = strsep(&splitptr,"/")) && *pelem) {
@@ -282,18 +382,271 @@ int hfs_lookup(hfs_volume* vol, const char* path, hfs_catalog_keyed_record_t* re
 		if(record->type != HFS_REC_FILE || strcmp(splitptr,"rsrc")) RET(5);
 		else if(fork) *fork = HFS_RSRCFORK;
 	}
-	free(splitpath);
 	if(record->type == HFS_REC_FILE &&
 	   record->file.user_info.file_creator == HFS_HFSPLUS_CREATOR && record->file.user_info.file_type == HFS_HARD_LINK_FILE_TYPE &&
 	   hfslib_get_hardlink(vol, record->file.bsd.special.inode_num, record, NULL))
-		return -6;
+		RET(6);
 	if(!splitptr) // don't cache rsrc lookups
-		ringbuffer_add(path,record,key);
+		record_cache_add(vol,cachekey,cachelen,record,key);
+	free(splitpath);
+	free(folded);
 	return 0;
 #undef RET
 }
 
 
+uint16_t hfs_get_file_extents(hfs_volume* vol, hfs_cnid_t cnid, uint8_t fork, hfs_extent_descriptor_t** extents) {
+	struct hfs_cache* cache = hfs_volume_cache(vol);
+	uint32_t key[2] = { cnid, fork };
+	size_t size;
+	if((*extents = hfs_cache_lookup_alloc(cache,HFS_CACHE_EXTENTS,key,sizeof(key),&size)))
+		return size / sizeof(**extents);
+	uint16_t nextents = hfslib_get_file_extents(vol,cnid,fork,extents,NULL);
+	if(nextents)
+		hfs_cache_insert(cache,HFS_CACHE_EXTENTS,key,sizeof(key),*extents,nextents*sizeof(**extents));
+	return nextents;
+}
+
+// file data is cached in blocks of this size, keyed by the inode's cnid so every hard link to a file shares them
+#define DATA_BLOCK_SIZE (64*1024)
+// blocks missing in a row are read from the device together, up to this many
+#define DATA_READ_BLOCKS 16
+
+// copies the part of a cached block that falls in the requested range
+static uint64_t copy_block(uint8_t* out, uint64_t offset, uint64_t length, const uint8_t* block, uint64_t start, uint64_t size) {
+	uint64_t lo = max(start,offset), hi = min(start + size,offset + length);
+	if(lo >= hi)
+		return 0;
+	memcpy(out + (lo - offset),block + (lo - start),hi - lo);
+	return hi - lo;
+}
+
+int hfs_read_fork(hfs_volume* vol, hfs_cnid_t cnid, uint8_t fork, hfs_extent_descriptor_t* extents, uint16_t nextents, void* buf, uint64_t* bytes, uint64_t length, uint64_t offset) {
+	struct hf_device* dev = vol->cbdata;
+	if(!dev->data_cache || !nextents)
+		return hfslib_readd_with_extents(vol,buf,bytes,length,offset,extents,nextents,NULL);
+	uint64_t end = 0;
+	for(uint16_t i = 0; i < nextents; i++)
+		end += (uint64_t)extents[i].block_count * vol->vh.block_size;
+	*bytes = 0;
+	if(offset >= end)
+		return 0;
+	length = min(length,end - offset);
+	uint64_t nblocks = (offset + length - 1) / DATA_BLOCK_SIZE - offset / DATA_BLOCK_SIZE + 1;
+	uint8_t* blocks = malloc((size_t)min(nblocks,DATA_READ_BLOCKS) * DATA_BLOCK_SIZE);
+	if(!blocks)
+		return -ENOMEM;
+	int ret = 0;
+	uint64_t key[2] = { (uint64_t)cnid << 8 | fork };
+	for(uint64_t b = offset / DATA_BLOCK_SIZE; b * DATA_BLOCK_SIZE < offset + length; ) {
+		uint64_t start = b * DATA_BLOCK_SIZE;
+		// the run of blocks missing from here, stopping early at one that's cached
+		uint32_t run = 0;
+		bool hit = false;
+		while(run < DATA_READ_BLOCKS && start + (uint64_t)run * DATA_BLOCK_SIZE < offset + length) {
+			uint64_t s = start + (uint64_t)run * DATA_BLOCK_SIZE;
+			key[1] = b + run;
+			if((hit = hfs_cache_lookup(dev->data_cache,HFS_CACHE_DATA,key,sizeof(key),blocks + (size_t)run * DATA_BLOCK_SIZE,min(DATA_BLOCK_SIZE,end - s))))
+				break;
+			run++;
+		}
+		if(run) {
+			uint64_t read, size = min((uint64_t)run * DATA_BLOCK_SIZE,end - start);
+			if((ret = hfslib_readd_with_extents(vol,blocks,&read,size,start,extents,nextents,NULL)))
+				break;
+			bool short_read = false;
+			for(uint32_t i = 0; i < run && !short_read; i++) {
+				uint64_t s = start + (uint64_t)i * DATA_BLOCK_SIZE, len = min(DATA_BLOCK_SIZE,end - s);
+				uint64_t got = read > s - start ? min(len,read - (s - start)) : 0;
+				// a block the device came up short on is passed on as far as it was read, but not cached
+				if((short_read = got < len))
+					len = got;
+				else {
+					key[1] = b + i;
+					hfs_cache_insert(dev->data_cache,HFS_CACHE_DATA,key,sizeof(key),blocks + (size_t)i * DATA_BLOCK_SIZE,len);
+				}
+				*bytes += copy_block(buf,offset,length,blocks + (size_t)i * DATA_BLOCK_SIZE,s,len);
+			}
+			if(short_read)
+				break;
+		}
+		if(hit) {
+			uint64_t s = start + (uint64_t)run * DATA_BLOCK_SIZE;
+			*bytes += copy_block(buf,offset,length,blocks + (size_t)run * DATA_BLOCK_SIZE,s,min(DATA_BLOCK_SIZE,end - s));
+			run++;
+		}
+		b += run;
+	}
+	free(blocks);
+	return ret;
+}
+
+// directory contents are cached as the record array followed by each name's length and UTF-16 units
+int hfs_get_directory_contents(hfs_volume* vol, hfs_cnid_t cnid, hfs_catalog_keyed_record_t** keys, hfs_unistr255_t** names, uint32_t* count) {
+	struct hfs_cache* cache = hfs_volume_cache(vol);
+	size_t size;
+	char* packed = hfs_cache_lookup_alloc(cache,HFS_CACHE_DIRS,&cnid,sizeof(cnid),&size);
+	if(packed) {
+		memcpy(count,packed,sizeof(*count));
+		*keys = malloc(sizeof(**keys) * *count + 1);
+		*names = malloc(sizeof(**names) * *count + 1);
+		if(!(*keys && *names)) {
+			free(*keys);
+			free(*names);
+			free(packed);
+			return -ENOMEM;
+		}
+		char* it = packed + sizeof(*count);
+		memcpy(*keys,it,sizeof(**keys) * *count);
+		it += sizeof(**keys) * *count;
+		for(uint32_t i = 0; i < *count; i++) {
+			memcpy(&(*names)[i].length,it,sizeof((*names)[i].length));
+			it += sizeof((*names)[i].length);
+			memcpy((*names)[i].unicode,it,(*names)[i].length * sizeof(unichar_t));
+			it += (*names)[i].length * sizeof(unichar_t);
+		}
+		free(packed);
+		return 0;
+	}
+
+	int ret = hfslib_get_directory_contents(vol,cnid,keys,names,count,NULL);
+	if(ret || !cache)
+		return ret;
+	size = sizeof(*count) + sizeof(**keys) * *count;
+	for(uint32_t i = 0; i < *count; i++)
+		size += sizeof((*names)[i].length) + (*names)[i].length * sizeof(unichar_t);
+	if(!(packed = malloc(size)))
+		return 0;
+	char* it = packed;
+	memcpy(it,count,sizeof(*count));
+	it += sizeof(*count);
+	memcpy(it,*keys,sizeof(**keys) * *count);
+	it += sizeof(**keys) * *count;
+	for(uint32_t i = 0; i < *count; i++) {
+		memcpy(it,&(*names)[i].length,sizeof((*names)[i].length));
+		it += sizeof((*names)[i].length);
+		memcpy(it,(*names)[i].unicode,(*names)[i].length * sizeof(unichar_t));
+		it += (*names)[i].length * sizeof(unichar_t);
+	}
+	hfs_cache_insert(cache,HFS_CACHE_DIRS,&cnid,sizeof(cnid),packed,size);
+	free(packed);
+	return 0;
+}
+
+// a hint only: the device reads below go through the OS cache, so warming it
+// turns the first reads of a file into cache hits without blocking open()
+static void prefetch_range(struct hf_device* dev, off_t offset, off_t length) {
+#if defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(dev->fd, offset, length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	struct radvisory ra = { .ra_offset = offset, .ra_count = min(length,INT_MAX) };
+	fcntl(dev->fd, F_RDADVISE, &ra);
+#endif
+}
+
+void hfs_prefetch_range(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t offset, uint64_t length) {
+	struct hf_device* dev = vol->cbdata;
+	for(uint16_t i = 0; i < nextents && length; i++) {
+		uint64_t size = (uint64_t)extents[i].block_count * vol->vh.block_size;
+		if(offset >= size) {
+			offset -= size;
+			continue;
+		}
+		uint64_t n = min(size - offset, length);
+		prefetch_range(dev, vol->offset + (uint64_t)extents[i].start_block * vol->vh.block_size + offset, n);
+		offset = 0;
+		length -= n;
+	}
+}
+
+void hfs_prefetch_head(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t size) {
+	struct hf_device* dev = vol->cbdata;
+	hfs_prefetch_range(vol, extents, nextents, 0, min(size,dev->prefetch_size));
+}
+
+int hfs_prefetch_manifest(hfs_volume* vol, const char* const paths[], size_t count, uint64_t window, bool append) {
+	struct hf_device* dev = vol->cbdata;
+	// resolving the paths takes a lookup each, so build the list aside and hold the lock only to swap it in
+	struct hfs_manifest* m = NULL;
+	int ret = 0;
+	if(count) {
+		if(!(m = hfs_manifest_create(window ? window : HFS_DEFAULT_PREFETCH_WINDOW)))
+			return -ENOMEM;
+		if((ret = hfs_manifest_add(m,vol,paths,count)) < 0) {
+			hfs_manifest_free(m);
+			return ret;
+		}
+	}
+	struct hfs_manifest* old = NULL;
+	pthread_mutex_lock(&dev->manifest_lock);
+	if(append && dev->manifest) {
+		int err = m ? hfs_manifest_merge(dev->manifest,m,vol) : 0;
+		if(err)
+			ret = err;
+	}
+	else {
+		old = dev->manifest;
+		if((dev->manifest = m))
+			hfs_manifest_start(m,vol);
+	}
+	pthread_mutex_unlock(&dev->manifest_lock);
+	hfs_manifest_free(old);
+	return ret;
+}
+
+void hfs_prefetch_opened(hfs_volume* vol, hfs_cnid_t cnid) {
+	struct hf_device* dev = vol->cbdata;
+	pthread_mutex_lock(&dev->manifest_lock);
+	if(dev->manifest)
+		hfs_manifest_opened(dev->manifest,vol,cnid);
+	pthread_mutex_unlock(&dev->manifest_lock);
+}
+
+int hfs_get_folder_usage(hfs_volume* vol, hfs_cnid_t cnid, struct hfs_folder_usage* usage) {
+	struct hf_device* dev = vol->cbdata;
+	int ret = 0;
+	pthread_mutex_lock(&dev->index_lock);
+	if(!dev->usage && !(dev->usage = hfs_usage_scan(vol)))
+		ret = -EIO;
+	else if(!hfs_usage_lookup(dev->usage,cnid,usage))
+		ret = -ENOENT;
+	pthread_mutex_unlock(&dev->index_lock);
+	return ret;
+}
+
+int hfs_get_hard_links(hfs_volume* vol, uint32_t inode, struct hfs_hard_link** links, uint32_t* count) {
+	struct hf_device* dev = vol->cbdata;
+	int ret;
+	pthread_mutex_lock(&dev->index_lock);
+	if(!dev->links && !(dev->links = hfs_links_load(vol)))
+		ret = -EIO;
+	else ret = hfs_links_lookup(dev->links,inode,links,count);
+	pthread_mutex_unlock(&dev->index_lock);
+	return ret;
+}
+
+int hfs_search_names(hfs_volume* vol, const char* substring, hfs_cnid_t** cnids, uint32_t* count) {
+	struct hf_device* dev = vol->cbdata;
+	int ret;
+	pthread_mutex_lock(&dev->index_lock);
+	if(!dev->search && !(dev->search = hfs_search_index_load(vol)))
+		ret = -EIO;
+	else ret = hfs_search_index_query(dev->search,substring,cnids,count);
+	pthread_mutex_unlock(&dev->index_lock);
+	return ret;
+}
+
+int hfs_device_fd(hfs_volume* vol, uint32_t* blksize) {
+	struct hf_device* dev = vol->cbdata;
+	if(blksize)
+		*blksize = dev->blksize;
+	return dev->fd;
+}
+
+const char* hfs_sidecar_dir(hfs_volume* vol) {
+	return vol->cbdata ? ((struct hf_device*)vol->cbdata)->sidecar_dir : NULL;
+}
+
 #define HFSTIMETOSPEC(x) ((struct timespec){ .tv_sec = HFSTIMETOEPOCH(x) })
 
 void hfs_stat(hfs_volume* vol, hfs_catalog_keyed_record_t* key, struct stat* st, uint8_t fork) {
@@ -369,15 +722,6 @@ void hfs_serialize_finderinfo(hfs_catalog_keyed_record_t* rec, char buf[32]) {
 	}
 }
 
-struct hf_device {
-	int fd;
-	uint32_t blksize;
-#ifdef HAVE_UBLIO
-	ublio_filehandle_t ubfh;
-	pthread_mutex_t ubmtx;
-#endif
-};
-
 #ifdef __APPLE__
 #include <sys/disk.h>
 #define DISKBLOCKSIZE DKIOCGETPHYSICALBLOCKSIZE
@@ -394,7 +738,150 @@ struct hf_device {
 
 #define BAIL(e) do { errno = e; goto error; } while(0)
 
+// reads straight from the device or one of its copies, past ublio's buffers and the block cache, whole device blocks at a time
+static int raw_read(int fd, uint32_t blksize, void* buf, size_t length, off_t offset) {
+	off_t start = offset / blksize * blksize;
+	size_t span = (offset - start + length + blksize - 1) / blksize * blksize;
+	char* tmp = malloc(span);
+	if(!tmp)
+		return -ENOMEM;
+	ssize_t n = pread(fd,tmp,span,start);
+	int ret = n < 0 ? -errno : (size_t)n < offset - start + length ? -EIO : 0;
+	if(!ret)
+		memcpy(buf,tmp + (offset - start),length);
+	free(tmp);
+	return ret;
+}
+
+static int read_volume_header_from(hfs_volume* vol, int fd, char buf[512], hfs_volume_header_t* vh) {
+	struct hf_device* dev = vol->cbdata;
+	int ret = raw_read(fd,dev->blksize,buf,512,vol->offset + HFS_VOLUME_HEAD_RESERVE_SIZE);
+	if(!ret && !hfslib_read_volume_header(buf,vh))
+		ret = -EIO;
+	return ret;
+}
+
+static int read_volume_header(hfs_volume* vol, hfs_volume_header_t* vh) {
+	char buf[512];
+	return read_volume_header_from(vol,((struct hf_device*)vol->cbdata)->fd,buf,vh);
+}
+
+static void close_replicas(struct hf_device* dev) {
+	hfs_replicas_destroy(dev->replicas);
+	dev->replicas = NULL;
+	for(unsigned i = 1; i < dev->nreplica_fds; i++)
+		close(dev->replica_fds[i]);
+	dev->nreplica_fds = 0;
+}
+
+// reads are only spread to copies the same size as the device with the same volume header, UUID included
+static void open_replicas(hfs_volume* vol) {
+	struct hf_device* dev = vol->cbdata;
+	close_replicas(dev);
+	char header[512], copy[512];
+	hfs_volume_header_t vh, cvh;
+	int ret = read_volume_header_from(vol,dev->fd,header,&vh);
+	if(ret) {
+		hfslib_error("could not read the volume header to check replicas against: %s", __FILE__, __LINE__, strerror(-ret));
+		return;
+	}
+	off_t size = lseek(dev->fd,0,SEEK_END);
+	dev->replica_fds[dev->nreplica_fds++] = dev->fd;
+	for(size_t i = 0; i < dev->nreplica_paths; i++) {
+		const char* path = dev->replica_paths[i];
+		const char* err = NULL;
+		int fd = open(path,O_RDONLY);
+		if(fd < 0)
+			err = strerror(errno);
+		else if(dev->nreplica_fds == HFS_REPLICAS_MAX)
+			err = "too many replicas";
+		else if(lseek(fd,0,SEEK_END) != size)
+			err = "its size differs from the device's";
+		else if((ret = read_volume_header_from(vol,fd,copy,&cvh)))
+			err = strerror(-ret);
+		else if(memcmp(cvh.finder_info + 6,vh.finder_info + 6,2 * sizeof(*vh.finder_info)))
+			err = "it holds a different volume";
+		else if(memcmp(copy,header,sizeof(header)))
+			err = "its volume header differs from the device's";
+		if(!err)
+			dev->replica_fds[dev->nreplica_fds++] = fd;
+		else {
+			hfslib_error("not reading from replica %s: %s", __FILE__, __LINE__, path, err);
+			if(fd >= 0)
+				close(fd);
+		}
+	}
+	if(dev->nreplica_fds < 2)
+		close_replicas(dev);
+}
+
+static int start_replicas(struct hf_device* dev) {
+	if(dev->nreplica_fds < 2 || dev->replicas)
+		return 0;
+	if(!(dev->replicas = hfs_replicas_create(dev->replica_fds,dev->nreplica_fds,dev->hedge_percentile))) {
+		int ret = -errno;
+		hfslib_error("could not start reading from replicas: %s", __FILE__, __LINE__, strerror(errno));
+		return ret;
+	}
+	return 0;
+}
+
+#ifdef HAVE_UBLIO
+static ssize_t ublio_replicas_pread(void* priv, void* buf, size_t count, off_t offset) {
+	struct hf_device* dev = priv;
+	return dev->replicas ? hfs_replicas_pread(dev->replicas,buf,count,offset) : pread(dev->fd,buf,count,offset);
+}
+
+static ssize_t ublio_replicas_preadv(void* priv, struct iovec* iov, int iovcnt, off_t offset) {
+	struct hf_device* dev = priv;
+	if(dev->replicas)
+		return hfs_replicas_preadv(dev->replicas,iov,iovcnt,offset);
+	ssize_t total = 0;
+	for(int i = 0; i < iovcnt; i++) {
+		ssize_t n = pread(dev->fd,iov[i].iov_base,iov[i].iov_len,offset + total);
+		if(n < 0)
+			return n;
+		total += n;
+		if((size_t)n < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+static ublio_filehandle_t open_ublio(struct hf_device* dev) {
+	struct ublio_param p = {
+		.up_priv = &dev->fd,
+		.up_blocksize = dev->blksize,
+		.up_items = 64,
+		.up_grace = 32,
+	};
+	if(dev->replicas) {
+		p.up_priv = dev;
+		p.up_pread = ublio_replicas_pread;
+		p.up_preadv = ublio_replicas_preadv;
+	}
+	return ublio_open(&p);
+}
+
+// ublio can only be made to forget its buffers by reopening it
+static int reopen_ublio(struct hf_device* dev) {
+	ublio_filehandle_t ubfh = open_ublio(dev);
+	if(!ubfh)
+		return -errno;
+	ublio_close(dev->ubfh);
+	dev->ubfh = ubfh;
+	return 0;
+}
+#endif
+
+static void free_replica_paths(struct hf_device* dev) {
+	for(size_t i = 0; i < dev->nreplica_paths; i++)
+		free(dev->replica_paths[i]);
+	free(dev->replica_paths);
+}
+
 int hfs_open(hfs_volume* vol, const char* name, hfs_callback_args* cbargs) {
+	struct hfs_device_args* args = cbargs ? cbargs->openvol : NULL;
 	struct hf_device* dev = calloc(1,sizeof(*dev));
 	if(!dev)
 		return -(errno = ENOMEM);
@@ -419,17 +906,38 @@ int hfs_open(hfs_volume* vol, const char* name, hfs_callback_args* cbargs) {
 	else BAIL(EINVAL);
 
 #ifdef HAVE_UBLIO
-	struct ublio_param p = {
-		.up_priv = &dev->fd,
-		.up_blocksize = dev->blksize,
-		.up_items = 64,
-		.up_grace = 32,
-	};
-	if(!(dev->ubfh = ublio_open(&p)))
+	if(!(dev->ubfh = open_ublio(dev)))
 		BAIL(errno);
 	if((errno = pthread_mutex_init(&dev->ubmtx,NULL)))
 		BAIL(errno);
 #endif
+	if(args && args->sidecar_dir && !(dev->sidecar_dir = strdup(args->sidecar_dir)))
+		BAIL(ENOMEM);
+	if(args && args->block_cache_dir && !(dev->block_cache_dir = strdup(args->block_cache_dir)))
+		BAIL(ENOMEM);
+	dev->block_cache_size = args && args->block_cache_size ? args->block_cache_size : HFS_DEFAULT_BLOCK_CACHE_SIZE;
+	dev->block_cache_data = args && args->block_cache_data;
+	if(args && args->nreplicas) {
+		if(!(dev->replica_paths = calloc(args->nreplicas,sizeof(*dev->replica_paths))))
+			BAIL(ENOMEM);
+		for(; dev->nreplica_paths < args->nreplicas; dev->nreplica_paths++)
+			if(!(dev->replica_paths[dev->nreplica_paths] = strdup(args->replicas[dev->nreplica_paths])))
+				BAIL(ENOMEM);
+	}
+	dev->hedge_percentile = args && args->hedge_percentile ? args->hedge_percentile : HFS_DEFAULT_HEDGE_PERCENTILE;
+	vol->vh.signature = 0;
+	vol->ehr.node_size = 0; // the block cache waits for this to look up the special files' overflow extents
+	if((errno = pthread_mutex_init(&dev->index_lock,NULL)))
+		BAIL(errno);
+	if((errno = pthread_mutex_init(&dev->manifest_lock,NULL)))
+		BAIL(errno);
+	dev->prefetch_size = args ? args->prefetch_size : 0;
+	size_t cache_size = args ? args->cache_size : HFS_DEFAULT_CACHE_SIZE;
+	if(cache_size && !(dev->cache = hfs_cache_create(cache_size,args ? args->compressed_cache_size : 0,HFS_CACHE_METADATA)))
+		BAIL(ENOMEM);
+	if(args && args->data_cache_size && !(dev->data_cache = hfs_cache_create(args->data_cache_size,0,1 << HFS_CACHE_DATA)))
+		BAIL(ENOMEM);
+	dev->block_mrc = hfs_shards_create(HFS_MRC_SAMPLES);
 	vol->cbdata = dev;
 	return 0;
 
@@ -440,39 +948,64 @@ error:
 	if(dev->ubfh)
 		ublio_close(dev->ubfh);
 #endif
+	hfs_cache_destroy(dev->cache);
+	free(dev->sidecar_dir);
+	free(dev->block_cache_dir);
+	free_replica_paths(dev);
 	free(dev);
 	return -errno;
 }
 
 void hfs_close(hfs_volume* vol, hfs_callback_args* cbargs) {
 	struct hf_device* dev = vol->cbdata;
+	hfs_cache_destroy(dev->cache);
+	hfs_cache_destroy(dev->data_cache);
+	hfs_usage_free(dev->usage);
+	hfs_links_free(dev->links);
+	hfs_search_index_free(dev->search);
+	hfs_block_cache_close(dev->blocks);
+	hfs_shards_destroy(dev->block_mrc);
+	hfs_manifest_free(dev->manifest);
+	pthread_mutex_destroy(&dev->index_lock);
+	pthread_mutex_destroy(&dev->manifest_lock);
+	free(dev->sidecar_dir);
+	free(dev->block_cache_dir);
 #ifdef HAVE_UBLIO
 	ublio_close(dev->ubfh);
 	pthread_mutex_destroy(&dev->ubmtx);
 #endif
+	close_replicas(dev);
+	free_replica_paths(dev);
 	close(dev->fd);
 	free(dev);
 }
 
 #ifdef HAVE_UBLIO
-int hfs_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset, hfs_callback_args* cbargs) {
+static int device_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset) {
 	struct hf_device* dev = vol->cbdata;
 	int ret = 0;
 	pthread_mutex_lock(&dev->ubmtx);
-	if(ublio_pread(dev->ubfh, outbytes, length, offset) < 0)
-		ret = -errno;
+	errno = 0;
+	ssize_t n = ublio_pread(dev->ubfh, outbytes, length, vol->offset + offset);
+	// ublio comes up short, or negative without setting errno, past the end of the device
+	if(n < 0 || (uint64_t)n < length)
+		ret = n < 0 && errno ? -errno : -EIO;
 	pthread_mutex_unlock(&dev->ubmtx);
 	return ret;
 }
 #else
-int hfs_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset, hfs_callback_args* cbargs) {
+static inline ssize_t device_pread(struct hf_device* dev, void* buf, size_t count, off_t offset) {
+	return dev->replicas ? hfs_replicas_pread(dev->replicas,buf,count,offset) : pread(dev->fd,buf,count,offset);
+}
+
+static int device_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset) {
 	struct hf_device* dev = vol->cbdata;
 	char* outbuf = outbytes;
 	ssize_t ret = 0;
 	offset += vol->offset;
 	uint64_t rem = length % dev->blksize;
 	length -= rem;
-	while(length && (ret = pread(dev->fd,outbuf,length,offset)) > 0) {
+	while(length && (ret = device_pread(dev,outbuf,length,offset)) > 0) {
 		if((ret = min(length,ret)) <= 0)
 			break;
 		outbuf += ret;
@@ -481,18 +1014,162 @@ int hfs_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset,
 	}
 	if(ret < 0)
 		return -errno;
+	if(length)
+		return -EIO; // past the end of the device, rather than leave the rest of outbytes unset
 	if(rem) {
 		char buf[dev->blksize];
-		ret = pread(dev->fd,buf,dev->blksize,offset);
-		if((ret = min(rem,ret)) > 0)
-			memcpy(outbuf,buf,ret);
+		ret = device_pread(dev,buf,dev->blksize,offset);
+		if(ret < 0)
+			return -errno;
+		if((uint64_t)ret < rem)
+			return -EIO;
+		memcpy(outbuf,buf,rem);
 	}
-	if(ret < 0)
-		return -errno;
 	return 0;
 }
 #endif
 
+int hfs_read(hfs_volume* vol, void* outbytes, uint64_t length, uint64_t offset, hfs_callback_args* cbargs) {
+	struct hf_device* dev = vol->cbdata;
+	// mounting is single threaded, so this happens before any concurrent reads
+	if(dev->block_cache_dir && !dev->blocks && (vol->vh.signature == HFS_SIG_HFSP || vol->vh.signature == HFS_SIG_HFSX)) {
+		if(!(dev->blocks = hfs_block_cache_open(vol,dev->block_cache_dir,dev->block_cache_size,dev->block_cache_data)))
+			hfslib_error("could not open the block cache in %s: %s", __FILE__, __LINE__, dev->block_cache_dir, strerror(errno));
+		free(dev->block_cache_dir);
+		dev->block_cache_dir = NULL;
+	}
+	if(dev->nreplica_paths && !dev->replicas_checked && (vol->vh.signature == HFS_SIG_HFSP || vol->vh.signature == HFS_SIG_HFSX)) {
+		dev->replicas_checked = true;
+		open_replicas(vol);
+	}
+	if(vol->vh.block_size && length)
+		for(uint64_t b = offset / vol->vh.block_size; b <= (offset + length - 1) / vol->vh.block_size; b++)
+			hfs_shards_access(dev->block_mrc,b,vol->vh.block_size);
+	if(dev->blocks && !dev->reloading)
+		return hfs_block_cache_read(dev->blocks,vol,outbytes,length,offset,device_read);
+	return device_read(vol,outbytes,length,offset);
+}
+
+// hinting every range before reading any lets the OS queue them all at once,
+// so mounting waits on one round of device latency instead of one per probe
+int hfs_readv(hfs_volume* vol, const hfs_read_request_t* reqs, uint16_t count, hfs_callback_args* cbargs) {
+	struct hf_device* dev = vol->cbdata;
+	if(count > 1)
+		for(uint16_t i = 0; i < count; i++)
+			prefetch_range(dev, vol->offset + reqs[i].offset, reqs[i].length);
+	int ret = 0;
+	for(uint16_t i = 0; i < count && !ret; i++)
+		ret = hfs_read(vol, reqs[i].buffer, reqs[i].length, reqs[i].offset, cbargs);
+	return ret;
+}
+
+int hfs_volume_changed(hfs_volume* vol) {
+	hfs_volume_header_t vh;
+	int ret = read_volume_header(vol,&vh);
+	if(ret)
+		return ret;
+	if(vh.write_count != vol->vh.write_count || vh.date_modified != vol->vh.date_modified ||
+	   vh.attributes != vol->vh.attributes || vh.journal_info_block != vol->vh.journal_info_block)
+		return 1;
+	if(!vol->journaled)
+		return 0;
+	// a journaled volume mounted elsewhere may only have written its journal so far
+	char buf[512];
+	hfs_journal_header_t jh;
+	struct hf_device* dev = vol->cbdata;
+	if((ret = raw_read(dev->fd,dev->blksize,buf,sizeof(buf),vol->offset + vol->jib.offset)))
+		return ret;
+	if(!hfslib_read_journal_header(buf,&jh))
+		return -EIO;
+	return jh.start != vol->jh.start || jh.end != vol->jh.end;
+}
+
+int hfs_start_replicas(hfs_volume* vol) {
+	struct hf_device* dev = vol->cbdata;
+	dev->replicas_started = true;
+	int ret = start_replicas(dev);
+#ifdef HAVE_UBLIO
+	if(!ret && dev->replicas)
+		ret = reopen_ublio(dev);
+#endif
+	return ret;
+}
+
+int hfs_volume_reload(hfs_volume* vol) {
+	struct hf_device* dev = vol->cbdata;
+	hfs_volume_header_t vh;
+	int ret = read_volume_header(vol,&vh);
+	if(ret)
+		return ret;
+	hfs_cache_clear(dev->cache);
+	hfs_cache_clear(dev->data_cache);
+	// the copies must have changed the same way
+	if(dev->nreplica_paths) {
+		open_replicas(vol);
+		if(dev->replicas_started)
+			start_replicas(dev);
+	}
+#ifdef HAVE_UBLIO
+	if((ret = reopen_ublio(dev)))
+		return ret;
+#endif
+	pthread_mutex_lock(&dev->index_lock);
+	hfs_usage_free(dev->usage);
+	hfs_links_free(dev->links);
+	hfs_search_index_free(dev->search);
+	dev->usage = NULL;
+	dev->links = NULL;
+	dev->search = NULL;
+	pthread_mutex_unlock(&dev->index_lock);
+
+	// the job can send its list again, the extents gathered for it may have moved
+	pthread_mutex_lock(&dev->manifest_lock);
+	hfs_manifest_free(dev->manifest);
+	dev->manifest = NULL;
+	pthread_mutex_unlock(&dev->manifest_lock);
+
+	// on a wrapped volume the header is first probed with the embedded volume's offset unset, which would cache
+	// the wrapper's blocks as the volume's own. so read past the block cache until the offset and header are final,
+	// and only then forget its blocks and take the new metadata ranges
+	dev->reloading = true;
+	ret = hfslib_reload_volume(vol,NULL) ? -EIO : 0;
+	dev->reloading = false;
+	hfs_block_cache_invalidate(dev->blocks,vol);
+	if(ret)
+		return ret;
+	if(dev->root.record.type && (ret = hfs_set_root(vol,dev->root.record.folder.cnid)))
+		dev->root.record.type = 0;
+	return ret;
+}
+
+void hfs_volume_cache_stats(hfs_volume* vol, unsigned tier, struct hfs_cache_tier_stats* stats, struct hfs_mrc* mrc) {
+	struct hf_device* dev = vol->cbdata;
+	if(tier == HFS_MRC_DEVICE) {
+		if(stats)
+			memset(stats,0,sizeof(*stats));
+		if(mrc)
+			hfs_shards_mrc(dev->block_mrc,mrc);
+		return;
+	}
+	struct hfs_cache* cache = tier == HFS_CACHE_DATA ? dev->data_cache : dev->cache;
+	if(stats)
+		hfs_cache_stats(cache,tier,stats);
+	if(mrc)
+		hfs_cache_mrc(cache,tier,mrc);
+}
+
+int hfs_getnode(hfs_volume* vol, hfs_btree_file_type btree, uint32_t node, void* buf, hfs_callback_args* cbargs) {
+	uint32_t key[2] = { btree, node };
+	uint16_t size = btree == HFS_CATALOG_FILE ? vol->chr.node_size : vol->ehr.node_size;
+	return !hfs_cache_lookup(hfs_volume_cache(vol),HFS_CACHE_NODES,key,sizeof(key),buf,size);
+}
+
+void hfs_putnode(hfs_volume* vol, hfs_btree_file_type btree, uint32_t node, const void* buf, hfs_callback_args* cbargs) {
+	uint32_t key[2] = { btree, node };
+	uint16_t size = btree == HFS_CATALOG_FILE ? vol->chr.node_size : vol->ehr.node_size;
+	hfs_cache_insert(hfs_volume_cache(vol),HFS_CACHE_NODES,key,sizeof(key),buf,size);
+}
+
 void* hfs_malloc(size_t size, hfs_callback_args* cbargs) { return malloc(size); }
 void* hfs_realloc(void* data, size_t size, hfs_callback_args* cbargs) { return size ? realloc(data,size) : NULL; }
 void  hfs_free(void* data, hfs_callback_args* cbargs) { free(data); }
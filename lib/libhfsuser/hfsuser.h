@@ -25,28 +25,209 @@
 #ifndef HFSLIB_H
 #define HFSLIB_H
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <sys/stat.h>
 
 #include "libhfs.h"
 
 #define HFSTIMETOEPOCH(x) (x>2082844800?x-2082844800:0)
 
-void ringbuffer_init();
-void ringbuffer_destroy();
+#define HFS_DEFAULT_CACHE_SIZE (16*1024*1024)
+#define HFS_DEFAULT_BLOCK_CACHE_SIZE (256*1024*1024)
+#define HFS_DEFAULT_HEDGE_PERCENTILE 95
+#define HFS_DEFAULT_PREFETCH_WINDOW (64*1024*1024)
+// the device and up to seven copies of it
+#define HFS_REPLICAS_MAX 8
+
+// passed to hfslib_open_volume as hfs_callback_args.openvol
+struct hfs_device_args {
+	size_t cache_size; // bytes shared by the record, node, extent, and directory caches; 0 disables them
+	size_t compressed_cache_size; // bytes of compressed b-tree nodes kept after eviction; 0 disables
+	size_t data_cache_size; // bytes of file contents cached by inode, shared by every hard link to a file; 0 disables
+	size_t prefetch_size; // bytes at the start of each opened file to read ahead; 0 disables prefetching
+	const char* sidecar_dir; // directory to save indexes built from catalog scans in for reuse; NULL disables saving them
+	const char* block_cache_dir; // directory on fast storage for a persistent cache of device blocks; NULL disables it
+	uint64_t block_cache_size; // size of the block cache file; 0 for the default
+	bool block_cache_data; // cache file contents in the block cache, not just metadata
+	const char* const* replicas; // paths of bit-identical copies of the device to spread reads across
+	size_t nreplicas; // at most HFS_REPLICAS_MAX - 1
+	double hedge_percentile; // percentile of read times past which a read is repeated on another copy; 0 for the default, 100 never
+};
 
 ssize_t hfs_unistr_to_utf8(const hfs_unistr255_t* u16, char u8[]);
 ssize_t hfs_pathname_to_unix(const hfs_unistr255_t* u16, char u8[]);
 ssize_t hfs_pathname_from_unix(const char* u8, hfs_unistr255_t* u16);
 
+int  hfs_set_root(hfs_volume* vol, hfs_cnid_t cnid);
+hfs_cnid_t hfs_get_root(hfs_volume* vol);
 char* hfs_get_path(hfs_volume* vol, hfs_cnid_t cnid);
 int  hfs_lookup(hfs_volume* vol, const char* path, hfs_catalog_keyed_record_t* record, hfs_catalog_key_t* key, uint8_t* fork);
 void hfs_stat(hfs_volume* vol, hfs_catalog_keyed_record_t* key, struct stat* st, uint8_t fork);
 void hfs_serialize_finderinfo(hfs_catalog_keyed_record_t*, char[32]);
+uint16_t hfs_get_file_extents(hfs_volume* vol, hfs_cnid_t cnid, uint8_t fork, hfs_extent_descriptor_t** extents);
+// hfslib_readd_with_extents through the data cache, if there is one. cnid should be the file's inode, as hfs_lookup
+// resolves hard links to, so reads through any link to a file hit the same cached blocks
+int  hfs_read_fork(hfs_volume* vol, hfs_cnid_t cnid, uint8_t fork, hfs_extent_descriptor_t* extents, uint16_t nextents, void* buf, uint64_t* bytes, uint64_t length, uint64_t offset);
+int  hfs_get_directory_contents(hfs_volume* vol, hfs_cnid_t cnid, hfs_catalog_keyed_record_t** keys, hfs_unistr255_t** names, uint32_t* count);
+// asks the OS to start reading the first prefetch_size bytes of a fork of the given size in the background
+void hfs_prefetch_head(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t size);
+// asks the OS to start reading length bytes at offset into a fork, whatever the prefetch_size
+void hfs_prefetch_range(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t offset, uint64_t length);
+// copies length bytes from offset into a fork to fd, with the kernel moving the data itself where it can (copy_file_range
+// to a regular file or splice to a pipe, on Linux), otherwise by a reader and a writer thread taking turns with two large
+// buffers. length must lie within the fork's extents. returns 0 or a negative errno
+int  hfs_stream_fork(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t offset, uint64_t length, int fd);
+// the device's file descriptor and block size, for reading it directly
+int  hfs_device_fd(hfs_volume* vol, uint32_t* blksize);
+// for batch jobs that know every file they'll read: resolves the paths and gathers their extents up front, then keeps
+// the next `window` bytes of files (0 for the default) prefetched in order of their blocks on the device, moving on
+// as hfs_prefetch_opened reports files opened. append adds to the current list instead of replacing it, and an empty
+// list that doesn't append cancels it. returns the number of paths that weren't files, or a negative errno
+int  hfs_prefetch_manifest(hfs_volume* vol, const char* const paths[], size_t count, uint64_t window, bool append);
+void hfs_prefetch_opened(hfs_volume* vol, hfs_cnid_t cnid);
+
+// for volumes another system may write to while they're open here.
+// hfs_volume_changed rereads the volume header, and the journal header of a journaled volume, straight from
+// the device, returning 1 if they differ from those loaded, 0 if not, or a negative errno.
+// hfs_volume_reload drops everything cached about the volume and loads its headers again. nothing else may be
+// using vol during the reload. returns 0 or a negative errno
+int  hfs_volume_changed(hfs_volume* vol);
+int  hfs_volume_reload(hfs_volume* vol);
+
+// starts reading from the replicas in hfs_device_args, which were checked against the device as the volume
+// was opened. their reader threads don't survive a fork, so until this is called reads go to the device alone
+int  hfs_start_replicas(hfs_volume* vol);
+
+enum hfs_cache_tier {
+	HFS_CACHE_RECORDS, // path -> catalog record and key
+	HFS_CACHE_NODES,   // (btree, node number) -> raw b-tree node
+	HFS_CACHE_EXTENTS, // (cnid, fork) -> extent descriptors
+	HFS_CACHE_DIRS,    // folder cnid -> directory contents
+	HFS_CACHE_DATA,    // (inode cnid, fork, block) -> file contents
+	HFS_CACHE_TIERS
+};
+
+// not a tier, but sampled like one for hfs_volume_cache_stats: device blocks read from below the caches
+#define HFS_MRC_DEVICE HFS_CACHE_TIERS
+
+struct hfs_cache_tier_stats {
+	uint64_t hits, misses, ghost_hits, evictions;
+	size_t bytes, target, entries;
+	uint64_t compressed_hits;
+	size_t compressed_bytes, compressed_entries;
+};
+
+// curve points are at cache sizes of 4K, 8K, ... 512G
+#define HFS_MRC_POINTS 28
+#define HFS_MRC_MIN_SIZE 4096
+
+struct hfs_mrc {
+	uint64_t references; // recent references, estimated from the samples
+	uint32_t keys;       // keys being tracked
+	double rate;         // fraction of keys sampled
+	uint64_t size[HFS_MRC_POINTS];
+	double miss_ratio[HFS_MRC_POINTS];
+};
+
+const char* hfs_cache_tier_name(enum hfs_cache_tier);
+// statistics of a cache tier, and its miss ratio curve estimated from a sample of
+// its lookups (see shards.h). HFS_MRC_DEVICE gives the curve of the device blocks read below the caches, as a block
+// cache would see them, and zeroed stats. either pointer may be NULL
+void hfs_volume_cache_stats(hfs_volume* vol, unsigned tier, struct hfs_cache_tier_stats* stats, struct hfs_mrc* mrc);
+
+// recursive totals for everything below a folder
+// hard linked files and directories are counted once no matter how many links are inside
+struct hfs_folder_usage {
+	uint64_t files, folders;
+	uint64_t logical_size;  // data and resource fork lengths
+	uint64_t physical_size; // allocated blocks, in bytes
+};
+
+// the first call scans the whole catalog once, later calls for any folder are lookups
+int  hfs_get_folder_usage(hfs_volume* vol, hfs_cnid_t cnid, struct hfs_folder_usage* usage);
+
+// a link record for a hard linked file or directory
+struct hfs_hard_link {
+	hfs_cnid_t parent; // folder containing the link
+	hfs_cnid_t cnid;   // the link record itself
+	const char* name;  // valid until the volume is closed or reloaded
+};
+
+// every link to the file or directory with the given inode number, which is the cnid of its iNode or dir_ record
+// the first call scans the whole catalog once (or loads the index saved in the sidecar directory)
+int  hfs_get_hard_links(hfs_volume* vol, uint32_t inode, struct hfs_hard_link** links, uint32_t* count);
+// full path of a link, or NULL if it's outside the root
+char* hfs_get_hard_link_path(hfs_volume* vol, const struct hfs_hard_link* link);
+
+// cnids of every file and folder whose name contains substring, ignoring case
+// the first call builds a trigram index of all names from one catalog scan (or maps the one saved in the sidecar directory)
+int  hfs_search_names(hfs_volume* vol, const char* substring, hfs_cnid_t** cnids, uint32_t* count);
+
+// verifies the catalog and extents overflow b-trees and the allocation bitmap, validating nodes on
+// a pool of worker threads (0 for one per CPU). each problem found is printed to out with its node number
+// returns the number of problems, or -1 if the check couldn't run
+long hfs_check(hfs_volume* vol, unsigned threads, FILE* out);
+
+// writes every file and folder record to out as a columnar file (see export.h for the layout), gathering the
+// rows on a thread per CPU into temporary files, so memory use doesn't grow with the catalog.
+// returns 0 or a negative errno
+int hfs_export_catalog(hfs_volume* vol, FILE* out);
+
+// reads the catalog, extents, and allocation files sequentially and writes one "name: value" line per statistic to out:
+// b-tree depth, node fill and record sizes per level, how contiguous the leaf chain is on the device, fragmentation
+// of the b-tree files, forks, and free space, and the node and record cache sizes that would let a fraction `rate`
+// of lookups hit if they were spread evenly over the catalog. returns 0 or a negative errno
+int hfs_profile_volume(hfs_volume* vol, double rate, FILE* out);
+
+// mirrors the files and folders under the root into the local directory dest. one catalog scan is compared to the
+// manifest the previous sync left in dest, and only new or changed forks are copied, on `threads` threads (0 for one
+// per CPU). items moved or renamed on the volume are renamed here, and items gone from it are removed. resource forks
+// are written as AppleDouble ._ files, and directory hard links aren't followed. problems and a summary go to log
+// returns the number of items that couldn't be synced, or a negative errno
+long hfs_sync_mirror(hfs_volume* vol, const char* dest, unsigned threads, FILE* log);
+
+struct hfs_file_version {
+	hfs_cnid_t inode; // the record holding this version: a hard link's iNode, or the item itself
+	uint8_t type;     // HFS_REC_FILE or HFS_REC_FLDR
+	uint64_t size;    // data fork length
+	int64_t modified; // content modification time
+};
+
+struct hfs_snapshot {
+	hfs_cnid_t cnid;
+	char* name;
+	int32_t version; // index into the versions, or -1 if the path doesn't exist in this snapshot
+};
+
+// finds path, relative to each Time Machine snapshot folder inside the folder `machine` (e.g. Backups.backupdb/host),
+// in every snapshot, and groups the snapshots by the version of the item they hold. a directory hard link shared by
+// several snapshots is resolved only once. free the results with hfs_free_file_history
+// returns 0 or a negative errno
+int  hfs_file_history(hfs_volume* vol, hfs_cnid_t machine, const char* path, struct hfs_snapshot** snapshots, uint32_t* nsnapshots, struct hfs_file_version** versions, uint32_t* nversions);
+void hfs_free_file_history(struct hfs_snapshot* snapshots, uint32_t nsnapshots, struct hfs_file_version* versions);
+
+// walks the catalog leaves as up to `partitions` contiguous ranges split at the index level above the leaves,
+// each on its own thread. records in partition i go to func with cookies[i], in key order, so concatenating
+// the partitions' results in order is the same as one sequential walk. callbacks for different partitions run
+// concurrently, and a nonzero return from any of them stops every partition
+// returns the number of partitions used, or a negative errno
+int hfs_scan_catalog(hfs_volume* vol, const hfs_catalog_predicate_t* pred, unsigned partitions, hfs_catalog_walk_func func, void* cookies[]);
+unsigned hfs_cpu_count(void);
+
+// drives lookups started with the hfslib_async_* functions until none of them needs another node.
+// each round reads every node wanted by any lookup, hinting all of them to the OS before reading
+// them with `threads` threads, so a few threads keep as many reads queued as there are lookups.
+// returns 0, or a negative errno if the lookups couldn't be driven; check each lookup's status
+int hfs_async_run(hfs_volume* vol, hfs_async_lookup_t* lookups[], size_t count, unsigned threads);
 
 // libhfs callbacks
 int  hfs_open(hfs_volume*,const char*,hfs_callback_args*);
 void hfs_close(hfs_volume*,hfs_callback_args*);
 int  hfs_read(hfs_volume*,void*,uint64_t,uint64_t,hfs_callback_args*);
+int  hfs_getnode(hfs_volume*,hfs_btree_file_type,uint32_t,void*,hfs_callback_args*);
+void hfs_putnode(hfs_volume*,hfs_btree_file_type,uint32_t,const void*,hfs_callback_args*);
+int  hfs_readv(hfs_volume*,const hfs_read_request_t*,uint16_t,hfs_callback_args*);
 void*hfs_malloc(size_t,hfs_callback_args*);
 void*hfs_realloc(void*,size_t,hfs_callback_args*);
 void hfs_free(void*,hfs_callback_args*);
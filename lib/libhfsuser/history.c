@@ -0,0 +1,175 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hfsuser.h"
+#include "vector.h"
+
+#include <errno.h>
+
+// Time Machine stores each snapshot as a folder of the machine's backup folder,
+// and any folder unchanged since the previous snapshot as a directory hard link
+// to a shared dir_N folder. A path's remainder below a given folder resolves the
+// same way in every snapshot reaching that folder, so each (folder, depth) pair
+// is resolved once and the result shared by every snapshot that reaches it.
+struct history_memo {
+	hfs_cnid_t folder;
+	uint16_t depth;
+	int32_t version;
+};
+
+struct history {
+	hfs_volume* vol;
+	hfs_unistr255_t* components;
+	uint16_t ncomponents;
+	VECTOR(struct history_memo) memo;
+	VECTOR(struct hfs_file_version) versions;
+};
+
+// the record a name in a folder refers to, following hard links to their targets
+static int resolve_name(hfs_volume* vol, hfs_cnid_t folder, const hfs_unistr255_t* name, hfs_catalog_keyed_record_t* rec) {
+	hfs_catalog_key_t key;
+	if(!hfslib_make_catalog_key(folder,name->length,(unichar_t*)name->unicode,&key) || hfslib_find_catalog_record_with_key(vol,&key,rec,NULL))
+		return -ENOENT;
+	if(rec->type != HFS_REC_FILE)
+		return 0;
+	hfs_file_record_t* f = &rec->file;
+	if(f->user_info.file_creator == HFS_MACS_CREATOR && f->user_info.file_type == HFS_DIR_HARD_LINK_FILE_TYPE)
+		return hfslib_get_directory_hardlink(vol,f->bsd.special.inode_num,rec,NULL) ? -ENOENT : 0;
+	if(f->user_info.file_creator == HFS_HFSPLUS_CREATOR && f->user_info.file_type == HFS_HARD_LINK_FILE_TYPE)
+		return hfslib_get_hardlink(vol,f->bsd.special.inode_num,rec,NULL) ? -ENOENT : 0;
+	return 0;
+}
+
+static int32_t memo_find(struct history* h, hfs_cnid_t folder, uint16_t depth) {
+	for(size_t i = 0; i < h->memo.size; i++)
+		if(h->memo.data[i].folder == folder && h->memo.data[i].depth == depth)
+			return i;
+	return -1;
+}
+
+// the index of the version found below a snapshot folder, -1 if there's none, or a negative errno below that
+static int64_t resolve_snapshot(struct history* h, hfs_cnid_t snapshot) {
+	struct history_memo visited[h->ncomponents];
+	hfs_catalog_keyed_record_t rec;
+	hfs_cnid_t folder = snapshot;
+	int64_t version = -1;
+	uint16_t depth;
+	for(depth = 0; depth < h->ncomponents; depth++) {
+		int32_t m = memo_find(h,folder,depth);
+		if(m >= 0) {
+			version = h->memo.data[m].version;
+			goto found;
+		}
+		visited[depth] = (struct history_memo){ folder, depth };
+		if(resolve_name(h->vol,folder,h->components+depth,&rec))
+			goto found;
+		if(depth+1 < h->ncomponents) {
+			if(rec.type != HFS_REC_FLDR)
+				goto found;
+			folder = rec.folder.cnid;
+		}
+	}
+
+	struct hfs_file_version v = { .inode = rec.file.cnid, .type = rec.type, .modified = HFSTIMETOEPOCH(rec.file.date_content_mod) };
+	if(rec.type == HFS_REC_FILE)
+		v.size = rec.file.data_fork.logical_size;
+	for(version = 0; version < (int64_t)h->versions.size && h->versions.data[version].inode != v.inode; version++)
+		;
+	if(version == (int64_t)h->versions.size && !PUSH(h->versions,v))
+		return -ENOMEM;
+
+found:
+	for(uint16_t i = 0; i < depth; i++) {
+		visited[i].version = version;
+		if(!PUSH(h->memo,visited[i]))
+			return -ENOMEM;
+	}
+	return version;
+}
+
+int hfs_file_history(hfs_volume* vol, hfs_cnid_t machine, const char* path, struct hfs_snapshot** snapshots, uint32_t* nsnapshots, struct hfs_file_version** versions, uint32_t* nversions) {
+	struct history h = { .vol = vol };
+	hfs_catalog_keyed_record_t* keys = NULL;
+	hfs_unistr255_t* names = NULL;
+	uint32_t count = 0;
+	VECTOR(struct hfs_snapshot) found = {0};
+	char* copy = strdup(path);
+	int ret = -ENOMEM;
+	if(!copy || !(h.components = malloc((strlen(path)/2+1) * sizeof(*h.components))))
+		goto end;
+	ret = -EINVAL;
+	for(char* it = copy, * component; (component = strsep(&it,"/")); ) {
+		if(!*component || !strcmp(component,"."))
+			continue;
+		if(!strcmp(component,"..") || hfs_pathname_from_unix(component,h.components + h.ncomponents) < 0)
+			goto end;
+		h.ncomponents++;
+	}
+	if(!h.ncomponents)
+		goto end;
+
+	if((ret = hfs_get_directory_contents(vol,machine,&keys,&names,&count)))
+		goto end;
+	for(uint32_t i = 0; i < count; i++) {
+		// skip Latest and anything else that isn't a snapshot folder
+		if(keys[i].type != HFS_REC_FLDR)
+			continue;
+		struct hfs_snapshot s = { .cnid = keys[i].folder.cnid, .name = malloc(512) };
+		if(!s.name || hfs_pathname_to_unix(names+i,s.name) < 0 || !PUSH(found,s)) {
+			free(s.name);
+			ret = -ENOMEM;
+			goto end;
+		}
+		int64_t version = resolve_snapshot(&h,s.cnid);
+		if(version < -1) {
+			ret = version;
+			goto end;
+		}
+		found.data[found.size-1].version = version;
+	}
+	*snapshots = found.data;
+	*nsnapshots = found.size;
+	*versions = h.versions.data;
+	*nversions = h.versions.size;
+	found.data = NULL;
+	found.size = 0;
+	h.versions.data = NULL;
+	ret = 0;
+
+end:
+	hfs_free_file_history(found.data,found.size,h.versions.data);
+	free(keys);
+	free(names);
+	free(h.components);
+	free(h.memo.data);
+	free(copy);
+	return ret;
+}
+
+void hfs_free_file_history(struct hfs_snapshot* snapshots, uint32_t nsnapshots, struct hfs_file_version* versions) {
+	for(uint32_t i = 0; i < nsnapshots; i++)
+		free(snapshots[i].name);
+	free(snapshots);
+	free(versions);
+}
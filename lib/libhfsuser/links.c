@@ -0,0 +1,256 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "links.h"
+#include "hardlink.h"
+#include "sidecar.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINKS_MAGIC "HFSLINKS"
+#define LINKS_VERSION 2 // 1 kept links whose target was missing
+
+#define NONE UINT32_MAX
+
+// inode is the cnid of the link's target, name is an offset into the string pool
+struct link_entry { uint32_t inode; hfs_cnid_t parent, cnid; uint32_t name; };
+// a private iNode<n> file or dir_<n> folder
+struct link_target { uint32_t num; hfs_cnid_t cnid, parent; };
+
+struct hfs_link_table {
+	struct link_entry* entries;
+	uint32_t nentries;
+	char* names;
+	void* sidecar; // entries and names both point into this when loaded from a sidecar file
+};
+
+// link entries hold the link's inode number until the scan is merged, and are then mapped to the target's cnid
+struct links_scan {
+	hfs_cnid_t metadata_dir, dir_metadata_dir;
+	VECTOR(struct link_entry) file_links, dir_links;
+	VECTOR(struct link_target) inodes, dirs;
+	VECTOR(char) names;
+};
+
+static int links_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct links_scan* s = cookie;
+	hfs_file_record_t* f = &rec->file;
+	uint32_t num;
+	if(rec->type == HFS_REC_FLDR) {
+		if(hfs_key_equals(key,&hfs_gMetadataDirectoryKey))
+			s->metadata_dir = rec->folder.cnid;
+		else if(hfs_key_equals(key,&hfs_gDirMetadataDirectoryKey))
+			s->dir_metadata_dir = rec->folder.cnid;
+		else if(hfs_parse_inode_name(&key->name,"dir_",&num))
+			return !PUSH(s->dirs, (struct link_target){ num, rec->folder.cnid, key->parent_cnid });
+		return 0;
+	}
+
+	bool dir = false;
+	if(f->user_info.file_creator == HFS_MACS_CREATOR && f->user_info.file_type == HFS_DIR_HARD_LINK_FILE_TYPE)
+		dir = true;
+	else if(!(f->user_info.file_creator == HFS_HFSPLUS_CREATOR && f->user_info.file_type == HFS_HARD_LINK_FILE_TYPE)) {
+		if(hfs_parse_inode_name(&key->name,"iNode",&num))
+			return !PUSH(s->inodes, (struct link_target){ num, f->cnid, key->parent_cnid });
+		return 0;
+	}
+
+	char name[512];
+	ssize_t len = hfs_pathname_to_unix(&key->name,name);
+	if(len < 0)
+		len = 0;
+	struct link_entry e = { f->bsd.special.inode_num, key->parent_cnid, f->cnid, s->names.size };
+	for(ssize_t i = 0; i <= len; i++)
+		if(!PUSH(s->names,name[i]))
+			return -1;
+	return dir ? !PUSH(s->dir_links,e) : !PUSH(s->file_links,e);
+}
+
+static int cmp_target(const void* a, const void* b) {
+	uint32_t x = ((const struct link_target*)a)->num, y = ((const struct link_target*)b)->num;
+	return (x > y) - (x < y);
+}
+
+// points each link at its target's cnid, keeping only targets actually inside the given private folder.
+// a link whose target is missing is dropped, since its inode number could be any other file's cnid.
+// returns the number of links kept
+static size_t links_resolve(struct link_entry* links, size_t nlinks, struct link_target* targets, size_t ntargets, hfs_cnid_t dir) {
+	size_t n = 0;
+	for(size_t i = 0; i < ntargets; i++)
+		if(targets[i].parent == dir)
+			targets[n++] = targets[i];
+	qsort(targets,n,sizeof(*targets),cmp_target);
+	size_t kept = 0;
+	for(size_t i = 0; i < nlinks; i++) {
+		struct link_target* t = bsearch(&(struct link_target){ .num = links[i].inode },targets,n,sizeof(*targets),cmp_target);
+		if(t) {
+			links[kept] = links[i];
+			links[kept++].inode = t->cnid;
+		}
+	}
+	return kept;
+}
+
+static int cmp_entry(const void* a, const void* b) {
+	const struct link_entry* x = a,* y = b;
+	if(x->inode != y->inode)
+		return (x->inode > y->inode) - (x->inode < y->inode);
+	return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+}
+
+static struct hfs_link_table* links_from_sidecar(hfs_volume* vol) {
+	size_t size;
+	char* data = hfs_sidecar_read(vol,"links",LINKS_MAGIC,LINKS_VERSION,&size);
+	struct hfs_link_table* t = NULL;
+	uint32_t n;
+	if(!data || size < sizeof(n))
+		goto fail;
+	memcpy(&n,data,sizeof(n));
+	if((size - sizeof(n)) / sizeof(struct link_entry) < n || !(t = malloc(sizeof(*t))))
+		goto fail;
+	size_t poolsize = size - sizeof(n) - n * sizeof(struct link_entry);
+	*t = (struct hfs_link_table){
+		.entries = (struct link_entry*)(data + sizeof(n)), .nentries = n,
+		.names = data + sizeof(n) + n * sizeof(struct link_entry), .sidecar = data
+	};
+	for(uint32_t i = 0; i < n; i++)
+		if(t->entries[i].name >= poolsize)
+			goto fail;
+	if(poolsize && t->names[poolsize-1])
+		goto fail;
+	return t;
+
+fail:
+	free(t);
+	free(data);
+	return NULL;
+}
+
+static struct hfs_link_table* links_scan(hfs_volume* vol) {
+	unsigned nthreads = hfs_cpu_count();
+	struct links_scan parts[nthreads];
+	void* cookies[nthreads];
+	for(unsigned i = 0; i < nthreads; i++) {
+		parts[i] = (struct links_scan){ .metadata_dir = NONE, .dir_metadata_dir = NONE };
+		cookies[i] = parts + i;
+	}
+	struct hfs_link_table* t = NULL;
+
+	hfs_catalog_condition_t records_only = { HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(&records_only,1,&pred,NULL))
+		goto end;
+	int nparts = hfs_scan_catalog(vol,&pred,nthreads,links_visit,cookies);
+	hfslib_free_catalog_predicate(&pred,NULL);
+	if(nparts <= 0)
+		goto end;
+
+	struct links_scan* s = parts;
+	for(int i = 1; i < nparts; i++) {
+		struct links_scan* p = parts + i;
+		if(p->metadata_dir != NONE)
+			s->metadata_dir = p->metadata_dir;
+		if(p->dir_metadata_dir != NONE)
+			s->dir_metadata_dir = p->dir_metadata_dir;
+		for(size_t j = 0; j < p->file_links.size; j++)
+			p->file_links.data[j].name += s->names.size;
+		for(size_t j = 0; j < p->dir_links.size; j++)
+			p->dir_links.data[j].name += s->names.size;
+		if(!APPEND(s->file_links,p->file_links) || !APPEND(s->dir_links,p->dir_links) ||
+		   !APPEND(s->inodes,p->inodes) || !APPEND(s->dirs,p->dirs) || !APPEND(s->names,p->names))
+			goto end;
+	}
+	s->file_links.size = links_resolve(s->file_links.data,s->file_links.size,s->inodes.data,s->inodes.size,s->metadata_dir);
+	s->dir_links.size = links_resolve(s->dir_links.data,s->dir_links.size,s->dirs.data,s->dirs.size,s->dir_metadata_dir);
+	if(!APPEND(s->file_links,s->dir_links))
+		goto end;
+	qsort(s->file_links.data,s->file_links.size,sizeof(*s->file_links.data),cmp_entry);
+
+	if(!(t = malloc(sizeof(*t))))
+		goto end;
+	*t = (struct hfs_link_table){ .entries = s->file_links.data, .nentries = s->file_links.size, .names = s->names.data };
+	s->file_links.data = NULL;
+	s->names.data = NULL;
+
+	if(hfs_sidecar_dir(vol)) {
+		uint32_t n = t->nentries;
+		const void* data[] = { &n, t->entries, t->names };
+		size_t sizes[] = { sizeof(n), n * sizeof(*t->entries), s->names.size };
+		int err = hfs_sidecar_write(vol,"links",LINKS_MAGIC,LINKS_VERSION,data,sizes,3);
+		if(err)
+			hfslib_error("could not save the hard link index: %s", __FILE__, __LINE__, strerror(-err));
+	}
+
+end:
+	for(unsigned i = 0; i < nthreads; i++) {
+		free(parts[i].file_links.data);
+		free(parts[i].dir_links.data);
+		free(parts[i].inodes.data);
+		free(parts[i].dirs.data);
+		free(parts[i].names.data);
+	}
+	return t;
+}
+
+struct hfs_link_table* hfs_links_load(hfs_volume* vol) {
+	struct hfs_link_table* t = links_from_sidecar(vol);
+	return t ? t : links_scan(vol);
+}
+
+int hfs_links_lookup(struct hfs_link_table* t, uint32_t inode, struct hfs_hard_link** links, uint32_t* count) {
+	// first entry for the inode
+	uint32_t lo = 0, hi = t->nentries;
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(t->entries[mid].inode < inode)
+			lo = mid + 1;
+		else hi = mid;
+	}
+	uint32_t n = 0;
+	while(lo + n < t->nentries && t->entries[lo+n].inode == inode)
+		n++;
+	if(!(*links = malloc(n * sizeof(**links) + 1)))
+		return -ENOMEM;
+	for(uint32_t i = 0; i < n; i++) {
+		struct link_entry* e = t->entries + lo + i;
+		(*links)[i] = (struct hfs_hard_link){ e->parent, e->cnid, t->names + e->name };
+	}
+	*count = n;
+	return 0;
+}
+
+void hfs_links_free(struct hfs_link_table* t) {
+	if(!t)
+		return;
+	if(t->sidecar)
+		free(t->sidecar);
+	else {
+		free(t->entries);
+		free(t->names);
+	}
+	free(t);
+}
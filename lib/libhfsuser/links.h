@@ -0,0 +1,40 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_LINKS_H
+#define HFSUSER_LINKS_H
+
+#include "hfsuser.h"
+
+// Reverse index of hard links: the folder, cnid, and name of every link record
+// pointing at each hard linked file or directory, sorted by the target's inode
+// number. Built from one parallel pass over the catalog, or read back from the
+// sidecar directory when a current copy was saved there by an earlier scan.
+struct hfs_link_table;
+
+struct hfs_link_table* hfs_links_load(hfs_volume*);
+int  hfs_links_lookup(struct hfs_link_table*, uint32_t inode, struct hfs_hard_link** links, uint32_t* count);
+void hfs_links_free(struct hfs_link_table*);
+
+#endif
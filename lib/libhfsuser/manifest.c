@@ -0,0 +1,195 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "manifest.h"
+#include "vector.h"
+
+#include <errno.h>
+
+#define EXTENT_BATCH 256
+#define EXTENT_THREADS 4
+
+struct manifest_file {
+	hfs_cnid_t cnid;
+	uint8_t fork;
+	uint64_t size;
+	size_t first, count; // range of extents
+};
+
+struct hfs_manifest {
+	uint64_t window;
+	VECTOR(struct manifest_file) files;
+	VECTOR(hfs_extent_descriptor_t) extents; // each file's extents, cut off at its logical size
+	size_t opened;   // files before this one have been opened
+	size_t next;     // files from opened up to this one have been prefetched
+	uint64_t ahead;  // their total size
+};
+
+struct hfs_manifest* hfs_manifest_create(uint64_t window) {
+	struct hfs_manifest* m = calloc(1,sizeof(*m));
+	if(m)
+		m->window = window;
+	return m;
+}
+
+void hfs_manifest_free(struct hfs_manifest* m) {
+	if(!m)
+		return;
+	free(m->files.data);
+	free(m->extents.data);
+	free(m);
+}
+
+static int extent_cmp(const void* a, const void* b) {
+	const hfs_extent_descriptor_t* x = a, * y = b;
+	return (x->start_block > y->start_block) - (x->start_block < y->start_block);
+}
+
+// hints files from next onwards until the window is full, in the order of their blocks on the device
+static void advance(struct hfs_manifest* m, hfs_volume* vol) {
+	size_t end = m->next, nextents = 0;
+	uint64_t ahead = m->ahead;
+	// always take at least one file, however large
+	while(end < m->files.size && (end == m->opened || ahead + m->files.data[end].size <= m->window)) {
+		ahead += m->files.data[end].size;
+		nextents += m->files.data[end].count;
+		end++;
+	}
+	if(end == m->next)
+		return;
+
+	hfs_extent_descriptor_t* sorted = malloc(nextents * sizeof(*sorted));
+	if(sorted) {
+		size_t n = 0;
+		for(size_t i = m->next; i < end; i++) {
+			memcpy(sorted + n, m->extents.data + m->files.data[i].first, m->files.data[i].count * sizeof(*sorted));
+			n += m->files.data[i].count;
+		}
+		qsort(sorted,n,sizeof(*sorted),extent_cmp);
+		for(size_t i = 0; i < n; i++)
+			hfs_prefetch_range(vol,sorted+i,1,0,(uint64_t)sorted[i].block_count * vol->vh.block_size);
+		free(sorted);
+	}
+	m->next = end;
+	m->ahead = ahead;
+}
+
+// fills in the extents of files [first,size) from one batch of resumable lookups at a time
+static int gather_extents(struct hfs_manifest* m, hfs_volume* vol, size_t first) {
+	hfs_async_lookup_t* lookups = malloc(EXTENT_BATCH * sizeof(*lookups));
+	hfs_async_lookup_t* batch[EXTENT_BATCH];
+	if(!lookups)
+		return -ENOMEM;
+	int ret = 0;
+	for(size_t i = first; i < m->files.size && !ret; i += EXTENT_BATCH) {
+		size_t n = min(m->files.size - i, EXTENT_BATCH);
+		for(size_t j = 0; j < n; j++) {
+			hfslib_async_get_file_extents(vol,m->files.data[i+j].cnid,m->files.data[i+j].fork,lookups+j,NULL);
+			batch[j] = lookups+j;
+		}
+		ret = hfs_async_run(vol,batch,n,EXTENT_THREADS);
+		for(size_t j = 0; j < n; j++) {
+			struct manifest_file* f = m->files.data + i + j;
+			f->first = m->extents.size;
+			f->count = 0;
+			uint64_t left = f->size;
+			for(uint16_t e = 0; !ret && lookups[j].status == HFS_ASYNC_DONE && e < lookups[j].num_extents && left; e++) {
+				hfs_extent_descriptor_t ext = lookups[j].extents[e];
+				uint64_t bytes = (uint64_t)ext.block_count * vol->vh.block_size;
+				if(bytes > left)
+					ext.block_count = (left + vol->vh.block_size - 1) / vol->vh.block_size;
+				left -= min(bytes,left);
+				if(!PUSH(m->extents,ext)) {
+					ret = -ENOMEM;
+					break;
+				}
+				f->count++;
+			}
+			hfslib_async_free(lookups+j,NULL);
+		}
+	}
+	free(lookups);
+	return ret;
+}
+
+int hfs_manifest_add(struct hfs_manifest* m, hfs_volume* vol, const char* const paths[], size_t count) {
+	size_t first = m->files.size;
+	int missing = 0;
+	for(size_t i = 0; i < count; i++) {
+		hfs_catalog_keyed_record_t rec; hfs_catalog_key_t key; uint8_t fork;
+		if(hfs_lookup(vol,paths[i],&rec,&key,&fork) || rec.type != HFS_REC_FILE) {
+			missing++;
+			continue;
+		}
+		struct manifest_file f = {
+			.cnid = rec.file.cnid,
+			.fork = fork,
+			.size = fork == HFS_DATAFORK ? rec.file.data_fork.logical_size : rec.file.rsrc_fork.logical_size
+		};
+		if(!PUSH(m->files,f))
+			return -ENOMEM;
+	}
+	int ret = gather_extents(m,vol,first);
+	if(ret) {
+		m->files.size = first;
+		return ret;
+	}
+	return missing;
+}
+
+int hfs_manifest_merge(struct hfs_manifest* m, struct hfs_manifest* from, hfs_volume* vol) {
+	size_t files = m->files.size, extents = m->extents.size;
+	for(size_t i = 0; i < from->files.size; i++) {
+		struct manifest_file f = from->files.data[i];
+		f.first += extents;
+		if(!PUSH(m->files,f))
+			goto nomem;
+	}
+	for(size_t i = 0; i < from->extents.size; i++)
+		if(!PUSH(m->extents,from->extents.data[i]))
+			goto nomem;
+	hfs_manifest_free(from);
+	advance(m,vol);
+	return 0;
+nomem:
+	m->files.size = files;
+	m->extents.size = extents;
+	hfs_manifest_free(from);
+	return -ENOMEM;
+}
+
+void hfs_manifest_start(struct hfs_manifest* m, hfs_volume* vol) {
+	advance(m,vol);
+}
+
+void hfs_manifest_opened(struct hfs_manifest* m, hfs_volume* vol, hfs_cnid_t cnid) {
+	// jobs may skip a file or open them a little out of order, so look through everything prefetched
+	for(size_t i = m->opened; i < m->next; i++)
+		if(m->files.data[i].cnid == cnid) {
+			for(; m->opened <= i; m->opened++)
+				m->ahead -= m->files.data[m->opened].size;
+			advance(m,vol);
+			return;
+		}
+}
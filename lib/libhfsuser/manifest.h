@@ -0,0 +1,50 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_MANIFEST_H
+#define HFSUSER_MANIFEST_H
+
+#include "hfsuser.h"
+
+// The files a batch job has said it will read, in the order it will open them.
+// Paths are resolved and every fork's extents gathered when the list arrives,
+// then the next window of files is hinted to the OS a window at a time, sorted
+// by position on the device, so the job's reads become one mostly sequential
+// sweep per window instead of a seek per file.
+struct hfs_manifest;
+
+struct hfs_manifest* hfs_manifest_create(uint64_t window);
+// resolves paths onto the end of the list without prefetching anything, so a new list can be
+// built aside and then started or merged into the one in use.
+// returns the number of paths that couldn't be resolved, or a negative errno
+int  hfs_manifest_add(struct hfs_manifest*, hfs_volume*, const char* const paths[], size_t count);
+// moves the files of from onto the end of m and frees from
+int  hfs_manifest_merge(struct hfs_manifest* m, struct hfs_manifest* from, hfs_volume*);
+// hints the first window of files
+void hfs_manifest_start(struct hfs_manifest*, hfs_volume*);
+// moves the window past cnid if it's one of the files prefetched so far
+void hfs_manifest_opened(struct hfs_manifest*, hfs_volume*, hfs_cnid_t cnid);
+void hfs_manifest_free(struct hfs_manifest*);
+
+#endif
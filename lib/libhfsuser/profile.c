@@ -0,0 +1,451 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hfsuser.h"
+#include "cache.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// b-tree files are read sequentially in pieces of this size
+#define PROFILE_CHUNK_SIZE (1024*1024)
+// levels above this are counted with it
+#define MAX_HEIGHT 15
+// histograms count values in power of two buckets, bucket b holding (2^(b-1), 2^b]
+#define BUCKETS 24
+
+static inline uint16_t be16(const uint8_t* p) { return (uint16_t)p[0] << 8 | p[1]; }
+static inline uint32_t be32(const uint8_t* p) { return (uint32_t)be16(p) << 16 | be16(p+2); }
+
+static inline unsigned bucket(uint64_t n) {
+	unsigned b = 0;
+	while(b < BUCKETS-1 && (1ULL << b) < n)
+		b++;
+	return b;
+}
+
+static inline uint64_t round_up(double x) {
+	uint64_t n = x;
+	return n + (n < x);
+}
+
+struct level { uint64_t nodes, bytes, records; };
+
+struct profile_tree {
+	const char* name;
+	hfs_btree_file_type btree;
+	hfs_header_record_t* hr;
+	hfs_fork_t* fork;
+	uint8_t keyfieldsize;
+	hfs_extent_descriptor_t* extents;
+	uint16_t nextents;
+	uint32_t nnodes;
+	uint8_t* map; // in-use bit per node
+	uint32_t* flinks;
+	struct level levels[MAX_HEIGHT+1];
+	uint64_t record_sizes[BUCKETS];
+};
+
+// overflow extents of a fork, from the extents tree
+struct overflow { hfs_cnid_t cnid; uint8_t fork; uint32_t extents; };
+
+struct folder { hfs_cnid_t cnid, parent; uint16_t namelen; uint32_t pathlen; };
+
+struct profile {
+	hfs_volume* vol;
+	VECTOR(struct overflow) overflow;
+	VECTOR(struct folder) folders;
+	VECTOR(hfs_cnid_t) parents; // of every file and folder record
+	uint64_t namelen, types[HFS_REC_FILE_THREAD+1];
+	uint64_t forks, fragmented, overflowed, fork_extents[BUCKETS];
+	bool nomem;
+};
+
+static inline bool node_in_use(struct profile_tree* t, uint32_t node) {
+	return node < t->nnodes && (t->map[node / 8] & (0x80 >> (node % 8)));
+}
+
+static int read_nodes(hfs_volume* vol, struct profile_tree* t, void* buf, uint32_t first, uint32_t count) {
+	uint64_t bytes;
+	size_t length = (size_t)count * t->hr->node_size;
+	if(hfslib_readd_with_extents(vol, buf, &bytes, length, (uint64_t)first * t->hr->node_size, t->extents, t->nextents, NULL) || bytes != length)
+		return -EIO;
+	return 0;
+}
+
+// the node map is the last record of the header node and of each map node chained to it
+static int read_map(hfs_volume* vol, struct profile_tree* t) {
+	uint16_t nodesize = t->hr->node_size;
+	size_t mapsize = (t->nnodes + 7) / 8, filled = 0;
+	uint8_t* node = malloc(nodesize);
+	int ret = -ENOMEM;
+	if(!node || !(t->map = calloc(1, mapsize)))
+		goto end;
+	uint32_t n = 0, visited = 0;
+	do {
+		if((ret = read_nodes(vol, t, node, n, 1)))
+			goto end;
+		uint16_t nrecs = be16(node+10);
+		uint16_t start = be16(node + nodesize - 2*nrecs), end = be16(node + nodesize - 2*(nrecs+1));
+		ret = -EILSEQ;
+		if(!nrecs || 2*(nrecs+1) > nodesize || end <= start || end > nodesize)
+			goto end;
+		size_t len = end - start < mapsize - filled ? end - start : mapsize - filled;
+		memcpy(t->map + filled, node + start, len);
+		filled += len;
+		n = be32(node);
+	} while(n && filled < mapsize && ++visited < t->nnodes);
+	ret = 0;
+end:
+	free(node);
+	return ret;
+}
+
+static void count_fork(struct profile* p, hfs_cnid_t cnid, uint8_t fork, const hfs_fork_t* f) {
+	if(!f->total_blocks)
+		return;
+	uint32_t extents = 0;
+	while(extents < 8 && f->extents[extents].block_count)
+		extents++;
+	if(extents == 8) {
+		struct overflow* o = p->overflow.data;
+		size_t lo = 0, hi = p->overflow.size;
+		while(lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if(o[mid].cnid < cnid || (o[mid].cnid == cnid && o[mid].fork < fork))
+				lo = mid + 1;
+			else hi = mid;
+		}
+		if(lo < p->overflow.size && o[lo].cnid == cnid && o[lo].fork == fork) {
+			extents += o[lo].extents;
+			p->overflowed++;
+		}
+	}
+	p->forks++;
+	p->fragmented += extents > 1;
+	p->fork_extents[bucket(extents)]++;
+}
+
+static void profile_node(struct profile* p, struct profile_tree* t, const uint8_t* buf, uint32_t n, uint8_t* scratch) {
+	uint16_t nodesize = t->hr->node_size;
+	int8_t kind = buf[8];
+	uint8_t height = buf[9];
+	uint16_t nrecs = be16(buf+10);
+	t->flinks[n] = be32(buf);
+	if((kind != HFS_LEAFNODE && kind != HFS_INDEXNODE) || !nrecs || 14 + 2 * (nrecs + 1) > nodesize)
+		return;
+
+	// the offset after the last record is where the node's free space starts
+	const uint8_t* offsets = buf + nodesize - 2;
+	uint16_t free = be16(offsets - 2*nrecs);
+	if(free > nodesize - 2 * (nrecs + 1))
+		return;
+	struct level* l = t->levels + (height < MAX_HEIGHT ? height : MAX_HEIGHT);
+	l->nodes++;
+	l->bytes += free + 2 * (nrecs + 1);
+	l->records += nrecs;
+	if(kind != HFS_LEAFNODE)
+		return;
+
+	for(uint16_t i = 0; i < nrecs; i++) {
+		uint16_t off = be16(offsets - 2*i), end = be16(offsets - 2*(i+1));
+		if(off < 14 || end <= off || end > free)
+			return;
+		uint16_t size = end - off;
+		t->record_sizes[bucket(size)]++;
+		// the libhfs readers trust length fields, so give them a padded copy
+		memcpy(scratch, buf + off, size);
+		memset(scratch + size, 0, 1024);
+		if(t->btree == HFS_CATALOG_FILE) {
+			hfs_catalog_keyed_record_t rec;
+			hfs_catalog_key_t key;
+			int16_t type = HFS_LEAFNODE;
+			hfslib_read_catalog_keyed_record(scratch, &rec, &type, &key, p->vol);
+			if(type < HFS_REC_FLDR || type > HFS_REC_FILE_THREAD)
+				continue;
+			p->types[type]++;
+			if(type == HFS_REC_FLDR)
+				p->nomem |= !PUSH(p->folders, (struct folder){ rec.folder.cnid, key.parent_cnid, key.name.length });
+			else if(type == HFS_REC_FILE) {
+				count_fork(p, rec.file.cnid, HFS_DATAFORK, &rec.file.data_fork);
+				count_fork(p, rec.file.cnid, HFS_RSRCFORK, &rec.file.rsrc_fork);
+			}
+			if(type == HFS_REC_FLDR || type == HFS_REC_FILE) {
+				p->namelen += key.name.length;
+				p->nomem |= !PUSH(p->parents, key.parent_cnid);
+			}
+		}
+		else {
+			hfs_extent_record_t erec;
+			hfs_extent_key_t key;
+			hfslib_read_extent_record(scratch, &erec, HFS_LEAFNODE, &key, p->vol);
+			uint32_t extents = 0;
+			while(extents < 8 && erec[extents].block_count)
+				extents++;
+			p->nomem |= !PUSH(p->overflow, (struct overflow){ key.file_cnid, key.fork_type, extents });
+		}
+	}
+}
+
+// device offset of a node, for judging how far apart linked nodes are
+static uint64_t node_position(hfs_volume* vol, struct profile_tree* t, uint32_t n) {
+	uint64_t offset = (uint64_t)n * t->hr->node_size, blocksize = vol->vh.block_size;
+	for(uint16_t i = 0; i < t->nextents; i++) {
+		uint64_t length = (uint64_t)t->extents[i].block_count * blocksize;
+		if(offset < length)
+			return t->extents[i].start_block * blocksize + offset;
+		offset -= length;
+	}
+	return UINT64_MAX;
+}
+
+static int cmp_overflow(const void* a, const void* b) {
+	const struct overflow* x = a,* y = b;
+	return x->cnid != y->cnid ? (x->cnid > y->cnid) - (x->cnid < y->cnid) : x->fork - y->fork;
+}
+
+// records of one fork may be split across several extent records, which are merged here
+static void merge_overflow(struct profile* p) {
+	qsort(p->overflow.data, p->overflow.size, sizeof(*p->overflow.data), cmp_overflow);
+	size_t n = 0;
+	for(size_t i = 0; i < p->overflow.size; i++) {
+		if(n && !cmp_overflow(p->overflow.data + n-1, p->overflow.data + i))
+			p->overflow.data[n-1].extents += p->overflow.data[i].extents;
+		else p->overflow.data[n++] = p->overflow.data[i];
+	}
+	p->overflow.size = n;
+}
+
+static int profile_btree(struct profile* p, struct profile_tree* t, FILE* out) {
+	hfs_volume* vol = p->vol;
+	uint16_t nodesize = t->hr->node_size;
+	uint8_t* buf = NULL,* scratch = NULL;
+	int ret = -EILSEQ;
+	if(nodesize < 512 || (nodesize & (nodesize - 1)))
+		return ret;
+	t->nnodes = min(t->hr->total_nodes, t->fork->logical_size / nodesize);
+	ret = -EIO;
+	if(!(t->nextents = hfslib_get_file_extents(vol, t->btree == HFS_CATALOG_FILE ? HFS_CNID_CATALOG : HFS_CNID_EXTENTS, HFS_DATAFORK, &t->extents, NULL)))
+		return ret;
+	ret = -ENOMEM;
+	if(!(t->flinks = calloc(t->nnodes, sizeof(*t->flinks))) || !(buf = malloc(PROFILE_CHUNK_SIZE)) || !(scratch = malloc(nodesize + 1024)))
+		goto end;
+	if((ret = read_map(vol, t)))
+		goto end;
+
+	// one sequential pass, skipping chunks with no nodes in use
+	uint32_t pernode = PROFILE_CHUNK_SIZE / nodesize;
+	for(uint32_t first = 0; first < t->nnodes; first += pernode) {
+		uint32_t count = min(pernode, t->nnodes - first), used = 0;
+		for(uint32_t n = first; n < first + count; n++)
+			used += node_in_use(t, n);
+		if(!used)
+			continue;
+		if((ret = read_nodes(vol, t, buf, first, count)))
+			goto end;
+		for(uint32_t n = first; n < first + count; n++)
+			if(n && node_in_use(t, n))
+				profile_node(p, t, buf + (size_t)(n - first) * nodesize, n, scratch);
+	}
+
+	uint32_t inline_extents = 0;
+	while(inline_extents < 8 && t->fork->extents[inline_extents].block_count)
+		inline_extents++;
+	fprintf(out, "%s.node_size: %u\n", t->name, nodesize);
+	fprintf(out, "%s.depth: %u\n", t->name, t->hr->tree_depth);
+	fprintf(out, "%s.total_nodes: %" PRIu32 "\n", t->name, t->hr->total_nodes);
+	fprintf(out, "%s.free_nodes: %" PRIu32 "\n", t->name, t->hr->free_nodes);
+	fprintf(out, "%s.leaf_records: %" PRIu32 "\n", t->name, t->hr->leaf_recs);
+	fprintf(out, "%s.file_extents: %u\n", t->name, t->nextents);
+	fprintf(out, "%s.file_overflow_extents: %u\n", t->name, t->nextents - min(t->nextents, inline_extents));
+	for(unsigned h = 1; h <= MAX_HEIGHT; h++) {
+		struct level* l = t->levels + h;
+		if(!l->nodes)
+			continue;
+		fprintf(out, "%s.level.%u.nodes: %" PRIu64 "\n", t->name, h, l->nodes);
+		fprintf(out, "%s.level.%u.records: %" PRIu64 "\n", t->name, h, l->records);
+		fprintf(out, "%s.level.%u.fill: %.3f\n", t->name, h, (double)l->bytes / (l->nodes * nodesize));
+	}
+	for(unsigned b = 0; b < BUCKETS; b++)
+		if(t->record_sizes[b])
+			fprintf(out, "%s.record_size.%llu: %" PRIu64 "\n", t->name, 1ULL << b, t->record_sizes[b]);
+
+	// the leaf chain in key order, compared to where each node is on the device
+	uint64_t links = 0, contiguous = 0, backward = 0, distance = 0;
+	uint32_t n = t->hr->first_leaf;
+	if(n && node_in_use(t, n)) {
+		uint64_t pos = node_position(vol, t, n);
+		for(uint32_t steps = 0; t->flinks[n] && node_in_use(t, t->flinks[n]) && steps < t->nnodes; steps++) {
+			n = t->flinks[n];
+			uint64_t next = node_position(vol, t, n);
+			links++;
+			if(next == pos + nodesize)
+				contiguous++;
+			else {
+				backward += next < pos;
+				distance += next < pos ? pos - next : next - pos;
+			}
+			pos = next;
+		}
+	}
+	fprintf(out, "%s.leaf_chain.links: %" PRIu64 "\n", t->name, links);
+	fprintf(out, "%s.leaf_chain.contiguous: %" PRIu64 "\n", t->name, contiguous);
+	fprintf(out, "%s.leaf_chain.backward: %" PRIu64 "\n", t->name, backward);
+	fprintf(out, "%s.leaf_chain.mean_seek: %" PRIu64 "\n", t->name, links > contiguous ? distance / (links - contiguous) : 0);
+	ret = 0;
+
+end:
+	free(buf);
+	free(scratch);
+	return ret;
+}
+
+static int cmp_folder(const void* a, const void* b) {
+	const struct folder* x = a,* y = b;
+	return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+}
+
+// length of the path hfs_lookup would be given for a folder, in UTF-16 units
+static uint32_t path_length(struct profile* p, hfs_cnid_t cnid, unsigned depth) {
+	if(cnid == HFS_CNID_ROOT_FOLDER || depth > 512)
+		return 0;
+	struct folder* f = bsearch(&(struct folder){ .cnid = cnid }, p->folders.data, p->folders.size, sizeof(*p->folders.data), cmp_folder);
+	if(!f)
+		return 0;
+	if(!f->pathlen)
+		f->pathlen = path_length(p, f->parent, depth + 1) + 1 + f->namelen;
+	return f->pathlen;
+}
+
+// bytes of node cache needed for lookups to find a fraction `rate` of their nodes cached, if lookups are spread
+// evenly over the records. every lookup reads one node per level, so whole levels are cached from the root down
+// until enough of each lookup's reads hit, and the last level needed is cached in proportion
+static uint64_t node_cache_size(struct profile_tree* t, double rate) {
+	double hits = rate * t->hr->tree_depth;
+	uint64_t nodes = 0;
+	for(unsigned h = min(t->hr->tree_depth, MAX_HEIGHT); h && hits > 0; h--, hits--)
+		nodes += round_up(t->levels[h].nodes * (hits < 1 ? hits : 1));
+	return nodes * hfs_cache_entry_size(2 * sizeof(uint32_t), t->hr->node_size);
+}
+
+static void allocation_profile(hfs_volume* vol, FILE* out) {
+	uint32_t total = vol->vh.total_blocks;
+	uint64_t size = (total + 7) / 8;
+	uint64_t nfree = 0, runs = 0, largest = 0, run = 0;
+	hfs_extent_descriptor_t* extents = NULL;
+	uint16_t nextents = hfslib_get_file_extents(vol, HFS_CNID_ALLOCATION, HFS_DATAFORK, &extents, NULL);
+	uint8_t* bitmap = malloc(PROFILE_CHUNK_SIZE);
+	if(!bitmap || !nextents)
+		goto end;
+	// the bitmap is read in pieces like the b-trees, with free runs carried across them
+	for(uint64_t pos = 0; pos < size; pos += PROFILE_CHUNK_SIZE) {
+		uint64_t len = min(size - pos, PROFILE_CHUNK_SIZE), bytes;
+		if(hfslib_readd_with_extents(vol, bitmap, &bytes, len, pos, extents, nextents, NULL) || bytes < len)
+			goto end;
+		uint32_t first = pos * 8, last = min(total, (pos + len) * 8);
+		for(uint32_t b = first; b < last; b++) {
+			if(!(bitmap[(b - first) / 8] & (0x80 >> (b % 8)))) {
+				run++;
+				continue;
+			}
+			if(run) {
+				nfree += run;
+				runs++;
+				largest = run > largest ? run : largest;
+			}
+			run = 0;
+		}
+	}
+	if(run) {
+		nfree += run;
+		runs++;
+		largest = run > largest ? run : largest;
+	}
+	fprintf(out, "allocation.block_size: %" PRIu32 "\n", vol->vh.block_size);
+	fprintf(out, "allocation.total_blocks: %" PRIu32 "\n", total);
+	fprintf(out, "allocation.free_blocks: %" PRIu64 "\n", nfree);
+	fprintf(out, "allocation.free_extents: %" PRIu64 "\n", runs);
+	fprintf(out, "allocation.largest_free_extent: %" PRIu64 "\n", largest);
+end:
+	free(bitmap);
+	free(extents);
+}
+
+int hfs_profile_volume(hfs_volume* vol, double rate, FILE* out) {
+	struct profile p = { .vol = vol };
+	struct profile_tree trees[2] = {
+		{ .name = "extents", .btree = HFS_EXTENTS_FILE, .hr = &vol->ehr, .fork = &vol->vh.extents_file },
+		{ .name = "catalog", .btree = HFS_CATALOG_FILE, .hr = &vol->chr, .fork = &vol->vh.catalog_file },
+	};
+	int ret = 0;
+	// overflow extents are needed to count the extents of each fork found in the catalog
+	for(int i = 0; i < 2 && !ret; i++) {
+		ret = profile_btree(&p, trees + i, out);
+		if(!i)
+			merge_overflow(&p);
+		if(p.nomem)
+			ret = -ENOMEM;
+	}
+	if(ret)
+		goto end;
+
+	fprintf(out, "catalog.folders: %" PRIu64 "\n", p.types[HFS_REC_FLDR]);
+	fprintf(out, "catalog.files: %" PRIu64 "\n", p.types[HFS_REC_FILE]);
+	fprintf(out, "catalog.threads: %" PRIu64 "\n", p.types[HFS_REC_FLDR_THREAD] + p.types[HFS_REC_FILE_THREAD]);
+	fprintf(out, "forks: %" PRIu64 "\n", p.forks);
+	fprintf(out, "forks.fragmented: %" PRIu64 "\n", p.fragmented);
+	fprintf(out, "forks.overflowed: %" PRIu64 "\n", p.overflowed);
+	for(unsigned b = 0; b < BUCKETS; b++)
+		if(p.fork_extents[b])
+			fprintf(out, "forks.extents.%llu: %" PRIu64 "\n", 1ULL << b, p.fork_extents[b]);
+	allocation_profile(vol, out);
+
+	// the record cache is keyed by path
+	qsort(p.folders.data, p.folders.size, sizeof(*p.folders.data), cmp_folder);
+	uint64_t pathlen = 0, records = p.parents.size;
+	for(size_t i = 0; i < p.parents.size; i++)
+		pathlen += path_length(&p, p.parents.data[i], 0) + 1;
+	pathlen += p.namelen;
+	size_t record_entry = hfs_cache_entry_size(records ? pathlen / records : 0, sizeof(hfs_catalog_keyed_record_t) + sizeof(hfs_catalog_key_t));
+	uint64_t record_cache = round_up(rate * records) * record_entry;
+	uint64_t node_cache = node_cache_size(trees + 1, rate) + (trees[0].hr->leaf_recs ? node_cache_size(trees, rate) : 0);
+	fprintf(out, "recommend.hit_rate: %.3f\n", rate);
+	fprintf(out, "recommend.node_cache: %" PRIu64 "\n", node_cache);
+	fprintf(out, "recommend.record_cache: %" PRIu64 "\n", record_cache);
+	fprintf(out, "recommend.cache_size: %" PRIu64 "\n", node_cache + record_cache);
+
+end:
+	for(int i = 0; i < 2; i++) {
+		free(trees[i].extents);
+		free(trees[i].map);
+		free(trees[i].flinks);
+	}
+	free(p.overflow.data);
+	free(p.folders.data);
+	free(p.parents.data);
+	return ret;
+}
@@ -0,0 +1,429 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "replica.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// read times are bucketed by power of two in ns, each split in 4
+#define LATENCY_BUCKETS 256
+// hedge after this long until there are enough samples for a percentile
+#define HEDGE_INITIAL_NS 10000000
+#define HEDGE_MIN_SAMPLES 64
+// the histogram is halved at this many samples so it follows the device's recent behavior
+#define HEDGE_DECAY_SAMPLES 65536
+// a copy that failed a read is only used again when no other is left to try for this long
+#define REPLICA_DOWN_NS 5000000000ULL
+
+struct replica_read;
+
+struct replica_job {
+	struct replica_job* next;
+	struct replica_read* read;
+};
+
+// one request, answered by whichever of the copies it was sent to finishes first
+struct replica_read {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const struct iovec* iov;
+	int iovcnt;
+	size_t count;
+	off_t offset;
+	unsigned refs;    // the caller and each copy's read that hasn't finished
+	unsigned pending; // copies' reads that haven't finished
+	uint32_t tried;   // copies the read has been sent to
+	bool done;
+	ssize_t result;
+	int error;
+	struct replica_job jobs[HFS_REPLICAS_MAX];
+};
+
+struct replica {
+	struct hfs_replicas* set;
+	int fd;
+	atomic_uint inflight;
+	atomic_uint_fast64_t latency;    // moving average of read times, in ns
+	atomic_uint_fast64_t down_until; // on the monotonic clock, after a failed read
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct replica_job* head,** tail;
+	atomic_uint refs; // the set's owner and each running reader, the last of which closes fd
+};
+
+struct hfs_replicas {
+	struct replica replicas[HFS_REPLICAS_MAX];
+	unsigned count;
+	double percentile;
+	atomic_bool stop;
+	atomic_uint refs; // the owner and each running reader, the last of which frees the set
+	pthread_mutex_t stats_lock;
+	uint32_t histogram[LATENCY_BUCKETS];
+	uint64_t samples;
+	atomic_uint_fast64_t hedge_after; // ns, 0 if never
+};
+
+static inline uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned latency_bucket(uint64_t ns) {
+	if(ns < 4)
+		return ns;
+	unsigned b = 63 - __builtin_clzll(ns);
+	return b * 4 + ((ns >> (b - 2)) & 3);
+}
+
+// the largest read time in a bucket
+static inline uint64_t bucket_limit(unsigned i) {
+	if(i < 4)
+		return i;
+	unsigned b = i / 4;
+	return ((uint64_t)(5 + i % 4) << (b - 2)) - 1;
+}
+
+static void record_latency(struct hfs_replicas* r, uint64_t ns) {
+	if(r->percentile >= 100)
+		return;
+	pthread_mutex_lock(&r->stats_lock);
+	r->histogram[latency_bucket(ns)]++;
+	if(++r->samples >= HEDGE_DECAY_SAMPLES) {
+		r->samples = 0;
+		for(unsigned i = 0; i < LATENCY_BUCKETS; i++)
+			r->samples += r->histogram[i] /= 2;
+	}
+	if(r->samples >= HEDGE_MIN_SAMPLES && !(r->samples % HEDGE_MIN_SAMPLES)) {
+		uint64_t rank = r->samples * r->percentile / 100, seen = 0;
+		unsigned i = 0;
+		while(i < LATENCY_BUCKETS - 1 && (seen += r->histogram[i]) <= rank)
+			i++;
+		atomic_store(&r->hedge_after,bucket_limit(i) + 1);
+	}
+	pthread_mutex_unlock(&r->stats_lock);
+}
+
+static ssize_t pread_full(int fd, char* buf, size_t count, off_t offset) {
+	size_t total = 0;
+	while(total < count) {
+		ssize_t n = pread(fd,buf + total,count - total,offset + total);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			return -1;
+		if(!n)
+			break;
+		total += n;
+	}
+	return total;
+}
+
+static void scatter(const struct iovec* iov, int iovcnt, const char* buf, size_t len) {
+	for(int i = 0; i < iovcnt && len; i++) {
+		size_t n = iov[i].iov_len < len ? iov[i].iov_len : len;
+		memcpy(iov[i].iov_base,buf,n);
+		buf += n;
+		len -= n;
+	}
+}
+
+static void release_read(struct replica_read* rd) {
+	bool last = !--rd->refs;
+	pthread_mutex_unlock(&rd->lock);
+	if(last) {
+		pthread_mutex_destroy(&rd->lock);
+		pthread_cond_destroy(&rd->cond);
+		free(rd);
+	}
+}
+
+// a dropped job only lets go of the read, for reads still queued when the set is destroyed
+static void run_job(struct replica* rep, struct replica_read* rd, bool drop) {
+	pthread_mutex_lock(&rd->lock);
+	bool answered = drop || rd->done;
+	pthread_mutex_unlock(&rd->lock);
+
+	// each copy reads into its own buffer, as a loser may still be reading after the caller has returned
+	ssize_t n = -1;
+	int err = EIO;
+	char* buf = NULL;
+	if(!answered) {
+		if(!(buf = malloc(rd->count)))
+			err = ENOMEM;
+		else {
+			uint64_t start = now_ns();
+			if((n = pread_full(rep->fd,buf,rd->count,rd->offset)) < 0)
+				err = errno;
+			uint64_t elapsed = now_ns() - start;
+			if(n >= 0) {
+				uint64_t avg = atomic_load(&rep->latency);
+				atomic_store(&rep->latency,avg ? avg - avg / 8 + elapsed / 8 : elapsed);
+				record_latency(rep->set,elapsed);
+			}
+			else atomic_store(&rep->down_until,now_ns() + REPLICA_DOWN_NS);
+		}
+	}
+
+	pthread_mutex_lock(&rd->lock);
+	rd->pending--;
+	if(n >= 0 && !rd->done) {
+		scatter(rd->iov,rd->iovcnt,buf,n);
+		rd->done = true;
+		rd->result = n;
+	}
+	else if(n < 0 && !answered)
+		rd->error = err;
+	pthread_cond_broadcast(&rd->cond);
+	release_read(rd);
+	free(buf);
+	atomic_fetch_sub(&rep->inflight,1);
+}
+
+static void free_replicas(struct hfs_replicas* r) {
+	for(unsigned i = 0; i < r->count; i++) {
+		pthread_mutex_destroy(&r->replicas[i].lock);
+		pthread_cond_destroy(&r->replicas[i].cond);
+	}
+	pthread_mutex_destroy(&r->stats_lock);
+	free(r);
+}
+
+static void release_fd(struct replica* rep) {
+	if(atomic_fetch_sub(&rep->refs,1) == 1 && rep->fd >= 0)
+		close(rep->fd);
+}
+
+static void release_set(struct hfs_replicas* r) {
+	if(atomic_fetch_sub(&r->refs,1) == 1)
+		free_replicas(r);
+}
+
+static void* replica_worker(void* arg) {
+	struct replica* rep = arg;
+	pthread_mutex_lock(&rep->lock);
+	while(!atomic_load(&rep->set->stop)) {
+		struct replica_job* job = rep->head;
+		if(!job) {
+			pthread_cond_wait(&rep->cond,&rep->lock);
+			continue;
+		}
+		if(!(rep->head = job->next))
+			rep->tail = &rep->head;
+		pthread_mutex_unlock(&rep->lock);
+		run_job(rep,job->read,false);
+		pthread_mutex_lock(&rep->lock);
+	}
+	struct replica_job* job = rep->head;
+	rep->head = NULL;
+	rep->tail = &rep->head;
+	pthread_mutex_unlock(&rep->lock);
+	while(job) {
+		struct replica_job* next = job->next; // the job lives in the read, which dropping may free
+		run_job(rep,job->read,true);
+		job = next;
+	}
+	release_fd(rep);
+	release_set(rep->set);
+	return NULL;
+}
+
+// sends the read to the best copy it hasn't been sent to: one that hasn't failed lately, then the
+// one with the fewest reads outstanding, then the fastest. called with rd->lock held
+static bool send_read(struct hfs_replicas* r, struct replica_read* rd) {
+	uint64_t now = now_ns();
+	int best = -1;
+	bool best_down = true;
+	unsigned best_inflight = 0;
+	uint64_t best_latency = 0;
+	for(unsigned i = 0; i < r->count; i++) {
+		if(rd->tried & (1u << i))
+			continue;
+		struct replica* rep = r->replicas + i;
+		bool down = atomic_load(&rep->down_until) > now;
+		unsigned inflight = atomic_load(&rep->inflight);
+		uint64_t latency = atomic_load(&rep->latency);
+		if(best < 0 || down < best_down || (down == best_down && (inflight < best_inflight ||
+		   (inflight == best_inflight && latency < best_latency)))) {
+			best = i;
+			best_down = down;
+			best_inflight = inflight;
+			best_latency = latency;
+		}
+	}
+	if(best < 0)
+		return false;
+
+	struct replica* rep = r->replicas + best;
+	struct replica_job* job = rd->jobs + best;
+	job->next = NULL;
+	job->read = rd;
+	rd->tried |= 1u << best;
+	rd->refs++;
+	rd->pending++;
+	atomic_fetch_add(&rep->inflight,1);
+	pthread_mutex_lock(&rep->lock);
+	*rep->tail = job;
+	rep->tail = &job->next;
+	pthread_cond_signal(&rep->cond);
+	pthread_mutex_unlock(&rep->lock);
+	return true;
+}
+
+static inline void deadline_after(struct timespec* ts, uint64_t ns) {
+	clock_gettime(CLOCK_REALTIME,ts);
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+static ssize_t replicas_read(struct hfs_replicas* r, const struct iovec* iov, int iovcnt, off_t offset) {
+	size_t count = 0;
+	for(int i = 0; i < iovcnt; i++)
+		count += iov[i].iov_len;
+	if(!count)
+		return 0;
+
+	struct replica_read* rd = calloc(1,sizeof(*rd));
+	if(!rd)
+		return (errno = ENOMEM), -1;
+	pthread_mutex_init(&rd->lock,NULL);
+	pthread_cond_init(&rd->cond,NULL);
+	rd->iov = iov;
+	rd->iovcnt = iovcnt;
+	rd->count = count;
+	rd->offset = offset;
+	rd->refs = 1;
+	rd->error = EIO;
+
+	pthread_mutex_lock(&rd->lock);
+	send_read(r,rd);
+	uint64_t hedge_after = atomic_load(&r->hedge_after);
+	struct timespec deadline;
+	if(hedge_after)
+		deadline_after(&deadline,hedge_after);
+	while(!rd->done) {
+		if(!rd->pending) {
+			// every copy asked so far failed
+			if(!send_read(r,rd))
+				break;
+		}
+		else if(!hedge_after)
+			pthread_cond_wait(&rd->cond,&rd->lock);
+		else if(pthread_cond_timedwait(&rd->cond,&rd->lock,&deadline) == ETIMEDOUT) {
+			if(send_read(r,rd))
+				deadline_after(&deadline,hedge_after);
+			else hedge_after = 0;
+		}
+	}
+	ssize_t ret = rd->done ? rd->result : -1;
+	if(ret < 0)
+		errno = rd->error;
+	release_read(rd);
+	return ret;
+}
+
+ssize_t hfs_replicas_pread(struct hfs_replicas* r, void* buf, size_t count, off_t offset) {
+	struct iovec iov = { buf, count };
+	return replicas_read(r,&iov,1,offset);
+}
+
+ssize_t hfs_replicas_preadv(struct hfs_replicas* r, const struct iovec* iov, int iovcnt, off_t offset) {
+	return replicas_read(r,iov,iovcnt,offset);
+}
+
+struct hfs_replicas* hfs_replicas_create(const int* fds, unsigned count, double percentile) {
+	if(!count || count > HFS_REPLICAS_MAX)
+		return (errno = EINVAL), NULL;
+	struct hfs_replicas* r = calloc(1,sizeof(*r));
+	if(!r)
+		return NULL;
+	r->percentile = percentile;
+	atomic_init(&r->stop,false);
+	atomic_init(&r->refs,1);
+	atomic_init(&r->hedge_after,percentile < 100 && count > 1 ? HEDGE_INITIAL_NS : 0);
+	pthread_mutex_init(&r->stats_lock,NULL);
+	for(; r->count < count; r->count++) {
+		struct replica* rep = r->replicas + r->count;
+		rep->set = r;
+		rep->tail = &rep->head;
+		atomic_init(&rep->inflight,0);
+		atomic_init(&rep->latency,0);
+		atomic_init(&rep->down_until,0);
+		atomic_init(&rep->refs,1);
+		pthread_mutex_init(&rep->lock,NULL);
+		pthread_cond_init(&rep->cond,NULL);
+		// a reader stuck on a hung device keeps its own fd open after the owner has closed theirs
+		if((rep->fd = dup(fds[r->count])) < 0) {
+			r->count++;
+			goto error;
+		}
+		unsigned started = 0;
+		for(; started < HFS_REPLICA_THREADS; started++) {
+			pthread_t thread;
+			atomic_fetch_add(&rep->refs,1);
+			atomic_fetch_add(&r->refs,1);
+			if((errno = pthread_create(&thread,NULL,replica_worker,rep))) {
+				atomic_fetch_sub(&rep->refs,1);
+				atomic_fetch_sub(&r->refs,1);
+				break;
+			}
+			pthread_detach(thread);
+		}
+		if(!started) {
+			r->count++;
+			goto error;
+		}
+	}
+	return r;
+
+error: {
+		int err = errno;
+		hfs_replicas_destroy(r);
+		errno = err;
+		return NULL;
+	}
+}
+
+void hfs_replicas_destroy(struct hfs_replicas* r) {
+	if(!r)
+		return;
+	atomic_store(&r->stop,true);
+	for(unsigned i = 0; i < r->count; i++) {
+		struct replica* rep = r->replicas + i;
+		pthread_mutex_lock(&rep->lock);
+		pthread_cond_broadcast(&rep->cond);
+		pthread_mutex_unlock(&rep->lock);
+		release_fd(rep);
+	}
+	release_set(r);
+}
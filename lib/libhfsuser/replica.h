@@ -0,0 +1,54 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_REPLICA_H
+#define HFSUSER_REPLICA_H
+
+#include "hfsuser.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Reads from a set of bit-identical copies of a device. Each read goes to the copy with the fewest
+// reads outstanding, done by a few threads per copy. A read still unanswered after a percentile of
+// recent read times is repeated on the next best copy and the first answer wins, and a read that
+// fails is retried on copies not yet tried, so one slow or failing copy doesn't set the tail latency.
+
+#define HFS_REPLICA_THREADS 4
+
+struct hfs_replicas;
+
+// percentile is of read times, in (0,100), past which a read is repeated; 100 or more never does.
+// the set reads from its own duplicates of the fds, which the caller may close at any time.
+// the reader threads are started here, so a process that forks should create the set after forking
+struct hfs_replicas* hfs_replicas_create(const int* fds, unsigned count, double percentile);
+// must not be called with reads waiting. doesn't wait for the readers: one stuck on a hung device
+// frees its share of the set whenever its read returns
+void hfs_replicas_destroy(struct hfs_replicas*);
+
+// like pread and preadv
+ssize_t hfs_replicas_pread(struct hfs_replicas*, void* buf, size_t count, off_t offset);
+ssize_t hfs_replicas_preadv(struct hfs_replicas*, const struct iovec* iov, int iovcnt, off_t offset);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hfsuser.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct scan_part {
+	hfs_volume* vol;
+	const hfs_catalog_predicate_t* pred;
+	uint32_t first, stop;
+	hfs_catalog_walk_func func;
+	void* cookie;
+	atomic_bool* stop_all;
+	int ret;
+	pthread_t thread;
+};
+
+unsigned hfs_cpu_count(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? cpus : 1;
+}
+
+// stops every partition once any one of them fails
+static int scan_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct scan_part* p = cookie;
+	if(*p->stop_all)
+		return 1;
+	int ret = p->func(vol,key,rec,p->cookie);
+	if(ret)
+		*p->stop_all = true;
+	return ret;
+}
+
+static void* scan_worker(void* arg) {
+	struct scan_part* p = arg;
+	if((p->ret = hfslib_walk_catalog_range(p->vol,p->pred,p->first,p->stop,scan_visit,p,NULL)))
+		*p->stop_all = true;
+	return NULL;
+}
+
+int hfs_scan_catalog(hfs_volume* vol, const hfs_catalog_predicate_t* pred, unsigned partitions, hfs_catalog_walk_func func, void* cookies[]) {
+	if(!partitions)
+		return -EINVAL;
+	uint32_t* starts = malloc(partitions * sizeof(*starts));
+	struct scan_part* parts = calloc(partitions, sizeof(*parts));
+	int ret = -ENOMEM;
+	if(!starts || !parts)
+		goto end;
+
+	uint32_t nparts = hfslib_partition_catalog(vol,partitions,starts,NULL);
+	if(!nparts) {
+		ret = -EIO;
+		goto end;
+	}
+
+	atomic_bool stop_all = false;
+	unsigned started = 0;
+	for(uint32_t i = 0; i < nparts; i++)
+		parts[i] = (struct scan_part){
+			.vol = vol, .pred = pred, .first = starts[i], .stop = i+1 < nparts ? starts[i+1] : 0,
+			.func = func, .cookie = cookies[i], .stop_all = &stop_all
+		};
+	// the first partition runs on this thread
+	for(uint32_t i = 1; i < nparts; i++, started++)
+		if(pthread_create(&parts[i].thread,NULL,scan_worker,parts+i))
+			break;
+	if(started == nparts-1)
+		scan_worker(parts);
+	else stop_all = true;
+	for(uint32_t i = 1; i <= started; i++)
+		pthread_join(parts[i].thread,NULL);
+
+	ret = started == nparts-1 ? nparts : -EAGAIN;
+	for(uint32_t i = 0; i < nparts && ret > 0; i++)
+		if(parts[i].ret)
+			ret = parts[i].ret < 0 ? -EIO : -ECANCELED;
+
+end:
+	free(starts);
+	free(parts);
+	return ret;
+}
@@ -0,0 +1,341 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "search.h"
+#include "sidecar.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_MAGIC "HFSTRIGR"
+#define SEARCH_VERSION 1
+
+// index layout, all in host byte order:
+// struct search_header, then the trigram table sorted by trigram, the name table sorted by cnid,
+// the folded names (each a length followed by UTF-16 units), and the postings
+struct search_header { uint32_t ntrigrams, nnames; uint64_t names_size, postings_size; };
+struct search_trigram { unichar_t t[3]; uint16_t reserved; uint32_t count, offset; };
+struct search_name { hfs_cnid_t cnid; uint32_t offset; }; // in units of the names array
+
+struct hfs_search_index {
+	const void* base;
+	size_t size;
+	bool mapped;
+	const struct search_header* header;
+	const struct search_trigram* trigrams;
+	const struct search_name* names;
+	const unichar_t* folded;
+	const uint8_t* postings;
+};
+
+struct search_posting { unichar_t t[3]; hfs_cnid_t cnid; };
+
+struct search_scan {
+	VECTOR(struct search_posting) postings;
+	VECTOR(struct search_name) names;
+	VECTOR(unichar_t) folded;
+};
+
+// case folds a name as in HFS+ key comparison, dropping ignorable characters
+static uint16_t fold_name(const unichar_t* in, uint16_t len, unichar_t* out) {
+	uint16_t n = 0;
+	for(uint16_t i = 0; i < len; i++) {
+		unichar_t c = in[i], lc = hfs_gcft[c >> 8];
+		if(lc)
+			lc = hfs_gcft[lc + (c & 0xFF)];
+		else lc = c;
+		if(lc)
+			out[n++] = lc;
+	}
+	return n;
+}
+
+static int cmp_trigram(const unichar_t* a, const unichar_t* b) {
+	for(int i = 0; i < 3; i++)
+		if(a[i] != b[i])
+			return (a[i] > b[i]) - (a[i] < b[i]);
+	return 0;
+}
+
+static int cmp_posting(const void* a, const void* b) {
+	const struct search_posting* x = a,* y = b;
+	int c = cmp_trigram(x->t,y->t);
+	return c ? c : (x->cnid > y->cnid) - (x->cnid < y->cnid);
+}
+
+static int cmp_name(const void* a, const void* b) {
+	hfs_cnid_t x = ((const struct search_name*)a)->cnid, y = ((const struct search_name*)b)->cnid;
+	return (x > y) - (x < y);
+}
+
+static int search_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct search_scan* s = cookie;
+	unichar_t folded[255];
+	uint16_t len = fold_name(key->name.unicode,key->name.length,folded);
+	if(!PUSH(s->names, (struct search_name){ rec->folder.cnid, s->folded.size }) || !PUSH(s->folded,len))
+		return -1;
+	for(uint16_t i = 0; i < len; i++)
+		if(!PUSH(s->folded,folded[i]))
+			return -1;
+	// repeated trigrams within a name are removed when the postings are sorted
+	for(uint16_t i = 0; i + 3 <= len; i++)
+		if(!PUSH(s->postings, (struct search_posting){ { folded[i], folded[i+1], folded[i+2] }, rec->folder.cnid }))
+			return -1;
+	return 0;
+}
+
+static void put_varint(uint8_t** p, uint32_t v) {
+	while(v >= 0x80) {
+		*(*p)++ = v | 0x80;
+		v >>= 7;
+	}
+	*(*p)++ = v;
+}
+
+static bool get_varint(const uint8_t** p, const uint8_t* end, uint32_t* v) {
+	*v = 0;
+	for(int shift = 0; shift < 35 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+		*v |= (uint32_t)(b & 0x7F) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool search_index_init(struct hfs_search_index* idx) {
+	const struct search_header* h = idx->base;
+	if(idx->size < sizeof(*h))
+		return false;
+	uint64_t tables = sizeof(*h) + (uint64_t)h->ntrigrams * sizeof(struct search_trigram) + (uint64_t)h->nnames * sizeof(struct search_name);
+	if(tables + h->names_size * sizeof(unichar_t) + h->postings_size != idx->size)
+		return false;
+	idx->header = h;
+	idx->trigrams = (const struct search_trigram*)(h + 1);
+	idx->names = (const struct search_name*)(idx->trigrams + h->ntrigrams);
+	idx->folded = (const unichar_t*)(idx->names + h->nnames);
+	idx->postings = (const uint8_t*)(idx->folded + h->names_size);
+	return true;
+}
+
+// lays the scan out in the index format, in one buffer
+static void* search_serialize(struct search_scan* s, size_t* size) {
+	struct search_posting* p = s->postings.data;
+	size_t np = s->postings.size;
+	qsort(p,np,sizeof(*p),cmp_posting);
+	qsort(s->names.data,s->names.size,sizeof(*s->names.data),cmp_name);
+
+	// worst case for each trigram entry and posting
+	uint64_t bound = sizeof(struct search_header) + np * (sizeof(struct search_trigram) + 5) +
+	                 s->names.size * sizeof(struct search_name) + s->folded.size * sizeof(unichar_t);
+	if(bound > SIZE_MAX || s->names.size > UINT32_MAX)
+		return NULL;
+	uint32_t ntrigrams = 0;
+	for(size_t i = 0; i < np; i++)
+		ntrigrams += !i || cmp_trigram(p[i].t,p[i-1].t);
+	char* buf = malloc(bound);
+	if(!buf)
+		return NULL;
+
+	struct search_header* h = (struct search_header*)buf;
+	*h = (struct search_header){ .ntrigrams = ntrigrams, .nnames = s->names.size, .names_size = s->folded.size };
+	struct search_trigram* t = (struct search_trigram*)(h + 1);
+	struct search_name* names = (struct search_name*)(t + ntrigrams);
+	memcpy(names,s->names.data,s->names.size * sizeof(*names));
+	unichar_t* folded = (unichar_t*)(names + s->names.size);
+	memcpy(folded,s->folded.data,s->folded.size * sizeof(*folded));
+	uint8_t* postings = (uint8_t*)(folded + s->folded.size),* it = postings;
+
+	for(size_t i = 0; i < np;) {
+		memcpy(t->t,p[i].t,sizeof(t->t));
+		t->reserved = 0;
+		t->count = 0;
+		t->offset = it - postings;
+		hfs_cnid_t prev = 0;
+		for(; i < np && !cmp_trigram(p[i].t,t->t); i++)
+			if(!t->count || p[i].cnid != prev) {
+				put_varint(&it,p[i].cnid - prev);
+				prev = p[i].cnid;
+				t->count++;
+			}
+		t++;
+	}
+	h->postings_size = it - postings;
+	if(it - postings > UINT32_MAX) {
+		free(buf);
+		return NULL;
+	}
+	*size = it - (uint8_t*)buf;
+	return buf;
+}
+
+static void* search_scan(hfs_volume* vol, size_t* size) {
+	unsigned nthreads = hfs_cpu_count();
+	struct search_scan parts[nthreads];
+	void* cookies[nthreads];
+	memset(parts,0,sizeof(parts));
+	for(unsigned i = 0; i < nthreads; i++)
+		cookies[i] = parts + i;
+	void* buf = NULL;
+
+	hfs_catalog_condition_t records_only = { HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(&records_only,1,&pred,NULL))
+		goto end;
+	int nparts = hfs_scan_catalog(vol,&pred,nthreads,search_visit,cookies);
+	hfslib_free_catalog_predicate(&pred,NULL);
+	if(nparts <= 0)
+		goto end;
+
+	struct search_scan* s = parts;
+	for(int i = 1; i < nparts; i++) {
+		for(size_t j = 0; j < parts[i].names.size; j++)
+			parts[i].names.data[j].offset += s->folded.size;
+		if(!APPEND(s->postings,parts[i].postings) || !APPEND(s->names,parts[i].names) || !APPEND(s->folded,parts[i].folded))
+			goto end;
+	}
+	if(s->folded.size > UINT32_MAX)
+		goto end;
+	buf = search_serialize(s,size);
+
+end:
+	for(unsigned i = 0; i < nthreads; i++) {
+		free(parts[i].postings.data);
+		free(parts[i].names.data);
+		free(parts[i].folded.data);
+	}
+	return buf;
+}
+
+struct hfs_search_index* hfs_search_index_load(hfs_volume* vol) {
+	struct hfs_search_index* idx = calloc(1,sizeof(*idx));
+	if(!idx)
+		return NULL;
+	if((idx->base = hfs_sidecar_map(vol,"trigrams",SEARCH_MAGIC,SEARCH_VERSION,&idx->size))) {
+		idx->mapped = true;
+		if(search_index_init(idx))
+			return idx;
+		hfs_sidecar_unmap(idx->base,idx->size);
+		idx->mapped = false;
+	}
+
+	if(!(idx->base = search_scan(vol,&idx->size)) || !search_index_init(idx)) {
+		hfs_search_index_free(idx);
+		return NULL;
+	}
+	if(hfs_sidecar_dir(vol)) {
+		int err = hfs_sidecar_write(vol,"trigrams",SEARCH_MAGIC,SEARCH_VERSION,&idx->base,&idx->size,1);
+		if(err)
+			hfslib_error("could not save the search index: %s", __FILE__, __LINE__, strerror(-err));
+	}
+	return idx;
+}
+
+static const unichar_t* find_name(struct hfs_search_index* idx, hfs_cnid_t cnid) {
+	const struct search_name* n = bsearch(&(struct search_name){ .cnid = cnid },idx->names,idx->header->nnames,sizeof(*n),cmp_name);
+	if(!n || n->offset >= idx->header->names_size || n->offset + 1 + (uint64_t)idx->folded[n->offset] > idx->header->names_size)
+		return NULL;
+	return idx->folded + n->offset;
+}
+
+static bool name_contains(const unichar_t* name, const unichar_t* q, uint16_t qlen) {
+	uint16_t len = name[0];
+	name++;
+	for(uint16_t i = 0; i + qlen <= len; i++)
+		if(!memcmp(name + i, q, qlen * sizeof(*q)))
+			return true;
+	return false;
+}
+
+int hfs_search_index_query(struct hfs_search_index* idx, const char* substring, hfs_cnid_t** cnids, uint32_t* count) {
+	hfs_unistr255_t u16;
+	if(hfs_pathname_from_unix(substring,&u16) < 0)
+		return -EINVAL;
+	unichar_t q[255];
+	uint16_t qlen = fold_name(u16.unicode,u16.length,q);
+
+	VECTOR(hfs_cnid_t) found = {0};
+	if(qlen < 3) {
+		// too short for a trigram, so check every name
+		for(uint32_t i = 0; i < idx->header->nnames; i++) {
+			const unichar_t* name = find_name(idx,idx->names[i].cnid);
+			if(name && name_contains(name,q,qlen) && !PUSH(found,idx->names[i].cnid))
+				goto nomem;
+		}
+	}
+	else {
+		// the trigram of the query with the shortest posting list
+		const struct search_trigram* best = NULL;
+		for(uint16_t i = 0; i + 3 <= qlen; i++) {
+			size_t lo = 0, hi = idx->header->ntrigrams;
+			while(lo < hi) {
+				size_t mid = lo + (hi - lo) / 2;
+				int c = cmp_trigram(idx->trigrams[mid].t,q+i);
+				if(!c) {
+					lo = mid;
+					break;
+				}
+				if(c < 0)
+					lo = mid + 1;
+				else hi = mid;
+			}
+			if(lo >= hi) // some trigram appears nowhere
+				goto done;
+			if(!best || idx->trigrams[lo].count < best->count)
+				best = idx->trigrams + lo;
+		}
+		const uint8_t* it = idx->postings + best->offset,* end = idx->postings + idx->header->postings_size;
+		hfs_cnid_t cnid = 0;
+		for(uint32_t i = 0; i < best->count; i++) {
+			uint32_t delta;
+			if(best->offset > idx->header->postings_size || !get_varint(&it,end,&delta))
+				break;
+			cnid += delta;
+			const unichar_t* name = find_name(idx,cnid);
+			if(name && name_contains(name,q,qlen) && !PUSH(found,cnid))
+				goto nomem;
+		}
+	}
+
+done:
+	*cnids = found.data;
+	*count = found.size;
+	return 0;
+
+nomem:
+	free(found.data);
+	return -ENOMEM;
+}
+
+void hfs_search_index_free(struct hfs_search_index* idx) {
+	if(!idx)
+		return;
+	if(idx->mapped)
+		hfs_sidecar_unmap(idx->base,idx->size);
+	else free((void*)idx->base);
+	free(idx);
+}
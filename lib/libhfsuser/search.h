@@ -0,0 +1,43 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_SEARCH_H
+#define HFSUSER_SEARCH_H
+
+#include "hfsuser.h"
+
+// Substring search over every file and folder name on the volume. Names are
+// case folded with the HFS+ folding table, and each distinct trigram of UTF-16
+// units maps to a delta and varint coded list of the cnids whose names contain
+// it. A query looks up its rarest trigram and checks only those names, which
+// are stored folded alongside the postings. The index is built from one
+// parallel catalog scan, and is saved to and memory mapped from the sidecar
+// directory if there is one.
+struct hfs_search_index;
+
+struct hfs_search_index* hfs_search_index_load(hfs_volume*);
+int  hfs_search_index_query(struct hfs_search_index*, const char* substring, hfs_cnid_t** cnids, uint32_t* count);
+void hfs_search_index_free(struct hfs_search_index*);
+
+#endif
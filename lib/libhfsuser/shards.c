@@ -0,0 +1,280 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "shards.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// sampling is decided on the low bits of the mixed hash, out of this modulus
+#define MODULUS (1 << 24)
+// each time the sample overflows, the threshold drops to shed about this fraction of it
+#define SHED_FRACTION 8
+// halve the histogram after this many sampled references
+#define DECAY_INTERVAL (1 << 16)
+
+struct sample {
+	struct sample* hnext;
+	struct sample* prev,* next; // LRU order, head most recent
+	uint64_t hash;
+	uint32_t t;
+	uint32_t time; // slot of the last reference in the distance tree
+	size_t size;
+};
+
+struct hfs_shards {
+	pthread_mutex_t lock;
+	_Atomic uint32_t threshold; // keys with t below this are sampled
+	size_t max, count;
+	struct sample** buckets;
+	size_t nbuckets;
+	struct sample* head,* tail;
+	// sizes of the samples by the time of their last reference, as a Fenwick tree, so the bytes
+	// referenced since any time are a prefix sum. times are renumbered in LRU order when they run out
+	uint64_t* sizes;
+	uint32_t ntimes, now;
+	uint64_t sampled;
+	// reuse distances, in buckets of power of two sizes from HFS_MRC_MIN_SIZE, and first references
+	double hist[HFS_MRC_POINTS+1], cold, total;
+};
+
+static inline uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static inline uint32_t sample_t(uint64_t hash) {
+	return mix(hash) & (MODULUS - 1);
+}
+
+struct hfs_shards* hfs_shards_create(size_t max_keys) {
+	struct hfs_shards* s = calloc(1,sizeof(*s));
+	if(!s)
+		return NULL;
+	for(s->nbuckets = 64; s->nbuckets < max_keys; s->nbuckets *= 2)
+		;
+	s->ntimes = s->nbuckets * 4;
+	if(!(s->buckets = calloc(s->nbuckets,sizeof(*s->buckets))) || !(s->sizes = calloc(s->ntimes+1,sizeof(*s->sizes)))) {
+		free(s->buckets);
+		free(s);
+		return NULL;
+	}
+	s->max = max_keys;
+	s->threshold = MODULUS;
+	pthread_mutex_init(&s->lock,NULL);
+	return s;
+}
+
+void hfs_shards_destroy(struct hfs_shards* s) {
+	if(!s)
+		return;
+	for(struct sample* it = s->head,* next; it; it = next) {
+		next = it->next;
+		free(it);
+	}
+	free(s->buckets);
+	free(s->sizes);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+static void tree_add(struct hfs_shards* s, uint32_t time, uint64_t delta) {
+	for(; time <= s->ntimes; time += time & -time)
+		s->sizes[time] += delta;
+}
+
+// bytes of samples last referenced at or before time
+static uint64_t tree_sum(struct hfs_shards* s, uint32_t time) {
+	uint64_t sum = 0;
+	for(; time; time -= time & -time)
+		sum += s->sizes[time];
+	return sum;
+}
+
+// gives a sample the next time, renumbering everything from the LRU tail when the times run out
+static void touch(struct hfs_shards* s, struct sample* e) {
+	if(s->now == s->ntimes) {
+		memset(s->sizes,0,(s->ntimes+1) * sizeof(*s->sizes));
+		s->now = 0;
+		for(struct sample* it = s->tail; it; it = it->prev)
+			if(it != e)
+				tree_add(s,it->time = ++s->now,it->size);
+	}
+	tree_add(s,e->time = ++s->now,e->size);
+}
+
+static struct sample* find(struct hfs_shards* s, uint64_t hash) {
+	for(struct sample* it = s->buckets[hash & (s->nbuckets-1)]; it; it = it->hnext)
+		if(it->hash == hash)
+			return it;
+	return NULL;
+}
+
+static void unlink_sample(struct hfs_shards* s, struct sample* e) {
+	if(e->prev) e->prev->next = e->next;
+	else s->head = e->next;
+	if(e->next) e->next->prev = e->prev;
+	else s->tail = e->prev;
+}
+
+static void push_sample(struct hfs_shards* s, struct sample* e) {
+	e->prev = NULL;
+	e->next = s->head;
+	if(s->head) s->head->prev = e;
+	else s->tail = e;
+	s->head = e;
+}
+
+static void drop_sample(struct hfs_shards* s, struct sample* e) {
+	struct sample** it = &s->buckets[e->hash & (s->nbuckets-1)];
+	while(*it != e)
+		it = &(*it)->hnext;
+	*it = e->hnext;
+	unlink_sample(s,e);
+	tree_add(s,e->time,-e->size);
+	s->count--;
+	free(e);
+}
+
+// lowers the threshold to shed the keys with the highest t. the counts so far were taken at the higher
+// rate, so they're scaled down to match what the new rate will add
+static void shed(struct hfs_shards* s) {
+	size_t counts[256] = {0};
+	uint32_t shift = 0;
+	while((s->threshold - 1) >> shift >= 256)
+		shift++;
+	for(struct sample* it = s->head; it; it = it->next)
+		counts[it->t >> shift]++;
+	size_t dropped = 0;
+	int b = 255;
+	while(b > 0 && dropped + counts[b] <= s->count / SHED_FRACTION)
+		dropped += counts[b--];
+	// at least one bucket goes, even if it holds more than the fraction
+	if(dropped == 0 && b > 0)
+		b--;
+	uint32_t threshold = (uint32_t)(b + 1) << shift;
+	if(threshold >= s->threshold)
+		threshold = s->threshold - 1;
+	for(struct sample* it = s->head,* next; it; it = next) {
+		next = it->next;
+		if(it->t >= threshold)
+			drop_sample(s,it);
+	}
+	double scale = (double)threshold / s->threshold;
+	for(int i = 0; i <= HFS_MRC_POINTS; i++)
+		s->hist[i] *= scale;
+	s->cold *= scale;
+	s->total *= scale;
+	s->threshold = threshold;
+}
+
+static inline int distance_bucket(double distance) {
+	int b = 0;
+	for(double size = HFS_MRC_MIN_SIZE; b < HFS_MRC_POINTS && distance > size; size *= 2)
+		b++;
+	return b;
+}
+
+void hfs_shards_access(struct hfs_shards* s, uint64_t hash, size_t size) {
+	if(!s)
+		return;
+	uint32_t t = sample_t(hash);
+	// a stale threshold only lets an extra key through to the check under the lock
+	if(t >= atomic_load_explicit(&s->threshold,memory_order_relaxed))
+		return;
+	pthread_mutex_lock(&s->lock);
+	if(t >= s->threshold)
+		goto end;
+	double rate = (double)s->threshold / MODULUS;
+	struct sample* e = find(s,hash);
+	if(e) {
+		// the distinct keys referenced since this one was last, and itself
+		uint64_t distance = tree_sum(s,s->now) - tree_sum(s,e->time) + e->size;
+		s->hist[distance_bucket(distance / rate)]++;
+		unlink_sample(s,e);
+		tree_add(s,e->time,-e->size);
+		if(size)
+			e->size = size;
+	}
+	else {
+		if(!(e = malloc(sizeof(*e))))
+			goto end;
+		e->hash = hash;
+		e->t = t;
+		e->size = size;
+		e->hnext = s->buckets[hash & (s->nbuckets-1)];
+		s->buckets[hash & (s->nbuckets-1)] = e;
+		s->count++;
+		s->cold++;
+	}
+	push_sample(s,e);
+	touch(s,e);
+	s->total++;
+	if(s->count > s->max)
+		shed(s);
+	if(!(++s->sampled % DECAY_INTERVAL)) {
+		for(int i = 0; i <= HFS_MRC_POINTS; i++)
+			s->hist[i] /= 2;
+		s->cold /= 2;
+		s->total /= 2;
+	}
+end:
+	pthread_mutex_unlock(&s->lock);
+}
+
+void hfs_shards_resize(struct hfs_shards* s, uint64_t hash, size_t size) {
+	if(!s || sample_t(hash) >= atomic_load_explicit(&s->threshold,memory_order_relaxed))
+		return;
+	pthread_mutex_lock(&s->lock);
+	struct sample* e = find(s,hash);
+	if(e) {
+		tree_add(s,e->time,size - e->size);
+		e->size = size;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+void hfs_shards_mrc(struct hfs_shards* s, struct hfs_mrc* mrc) {
+	memset(mrc,0,sizeof(*mrc));
+	if(!s)
+		return;
+	pthread_mutex_lock(&s->lock);
+	double rate = (double)s->threshold / MODULUS;
+	mrc->references = s->total / rate;
+	mrc->keys = s->count;
+	mrc->rate = rate;
+	// a reference misses in a cache of a given size if its reuse distance is larger, or if it's the key's first
+	double misses = s->total;
+	for(int i = 0; i < HFS_MRC_POINTS; i++) {
+		misses -= s->hist[i];
+		mrc->size[i] = (uint64_t)HFS_MRC_MIN_SIZE << i;
+		mrc->miss_ratio[i] = s->total > 0 ? misses / s->total : 0;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,51 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef HFSUSER_SHARDS_H
+#define HFSUSER_SHARDS_H
+
+#include "hfsuser.h"
+
+// Estimates the miss ratio curve of an LRU cache over a stream of keys from a spatially hashed
+// sample of them (SHARDS). Keys whose hash falls below a threshold are tracked exactly, and their
+// reuse distances, the bytes of distinct keys seen since their last reference, are scaled up by
+// the sampling rate. The threshold is lowered as needed to track at most a fixed number of keys,
+// and the histogram decays so the curve follows the recent workload.
+
+// keys tracked per curve, which the SHARDS paper finds enough for curves within a percent or two
+#define HFS_MRC_SAMPLES 4096
+
+struct hfs_shards;
+
+struct hfs_shards* hfs_shards_create(size_t max_keys);
+void hfs_shards_destroy(struct hfs_shards*);
+
+// records a reference to the key with this hash, whose value takes size bytes, or 0 if not yet known
+void hfs_shards_access(struct hfs_shards*, uint64_t hash, size_t size);
+// sets the size of a key once it is known, without counting a reference
+void hfs_shards_resize(struct hfs_shards*, uint64_t hash, size_t size);
+void hfs_shards_mrc(struct hfs_shards*, struct hfs_mrc*);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sidecar.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint64_t hfs_volume_id(hfs_volume* vol) {
+	return (uint64_t)vol->vh.finder_info[6] << 32 | vol->vh.finder_info[7];
+}
+char* hfs_sidecar_path(hfs_volume* vol, const char* dir, const char* kind, const char* suffix) {
+	int len = snprintf(NULL, 0, "%s/%016" PRIx64 "-%08" PRIx32 ".%s%s", dir, hfs_volume_id(vol), vol->vh.date_created, kind, suffix);
+	char* path = malloc(len + 1);
+	if(path)
+		snprintf(path, len + 1, "%s/%016" PRIx64 "-%08" PRIx32 ".%s%s", dir, hfs_volume_id(vol), vol->vh.date_created, kind, suffix);
+	return path;
+}
+
+static char* sidecar_path(hfs_volume* vol, const char* kind, const char* suffix) {
+	const char* dir = hfs_sidecar_dir(vol);
+	return dir ? hfs_sidecar_path(vol,dir,kind,suffix) : NULL;
+}
+
+static bool header_valid(hfs_volume* vol, const struct hfs_sidecar_header* h, const char magic[8], uint32_t version) {
+	return !memcmp(h->magic,magic,sizeof(h->magic)) && h->version == version &&
+	       h->write_count == vol->vh.write_count && h->volume_id == hfs_volume_id(vol) && h->size <= SIZE_MAX;
+}
+
+void* hfs_sidecar_read(hfs_volume* vol, const char* kind, const char magic[8], uint32_t version, size_t* size) {
+	char* path = sidecar_path(vol,kind,"");
+	if(!path)
+		return NULL;
+	FILE* f = fopen(path,"rb");
+	free(path);
+	if(!f)
+		return NULL;
+
+	void* data = NULL;
+	struct hfs_sidecar_header h;
+	if(fread(&h,sizeof(h),1,f) != 1 || !header_valid(vol,&h,magic,version))
+		goto end;
+	if(!(data = malloc(h.size + 1)) || fread(data,1,h.size,f) != h.size) {
+		free(data);
+		data = NULL;
+		goto end;
+	}
+	*size = h.size;
+
+end:
+	fclose(f);
+	return data;
+}
+
+const void* hfs_sidecar_map(hfs_volume* vol, const char* kind, const char magic[8], uint32_t version, size_t* size) {
+	char* path = sidecar_path(vol,kind,"");
+	if(!path)
+		return NULL;
+	int fd = open(path,O_RDONLY);
+	free(path);
+	if(fd < 0)
+		return NULL;
+
+	const char* data = NULL;
+	struct stat st;
+	if(fstat(fd,&st) || (uint64_t)st.st_size < sizeof(struct hfs_sidecar_header) || (uint64_t)st.st_size > SIZE_MAX)
+		goto end;
+	void* map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	if(map == MAP_FAILED)
+		goto end;
+	const struct hfs_sidecar_header* h = map;
+	if(!header_valid(vol,h,magic,version) || h->size != st.st_size - sizeof(*h)) {
+		munmap(map,st.st_size);
+		goto end;
+	}
+	data = (const char*)map + sizeof(*h);
+	*size = h->size;
+
+end:
+	close(fd);
+	return data;
+}
+
+void hfs_sidecar_unmap(const void* data, size_t size) {
+	if(data)
+		munmap((char*)data - sizeof(struct hfs_sidecar_header), size + sizeof(struct hfs_sidecar_header));
+}
+
+int hfs_sidecar_write(hfs_volume* vol, const char* kind, const char magic[8], uint32_t version, const void* const data[], const size_t sizes[], size_t n) {
+	char* path = sidecar_path(vol,kind,"");
+	char* tmp = sidecar_path(vol,kind,".tmp");
+	int ret = 0;
+	FILE* f = NULL;
+	if(!path || !tmp) {
+		ret = hfs_sidecar_dir(vol) ? -ENOMEM : -ENOENT;
+		goto end;
+	}
+	if(!(f = fopen(tmp,"wb"))) {
+		ret = -errno;
+		goto end;
+	}
+
+	struct hfs_sidecar_header h = { .version = version, .write_count = vol->vh.write_count, .volume_id = hfs_volume_id(vol) };
+	memcpy(h.magic,magic,sizeof(h.magic));
+	for(size_t i = 0; i < n; i++)
+		h.size += sizes[i];
+	bool ok = fwrite(&h,sizeof(h),1,f) == 1;
+	for(size_t i = 0; i < n && ok; i++)
+		ok = !sizes[i] || fwrite(data[i],sizes[i],1,f) == 1;
+	if(!ok)
+		ret = -EIO;
+	if(fclose(f) && !ret)
+		ret = -errno;
+	// written in full before replacing the old file, so readers never see a partial one
+	if(!ret && rename(tmp,path))
+		ret = -errno;
+	if(ret)
+		unlink(tmp);
+
+end:
+	free(path);
+	free(tmp);
+	return ret;
+}
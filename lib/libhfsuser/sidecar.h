@@ -0,0 +1,61 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_SIDECAR_H
+#define HFSUSER_SIDECAR_H
+
+#include "hfsuser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Indexes built from a full catalog scan can be saved to files in a sidecar
+// directory and reused by later runs instead of scanning again. Each file is
+// named for the volume's unique ID and creation date plus the kind of index,
+// and starts with a header recording the volume's write count, which changes
+// whenever the volume is mounted writable, so stale files are ignored.
+struct hfs_sidecar_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t write_count;
+	uint64_t volume_id;
+	uint64_t size; // bytes following the header
+};
+
+// the sidecar directory, or NULL if disabled
+const char* hfs_sidecar_dir(hfs_volume*);
+// the unique ID Mac OS X stores in the volume header's finder info
+uint64_t hfs_volume_id(hfs_volume*);
+// a malloc'd path for a file of the given kind for this volume in dir
+char* hfs_sidecar_path(hfs_volume*, const char* dir, const char* kind, const char* suffix);
+
+// reads a whole sidecar file's contents, returning NULL if it's missing, stale, or from a different format version
+void* hfs_sidecar_read(hfs_volume*, const char* kind, const char magic[8], uint32_t version, size_t* size);
+// maps a sidecar file's contents read-only, returning NULL under the same conditions as hfs_sidecar_read
+const void* hfs_sidecar_map(hfs_volume*, const char* kind, const char magic[8], uint32_t version, size_t* size);
+void hfs_sidecar_unmap(const void* data, size_t size);
+// replaces a sidecar file with the concatenation of n pieces of data, returning 0 or a negative errno
+int hfs_sidecar_write(hfs_volume*, const char* kind, const char magic[8], uint32_t version, const void* const data[], const size_t sizes[], size_t n);
+
+#endif
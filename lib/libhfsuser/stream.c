@@ -0,0 +1,217 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE // copy_file_range, splice
+
+#include "hfsuser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STREAM_BUFFER (8*1024*1024)
+
+// a contiguous run of the fork's bytes on the device
+struct segment {
+	uint64_t offset, length;
+};
+
+struct stream {
+	int in, out;
+	uint32_t blksize;
+	struct segment* segs;
+	size_t nsegs;
+	// progress, shared by whichever strategy finishes the copy
+	size_t seg;
+	uint64_t pos; // into segs[seg]
+	// the reader fills the buffers in turn and the writer empties them in the same order
+	struct {
+		char* data;
+		size_t skip, length;
+		bool full;
+	} bufs[2];
+	bool eof;
+	int err;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static size_t map_segments(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t offset, uint64_t length, struct segment* segs) {
+	size_t n = 0;
+	for(uint16_t i = 0; i < nextents && length; i++) {
+		uint64_t size = (uint64_t)extents[i].block_count * vol->vh.block_size;
+		if(offset >= size) {
+			offset -= size;
+			continue;
+		}
+		uint64_t len = min(size - offset, length);
+		segs[n++] = (struct segment){ vol->offset + (uint64_t)extents[i].start_block * vol->vh.block_size + offset, len };
+		offset = 0;
+		length -= len;
+	}
+	return n;
+}
+
+#ifdef __linux__
+// lets the kernel move the data itself: copy_file_range between regular files, or splice into a pipe.
+// returns 0 when done, a negative errno, or 1 if neither applies and the rest should be copied through buffers
+static int stream_direct(struct stream* s) {
+	struct stat in, out;
+	if(fstat(s->in,&in) || fstat(s->out,&out))
+		return -errno;
+	bool file = S_ISREG(in.st_mode) && S_ISREG(out.st_mode);
+	if(!file && !S_ISFIFO(out.st_mode))
+		return 1;
+	for(; s->seg < s->nsegs; s->seg++, s->pos = 0)
+		while(s->pos < s->segs[s->seg].length) {
+			loff_t off = s->segs[s->seg].offset + s->pos;
+			size_t len = min(s->segs[s->seg].length - s->pos, (uint64_t)1 << 30);
+			ssize_t n = file ? copy_file_range(s->in,&off,s->out,NULL,len,0) : splice(s->in,&off,s->out,NULL,len,SPLICE_F_MORE);
+			if(n > 0)
+				s->pos += n;
+			else if(n == 0)
+				return -EIO;
+			else if(errno == EINTR)
+				continue;
+			else if(errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)
+				return 1;
+			else return -errno;
+		}
+	return 0;
+}
+#endif
+
+static void* stream_writer(void* data) {
+	struct stream* s = data;
+	pthread_mutex_lock(&s->lock);
+	for(int b = 0; ; b ^= 1) {
+		while(!s->bufs[b].full && !s->eof && !s->err)
+			pthread_cond_wait(&s->cond,&s->lock);
+		if(!s->bufs[b].full || s->err)
+			break;
+		pthread_mutex_unlock(&s->lock);
+		int err = 0;
+		for(size_t done = 0; done < s->bufs[b].length && !err; ) {
+			ssize_t n = write(s->out,s->bufs[b].data + s->bufs[b].skip + done,s->bufs[b].length - done);
+			if(n > 0)
+				done += n;
+			else if(n < 0 && errno != EINTR)
+				err = -errno;
+		}
+		pthread_mutex_lock(&s->lock);
+		if(err)
+			s->err = err;
+		s->bufs[b].full = false;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+// reads each piece of a segment into the next free buffer in whole device blocks while the writer drains the other
+static int stream_buffered(struct stream* s) {
+	pthread_t writer;
+	int ret = 0;
+	if((errno = pthread_create(&writer,NULL,stream_writer,s)))
+		return -errno;
+	for(int b = 0; s->seg < s->nsegs; b ^= 1) {
+		pthread_mutex_lock(&s->lock);
+		while(s->bufs[b].full && !s->err)
+			pthread_cond_wait(&s->cond,&s->lock);
+		ret = s->err;
+		pthread_mutex_unlock(&s->lock);
+		if(ret)
+			break;
+
+		uint64_t start = s->segs[s->seg].offset + s->pos;
+		uint64_t aligned = start / s->blksize * s->blksize;
+		size_t length = min(s->segs[s->seg].length - s->pos, STREAM_BUFFER - s->blksize);
+		size_t span = (start - aligned + length + s->blksize - 1) / s->blksize * s->blksize;
+		for(size_t done = 0; done < start - aligned + length; ) {
+			ssize_t n = pread(s->in,s->bufs[b].data + done,span - done,aligned + done);
+			if(n > 0)
+				done += n;
+			else if(n == 0 || errno != EINTR) {
+				ret = n ? -errno : -EIO;
+				break;
+			}
+		}
+		if(ret)
+			break;
+		if((s->pos += length) == s->segs[s->seg].length) {
+			s->seg++;
+			s->pos = 0;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		s->bufs[b].skip = start - aligned;
+		s->bufs[b].length = length;
+		s->bufs[b].full = true;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+	pthread_mutex_lock(&s->lock);
+	if(ret)
+		s->err = ret;
+	s->eof = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(writer,NULL);
+	return s->err;
+}
+
+int hfs_stream_fork(hfs_volume* vol, const hfs_extent_descriptor_t* extents, uint16_t nextents, uint64_t offset, uint64_t length, int fd) {
+	struct stream s = { .out = fd, .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+	s.in = hfs_device_fd(vol,&s.blksize);
+	if(!(s.segs = malloc((nextents+1) * sizeof(*s.segs))))
+		return -ENOMEM;
+	s.nsegs = map_segments(vol,extents,nextents,offset,length,s.segs);
+	uint64_t mapped = 0;
+	for(size_t i = 0; i < s.nsegs; i++) {
+		mapped += s.segs[i].length;
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(s.in,s.segs[i].offset,s.segs[i].length,POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+	int ret = mapped < length ? -EIO : 1;
+#ifdef __linux__
+	if(ret > 0)
+		ret = stream_direct(&s);
+#endif
+	if(ret > 0) {
+		ret = 0;
+		for(int b = 0; b < 2 && !ret; b++)
+			if((ret = posix_memalign((void**)&s.bufs[b].data,s.blksize,STREAM_BUFFER)))
+				ret = -ret;
+		if(!ret)
+			ret = stream_buffered(&s);
+		free(s.bufs[0].data);
+		free(s.bufs[1].data);
+	}
+	free(s.segs);
+	return ret;
+}
@@ -0,0 +1,754 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sidecar.h"
+#include "vector.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The mirror's manifest lists every file and folder copied by the last sync, with
+// what's needed to tell whether it changed since: its place in the tree and the
+// sizes and dates of its forks. A sync compares a fresh catalog scan to it by
+// CNID, so an unchanged volume costs one scan and no filesystem calls, and a
+// renamed or moved item is renamed locally instead of copied again.
+#define SYNC_MANIFEST ".hfsdump-sync"
+#define SYNC_STAGING ".hfsdump-sync.moving"
+#define SYNC_MAGIC "HFSSYNC"
+#define SYNC_VERSION 1
+#define SYNC_CHUNK (1024*1024)
+
+enum {
+	SYNC_PRIVATE  = 1, // the volume's private folders and files, never mirrored
+	SYNC_DIR_LINK = 2, // directory hard links aren't followed
+	SYNC_SPECIAL  = 4, // devices, fifos, and sockets
+};
+
+struct sync_entry {
+	uint64_t data_size, rsrc_size;
+	int64_t content_mod, attrib_mod;
+	uint64_t name; // offset into the list's names
+	uint32_t cnid, parent;
+	uint32_t inode; // record holding the forks, the target of a hard link or the file itself
+	uint16_t namelen, mode;
+	uint8_t type, flags;
+};
+
+struct sync_list {
+	VECTOR(struct sync_entry) entries; // sorted by cnid
+	VECTOR(char) names;
+	uint8_t* reach; // 0 unknown, 1 reachable from the root, 2 not
+	char** paths;   // built only for the entries that need them
+};
+
+// what a sync does to each item, applied in passes over the old and new trees
+enum {
+	OP_DELETE  = 1,
+	OP_MOVE    = 2,
+	OP_CREATE  = 4,
+	OP_DATA    = 8,  // copy the data fork
+	OP_RSRC    = 16, // write the resource fork's AppleDouble file, or remove it if now empty
+	OP_META    = 32, // permissions and times
+	OP_FAILED  = 64,
+	OP_TOUCHED = 128, // a folder whose contents were changed here, so its times need setting again
+};
+
+struct sync_op {
+	size_t old, new; // indexes into each list, SIZE_MAX if absent
+	unsigned flags;
+	int depth;
+};
+
+struct sync_state {
+	hfs_volume* vol;
+	const char* dest;
+	hfs_cnid_t root;
+	struct sync_list old, new;
+	VECTOR(struct sync_op) ops;
+	uint8_t* opflags; // by new index
+	FILE* log;
+	// copy pool
+	size_t* copies;
+	size_t ncopies, next;
+	pthread_mutex_t lock;
+	long failed;
+};
+
+static int entry_cmp(const void* a, const void* b) {
+	const struct sync_entry* x = a, * y = b;
+	return (x->cnid > y->cnid) - (x->cnid < y->cnid);
+}
+
+static size_t find_entry(const struct sync_list* l, hfs_cnid_t cnid) {
+	struct sync_entry key = { .cnid = cnid };
+	struct sync_entry* e = bsearch(&key,l->entries.data,l->entries.size,sizeof(key),entry_cmp);
+	return e ? (size_t)(e - l->entries.data) : SIZE_MAX;
+}
+
+static int sync_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct sync_list* l = cookie;
+	hfs_file_record_t* f = &rec->file;
+	char name[512];
+	ssize_t len = hfs_pathname_to_unix(&key->name,name);
+	if(len < 0)
+		len = 0;
+	struct sync_entry e = {
+		.name = l->names.size, .namelen = len, .cnid = f->cnid, .parent = key->parent_cnid, .inode = f->cnid,
+		.type = rec->type, .mode = f->bsd.file_mode,
+		.content_mod = HFSTIMETOEPOCH(f->date_content_mod), .attrib_mod = HFSTIMETOEPOCH(f->date_attrib_mod)
+	};
+	if(hfslib_is_private_file(key))
+		e.flags |= SYNC_PRIVATE;
+	if(rec->type == HFS_REC_FILE) {
+		e.data_size = f->data_fork.logical_size;
+		e.rsrc_size = f->rsrc_fork.logical_size;
+		if(f->user_info.file_creator == HFS_HFSPLUS_CREATOR && f->user_info.file_type == HFS_HARD_LINK_FILE_TYPE)
+			e.inode = f->bsd.special.inode_num;
+		else if(f->user_info.file_creator == HFS_MACS_CREATOR && f->user_info.file_type == HFS_DIR_HARD_LINK_FILE_TYPE)
+			e.flags |= SYNC_DIR_LINK;
+		else if((e.mode & S_IFMT) && !S_ISREG(e.mode) && !S_ISLNK(e.mode))
+			e.flags |= SYNC_SPECIAL;
+	}
+	for(ssize_t i = 0; i < len; i++)
+		if(!PUSH(l->names,name[i]))
+			return -1;
+	return !PUSH(l->entries,e);
+}
+
+// gathers every file and folder on parallel partitions of the catalog, then points hard links at their targets' forks
+static int scan(hfs_volume* vol, struct sync_list* l) {
+	unsigned nthreads = hfs_cpu_count();
+	struct sync_list parts[nthreads];
+	void* cookies[nthreads];
+	for(unsigned i = 0; i < nthreads; i++) {
+		parts[i] = (struct sync_list){{0}};
+		cookies[i] = parts + i;
+	}
+	int ret = -EIO;
+	hfs_catalog_condition_t records_only = { HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(&records_only,1,&pred,NULL))
+		goto end;
+	int nparts = hfs_scan_catalog(vol,&pred,nthreads,sync_visit,cookies);
+	hfslib_free_catalog_predicate(&pred,NULL);
+	if(nparts <= 0) {
+		ret = nparts == -ECANCELED ? -ENOMEM : nparts;
+		goto end;
+	}
+	ret = -ENOMEM;
+	for(int i = 0; i < nparts; i++) {
+		for(size_t j = 0; j < parts[i].entries.size; j++)
+			parts[i].entries.data[j].name += l->names.size;
+		if(!APPEND(l->entries,parts[i].entries) || !APPEND(l->names,parts[i].names))
+			goto end;
+	}
+	qsort(l->entries.data,l->entries.size,sizeof(*l->entries.data),entry_cmp);
+	for(size_t i = 0; i < l->entries.size; i++) {
+		struct sync_entry* e = l->entries.data + i;
+		if(e->inode == e->cnid)
+			continue;
+		size_t t = find_entry(l,e->inode);
+		if(t == SIZE_MAX) // a link to nothing mirrors as the empty link file
+			e->inode = e->cnid;
+		else {
+			e->data_size = l->entries.data[t].data_size;
+			e->rsrc_size = l->entries.data[t].rsrc_size;
+			e->content_mod = l->entries.data[t].content_mod;
+			e->attrib_mod = l->entries.data[t].attrib_mod;
+			e->mode = l->entries.data[t].mode;
+		}
+	}
+	ret = 0;
+
+end:
+	for(unsigned i = 0; i < nthreads; i++) {
+		free(parts[i].entries.data);
+		free(parts[i].names.data);
+	}
+	return ret;
+}
+
+static bool reachable(struct sync_list* l, size_t i, hfs_cnid_t root) {
+	if(!l->reach[i]) {
+		struct sync_entry* e = l->entries.data + i;
+		size_t p;
+		l->reach[i] = 2;
+		if(e->cnid == root)
+			l->reach[i] = 1;
+		else if(!(e->flags & (SYNC_PRIVATE|SYNC_DIR_LINK|SYNC_SPECIAL)) && (p = find_entry(l,e->parent)) != SIZE_MAX &&
+		        l->entries.data[p].type == HFS_REC_FLDR && reachable(l,p,root))
+			l->reach[i] = 1;
+	}
+	return l->reach[i] == 1;
+}
+
+// relative to the mirror's root, so "" for the root itself
+static const char* entry_path(struct sync_list* l, size_t i, hfs_cnid_t root) {
+	if(!l->paths[i]) {
+		struct sync_entry* e = l->entries.data + i;
+		if(e->cnid == root)
+			return l->paths[i] = strdup("");
+		const char* parent = entry_path(l,find_entry(l,e->parent),root);
+		if(!parent || !(l->paths[i] = malloc(strlen(parent) + e->namelen + 2)))
+			return NULL;
+		sprintf(l->paths[i],"%s/%.*s",parent,(int)e->namelen,l->names.data + e->name);
+	}
+	return l->paths[i];
+}
+
+static char* format(const char* fmt, ...) {
+	va_list ap, ap2;
+	va_start(ap,fmt);
+	va_copy(ap2,ap);
+	int len = vsnprintf(NULL,0,fmt,ap);
+	char* out = len < 0 ? NULL : malloc(len+1);
+	if(out)
+		vsnprintf(out,len+1,fmt,ap2);
+	va_end(ap2);
+	va_end(ap);
+	return out;
+}
+
+static char* local_path(struct sync_state* s, const char* path, const char* prefix) {
+	const char* name = strrchr(path,'/');
+	if(!prefix || !name)
+		return format("%s%s",s->dest,path);
+	// a sibling of path, like its AppleDouble file
+	return format("%s%.*s/%s%s",s->dest,(int)(name - path),path,prefix,name+1);
+}
+
+// where a moving item waits between leaving its old place and arriving at its new one
+static char* staged_path(const char* staging, hfs_cnid_t cnid, const char* suffix) {
+	return format("%s/%" PRIu32 "%s",staging,cnid,suffix);
+}
+
+static int path_depth(const char* path) {
+	int depth = 0;
+	for(; *path; path++)
+		depth += *path == '/';
+	return depth;
+}
+
+static void sync_error(struct sync_state* s, const char* what, const char* path, int err) {
+	pthread_mutex_lock(&s->lock);
+	fprintf(s->log,"sync: couldn't %s %s: %s\n",what,path,strerror(err));
+	s->failed++;
+	pthread_mutex_unlock(&s->lock);
+}
+
+// reads a whole fork smaller than the buffer, like a symbolic link's target
+static int read_fork(struct sync_state* s, hfs_cnid_t cnid, uint8_t fork, uint64_t size, char* buf) {
+	hfs_extent_descriptor_t* extents = NULL;
+	uint16_t nextents = hfs_get_file_extents(s->vol,cnid,fork,&extents);
+	uint64_t bytes = 0;
+	int ret = size && (hfslib_readd_with_extents(s->vol,buf,&bytes,size,0,extents,nextents,NULL) || bytes < size) ? EIO : 0;
+	buf[ret ? 0 : size] = '\0';
+	free(extents);
+	return ret;
+}
+
+// writes buffer-sized pieces of a fork to fd
+static int copy_fork(struct sync_state* s, hfs_cnid_t cnid, uint8_t fork, uint64_t size, int fd, char* buf) {
+	hfs_extent_descriptor_t* extents = NULL;
+	uint16_t nextents = hfs_get_file_extents(s->vol,cnid,fork,&extents);
+	int ret = 0;
+	for(uint64_t offset = 0; offset < size && !ret; ) {
+		uint64_t bytes = 0;
+		if(hfslib_readd_with_extents(s->vol,buf,&bytes,min(SYNC_CHUNK,size-offset),offset,extents,nextents,NULL) || !bytes)
+			ret = EIO;
+		else if(write(fd,buf,min(bytes,size-offset)) != (ssize_t)min(bytes,size-offset))
+			ret = errno ? errno : EIO;
+		offset += bytes;
+	}
+	free(extents);
+	return ret;
+}
+
+// AppleDouble, as Mac OS X itself writes for resource forks on other filesystems
+static int write_appledouble(struct sync_state* s, const struct sync_entry* e, int fd, char* buf) {
+	unsigned char h[26+12] = { 0x00,0x05,0x16,0x07, 0x00,0x02,0x00,0x00 };
+	h[25] = 1; // one entry: the resource fork, right after the header
+	h[29] = 2;
+	h[33] = sizeof(h);
+	for(int i = 0; i < 4; i++)
+		h[37-i] = e->rsrc_size >> (8*i);
+	if(write(fd,h,sizeof(h)) != sizeof(h))
+		return errno ? errno : EIO;
+	return copy_fork(s,e->inode,HFS_RSRCFORK,e->rsrc_size,fd,buf);
+}
+
+// copies a file's changed forks into place through temporary files, so an interrupted sync leaves the old copy
+static int copy_file(struct sync_state* s, size_t i, char* buf) {
+	struct sync_entry* e = s->new.entries.data + i;
+	const char* path = s->new.paths[i];
+	unsigned flags = s->opflags[i];
+	int ret = 0;
+	for(int rsrc = 0; rsrc < 2 && !ret; rsrc++) {
+		if(!(flags & (rsrc ? OP_RSRC : OP_DATA)))
+			continue;
+		char* dst = local_path(s,path,rsrc ? "._" : NULL);
+		char* tmp = local_path(s,path,rsrc ? "._.hfsdump-sync." : ".hfsdump-sync.");
+		if(!dst || !tmp)
+			ret = ENOMEM;
+		else if(rsrc && !e->rsrc_size) {
+			if(unlink(dst) && errno != ENOENT)
+				ret = errno;
+		}
+		else if(!rsrc && S_ISLNK(e->mode)) {
+			// the link's target is its data fork
+			if(e->data_size >= SYNC_CHUNK)
+				ret = ENAMETOOLONG;
+			else if(!(ret = read_fork(s,e->inode,HFS_DATAFORK,e->data_size,buf))) {
+				unlink(tmp);
+				if(symlink(buf,tmp) || rename(tmp,dst))
+					ret = errno;
+			}
+		}
+		else {
+			int fd = open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+			if(fd < 0)
+				ret = errno;
+			else {
+				ret = rsrc ? write_appledouble(s,e,fd,buf) : copy_fork(s,e->inode,HFS_DATAFORK,e->data_size,fd,buf);
+				if(close(fd) && !ret)
+					ret = errno;
+				if(!ret && rename(tmp,dst))
+					ret = errno;
+				if(ret)
+					unlink(tmp);
+			}
+		}
+		if(ret)
+			sync_error(s,"copy",dst ? dst : path,ret);
+		free(dst);
+		free(tmp);
+	}
+	return ret;
+}
+
+static void* copy_worker(void* data) {
+	struct sync_state* s = data;
+	char* buf = malloc(SYNC_CHUNK+1);
+	while(true) {
+		pthread_mutex_lock(&s->lock);
+		size_t next = s->next < s->ncopies ? s->copies[s->next++] : SIZE_MAX;
+		pthread_mutex_unlock(&s->lock);
+		if(next == SIZE_MAX)
+			break;
+		if(!buf) {
+			sync_error(s,"copy",s->new.paths[next],ENOMEM);
+			s->opflags[next] |= OP_FAILED;
+		}
+		else if(copy_file(s,next,buf))
+			s->opflags[next] |= OP_FAILED;
+	}
+	free(buf);
+	return NULL;
+}
+
+// file contents go on a pool of threads
+static void copy_files(struct sync_state* s, unsigned threads) {
+	pthread_t workers[threads];
+	unsigned started = 0;
+	for(; started < threads && started < s->ncopies; started++)
+		if(pthread_create(workers+started,NULL,copy_worker,s))
+			break;
+	if(!started)
+		copy_worker(s);
+	for(unsigned i = 0; i < started; i++)
+		pthread_join(workers[i],NULL);
+}
+
+static void set_meta(struct sync_state* s, size_t i) {
+	struct sync_entry* e = s->new.entries.data + i;
+	char* dst = local_path(s,s->new.paths[i],NULL);
+	if(!dst)
+		return;
+	struct timespec times[2] = { { .tv_sec = e->content_mod }, { .tv_sec = e->content_mod } };
+	mode_t mode = e->mode & 07777 ? e->mode & 07777 : e->type == HFS_REC_FLDR ? 0755 : 0644;
+	if(!S_ISLNK(e->mode) && chmod(dst,mode | (e->type == HFS_REC_FLDR ? S_IRWXU : S_IRUSR|S_IWUSR)))
+		sync_error(s,"set the permissions of",dst,errno);
+	else if(utimensat(AT_FDCWD,dst,times,AT_SYMLINK_NOFOLLOW))
+		sync_error(s,"set the times of",dst,errno);
+	free(dst);
+}
+
+static int load_manifest(struct sync_state* s) {
+	char* path = local_path(s,"/" SYNC_MANIFEST,NULL);
+	FILE* f = path ? fopen(path,"rb") : NULL;
+	int ret = 0;
+	free(path);
+	if(!f)
+		return errno == ENOENT ? 0 : -errno;
+	struct hfs_sidecar_header h;
+	uint64_t count;
+	struct stat st;
+	// the names take whatever the entries leave of size, which must be what's left of the file
+	if(fread(&h,sizeof(h),1,f) != 1 || memcmp(h.magic,SYNC_MAGIC,sizeof(h.magic)) || h.version != SYNC_VERSION ||
+	   fread(&count,sizeof(count),1,f) != 1 || h.size < sizeof(count) || count > (h.size - sizeof(count)) / sizeof(struct sync_entry) ||
+	   fstat(fileno(f),&st) || (uint64_t)st.st_size != sizeof(h) + h.size)
+		ret = -EINVAL;
+	else if(h.volume_id != hfs_volume_id(s->vol))
+		ret = -EXDEV;
+	else {
+		size_t names = h.size - sizeof(count) - count * sizeof(struct sync_entry);
+		s->old.entries.data = malloc(count * sizeof(struct sync_entry));
+		s->old.names.data = malloc(names);
+		if(!s->old.entries.data || !s->old.names.data)
+			ret = -ENOMEM;
+		else if((count && fread(s->old.entries.data,count * sizeof(struct sync_entry),1,f) != 1) || (names && fread(s->old.names.data,names,1,f) != 1))
+			ret = -EINVAL;
+		else {
+			s->old.entries.size = s->old.entries.cap = count;
+			s->old.names.size = s->old.names.cap = names;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static int remove_tree(const char* path) {
+	struct stat st;
+	if(lstat(path,&st))
+		return -1;
+	if(!S_ISDIR(st.st_mode))
+		return unlink(path);
+	DIR* d = opendir(path);
+	if(!d)
+		return -1;
+	struct dirent* de;
+	int ret = 0;
+	while(!ret && (de = readdir(d)))
+		if(strcmp(de->d_name,".") && strcmp(de->d_name,"..")) {
+			char* sub = format("%s/%s",path,de->d_name);
+			if(!sub) {
+				errno = ENOMEM;
+				ret = -1;
+			}
+			else ret = remove_tree(sub);
+			free(sub);
+		}
+	closedir(d);
+	return ret ? ret : rmdir(path);
+}
+
+// an interrupted sync leaves moving items in staging, while the manifest it never saved still has them at their old
+// places. they're removed and forgotten, so this sync copies them again wherever they are now
+static void clear_staging(struct sync_state* s, const char* staging) {
+	DIR* d = opendir(staging);
+	if(!d)
+		return;
+	struct dirent* de;
+	while((de = readdir(d))) {
+		if(!strcmp(de->d_name,".") || !strcmp(de->d_name,".."))
+			continue;
+		char* end;
+		unsigned long cnid = strtoul(de->d_name,&end,10);
+		size_t i = end != de->d_name && (!*end || !strcmp(end,".rsrc")) && cnid <= UINT32_MAX ? find_entry(&s->old,cnid) : SIZE_MAX;
+		if(i != SIZE_MAX)
+			s->old.reach[i] = 2; // and so is everything that was inside it
+		char* path = format("%s/%s",staging,de->d_name);
+		if(!path || remove_tree(path))
+			sync_error(s,"remove",path ? path : de->d_name,path ? errno : ENOMEM);
+		free(path);
+	}
+	closedir(d);
+	rmdir(staging);
+}
+
+// lists what's now in the mirror: the new entries, except old ones where an operation failed
+static int save_manifest(struct sync_state* s) {
+	VECTOR(struct sync_entry) entries = {0};
+	VECTOR(char) names = {0};
+	int ret = -ENOMEM;
+	for(size_t i = 0, j = 0; i < s->new.entries.size || j < s->old.entries.size; ) {
+		uint32_t ci = i < s->new.entries.size ? s->new.entries.data[i].cnid : UINT32_MAX;
+		uint32_t cj = j < s->old.entries.size ? s->old.entries.data[j].cnid : UINT32_MAX;
+		size_t ni = ci <= cj ? i++ : SIZE_MAX, oj = cj <= ci ? j++ : SIZE_MAX;
+		// gone from the volume, and removed here unless that failed, which is forgotten
+		if(ni == SIZE_MAX || !reachable(&s->new,ni,s->root))
+			continue;
+		unsigned flags = s->opflags[ni];
+		const struct sync_list* l = &s->new;
+		struct sync_entry e = s->new.entries.data[ni];
+		if(flags & OP_FAILED) {
+			if(flags & OP_CREATE)
+				continue;
+			// a failed move leaves it where it was
+			if(flags & OP_MOVE) {
+				e = s->old.entries.data[oj];
+				l = &s->old;
+			}
+			// and a failed copy leaves the old contents, which the next sync should replace
+			e.content_mod = INT64_MIN;
+		}
+		const char* name = l->names.data + e.name;
+		e.name = names.size;
+		for(uint16_t k = 0; k < e.namelen; k++)
+			if(!PUSH(names,name[k]))
+				goto end;
+		if(!PUSH(entries,e))
+			goto end;
+	}
+
+	char* path = local_path(s,"/" SYNC_MANIFEST,NULL);
+	char* tmp = local_path(s,"/" SYNC_MANIFEST ".tmp",NULL);
+	FILE* f = path && tmp ? fopen(tmp,"wb") : NULL;
+	if(f) {
+		uint64_t count = entries.size;
+		struct hfs_sidecar_header h = { .magic = SYNC_MAGIC, .version = SYNC_VERSION, .write_count = s->vol->vh.write_count, .volume_id = hfs_volume_id(s->vol),
+		                                .size = sizeof(count) + count * sizeof(*entries.data) + names.size };
+		bool ok = fwrite(&h,sizeof(h),1,f) == 1 && fwrite(&count,sizeof(count),1,f) == 1 &&
+		          (!count || fwrite(entries.data,count * sizeof(*entries.data),1,f) == 1) && (!names.size || fwrite(names.data,names.size,1,f) == 1);
+		ret = fclose(f) ? -errno : ok ? 0 : -EIO;
+		if(!ret && rename(tmp,path))
+			ret = -errno;
+		if(ret)
+			unlink(tmp);
+	}
+	else ret = path && tmp ? -errno : -ENOMEM;
+	free(path);
+	free(tmp);
+
+end:
+	free(entries.data);
+	free(names.data);
+	return ret;
+}
+
+// compares the lists by cnid, recording what each changed item needs
+static int diff(struct sync_state* s, long counts[4]) {
+	for(size_t i = 0, j = 0; i < s->new.entries.size || j < s->old.entries.size; ) {
+		uint32_t ci = i < s->new.entries.size ? s->new.entries.data[i].cnid : UINT32_MAX;
+		uint32_t cj = j < s->old.entries.size ? s->old.entries.data[j].cnid : UINT32_MAX;
+		size_t ni = ci <= cj ? i++ : SIZE_MAX, oj = cj <= ci ? j++ : SIZE_MAX;
+		struct sync_entry* n = ni != SIZE_MAX && reachable(&s->new,ni,s->root) ? s->new.entries.data + ni : NULL;
+		struct sync_entry* o = oj != SIZE_MAX && reachable(&s->old,oj,s->root) ? s->old.entries.data + oj : NULL;
+		if(n && n->cnid == s->root)
+			continue;
+		unsigned flags = 0;
+		if(o && (!n || n->type != o->type || S_ISLNK(n->mode) != S_ISLNK(o->mode))) {
+			if(!PUSH(s->ops,((struct sync_op){ oj, SIZE_MAX, OP_DELETE })))
+				return -ENOMEM;
+			counts[3]++;
+			o = NULL;
+		}
+		if(!n)
+			continue;
+		if(!o) {
+			flags = OP_CREATE | OP_META | (n->type == HFS_REC_FILE ? OP_DATA | (n->rsrc_size ? OP_RSRC : 0) : 0);
+			counts[0]++;
+		}
+		else {
+			if(n->parent != o->parent || n->namelen != o->namelen || memcmp(s->new.names.data + n->name,s->old.names.data + o->name,n->namelen))
+				flags |= OP_MOVE;
+			if(n->type == HFS_REC_FILE && (n->data_size != o->data_size || n->content_mod != o->content_mod || n->inode != o->inode))
+				flags |= OP_DATA;
+			if(n->type == HFS_REC_FILE && (n->rsrc_size != o->rsrc_size || (n->rsrc_size && (n->content_mod != o->content_mod || n->inode != o->inode))))
+				flags |= OP_RSRC;
+			if(flags || n->attrib_mod != o->attrib_mod || n->mode != o->mode || (n->type == HFS_REC_FLDR && n->content_mod != o->content_mod))
+				flags |= OP_META;
+			counts[flags & OP_MOVE ? 2 : 1] += !!flags;
+		}
+		if(flags) {
+			s->opflags[ni] = flags;
+			if(!PUSH(s->ops,((struct sync_op){ o ? oj : SIZE_MAX, ni, flags })))
+				return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static int deepest_first(const void* a, const void* b) {
+	return ((const struct sync_op*)b)->depth - ((const struct sync_op*)a)->depth;
+}
+
+static void touch_parent(struct sync_state* s, const struct sync_entry* e) {
+	size_t p = find_entry(&s->new,e->parent);
+	if(p != SIZE_MAX && e->parent != s->root && reachable(&s->new,p,s->root) && !(s->opflags[p] & OP_FAILED))
+		s->opflags[p] |= OP_TOUCHED | OP_META;
+}
+
+long hfs_sync_mirror(hfs_volume* vol, const char* dest, unsigned threads, FILE* log) {
+	struct sync_state s = { .vol = vol, .dest = dest, .root = hfs_get_root(vol), .log = log };
+	long counts[4] = {0}; // created, updated, moved, deleted
+	char* staging = NULL;
+	long ret = 0;
+	if(mkdir(dest,0755) && errno != EEXIST)
+		return -errno;
+	if((errno = pthread_mutex_init(&s.lock,NULL)))
+		return -errno;
+	if((ret = load_manifest(&s))) {
+		if(ret == -EXDEV)
+			fprintf(log,"sync: %s is a mirror of a different volume\n",dest);
+		else if(ret == -EINVAL)
+			fprintf(log,"sync: %s has an unreadable manifest, remove " SYNC_MANIFEST " to copy everything again\n",dest);
+		goto end;
+	}
+	if((ret = scan(vol,&s.new)))
+		goto end;
+	ret = -ENOMEM;
+	if(!(s.new.reach = calloc(s.new.entries.size+1,1)) || !(s.new.paths = calloc(s.new.entries.size+1,sizeof(char*))) ||
+	   !(s.old.reach = calloc(s.old.entries.size+1,1)) || !(s.old.paths = calloc(s.old.entries.size+1,sizeof(char*))) ||
+	   !(s.opflags = calloc(s.new.entries.size+1,1)) || !(staging = local_path(&s,"/" SYNC_STAGING,NULL)))
+		goto end;
+	clear_staging(&s,staging);
+	if((ret = diff(&s,counts)))
+		goto end;
+
+	// first everything leaving its old place, deepest first so folders are emptied before they're removed
+	for(size_t i = 0; i < s.ops.size; i++) {
+		struct sync_op* op = s.ops.data + i;
+		if(op->old != SIZE_MAX && (op->flags & (OP_DELETE|OP_MOVE)) && !entry_path(&s.old,op->old,s.root))
+			goto end;
+		op->depth = op->old != SIZE_MAX && (op->flags & (OP_DELETE|OP_MOVE)) ? path_depth(s.old.paths[op->old]) : -1;
+	}
+	qsort(s.ops.data,s.ops.size,sizeof(*s.ops.data),deepest_first);
+	if(s.ops.size && mkdir(staging,0700) && errno != EEXIST) {
+		ret = -errno;
+		goto end;
+	}
+	for(size_t i = 0; i < s.ops.size && s.ops.data[i].depth >= 0; i++) {
+		struct sync_op* op = s.ops.data + i;
+		struct sync_entry* o = s.old.entries.data + op->old;
+		char* src = local_path(&s,s.old.paths[op->old],NULL);
+		char* src_rsrc = local_path(&s,s.old.paths[op->old],"._");
+		char* moved = op->flags & OP_MOVE ? staged_path(staging,o->cnid,"") : NULL;
+		char* moved_rsrc = op->flags & OP_MOVE ? staged_path(staging,o->cnid,".rsrc") : NULL;
+		if(!src || !src_rsrc || ((op->flags & OP_MOVE) && (!moved || !moved_rsrc))) {
+			sync_error(&s,op->flags & OP_MOVE ? "move" : "remove",s.old.paths[op->old],ENOMEM);
+			if(op->flags & OP_MOVE)
+				s.opflags[op->new] |= OP_FAILED;
+		}
+		else if(op->flags & OP_MOVE) {
+			if(rename(src,moved)) {
+				sync_error(&s,"move",src,errno);
+				s.opflags[op->new] |= OP_FAILED;
+			}
+			else if(o->rsrc_size && rename(src_rsrc,moved_rsrc) && errno != ENOENT)
+				sync_error(&s,"move",src_rsrc,errno);
+		}
+		else if(o->type == HFS_REC_FLDR ? rmdir(src) : unlink(src))
+			sync_error(&s,"remove",src,errno);
+		else if(o->rsrc_size && unlink(src_rsrc) && errno != ENOENT)
+			sync_error(&s,"remove",src_rsrc,errno);
+		free(src); free(src_rsrc); free(moved); free(moved_rsrc);
+	}
+
+	// then everything arriving, shallowest first so each parent exists before its children
+	for(size_t i = 0; i < s.ops.size; i++) {
+		struct sync_op* op = s.ops.data + i;
+		if(op->new != SIZE_MAX && !entry_path(&s.new,op->new,s.root))
+			goto end;
+		op->depth = op->new != SIZE_MAX ? path_depth(s.new.paths[op->new]) : INT_MAX;
+	}
+	qsort(s.ops.data,s.ops.size,sizeof(*s.ops.data),deepest_first);
+	if(!(s.copies = malloc(s.ops.size * sizeof(*s.copies) + 1)))
+		goto end;
+	for(size_t i = s.ops.size; i--; ) {
+		struct sync_op* op = s.ops.data + i;
+		if(op->new == SIZE_MAX)
+			continue;
+		struct sync_entry* n = s.new.entries.data + op->new;
+		uint8_t* flags = s.opflags + op->new;
+		size_t p = find_entry(&s.new,n->parent);
+		// nothing can arrive in a folder that couldn't be created or moved into place
+		if(p != SIZE_MAX && s.opflags[p] & OP_FAILED && s.opflags[p] & (OP_CREATE|OP_MOVE))
+			*flags |= OP_FAILED;
+		if(*flags & OP_FAILED)
+			continue;
+		char* dst = local_path(&s,s.new.paths[op->new],NULL);
+		if(!dst) {
+			sync_error(&s,"create",s.new.paths[op->new],ENOMEM);
+			*flags |= OP_FAILED;
+		}
+		else if(*flags & OP_MOVE) {
+			char* moved = staged_path(staging,n->cnid,"");
+			char* moved_rsrc = staged_path(staging,n->cnid,".rsrc");
+			char* dst_rsrc = local_path(&s,s.new.paths[op->new],"._");
+			if(!moved || !moved_rsrc || !dst_rsrc) {
+				sync_error(&s,"move",dst,ENOMEM);
+				*flags |= OP_FAILED;
+			}
+			else if(rename(moved,dst)) {
+				sync_error(&s,"move",dst,errno);
+				*flags |= OP_FAILED;
+			}
+			else if(rename(moved_rsrc,dst_rsrc) && errno != ENOENT)
+				sync_error(&s,"move",dst_rsrc,errno);
+			free(moved); free(moved_rsrc); free(dst_rsrc);
+		}
+		else if((*flags & OP_CREATE) && n->type == HFS_REC_FLDR && mkdir(dst,0700) && errno != EEXIST) {
+			sync_error(&s,"create",dst,errno);
+			*flags |= OP_FAILED;
+		}
+		free(dst);
+		if(*flags & OP_FAILED)
+			continue;
+		if(*flags & (OP_CREATE|OP_MOVE|OP_DATA|OP_RSRC))
+			touch_parent(&s,n);
+		if(*flags & (OP_DATA|OP_RSRC))
+			s.copies[s.ncopies++] = op->new;
+	}
+
+	copy_files(&s,threads ? threads : hfs_cpu_count());
+
+	// permissions and times last, once nothing else will change the folders
+	for(size_t i = 0; i < s.new.entries.size; i++)
+		if((s.opflags[i] & (OP_META|OP_FAILED)) == OP_META) {
+			if(!entry_path(&s.new,i,s.root))
+				goto end;
+			set_meta(&s,i);
+		}
+	rmdir(staging);
+
+	if((ret = save_manifest(&s)))
+		goto end;
+	fprintf(log,"created %ld, updated %ld, moved %ld, removed %ld, failed %ld\n",counts[0],counts[1],counts[2],counts[3],s.failed);
+	ret = s.failed;
+
+end:
+	for(size_t i = 0; s.new.paths && i < s.new.entries.size; i++)
+		free(s.new.paths[i]);
+	for(size_t i = 0; s.old.paths && i < s.old.entries.size; i++)
+		free(s.old.paths[i]);
+	free(s.new.paths); free(s.old.paths);
+	free(s.new.reach); free(s.old.reach);
+	free(s.new.entries.data); free(s.old.entries.data);
+	free(s.new.names.data); free(s.old.names.data);
+	free(s.ops.data);
+	free(s.opflags);
+	free(s.copies);
+	free(staging);
+	pthread_mutex_destroy(&s.lock);
+	return ret;
+}
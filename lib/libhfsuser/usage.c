@@ -0,0 +1,318 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "usage.h"
+#include "hardlink.h"
+#include "vector.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE UINT32_MAX
+
+struct usage_folder {
+	hfs_cnid_t cnid, parent_cnid;
+	uint32_t parent; // index of the parent folder
+	uint32_t links;  // first edge to an additional parent through a directory hard link
+	uint32_t stamp;  // last propagation that visited this folder
+	struct hfs_folder_usage direct, total;
+};
+
+struct usage_edge { uint32_t folder, next; };
+
+// a folder cnid with the plain files found directly inside it
+struct usage_run { hfs_cnid_t cnid; struct hfs_folder_usage files; };
+
+// hard link records and their targets, matched by inode number
+struct usage_link { uint32_t inode; hfs_cnid_t cnid; };
+struct usage_inode { uint32_t inode; hfs_cnid_t cnid, parent; uint64_t logical, physical; };
+
+struct hfs_usage_table {
+	struct usage_folder* folders;
+	size_t nfolders;
+};
+
+struct usage_scan {
+	uint32_t block_size;
+	hfs_cnid_t metadata_dir, dir_metadata_dir;
+	VECTOR(struct usage_folder) folders;
+	VECTOR(struct usage_run) runs;
+	VECTOR(struct usage_link) file_links, dir_links; // inode -> parent folder cnid
+	VECTOR(struct usage_inode) inodes, dirs;        // inode -> file sizes or folder cnid
+	bool nomem;
+};
+
+static int usage_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	struct usage_scan* s = cookie;
+	bool ok = true;
+	uint32_t inode;
+	if(rec->type == HFS_REC_FLDR) {
+		if(hfs_key_equals(key,&hfs_gMetadataDirectoryKey))
+			s->metadata_dir = rec->folder.cnid;
+		else if(hfs_key_equals(key,&hfs_gDirMetadataDirectoryKey))
+			s->dir_metadata_dir = rec->folder.cnid;
+		// the private folders may be in another partition, so their contents are sorted out after merging
+		else if(hfs_parse_inode_name(&key->name,"dir_",&inode))
+			ok = PUSH(s->dirs, (struct usage_inode){ .inode = inode, .cnid = rec->folder.cnid, .parent = key->parent_cnid });
+		ok = ok && PUSH(s->folders, (struct usage_folder){
+			.cnid = rec->folder.cnid, .parent_cnid = key->parent_cnid, .parent = NONE, .links = NONE
+		});
+	}
+	else if(rec->type == HFS_REC_FILE) {
+		hfs_file_record_t* f = &rec->file;
+		uint64_t logical = f->data_fork.logical_size + f->rsrc_fork.logical_size;
+		uint64_t physical = ((uint64_t)f->data_fork.total_blocks + f->rsrc_fork.total_blocks) * s->block_size;
+		if(f->user_info.file_creator == HFS_HFSPLUS_CREATOR && f->user_info.file_type == HFS_HARD_LINK_FILE_TYPE)
+			ok = PUSH(s->file_links, (struct usage_link){ f->bsd.special.inode_num, key->parent_cnid });
+		else if(f->user_info.file_creator == HFS_MACS_CREATOR && f->user_info.file_type == HFS_DIR_HARD_LINK_FILE_TYPE)
+			ok = PUSH(s->dir_links, (struct usage_link){ f->bsd.special.inode_num, key->parent_cnid });
+		else if(hfs_parse_inode_name(&key->name,"iNode",&inode))
+			ok = PUSH(s->inodes, (struct usage_inode){ inode, f->cnid, key->parent_cnid, logical, physical });
+		else {
+			// a folder's children are contiguous in the catalog, so extend the current run
+			if(!s->runs.size || s->runs.data[s->runs.size-1].cnid != key->parent_cnid)
+				ok = PUSH(s->runs, (struct usage_run){ .cnid = key->parent_cnid });
+			if(ok) {
+				struct hfs_folder_usage* u = &s->runs.data[s->runs.size-1].files;
+				u->files++;
+				u->logical_size += logical;
+				u->physical_size += physical;
+			}
+		}
+	}
+	if(!ok) {
+		s->nomem = true;
+		return -1;
+	}
+	return 0;
+}
+
+static int cmp_folder(const void* a, const void* b) {
+	hfs_cnid_t x = ((const struct usage_folder*)a)->cnid, y = ((const struct usage_folder*)b)->cnid;
+	return (x > y) - (x < y);
+}
+
+static int cmp_link(const void* a, const void* b) {
+	uint32_t x = ((const struct usage_link*)a)->inode, y = ((const struct usage_link*)b)->inode;
+	return (x > y) - (x < y);
+}
+
+static int cmp_inode(const void* a, const void* b) {
+	uint32_t x = ((const struct usage_inode*)a)->inode, y = ((const struct usage_inode*)b)->inode;
+	return (x > y) - (x < y);
+}
+
+static uint32_t find_folder(struct usage_folder* folders, size_t nfolders, hfs_cnid_t cnid) {
+	struct usage_folder* f = bsearch(&(struct usage_folder){ .cnid = cnid }, folders, nfolders, sizeof(*folders), cmp_folder);
+	return f ? f - folders : NONE;
+}
+
+static struct usage_inode* find_inode(struct usage_inode* inodes, size_t ninodes, uint32_t inode) {
+	return bsearch(&(struct usage_inode){ .inode = inode }, inodes, ninodes, sizeof(*inodes), cmp_inode);
+}
+
+static inline void usage_add(struct hfs_folder_usage* to, const struct hfs_folder_usage* from) {
+	to->files += from->files;
+	to->folders += from->folders;
+	to->logical_size += from->logical_size;
+	to->physical_size += from->physical_size;
+}
+
+struct usage_walk {
+	struct usage_folder* folders;
+	struct usage_edge* edges;
+	uint32_t* stack;
+	uint32_t stamp;
+};
+
+static inline void walk_push(struct usage_walk* w, size_t* depth, uint32_t folder) {
+	if(folder != NONE && w->folders[folder].stamp != w->stamp) {
+		w->folders[folder].stamp = w->stamp;
+		w->stack[(*depth)++] = folder;
+	}
+}
+
+// adds u to the starting folders and all of their ancestors, each exactly once
+// ancestors include the folders holding directory hard links to any folder on the way up
+static void usage_propagate(struct usage_walk* w, const uint32_t* start, size_t nstart, const struct hfs_folder_usage* u) {
+	size_t depth = 0;
+	w->stamp++;
+	for(size_t i = 0; i < nstart; i++)
+		walk_push(w,&depth,start[i]);
+	while(depth) {
+		uint32_t i = w->stack[--depth];
+		struct usage_folder* f = w->folders + i;
+		usage_add(&f->total,u);
+		walk_push(w,&depth,f->parent);
+		for(uint32_t e = f->links; e != NONE; e = w->edges[e].next)
+			walk_push(w,&depth,w->edges[e].folder);
+	}
+}
+
+static void usage_scan_free(struct usage_scan* s) {
+	free(s->folders.data);
+	free(s->runs.data);
+	free(s->file_links.data);
+	free(s->dir_links.data);
+	free(s->inodes.data);
+	free(s->dirs.data);
+}
+
+// gathers every partition's findings into parts[0]
+static bool usage_merge(struct usage_scan* parts, int nparts) {
+	struct usage_scan* s = parts;
+	for(int i = 1; i < nparts; i++) {
+		struct usage_scan* p = parts + i;
+		if(p->metadata_dir != NONE)
+			s->metadata_dir = p->metadata_dir;
+		if(p->dir_metadata_dir != NONE)
+			s->dir_metadata_dir = p->dir_metadata_dir;
+		if(!APPEND(s->folders,p->folders) || !APPEND(s->runs,p->runs) || !APPEND(s->file_links,p->file_links) ||
+		   !APPEND(s->dir_links,p->dir_links) || !APPEND(s->inodes,p->inodes) || !APPEND(s->dirs,p->dirs))
+			return false;
+	}
+
+	// names that only looked like hard link targets are ordinary contents of their folder
+	size_t n = 0;
+	for(size_t i = 0; i < s->inodes.size; i++) {
+		struct usage_inode in = s->inodes.data[i];
+		if(in.parent == s->metadata_dir)
+			s->inodes.data[n++] = in;
+		else if(!PUSH(s->runs, (struct usage_run){ in.parent, { .files = 1, .logical_size = in.logical, .physical_size = in.physical } }))
+			return false;
+	}
+	s->inodes.size = n;
+	n = 0;
+	for(size_t i = 0; i < s->dirs.size; i++)
+		if(s->dirs.data[i].parent == s->dir_metadata_dir)
+			s->dirs.data[n++] = s->dirs.data[i];
+	s->dirs.size = n;
+	return true;
+}
+
+struct hfs_usage_table* hfs_usage_scan(hfs_volume* vol) {
+	unsigned nthreads = hfs_cpu_count();
+	struct usage_scan parts[nthreads];
+	void* cookies[nthreads];
+	for(unsigned i = 0; i < nthreads; i++) {
+		parts[i] = (struct usage_scan){ .block_size = vol->vh.block_size, .metadata_dir = NONE, .dir_metadata_dir = NONE };
+		cookies[i] = parts + i;
+	}
+	struct usage_scan* s = parts;
+	struct hfs_usage_table* table = NULL;
+	struct usage_walk w = {0};
+	uint32_t* starts = NULL;
+
+	// thread records are skipped before their keys are ever decoded
+	hfs_catalog_condition_t records_only = { HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(&records_only,1,&pred,NULL))
+		goto end;
+	int nparts = hfs_scan_catalog(vol,&pred,nthreads,usage_visit,cookies);
+	hfslib_free_catalog_predicate(&pred,NULL);
+	if(nparts <= 0 || !usage_merge(parts,nparts))
+		goto end;
+
+	struct usage_folder* folders = s->folders.data;
+	size_t nfolders = s->folders.size;
+	qsort(folders,nfolders,sizeof(*folders),cmp_folder);
+	for(size_t i = 0; i < nfolders; i++)
+		folders[i].parent = find_folder(folders,nfolders,folders[i].parent_cnid);
+	for(size_t i = 0; i < s->runs.size; i++) {
+		uint32_t f = find_folder(folders,nfolders,s->runs.data[i].cnid);
+		if(f != NONE)
+			usage_add(&folders[f].direct,&s->runs.data[i].files);
+	}
+
+	// each directory hard link adds its folder as another parent of the linked directory
+	if(!(w.edges = malloc(s->dir_links.size * sizeof(*w.edges) + 1)))
+		goto end;
+	qsort(s->dirs.data,s->dirs.size,sizeof(*s->dirs.data),cmp_inode);
+	size_t nedges = 0;
+	for(size_t i = 0; i < s->dir_links.size; i++) {
+		struct usage_inode* dir = find_inode(s->dirs.data,s->dirs.size,s->dir_links.data[i].inode);
+		uint32_t target = dir ? find_folder(folders,nfolders,dir->cnid) : NONE;
+		uint32_t parent = find_folder(folders,nfolders,s->dir_links.data[i].cnid);
+		if(target == NONE || parent == NONE)
+			continue;
+		w.edges[nedges] = (struct usage_edge){ parent, folders[target].links };
+		folders[target].links = nedges++;
+	}
+
+	if(!(w.stack = malloc(nfolders * sizeof(*w.stack) + 1)) || !(starts = malloc(s->file_links.size * sizeof(*starts) + 1)))
+		goto end;
+	w.folders = folders;
+
+	// each folder counts itself too, which lookups take back out
+	for(uint32_t i = 0; i < nfolders; i++) {
+		struct hfs_folder_usage u = folders[i].direct;
+		u.folders = 1;
+		usage_propagate(&w,&i,1,&u);
+	}
+
+	// a file hard linked from several places counts once in any folder containing more than one of them
+	qsort(s->inodes.data,s->inodes.size,sizeof(*s->inodes.data),cmp_inode);
+	qsort(s->file_links.data,s->file_links.size,sizeof(*s->file_links.data),cmp_link);
+	for(size_t i = 0, j; i < s->file_links.size; i = j) {
+		size_t nstarts = 0;
+		for(j = i; j < s->file_links.size && s->file_links.data[j].inode == s->file_links.data[i].inode; j++)
+			if((starts[nstarts] = find_folder(folders,nfolders,s->file_links.data[j].cnid)) != NONE)
+				nstarts++;
+		struct usage_inode* inode = find_inode(s->inodes.data,s->inodes.size,s->file_links.data[i].inode);
+		if(!inode)
+			continue;
+		struct hfs_folder_usage u = { .files = 1, .logical_size = inode->logical, .physical_size = inode->physical };
+		usage_propagate(&w,starts,nstarts,&u);
+	}
+
+	if((table = malloc(sizeof(*table)))) {
+		table->folders = folders;
+		table->nfolders = nfolders;
+		s->folders.data = NULL;
+	}
+
+end:
+	free(starts);
+	free(w.stack);
+	free(w.edges);
+	for(unsigned i = 0; i < nthreads; i++)
+		usage_scan_free(parts+i);
+	return table;
+}
+
+bool hfs_usage_lookup(struct hfs_usage_table* table, hfs_cnid_t cnid, struct hfs_folder_usage* usage) {
+	uint32_t f = find_folder(table->folders,table->nfolders,cnid);
+	if(f == NONE)
+		return false;
+	*usage = table->folders[f].total;
+	usage->folders--;
+	return true;
+}
+
+void hfs_usage_free(struct hfs_usage_table* table) {
+	if(!table)
+		return;
+	free(table->folders);
+	free(table);
+}
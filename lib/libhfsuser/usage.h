@@ -0,0 +1,43 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_USAGE_H
+#define HFSUSER_USAGE_H
+
+#include "hfsuser.h"
+
+#include <stdbool.h>
+
+// Recursive folder totals for the whole volume, built from one pass over the
+// catalog leaves, split across a thread per CPU. Folder hierarchy, hard link and directory hard link
+// relationships are collected during the pass, then each folder's direct
+// contents and each hard link target are added once to every distinct
+// ancestor, so content reachable through several links is not counted twice.
+struct hfs_usage_table;
+
+struct hfs_usage_table* hfs_usage_scan(hfs_volume*);
+bool hfs_usage_lookup(struct hfs_usage_table*, hfs_cnid_t, struct hfs_folder_usage*);
+void hfs_usage_free(struct hfs_usage_table*);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * libhfsuser - Userspace support library for NetBSD's libhfs
+ * Copyright 2013-2017 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSUSER_VECTOR_H
+#define HFSUSER_VECTOR_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// minimal growable arrays for the catalog scans
+#define VECTOR(type) struct { type* data; size_t size, cap; }
+// appends an element, evaluating to false if memory ran out
+#define PUSH(v, ...) (((v).size < (v).cap || vector_grow((void**)&(v).data,&(v).cap,sizeof(*(v).data))) ? ((v).data[(v).size++] = (__VA_ARGS__), true) : false)
+
+static inline bool vector_grow(void** data, size_t* cap, size_t elemsize) {
+	size_t newcap = *cap ? *cap * 2 : 64;
+	void* newdata = realloc(*data, newcap * elemsize);
+	if(!newdata)
+		return false;
+	*data = newdata;
+	*cap = newcap;
+	return true;
+}
+
+// moves all of src's elements onto the end of dst, leaving src empty
+#define APPEND(dst, src) vector_append((void**)&(dst).data,&(dst).size,&(dst).cap,(void**)&(src).data,&(src).size,&(src).cap,sizeof(*(dst).data))
+
+static inline bool vector_append(void** data, size_t* size, size_t* cap, void** srcdata, size_t* srcsize, size_t* srccap, size_t elemsize) {
+	if(!*size) {
+		free(*data);
+		*data = *srcdata; *size = *srcsize; *cap = *srccap;
+	}
+	else if(*srcsize) {
+		if(*size + *srcsize > *cap) {
+			void* newdata = realloc(*data, (*size + *srcsize) * elemsize);
+			if(!newdata)
+				return false;
+			*data = newdata;
+			*cap = *size + *srcsize;
+		}
+		memcpy((char*)*data + *size * elemsize, *srcdata, *srcsize * elemsize);
+		*size += *srcsize;
+		free(*srcdata);
+	}
+	else free(*srcdata);
+	*srcdata = NULL; *srcsize = *srccap = 0;
+	return true;
+}
+
+#endif
@@ -28,6 +28,9 @@
 
 #include <time.h>
 #include <inttypes.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
 
 #define HFSTIMETOTIMET(x) ((time_t[1]){HFSTIMETOEPOCH(x)})
 
@@ -155,23 +158,317 @@ static inline void dump_record(hfs_catalog_keyed_record_t rec) {
 	}
 }
 
+static const struct {
+	const char* name;
+	hfs_catalog_field field;
+	enum { FIND_NUMBER, FIND_SIZE, FIND_DATE, FIND_OCTAL, FIND_OSTYPE, FIND_RECTYPE } format;
+} find_fields[] = {
+	{"type",     HFS_CATFIELD_REC_TYPE,         FIND_RECTYPE},
+	{"cnid",     HFS_CATFIELD_CNID,             FIND_NUMBER},
+	{"parent",   HFS_CATFIELD_PARENT_CNID,      FIND_NUMBER},
+	{"flags",    HFS_CATFIELD_FLAGS,            FIND_NUMBER},
+	{"uid",      HFS_CATFIELD_OWNER_ID,         FIND_NUMBER},
+	{"gid",      HFS_CATFIELD_GROUP_ID,         FIND_NUMBER},
+	{"mode",     HFS_CATFIELD_FILE_MODE,        FIND_OCTAL},
+	{"size",     HFS_CATFIELD_DATA_SIZE,        FIND_SIZE},
+	{"rsize",    HFS_CATFIELD_RSRC_SIZE,        FIND_SIZE},
+	{"created",  HFS_CATFIELD_DATE_CREATED,     FIND_DATE},
+	{"modified", HFS_CATFIELD_DATE_CONTENT_MOD, FIND_DATE},
+	{"changed",  HFS_CATFIELD_DATE_ATTRIB_MOD,  FIND_DATE},
+	{"accessed", HFS_CATFIELD_DATE_ACCESSED,    FIND_DATE},
+	{"backedup", HFS_CATFIELD_DATE_BACKEDUP,    FIND_DATE},
+	{"ftype",    HFS_CATFIELD_FILE_TYPE,        FIND_OSTYPE},
+	{"creator",  HFS_CATFIELD_FILE_CREATOR,     FIND_OSTYPE},
+};
+
+static const char* find_ops[] = {
+	[HFS_CMP_EQ] = "=", [HFS_CMP_NE] = "!=", [HFS_CMP_LT] = "<", [HFS_CMP_LE] = "<=",
+	[HFS_CMP_GT] = ">", [HFS_CMP_GE] = ">=", [HFS_CMP_ALLSET] = "&"
+};
+
+// parses field<op>value, e.g. size>=10M, type=file, modified<2017-01-01, creator=MACS
+static int parse_condition(const char* arg, hfs_catalog_condition_t* cond) {
+	size_t namelen = 0;
+	while(isalpha((unsigned char)arg[namelen]))
+		namelen++;
+	size_t f;
+	for(f = 0; f < sizeof(find_fields)/sizeof(*find_fields); f++)
+		if(strlen(find_fields[f].name) == namelen && !strncmp(arg,find_fields[f].name,namelen))
+			break;
+	if(f == sizeof(find_fields)/sizeof(*find_fields))
+		return -1;
+	cond->field = find_fields[f].field;
+
+	const char* value = NULL;
+	for(hfs_compare_op op = HFS_CMP_EQ; op <= HFS_CMP_ALLSET; op++) {
+		size_t oplen = strlen(find_ops[op]);
+		// prefer the longest operator, so <= isn't read as < followed by =
+		if(!strncmp(arg+namelen,find_ops[op],oplen) && (!value || arg+namelen+oplen > value)) {
+			cond->op = op;
+			value = arg+namelen+oplen;
+		}
+	}
+	if(!value || !*value)
+		return -1;
+
+	char* end;
+	switch(find_fields[f].format) {
+		case FIND_RECTYPE:
+			if(!strcmp(value,"file"))
+				cond->value = HFS_REC_FILE;
+			else if(!strcmp(value,"folder"))
+				cond->value = HFS_REC_FLDR;
+			else return -1;
+			return 0;
+		case FIND_OSTYPE:
+			if(strlen(value) != 4)
+				return -1;
+			cond->value = (uint32_t)(unsigned char)value[0] << 24 | (unsigned char)value[1] << 16 | (unsigned char)value[2] << 8 | (unsigned char)value[3];
+			return 0;
+		case FIND_DATE: {
+			struct tm tm = {0};
+			int n;
+			if(sscanf(value,"%d-%d-%d%n",&tm.tm_year,&tm.tm_mon,&tm.tm_mday,&n) == 3 && !value[n]) {
+				tm.tm_year -= 1900;
+				tm.tm_mon -= 1;
+				cond->value = timegm(&tm);
+			}
+			else {
+				cond->value = strtoull(value,&end,10);
+				if(*end)
+					return -1;
+			}
+			cond->value += 2082844800; // HFS+ dates count from 1904
+			return 0;
+		}
+		case FIND_SIZE:
+			cond->value = strtoull(value,&end,10);
+			switch(*end) {
+				case 'G': case 'g': cond->value <<= 10; // fallthrough
+				case 'M': case 'm': cond->value <<= 10; // fallthrough
+				case 'K': case 'k': cond->value <<= 10; end++;
+			}
+			return *end ? -1 : 0;
+		default:
+			cond->value = strtoull(value,&end,find_fields[f].format == FIND_OCTAL ? 8 : 10);
+			return *end ? -1 : 0;
+	}
+}
+
+// each partition of the scan writes its matches to its own stream, which are printed in order at the end
+static int find_visit(hfs_volume* vol, hfs_catalog_key_t* key, hfs_catalog_keyed_record_t* rec, void* cookie) {
+	char* path = hfs_get_path(vol, rec->folder.cnid);
+	if(path)
+		fprintf(cookie, "%" PRIu32 "\t%s\n", rec->folder.cnid, path);
+	free(path);
+	return 0;
+}
+
+static int find(hfs_volume* vol, int nconds, char* args[]) {
+	hfs_catalog_condition_t conds[nconds+1];
+	// files and folders only, never their thread records
+	conds[0] = (hfs_catalog_condition_t){ HFS_CATFIELD_REC_TYPE, HFS_CMP_LE, HFS_REC_FILE };
+	for(int i = 0; i < nconds; i++)
+		if(parse_condition(args[i],conds+i+1)) {
+			fprintf(stderr,"find: invalid condition: %s\n", args[i]);
+			return 1;
+		}
+
+	hfs_catalog_predicate_t pred;
+	if(hfslib_compile_catalog_predicate(conds,nconds+1,&pred,NULL))
+		return 1;
+	unsigned nparts = hfs_cpu_count();
+	char* out[nparts];
+	size_t outlen[nparts];
+	void* streams[nparts];
+	for(unsigned i = 0; i < nparts; i++)
+		if(!(streams[i] = open_memstream(out+i,outlen+i))) {
+			nparts = i;
+			break;
+		}
+	int ret = nparts ? hfs_scan_catalog(vol,&pred,nparts,find_visit,streams) : -ENOMEM;
+	hfslib_free_catalog_predicate(&pred,NULL);
+	for(unsigned i = 0; i < nparts; i++) {
+		fclose(streams[i]);
+		if(ret > 0 && (int)i < ret)
+			fwrite(out[i],outlen[i],1,stdout);
+		free(out[i]);
+	}
+	if(ret < 0)
+		fprintf(stderr,"find: catalog scan failed: %s\n", strerror(-ret));
+	return ret < 0;
+}
+
+#define LOOKUP_BATCH 256
+#define LOOKUP_THREADS 4
+
+static void lookup_print(hfs_volume* vol, hfs_async_lookup_t* l) {
+	char name[512];
+	if(l->status != HFS_ASYNC_DONE) {
+		fprintf(stderr,"CNID lookup failure: %" PRIu32 "\n", l->cnid);
+		return;
+	}
+	hfs_unistr_to_utf8(&l->key.name, name);
+	printf("%" PRIu32 "\t%" PRIu32 "\t%s\t%s\n", l->cnid, l->key.parent_cnid, l->rec.type == HFS_REC_FLDR ? "folder" : "file", name);
+}
+
+// looks up the CNIDs given as arguments, or one per line on standard input, many at a time
+static int lookup(hfs_volume* vol, int ncnids, char* args[]) {
+	static hfs_async_lookup_t lookups[LOOKUP_BATCH];
+	hfs_async_lookup_t* batch[LOOKUP_BATCH];
+	char line[32];
+	int ret = 0, n = 0;
+	for(int i = 0; ; i++) {
+		const char* arg = ncnids ? (i < ncnids ? args[i] : NULL) : fgets(line,sizeof(line),stdin);
+		if(arg) {
+			char* end;
+			hfs_cnid_t cnid = strtoul(arg,&end,10);
+			if(end == arg || (*end && *end != '\n')) {
+				fprintf(stderr,"lookup: invalid CNID: %s\n", arg);
+				continue;
+			}
+			hfslib_async_find_cnid(vol,cnid,lookups+n,NULL);
+			batch[n] = lookups+n;
+			n++;
+		}
+		if(n == LOOKUP_BATCH || (!arg && n)) {
+			if((ret = hfs_async_run(vol,batch,n,LOOKUP_THREADS)))
+				fprintf(stderr,"lookup: %s\n", strerror(-ret));
+			for(int j = 0; j < n; j++) {
+				if(!ret)
+					lookup_print(vol,lookups+j);
+				hfslib_async_free(lookups+j,NULL);
+			}
+			n = 0;
+		}
+		if(!arg || ret)
+			break;
+	}
+	return ret != 0;
+}
+
+static int history(hfs_volume* vol, hfs_cnid_t machine, const char* path) {
+	struct hfs_snapshot* snapshots;
+	struct hfs_file_version* versions;
+	uint32_t nsnapshots, nversions;
+	int ret = hfs_file_history(vol,machine,path,&snapshots,&nsnapshots,&versions,&nversions);
+	if(ret) {
+		fprintf(stderr,"history: %s\n", strerror(-ret));
+		return 1;
+	}
+	for(int64_t v = 0; v <= nversions; v++) {
+		int32_t version = v < nversions ? v : -1;
+		bool header = false;
+		for(uint32_t i = 0; i < nsnapshots; i++) {
+			if(snapshots[i].version != version)
+				continue;
+			if(!header) {
+				if(version < 0)
+					printf("absent\n");
+				else {
+					char date[32];
+					time_t t = versions[v].modified;
+					strftime(date,sizeof(date),"%Y-%m-%d %H:%M:%S",localtime(&t));
+					printf("inode %" PRIu32 "\t%s%" PRIu64 "\t%s\n", versions[v].inode, versions[v].type == HFS_REC_FLDR ? "folder\t" : "", versions[v].size, date);
+				}
+				header = true;
+			}
+			printf("\t%s\n", snapshots[i].name);
+		}
+	}
+	hfs_free_file_history(snapshots,nsnapshots,versions);
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
 	if(argc < 2) {
-		fprintf(stderr,"Usage: hfsdump <device> [<stat|read> <path|inode>]\n");
+		fprintf(stderr,"Usage: hfsdump <device> [<stat|du|links> <path|inode> | read <path|inode> [offset [length]] | check [threads] | find [conditions...] | search <substring> | lookup [cnids...] | export <file> | profile [hit rate] | sync <dir> [threads] | history <path|inode> <path>]\n");
 		return 0;
 	}
 
-	hfs_callbacks cb = {hfs_vprintf, hfs_malloc, hfs_realloc, hfs_free, hfs_open, hfs_close, hfs_read};
+	hfs_callbacks cb = {hfs_vprintf, hfs_malloc, hfs_realloc, hfs_free, hfs_open, hfs_close, hfs_read, hfs_getnode, hfs_putnode, hfs_readv, NULL};
 	hfslib_init(&cb);
 	hfs_volume vol = {0};
-	hfs_catalog_keyed_record_t rec; hfs_catalog_key_t key; unsigned char fork;
+	hfs_catalog_keyed_record_t rec; hfs_catalog_key_t key; unsigned char fork = HFS_DATAFORK;
 	int ret = 0;
-	if((ret = hfslib_open_volume(argv[1],1,&vol,NULL))) {
+	// indexes like the hard link index are saved to and reused from this directory if set
+	struct hfs_device_args devargs = {
+		.cache_size = HFS_DEFAULT_CACHE_SIZE,
+		.sidecar_dir = getenv("HFSDUMP_SIDECAR"),
+		.block_cache_dir = getenv("HFSDUMP_BLOCK_CACHE"),
+	};
+	hfs_callback_args cbargs;
+	hfslib_init_cbargs(&cbargs);
+	cbargs.openvol = &devargs;
+	if((ret = hfslib_open_volume(argv[1],1,&vol,&cbargs))) {
 		fprintf(stderr,"Couldn't open volume\n");
 		hfslib_done();
 		return ret;
 	}
 
+	if(argc > 2 && !strcmp(argv[2], "check")) {
+		long problems = hfs_check(&vol, argc > 3 ? strtoul(argv[3], NULL, 10) : 0, stdout);
+		if(problems < 0)
+			fprintf(stderr,"Couldn't check volume\n");
+		else printf("%ld problems found\n", problems);
+		ret = problems != 0;
+		goto end;
+	}
+
+	if(argc > 2 && !strcmp(argv[2], "find")) {
+		ret = find(&vol, argc-3, argv+3);
+		goto end;
+	}
+
+	if(argc > 2 && !strcmp(argv[2], "lookup")) {
+		ret = lookup(&vol, argc-3, argv+3);
+		goto end;
+	}
+
+	if(argc > 3 && !strcmp(argv[2], "export")) {
+		FILE* out = strcmp(argv[3], "-") ? fopen(argv[3], "wb") : stdout;
+		if(!out)
+			perror("export");
+		else if((ret = hfs_export_catalog(&vol, out)))
+			fprintf(stderr,"export: %s\n", strerror(-ret));
+		if(out && out != stdout && fclose(out) && !ret)
+			ret = -errno;
+		ret = !out || ret;
+		goto end;
+	}
+
+	if(argc > 2 && !strcmp(argv[2], "profile")) {
+		if((ret = hfs_profile_volume(&vol, argc > 3 ? strtod(argv[3], NULL) : 0.9, stdout)))
+			fprintf(stderr,"profile: %s\n", strerror(-ret));
+		ret = ret != 0;
+		goto end;
+	}
+
+	if(argc > 3 && !strcmp(argv[2], "sync")) {
+		long failed = hfs_sync_mirror(&vol, argv[3], argc > 4 ? strtoul(argv[4], NULL, 10) : 0, stderr);
+		if(failed < 0)
+			fprintf(stderr,"sync: %s\n", strerror(-failed));
+		ret = failed != 0;
+		goto end;
+	}
+
+	if(argc > 3 && !strcmp(argv[2], "search")) {
+		hfs_cnid_t* cnids;
+		uint32_t count;
+		if((ret = hfs_search_names(&vol, argv[3], &cnids, &count)))
+			fprintf(stderr,"search: %s\n", strerror(-ret));
+		else {
+			for(uint32_t i = 0; i < count; i++) {
+				char* path = hfs_get_path(&vol, cnids[i]);
+				if(path)
+					printf("%" PRIu32 "\t%s\n", cnids[i], path);
+				free(path);
+			}
+			free(cnids);
+		}
+		goto end;
+	}
+
 	if(argc < 4) {
 		char name[512];
 		hfs_unistr_to_utf8(&vol.name, name);
@@ -207,7 +504,7 @@ int main(int argc, char* argv[]) {
 			hfs_catalog_keyed_record_t* keys;
 			hfs_unistr255_t* names;
 			uint32_t count;
-			hfslib_get_directory_contents(&vol,rec.folder.cnid,&keys,&names,&count,NULL);
+			hfs_get_directory_contents(&vol,rec.folder.cnid,&keys,&names,&count);
 			for(size_t i = 0; i < count; i++) {
 				char name[512];
 				hfs_pathname_to_unix(names+i,name);
@@ -217,18 +514,64 @@ int main(int argc, char* argv[]) {
 			free(keys);
 		}
 		else if(rec.type == HFS_REC_FILE) {
+			uint64_t size = fork == HFS_DATAFORK ? rec.file.data_fork.logical_size : rec.file.rsrc_fork.logical_size;
+			uint64_t offset = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+			uint64_t length = argc > 5 ? strtoull(argv[5], NULL, 10) : UINT64_MAX;
+			offset = min(offset,size);
+			length = min(length,size-offset);
 			hfs_extent_descriptor_t* extents = NULL;
-			uint16_t nextents = hfslib_get_file_extents(&vol,rec.file.cnid,fork,&extents,NULL);
-			uint64_t bytes = 0, offset = 0, size = fork == HFS_DATAFORK ? rec.file.data_fork.logical_size : rec.file.rsrc_fork.logical_size;
-			char data[4096];
-			while(!(ret = hfslib_readd_with_extents(&vol,data,&bytes,4096,offset,extents,nextents,NULL)) && offset < size) {
-				fwrite(data,(size-offset < bytes ? size-offset : bytes),1,stdout);
-				offset += bytes;
+			uint16_t nextents = hfs_get_file_extents(&vol,rec.file.cnid,fork,&extents);
+			fflush(stdout);
+			int err = hfs_stream_fork(&vol,extents,nextents,offset,length,STDOUT_FILENO);
+			if(err) {
+				fprintf(stderr,"read: %s\n", strerror(-err));
+				ret = 1;
 			}
 			free(extents);
 		}
 	}
-	else fprintf(stderr,"valid commands: stat, read\n");
+	else if(!strcmp(argv[2], "du")) {
+		struct hfs_folder_usage u;
+		if(rec.type != HFS_REC_FLDR) {
+			fprintf(stderr,"du: not a folder\n");
+			ret = 1;
+		}
+		else if(hfs_get_folder_usage(&vol, rec.folder.cnid, &u)) {
+			fprintf(stderr,"du: catalog scan failed\n");
+			ret = 1;
+		}
+		else printf(
+			"files: %" PRIu64 "\n"
+			"folders: %" PRIu64 "\n"
+			"logical_size: %" PRIu64 "\n"
+			"physical_size: %" PRIu64 "\n",
+			u.files, u.folders, u.logical_size, u.physical_size
+		);
+	}
+	else if(!strcmp(argv[2], "links")) {
+		struct hfs_hard_link* links;
+		uint32_t count;
+		if(hfs_get_hard_links(&vol, rec.file.cnid, &links, &count)) {
+			fprintf(stderr,"links: catalog scan failed\n");
+			ret = 1;
+		}
+		else {
+			for(uint32_t i = 0; i < count; i++) {
+				char* path = hfs_get_hard_link_path(&vol, links+i);
+				printf("%" PRIu32 "\t%s\n", links[i].cnid, path ? path : links[i].name);
+				free(path);
+			}
+			free(links);
+		}
+	}
+	else if(!strcmp(argv[2], "history")) {
+		if(rec.type != HFS_REC_FLDR || argc < 5) {
+			fprintf(stderr,"history: usage: history <backup folder> <path within each snapshot>\n");
+			ret = 1;
+		}
+		else ret = history(&vol, rec.folder.cnid, argv[4]);
+	}
+	else fprintf(stderr,"valid commands: stat, read, du, links, check, find, search, lookup, export, profile, sync, history\n");
 
 end:
 	hfslib_close_volume(&vol,NULL);
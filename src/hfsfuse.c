@@ -22,27 +22,71 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE // O_DIRECT
+
+#include "hfsfuse.h"
 #include "hfsuser.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
 #include <fuse/fuse.h>
-
-static void* hfsfuse_init(struct fuse_conn_info* conn) {
-	ringbuffer_init();
-	return fuse_get_context()->private_data;
+#include <fuse/fuse_lowlevel.h>
+#include <fuse/fuse_opt.h>
+
+// with poll_interval set, a thread watches the device for writes made elsewhere and reloads the volume.
+// requests hold volume_lock for reading, the reload holds it for writing.
+static pthread_rwlock_t volume_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct {
+	unsigned interval;
+	struct fuse* fuse;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+	uint32_t generation;
+	// the generation each recently opened file was last opened in, to decide whether its pages may be kept
+	struct {
+		hfs_cnid_t cnid;
+		uint32_t generation;
+	} opened[1024];
+} poller = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// set while serving a request. libhfs also reads while the volume is opened and reloaded, where there's no
+// request for fuse_interrupted to look at
+static __thread int in_request;
+
+// lets libhfs abandon a request the kernel has given up on, e.g. because the caller was killed
+static int hfsfuse_interrupted(hfs_callback_args* cbargs) {
+	return in_request && fuse_interrupted();
 }
 
-static void hfsfuse_destroy(void* vol) {
-	ringbuffer_destroy();
+// the kernel may keep a file's cached pages only if the volume hasn't been reloaded since the file was last opened
+static int keep_cache(hfs_cnid_t cnid) {
+	if(!poller.interval)
+		return 1;
+	pthread_mutex_lock(&poller.lock);
+	__typeof__(*poller.opened)* slot = poller.opened + cnid % (sizeof(poller.opened)/sizeof(*poller.opened));
+	int keep = slot->cnid == cnid && slot->generation == poller.generation;
+	slot->cnid = cnid;
+	slot->generation = poller.generation;
+	pthread_mutex_unlock(&poller.lock);
+	return keep;
 }
 
-
 struct hf_file {
 	hfs_cnid_t cnid;
 	hfs_extent_descriptor_t* extents;
 	uint16_t nextents;
 	uint8_t fork;
+	uint32_t generation; // of the volume the extents were looked up in
+	pthread_rwlock_t lock; // reads hold it shared, replacing stale extents exclusive
 };
 
 static int hfsfuse_open(const char* path, struct fuse_file_info* info) {
@@ -54,31 +98,70 @@ static int hfsfuse_open(const char* path, struct fuse_file_info* info) {
 	struct hf_file* f = malloc(sizeof(*f));
 	f->cnid = rec.file.cnid;
 	f->fork = fork;
-	f->nextents = hfslib_get_file_extents(vol,f->cnid,fork,&f->extents,NULL);
+	f->nextents = hfs_get_file_extents(vol,f->cnid,fork,&f->extents);
+	f->generation = poller.generation;
+	pthread_rwlock_init(&f->lock,NULL);
+	hfs_prefetch_opened(vol,f->cnid);
+	// O_DIRECT readers are streaming and manage their own buffering
+#ifdef O_DIRECT
+	if(!(info->flags & O_DIRECT))
+#endif
+		hfs_prefetch_head(vol,f->extents,f->nextents,fork == HFS_DATAFORK ? rec.file.data_fork.logical_size : rec.file.rsrc_fork.logical_size);
 	info->fh = (uint64_t)f;
-	info->keep_cache = 1;
+	info->keep_cache = keep_cache(f->cnid);
 	return 0;
 }
 
 static int hfsfuse_release(const char* path, struct fuse_file_info* info) {
 	struct hf_file* f = (struct hf_file*)info->fh;
+	pthread_rwlock_destroy(&f->lock);
 	free(f->extents);
 	free(f);
 	return 0;
 }
 
+// a file opened before a reload may have moved on the device since, so its extents are looked up again.
+// reloads change the generation only while holding volume_lock for writing, so it's stable during a request
+static int refresh_extents(hfs_volume* vol, struct hf_file* f) {
+	int ret = 0;
+	pthread_rwlock_wrlock(&f->lock);
+	if(f->generation != poller.generation) {
+		hfs_extent_descriptor_t* extents;
+		uint16_t nextents = hfs_get_file_extents(vol,f->cnid,f->fork,&extents);
+		if(!nextents && f->nextents)
+			ret = -ESTALE; // deleted from the volume
+		else {
+			free(f->extents);
+			f->extents = extents;
+			f->nextents = nextents;
+			f->generation = poller.generation;
+		}
+	}
+	pthread_rwlock_unlock(&f->lock);
+	return ret;
+}
+
 static int hfsfuse_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* info) {
 	hfs_volume* vol = fuse_get_context()->private_data;
 	struct hf_file* f = (struct hf_file*)info->fh;
 	uint64_t bytes;
-	int ret = hfslib_readd_with_extents(vol,buf,&bytes,size,offset,f->extents,f->nextents,NULL);
+	int ret;
+	pthread_rwlock_rdlock(&f->lock);
+	while(f->generation != poller.generation) {
+		pthread_rwlock_unlock(&f->lock);
+		if((ret = refresh_extents(vol,f)))
+			return ret;
+		pthread_rwlock_rdlock(&f->lock);
+	}
+	ret = hfs_read_fork(vol,f->cnid,f->fork,f->extents,f->nextents,buf,&bytes,size,offset);
+	pthread_rwlock_unlock(&f->lock);
 	if(ret < 0)
-		return ret;
+		return fuse_interrupted() ? -EINTR : ret;
 	return bytes;
 }
 
 static int hfsfuse_readlink(const char* path, char* buf, size_t size) {
-	struct fuse_file_info info;
+	struct fuse_file_info info = {0};
 	if(hfsfuse_open(path,&info)) return -errno;
 	int bytes = hfsfuse_read(path,buf,size,0,&info);
 	hfsfuse_release(NULL,&info);
@@ -122,8 +205,13 @@ static int hfsfuse_opendir(const char* path, struct fuse_file_info* info) {
 	if(ret > 0) return -ENOENT;
 	if(ret) return -errno;
 	struct hf_dir* d = malloc(sizeof(*d));
+	if(!d)
+		return -ENOMEM;
 	d->cnid = rec.folder.cnid;
-	hfslib_get_directory_contents(vol,d->cnid,&d->keys,&d->paths,&d->npaths,NULL);
+	if((ret = hfs_get_directory_contents(vol,d->cnid,&d->keys,&d->paths,&d->npaths))) {
+		free(d);
+		return fuse_interrupted() ? -EINTR : ret < 0 ? ret : -EIO;
+	}
 
 	hfs_catalog_keyed_record_t link;
 	for(hfs_catalog_keyed_record_t* record = d->keys; record != d->keys + d->npaths; record++)
@@ -180,8 +268,10 @@ static int hfsfuse_readdir2(const char* path, void* buf, fuse_fill_dir_t filler,
 			if(filler(buf, ".", &st, 1))
 				return 0;
 		}
-		hfslib_find_catalog_record_with_cnid(vol, key.parent_cnid, &rec, &key, NULL);
-		hfs_stat(vol, &rec, &st, 0);
+		if(d->cnid != hfs_get_root(vol)) { // the mounted root is its own parent
+			hfslib_find_catalog_record_with_cnid(vol, key.parent_cnid, &rec, &key, NULL);
+			hfs_stat(vol, &rec, &st, 0);
+		}
 		if(filler(buf, "..", NULL, 2))
 			return 0;
 	}
@@ -256,6 +346,17 @@ static int hfsfuse_listxattr(const char* path, char* attr, size_t size) {
 	if(memcmp(&rec.file,(char[32]){0},32))
 		declare_attr("com.apple.FinderInfo", attr, size, ret);
 
+	if(rec.type == HFS_REC_FLDR) {
+		declare_attr("hfsfuse.du.files", attr, size, ret);
+		declare_attr("hfsfuse.du.folders", attr, size, ret);
+		declare_attr("hfsfuse.du.logical_size", attr, size, ret);
+		declare_attr("hfsfuse.du.physical_size", attr, size, ret);
+	}
+	// special is the link count of iNode files and dir_ folders, but the device number of device files
+	const hfs_bsd_data_t* bsd = rec.type == HFS_REC_FLDR ? &rec.folder.bsd : &rec.file.bsd;
+	if(!S_ISBLK(bsd->file_mode) && !S_ISCHR(bsd->file_mode) && bsd->special.link_count > 1)
+		declare_attr("hfsfuse.links", attr, size, ret);
+
 	return ret;
 }
 
@@ -285,7 +386,7 @@ static int hfsfuse_getxattr(const char* path, const char* attr, char* value, siz
 		uint64_t bytes;
 		if(size > ret)
 			size = ret;
-		uint16_t nextents = hfslib_get_file_extents(vol,rec.file.cnid,HFS_RSRCFORK,&extents,NULL);
+		uint16_t nextents = hfs_get_file_extents(vol,rec.file.cnid,HFS_RSRCFORK,&extents);
 		if((ret = hfslib_readd_with_extents(vol,value,&bytes,size,0,extents,nextents,NULL)) >= 0)
 			ret = bytes;
 		else ret = -EIO;
@@ -304,6 +405,55 @@ static int hfsfuse_getxattr(const char* path, const char* attr, char* value, siz
 		strftime(value, 24, "%FT%T%z", &t);
 	});
 
+	// recursive totals, all computed by the first catalog scan
+	if(rec.type == HFS_REC_FLDR && !strncmp(attr, attrname("hfsfuse.du."), strlen(attrname("hfsfuse.du.")))) {
+		struct hfs_folder_usage u;
+		if((ret = hfs_get_folder_usage(vol,rec.folder.cnid,&u)))
+			return ret;
+		char buf[21];
+#define define_usage_attr(field) do {\
+	ret = snprintf(buf, sizeof(buf), "%" PRIu64, u.field);\
+	define_attr(attr, "hfsfuse.du." #field, size, ret, { memcpy(value, buf, ret); });\
+} while(0)
+		define_usage_attr(files);
+		define_usage_attr(folders);
+		define_usage_attr(logical_size);
+		define_usage_attr(physical_size);
+#undef define_usage_attr
+	}
+
+	// every path linking to this file, one per line
+	if(!strcmp(attr, attrname("hfsfuse.links"))) {
+		struct hfs_hard_link* links;
+		uint32_t count;
+		if((ret = hfs_get_hard_links(vol,rec.file.cnid,&links,&count)))
+			return ret;
+		char* paths = NULL;
+		size_t len = 0;
+		FILE* out = open_memstream(&paths,&len);
+		if(!out) {
+			free(links);
+			return -ENOMEM;
+		}
+		for(uint32_t i = 0; i < count; i++) {
+			char* path = hfs_get_hard_link_path(vol,links+i);
+			if(path)
+				fprintf(out,"%s\n",path);
+			free(path);
+		}
+		free(links);
+		fclose(out);
+		if(!paths)
+			return -ENOMEM;
+		ret = len;
+		if(size && size < len)
+			ret = -ERANGE;
+		else if(size)
+			memcpy(value, paths, len);
+		free(paths);
+		return ret;
+	}
+
 	return -1;
 }
 
@@ -311,67 +461,448 @@ static int hfsfuse_getxattr_darwin(const char* path, const char* attr, char* val
 	return hfsfuse_getxattr(path, attr, value, size);
 }
 
+static int prefetch_ioctl(hfs_volume* vol, struct hfsfuse_prefetch* p) {
+	p->paths[sizeof(p->paths)-1] = '\0';
+	size_t npaths = 0;
+	const char** paths = malloc((sizeof(p->paths)/2+1) * sizeof(*paths));
+	if(!paths)
+		return -ENOMEM;
+	for(char* it = p->paths, * end; *it; it = end) {
+		end = it + strcspn(it,"\n");
+		if(*end)
+			*end++ = '\0';
+		if(*it)
+			paths[npaths++] = it;
+	}
+	int ret = hfs_prefetch_manifest(vol,paths,npaths,p->window,p->flags & HFSFUSE_PREFETCH_APPEND);
+	free(paths);
+	return ret;
+}
+
+_Static_assert(HFSFUSE_STATS_STREAMS == HFS_MRC_DEVICE+1 && HFSFUSE_MRC_POINTS == HFS_MRC_POINTS, "hfsfuse.h doesn't match the cache");
+
+static int stats_ioctl(hfs_volume* vol, struct hfsfuse_stats* st) {
+	memset(st,0,sizeof(*st));
+	st->nstreams = HFSFUSE_STATS_STREAMS;
+	for(unsigned i = 0; i < HFSFUSE_STATS_STREAMS; i++) {
+		struct hfsfuse_stream_stats* s = st->streams + i;
+		struct hfs_cache_tier_stats stats;
+		struct hfs_mrc mrc;
+		hfs_volume_cache_stats(vol,i,&stats,&mrc);
+		strncpy(s->name,i == HFS_MRC_DEVICE ? "device" : hfs_cache_tier_name(i),sizeof(s->name)-1);
+		s->hits = stats.hits;
+		s->misses = stats.misses;
+		s->evictions = stats.evictions;
+		s->bytes = stats.bytes;
+		s->target = stats.target;
+		s->references = mrc.references;
+		s->sampling_rate = mrc.rate * 1000000;
+		for(int j = 0; j < HFSFUSE_MRC_POINTS; j++) {
+			s->size[j] = mrc.size[j];
+			s->miss_ratio[j] = mrc.miss_ratio[j] * 1000000;
+		}
+	}
+	return 0;
+}
+
+static int hfsfuse_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* info, unsigned int flags, void* data) {
+	hfs_volume* vol = fuse_get_context()->private_data;
+	switch((unsigned int)cmd) {
+		case HFSFUSE_IOC_PREFETCH: return prefetch_ioctl(vol,data);
+		case HFSFUSE_IOC_STATS: return stats_ioctl(vol,data);
+	}
+	return -ENOTTY;
+}
+
+// wraps an operation in the volume lock, and marks it as a request for hfsfuse_interrupted
+#define LOCKED(op, params, args) \
+static int op##_locked params {\
+	pthread_rwlock_rdlock(&volume_lock);\
+	in_request = 1;\
+	int ret = op args;\
+	in_request = 0;\
+	pthread_rwlock_unlock(&volume_lock);\
+	return ret;\
+}
+
+LOCKED(hfsfuse_open, (const char* path, struct fuse_file_info* info), (path,info))
+LOCKED(hfsfuse_read, (const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* info), (path,buf,size,offset,info))
+LOCKED(hfsfuse_readlink, (const char* path, char* buf, size_t size), (path,buf,size))
+LOCKED(hfsfuse_getattr, (const char* path, struct stat* st), (path,st))
+LOCKED(hfsfuse_fgetattr, (const char* path, struct stat* st, struct fuse_file_info* info), (path,st,info))
+LOCKED(hfsfuse_opendir, (const char* path, struct fuse_file_info* info), (path,info))
+LOCKED(hfsfuse_readdir2, (const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* info), (path,buf,filler,offset,info))
+LOCKED(hfsfuse_statfs, (const char* path, struct statvfs* st), (path,st))
+LOCKED(hfsfuse_listxattr, (const char* path, char* attr, size_t size), (path,attr,size))
+LOCKED(hfsfuse_ioctl, (const char* path, int cmd, void* arg, struct fuse_file_info* info, unsigned int flags, void* data), (path,cmd,arg,info,flags,data))
+#ifdef __APPLE__
+LOCKED(hfsfuse_getxattr_darwin, (const char* path, const char* attr, char* value, size_t size, u_int32_t unused), (path,attr,value,size,unused))
+LOCKED(hfsfuse_getxtimes, (const char* path, struct timespec* bkuptime, struct timespec* crtime), (path,bkuptime,crtime))
+#else
+LOCKED(hfsfuse_getxattr, (const char* path, const char* attr, char* value, size_t size), (path,attr,value,size))
+#endif
+
+// reloads the volume and tells the kernel to forget what it cached from before.
+// the high level API only names the root inode, so the root's entries are invalidated by name,
+// which takes everything beneath them out of the kernel's dentry cache too.
+static int reload(hfs_volume* vol) {
+	hfs_catalog_keyed_record_t* keys = NULL;
+	hfs_unistr255_t* names = NULL;
+	uint32_t nnames = 0;
+
+	pthread_rwlock_wrlock(&volume_lock);
+	if(hfs_get_directory_contents(vol,hfs_get_root(vol),&keys,&names,&nnames))
+		nnames = 0;
+	int ret = hfs_volume_reload(vol);
+	pthread_mutex_lock(&poller.lock);
+	poller.generation++;
+	pthread_mutex_unlock(&poller.lock);
+	pthread_rwlock_unlock(&volume_lock);
+
+	struct fuse_chan* ch = fuse_session_next_chan(fuse_get_session(poller.fuse),NULL);
+	fuse_lowlevel_notify_inval_inode(ch,FUSE_ROOT_ID,0,0);
+	char name[512];
+	for(uint32_t i = 0; i < nnames; i++) {
+		ssize_t len = hfs_pathname_to_unix(names+i,name);
+		if(len > 0)
+			fuse_lowlevel_notify_inval_entry(ch,FUSE_ROOT_ID,name,len);
+	}
+	free(keys);
+	free(names);
+	return ret;
+}
+
+static void* poll_volume(void* data) {
+	hfs_volume* vol = data;
+	int failed = 0;
+	pthread_mutex_lock(&poller.lock);
+	while(!poller.stop) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME,&deadline);
+		deadline.tv_sec += poller.interval;
+		while(!poller.stop && pthread_cond_timedwait(&poller.cond,&poller.lock,&deadline) != ETIMEDOUT)
+			;
+		if(poller.stop)
+			break;
+		pthread_mutex_unlock(&poller.lock);
+
+		// a failed reload is retried, the writer may have been midway through an update
+		int ret = failed ? 1 : hfs_volume_changed(vol);
+		if(ret < 0)
+			syslog(LOG_ERR,"hfsfuse: couldn't check the volume for changes: %s",strerror(-ret));
+		else if(ret && (failed = !!(ret = reload(vol))))
+			syslog(LOG_ERR,"hfsfuse: couldn't reload the changed volume: %s",strerror(-ret));
+
+		pthread_mutex_lock(&poller.lock);
+	}
+	pthread_mutex_unlock(&poller.lock);
+	return NULL;
+}
+
+static void* hfsfuse_init(struct fuse_conn_info* conn) {
+	struct fuse_context* ctx = fuse_get_context();
+	// fuse_main has daemonized by now
+	int ret = hfs_start_replicas(ctx->private_data);
+	if(ret)
+		syslog(LOG_ERR,"hfsfuse: couldn't start reading from replicas: %s",strerror(-ret));
+	if(poller.interval) {
+		poller.fuse = ctx->fuse;
+		if(pthread_create(&poller.thread,NULL,poll_volume,ctx->private_data)) {
+			syslog(LOG_ERR,"hfsfuse: couldn't start polling the volume for changes");
+			poller.interval = 0;
+		}
+	}
+	return ctx->private_data;
+}
+
+static void hfsfuse_destroy(void* data) {
+	if(!poller.interval)
+		return;
+	pthread_mutex_lock(&poller.lock);
+	poller.stop = 1;
+	pthread_cond_signal(&poller.cond);
+	pthread_mutex_unlock(&poller.lock);
+	pthread_join(poller.thread,NULL);
+}
+
 static struct fuse_operations hfsfuse_ops = {
 	.init        = hfsfuse_init,
 	.destroy     = hfsfuse_destroy,
-	.open        = hfsfuse_open,
-	.opendir     = hfsfuse_opendir,
-	.read        = hfsfuse_read,
-	.readdir     = hfsfuse_readdir2,
+	.open        = hfsfuse_open_locked,
+	.opendir     = hfsfuse_opendir_locked,
+	.read        = hfsfuse_read_locked,
+	.readdir     = hfsfuse_readdir2_locked,
 	.release     = hfsfuse_release,
 	.releasedir  = hfsfuse_releasedir,
-	.statfs      = hfsfuse_statfs,
-	.getattr     = hfsfuse_getattr,
-	.readlink    = hfsfuse_readlink,
-	.fgetattr    = hfsfuse_fgetattr,
-	.listxattr   = hfsfuse_listxattr,
+	.statfs      = hfsfuse_statfs_locked,
+	.getattr     = hfsfuse_getattr_locked,
+	.readlink    = hfsfuse_readlink_locked,
+	.fgetattr    = hfsfuse_fgetattr_locked,
+	.listxattr   = hfsfuse_listxattr_locked,
+	.ioctl       = hfsfuse_ioctl_locked,
 #ifdef __APPLE__
-	.getxattr    = hfsfuse_getxattr_darwin,
+	.getxattr    = hfsfuse_getxattr_darwin_locked,
 #else
-	.getxattr    = hfsfuse_getxattr,
+	.getxattr    = hfsfuse_getxattr_locked,
 #endif
 #ifdef __APPLE__
-	.getxtimes   = hfsfuse_getxtimes,
+	.getxtimes   = hfsfuse_getxtimes_locked,
 #else
 	.flag_nopath = 1,
 	.flag_nullpath_ok = 1
 #endif
 };
 
+struct hfsfuse_config {
+	char* device;
+	char* root;
+	char* sidecar;
+	char* block_cache;
+	size_t block_cache_size;
+	int block_cache_data;
+	size_t cache_size;
+	size_t compressed_cache_size;
+	size_t data_cache_size;
+	size_t prefetch_size;
+	unsigned poll_interval;
+	char* replicas[HFS_REPLICAS_MAX - 1];
+	size_t nreplicas;
+	double hedge_percentile;
+};
+
+enum {
+	HFSFUSE_OPT_KEY_HELP,
+	HFSFUSE_OPT_KEY_CACHE_SIZE,
+	HFSFUSE_OPT_KEY_COMPRESSED_CACHE_SIZE,
+	HFSFUSE_OPT_KEY_DATA_CACHE_SIZE,
+	HFSFUSE_OPT_KEY_PREFETCH_SIZE,
+	HFSFUSE_OPT_KEY_BLOCK_CACHE_SIZE,
+	HFSFUSE_OPT_KEY_REPLICA,
+	HFSFUSE_OPT_KEY_HEDGE_PERCENTILE,
+};
+
+static struct fuse_opt hfsfuse_opts[] = {
+	FUSE_OPT_KEY("-h", HFSFUSE_OPT_KEY_HELP),
+	FUSE_OPT_KEY("--help", HFSFUSE_OPT_KEY_HELP),
+	FUSE_OPT_KEY("cache_size=", HFSFUSE_OPT_KEY_CACHE_SIZE),
+	FUSE_OPT_KEY("compressed_cache_size=", HFSFUSE_OPT_KEY_COMPRESSED_CACHE_SIZE),
+	FUSE_OPT_KEY("data_cache_size=", HFSFUSE_OPT_KEY_DATA_CACHE_SIZE),
+	FUSE_OPT_KEY("prefetch_size=", HFSFUSE_OPT_KEY_PREFETCH_SIZE),
+	FUSE_OPT_KEY("block_cache_size=", HFSFUSE_OPT_KEY_BLOCK_CACHE_SIZE),
+	FUSE_OPT_KEY("replica=", HFSFUSE_OPT_KEY_REPLICA),
+	FUSE_OPT_KEY("hedge_percentile=", HFSFUSE_OPT_KEY_HEDGE_PERCENTILE),
+	{"block_cache=%s", offsetof(struct hfsfuse_config, block_cache), 0},
+	{"block_cache_data", offsetof(struct hfsfuse_config, block_cache_data), 1},
+	{"root=%s", offsetof(struct hfsfuse_config, root), 0},
+	{"sidecar=%s", offsetof(struct hfsfuse_config, sidecar), 0},
+	{"poll_interval=%u", offsetof(struct hfsfuse_config, poll_interval), 0},
+	FUSE_OPT_END
+};
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: hfsfuse [-h] [-o options] <device> <mountpoint>\n\n"
+		"hfsfuse options:\n"
+		"    -o cache_size=N        bytes of memory for cached records, b-tree nodes,\n"
+		"                           extents, and directories (K/M/G suffixes ok,\n"
+		"                           default %dM, 0 to disable)\n"
+		"    -o compressed_cache_size=N\n"
+		"                           bytes of memory for keeping evicted b-tree nodes\n"
+		"                           compressed, if built with LZ4 or zlib\n"
+		"                           (K/M/G suffixes ok, default 0 = disabled)\n"
+		"    -o data_cache_size=N   bytes of memory for cached file contents, shared by\n"
+		"                           every hard link to a file, like the copies of a\n"
+		"                           file in Time Machine snapshots\n"
+		"                           (K/M/G suffixes ok, default 0 = disabled)\n"
+		"    -o prefetch_size=N     read ahead the first N bytes of each file when it\n"
+		"                           is opened, unless opened with O_DIRECT\n"
+		"                           (K/M/G suffixes ok, default 0 = disabled)\n"
+		"    -o root=PATH|CNID      mount the folder at PATH or with catalog node ID\n"
+		"                           CNID as the root, e.g. a Time Machine snapshot\n"
+		"    -o sidecar=DIR         save indexes built by scanning the catalog, like\n"
+		"                           the hard link index, in DIR to reuse next time\n"
+		"    -o block_cache=DIR     keep a persistent cache of the volume's metadata\n"
+		"                           blocks in DIR, for devices slower than DIR's\n"
+		"    -o block_cache_size=N  size of the block cache file (K/M/G suffixes ok,\n"
+		"                           default %dM)\n"
+		"    -o block_cache_data    cache file contents in the block cache too\n"
+		"    -o poll_interval=N     check the device every N seconds for changes made\n"
+		"                           by another system and reload the volume if found\n"
+		"                           (default 0 = disabled)\n"
+		"    -o replica=PATH        also read from PATH, a bit-identical copy of the\n"
+		"                           device, sending each read to the least busy copy\n"
+		"                           (may be given up to %d times)\n"
+		"    -o hedge_percentile=N  repeat a read on another replica when it takes\n"
+		"                           longer than N%% of recent reads (default %d,\n"
+		"                           100 to disable)\n\n",
+		HFS_DEFAULT_CACHE_SIZE/(1024*1024), HFS_DEFAULT_BLOCK_CACHE_SIZE/(1024*1024), HFS_REPLICAS_MAX - 1, HFS_DEFAULT_HEDGE_PERCENTILE
+	);
+}
+
+// parses a byte count with an optional K, M, or G suffix
+static int parse_size(const char* str, size_t* size) {
+	char* end;
+	errno = 0;
+	unsigned long long val = strtoull(str,&end,10);
+	if(end == str || errno == ERANGE || *str == '-')
+		return -1;
+	// sizes that don't fit are rejected rather than wrapped around to something small
+	switch(*end) {
+		case 'g': case 'G': if(val > SIZE_MAX / 1024) return -1; val *= 1024; // fallthrough
+		case 'm': case 'M': if(val > SIZE_MAX / 1024) return -1; val *= 1024; // fallthrough
+		case 'k': case 'K': if(val > SIZE_MAX / 1024) return -1; val *= 1024; end++;
+	}
+	if(*end || val > SIZE_MAX)
+		return -1;
+	*size = val;
+	return 0;
+}
+
+// resolves the root= option to a folder and makes it the root for lookups
+static int hfsfuse_set_root(hfs_volume* vol, const char* root) {
+	hfs_cnid_t cnid;
+	if(*root == '/') {
+		hfs_catalog_keyed_record_t rec; hfs_catalog_key_t key;
+		// hfs_lookup's codes aren't errnos; -5 means a file was found partway through the path
+		int ret = hfs_lookup(vol,root,&rec,&key,NULL);
+		if(ret)
+			return ret == -5 ? -ENOTDIR : -ENOENT;
+		if(rec.type != HFS_REC_FLDR)
+			return -ENOTDIR;
+		cnid = rec.folder.cnid;
+	}
+	else {
+		char* end;
+		unsigned long val = strtoul(root,&end,10);
+		if(end == root || *end || !val || val > UINT32_MAX)
+			return -EINVAL;
+		cnid = val;
+	}
+	return hfs_set_root(vol,cnid);
+}
+
+static int hfsfuse_opt_proc(void* data, const char* arg, int key, struct fuse_args* outargs) {
+	struct hfsfuse_config* cfg = data;
+	switch(key) {
+		case FUSE_OPT_KEY_NONOPT:
+			if(!cfg->device) {
+				cfg->device = strdup(arg);
+				return 0;
+			}
+			return 1;
+		case HFSFUSE_OPT_KEY_HELP:
+			usage();
+			fuse_opt_add_arg(outargs,"-ho");
+			fuse_main(outargs->argc,outargs->argv,&hfsfuse_ops,NULL);
+			exit(0);
+		case HFSFUSE_OPT_KEY_CACHE_SIZE:
+			if(parse_size(strchr(arg,'=')+1,&cfg->cache_size)) {
+				fprintf(stderr,"hfsfuse: invalid cache_size: %s\n",arg);
+				return -1;
+			}
+			return 0;
+		case HFSFUSE_OPT_KEY_COMPRESSED_CACHE_SIZE:
+			if(parse_size(strchr(arg,'=')+1,&cfg->compressed_cache_size)) {
+				fprintf(stderr,"hfsfuse: invalid compressed_cache_size: %s\n",arg);
+				return -1;
+			}
+#if !defined(HAVE_LZ4) && !defined(HAVE_ZLIB)
+			if(cfg->compressed_cache_size) {
+				fprintf(stderr,"hfsfuse: compressed_cache_size needs a build with LZ4 or zlib\n");
+				return -1;
+			}
+#endif
+			return 0;
+		case HFSFUSE_OPT_KEY_DATA_CACHE_SIZE:
+			if(parse_size(strchr(arg,'=')+1,&cfg->data_cache_size)) {
+				fprintf(stderr,"hfsfuse: invalid data_cache_size: %s\n",arg);
+				return -1;
+			}
+			return 0;
+		case HFSFUSE_OPT_KEY_BLOCK_CACHE_SIZE:
+			if(parse_size(strchr(arg,'=')+1,&cfg->block_cache_size)) {
+				fprintf(stderr,"hfsfuse: invalid block_cache_size: %s\n",arg);
+				return -1;
+			}
+			return 0;
+		case HFSFUSE_OPT_KEY_PREFETCH_SIZE:
+			if(parse_size(strchr(arg,'=')+1,&cfg->prefetch_size)) {
+				fprintf(stderr,"hfsfuse: invalid prefetch_size: %s\n",arg);
+				return -1;
+			}
+			return 0;
+		case HFSFUSE_OPT_KEY_REPLICA:
+			if(cfg->nreplicas == HFS_REPLICAS_MAX - 1) {
+				fprintf(stderr,"hfsfuse: at most %d replicas can be given\n",HFS_REPLICAS_MAX - 1);
+				return -1;
+			}
+			cfg->replicas[cfg->nreplicas++] = strdup(strchr(arg,'=')+1);
+			return 0;
+		case HFSFUSE_OPT_KEY_HEDGE_PERCENTILE: {
+			char* end;
+			double val = strtod(strchr(arg,'=')+1,&end);
+			if(*end || !(val > 0 && val <= 100)) {
+				fprintf(stderr,"hfsfuse: invalid hedge_percentile: %s\n",arg);
+				return -1;
+			}
+			cfg->hedge_percentile = val;
+			return 0;
+		}
+	}
+	return 1;
+}
+
 int main(int argc, char* argv[]) {
-	// cheat a lot with option parsing to stay within the fuse_main high level API
-	if(argc < 3 || !strcmp(argv[1],"-h")) {
-		fuse_main(2,((char*[]){"hfsfuse","-h"}),NULL,NULL);
-		return 0;
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct hfsfuse_config cfg = { .cache_size = HFS_DEFAULT_CACHE_SIZE };
+	if(fuse_opt_parse(&args, &cfg, hfsfuse_opts, hfsfuse_opt_proc) == -1)
+		return 1;
+	if(!cfg.device) {
+		usage();
+		return 1;
 	}
 
 	const char opts[] = "-oro,allow_other,use_ino,subtype=hfs,fsname=";
-	const char* device = argv[argc-2];
-	char* mount = argv[argc-1];
-	char* argv2[argc+2];
-	argv2[0] = "hfsfuse";
-	argv2[1] = mount;
-	argv2[2] = strcat(strcpy(malloc(strlen(opts)+strlen(device)+1),opts),device);
-	argv2[3] = "-s";
-	for(int i = 1; i < argc-2; i++)
-		argv2[i+3] = argv[i];
-	argv2[argc+1] = NULL;
-
-	hfs_callbacks cb = {hfs_vprintf, hfs_malloc, hfs_realloc, hfs_free, hfs_open, hfs_close, hfs_read};
+	char* fsopts = malloc(strlen(opts)+strlen(cfg.device)+1);
+	fuse_opt_insert_arg(&args, 1, strcat(strcpy(fsopts,opts),cfg.device));
+	free(fsopts);
+	// nothing changes underneath a static volume, and after a reload the kernel is told what's stale
+	if(cfg.poll_interval)
+		fuse_opt_insert_arg(&args, 1, "-oentry_timeout=31536000,attr_timeout=31536000");
+	poller.interval = cfg.poll_interval;
+
+	hfs_callbacks cb = {hfs_vprintf, hfs_malloc, hfs_realloc, hfs_free, hfs_open, hfs_close, hfs_read, hfs_getnode, hfs_putnode, hfs_readv, hfsfuse_interrupted};
 	hfslib_init(&cb);
 
 	// open volume
+	struct hfs_device_args devargs = { .cache_size = cfg.cache_size, .compressed_cache_size = cfg.compressed_cache_size, .data_cache_size = cfg.data_cache_size, .prefetch_size = cfg.prefetch_size, .sidecar_dir = cfg.sidecar,
+	                                   .block_cache_dir = cfg.block_cache, .block_cache_size = cfg.block_cache_size, .block_cache_data = cfg.block_cache_data,
+	                                   .replicas = (const char* const*)cfg.replicas, .nreplicas = cfg.nreplicas, .hedge_percentile = cfg.hedge_percentile };
+	hfs_callback_args cbargs;
+	hfslib_init_cbargs(&cbargs);
+	cbargs.openvol = &devargs;
+
 	hfs_volume vol;
-	int ret = hfslib_open_volume(device, 1, &vol, NULL);
+	int ret = hfslib_open_volume(cfg.device, 1, &vol, &cbargs);
 	if(ret) {
 		perror("Couldn't open volume");
 		//goto done;
 	}
-	hfslib_callbacks()->error = hfs_vsyslog; // prepare to daemonize
-	ret = fuse_main(sizeof(argv2)/sizeof(*argv2)-1,argv2,&hfsfuse_ops,&vol);
+	if(cfg.root && (ret = hfsfuse_set_root(&vol,cfg.root)))
+		fprintf(stderr,"Couldn't use %s as root: %s\n",cfg.root,strerror(-ret));
+	else {
+		hfslib_callbacks()->error = hfs_vsyslog; // prepare to daemonize
+		ret = fuse_main(args.argc,args.argv,&hfsfuse_ops,&vol);
+	}
 
 	hfslib_close_volume(&vol, NULL);
 done:
 	hfslib_done();
+	fuse_opt_free_args(&args);
+	free(cfg.device);
+	free(cfg.root);
+	free(cfg.sidecar);
+	for(size_t i = 0; i < cfg.nreplicas; i++)
+		free(cfg.replicas[i]);
 	return ret;
 }
@@ -0,0 +1,73 @@
+/*
+ * hfsfuse - FUSE driver for HFS+ filesystems
+ * Copyright 2013-2016 0x09.net.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HFSFUSE_H
+#define HFSFUSE_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// ioctls accepted on any file in an hfsfuse mount
+
+// hands hfsfuse the files a batch job is about to read, in the order it will open them, to be prefetched a
+// window at a time in the order their blocks lie on the device. lists longer than one buffer are sent in pieces
+// with HFSFUSE_PREFETCH_APPEND set on all but the first, and sending an empty list without it cancels prefetching.
+// the ioctl returns the number of paths that weren't files on the volume
+#define HFSFUSE_PREFETCH_APPEND 1
+
+struct hfsfuse_prefetch {
+	uint64_t window; // bytes of files to keep prefetched ahead of the job, 0 for the default of 64M
+	uint32_t flags;
+	uint32_t reserved;
+	char paths[8192]; // paths in the mount, relative to its root, separated by newlines and ending with a NUL
+};
+
+#define HFSFUSE_IOC_PREFETCH _IOW('H', 1, struct hfsfuse_prefetch)
+
+// reads the statistics of each cache (records, nodes, extents, dirs, data) and of the device blocks read below them
+// (device), with miss ratio curves estimated from a sample of each one's keys: the fraction of recent lookups that
+// would have missed with each cache size. the device curve is the one to size block_cache_size by
+#define HFSFUSE_STATS_STREAMS 6
+#define HFSFUSE_MRC_POINTS 28
+
+struct hfsfuse_stream_stats {
+	char name[16];
+	uint64_t hits, misses, evictions;
+	uint64_t bytes, target; // cached now, and this cache's current share of cache_size or data_cache_size
+	uint64_t references;    // recent references, estimated from the sample
+	uint32_t sampling_rate; // fraction of keys sampled, in millionths
+	uint32_t reserved;
+	uint64_t size[HFSFUSE_MRC_POINTS]; // 4K, doubling up to 512G
+	uint32_t miss_ratio[HFSFUSE_MRC_POINTS]; // in millionths
+};
+
+struct hfsfuse_stats {
+	uint32_t nstreams;
+	uint32_t reserved;
+	struct hfsfuse_stream_stats streams[HFSFUSE_STATS_STREAMS];
+};
+
+#define HFSFUSE_IOC_STATS _IOR('H', 2, struct hfsfuse_stats)
+
+#endif